@@ -0,0 +1,58 @@
+#version 460
+
+layout (location = 0) in vec3 pos;
+layout (location = 1) in vec3 norm;
+layout (location = 2) in vec2 texc;
+
+
+layout (location = 3) out vec3 v_space_norm;
+layout (location = 4) out vec3 v_space_pos;
+layout (location = 5) out vec2 tex_coord;
+layout (location = 6) out vec3 w_space_pos;
+layout (location = 7) out vec3 w_space_norm;
+layout (location = 8) out vec4 lv_space_pos;
+layout (location = 9) flat out vec3 material_ka;
+layout (location = 10) flat out vec3 material_kd;
+layout (location = 11) flat out vec3 material_ks;
+layout (location = 12) flat out float material_shininess;
+layout (location = 13) noperspective out vec3 edge_distance; //replaced by wireframe_overlay.geom when it is attached
+
+//Per draw data of the multi draw indexed with gl_DrawID,
+//or per instance data indexed with instance_offset + gl_InstanceID
+struct DrawData {
+    mat4 to_world_space; //m
+    mat4 normals_to_world_space; //upper 3x3 is used
+    vec4 ka;
+    vec4 kd;
+    vec4 ks; //w = shininess
+};
+layout (std430, binding = 0) readonly buffer DrawDataBuffer {
+    DrawData draws[];
+};
+
+//identical expression in the depth pre-pass and the shading pass, required for the equal depth test
+invariant gl_Position;
+
+uniform mat4 view_matrix; //v
+uniform mat4 view_projection_matrix; //pv, same value as to_light_space in the depth pre-pass
+uniform int instance_offset = -1; //>= 0 while drawing instances of a single mesh
+
+void main() {
+    const DrawData draw_data = draws[instance_offset >= 0 ? instance_offset + gl_InstanceID : gl_DrawID];
+
+    const vec4 w_pos = draw_data.to_world_space * vec4(pos, 1.0);
+    const vec4 v_pos = view_matrix * w_pos;
+    gl_Position = view_projection_matrix * w_pos;
+    tex_coord = texc;
+
+    w_space_pos = w_pos.xyz;
+    w_space_norm = mat3(draw_data.normals_to_world_space) * norm;
+    v_space_pos = v_pos.xyz;
+    v_space_norm = mat3(view_matrix) * w_space_norm;
+
+    material_ka = draw_data.ka.xyz;
+    material_kd = draw_data.kd.xyz;
+    material_ks = draw_data.ks.xyz;
+    material_shininess = draw_data.ks.w;
+    edge_distance = vec3(1e6);
+}
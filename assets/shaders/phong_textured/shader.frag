@@ -9,88 +9,139 @@ const vec2 poissonDisk[4] = vec2[](
 );
 
 //------------ Structs ------------
-struct PLight{
-    vec3 position;
-    vec3 color;
-    float intensity;
-    int casting_shadows;
-    //mat4 to_light_view_space;
+struct Light{
+    vec4 position; //w = range
+    vec4 direction; //w = cutoff
+    vec4 color; //w = intensity
+    ivec4 shadow; //x = first shadow view, y = number of views (0 without shadows), z = type, 0 point 1 directional 2 spot
 };
-vec3 illuminationAt(in PLight light, in vec3 pos, samplerCubeShadow shadow_map, in vec3 w_space_pos, inout vec3 l)
+struct ShadowView{
+    mat4 to_shadow_space; //light vp with the [0,1] scale bias, zero while the tile was never rendered
+    vec4 rect; //uv offset and size of the tile in the atlas
+};
+layout (std430, binding = 3) readonly buffer LightBuffer {
+    Light lights[];
+};
+layout (std430, binding = 4) readonly buffer ShadowViewBuffer {
+    ShadowView shadow_views[];
+};
+uniform int light_count;
+uniform int directional_light_count; //directional lights come first and reach every fragment
+uniform sampler2DShadow shadow_atlas;
+
+//------------ Clusters ------------
+//point and spot lights binned into screen tiles times exponential depth slices, see LightClusters.h
+const ivec3 cluster_grid = ivec3(16, 9, 24);
+layout (std430, binding = 5) readonly buffer ClusterBuffer {
+    uvec2 clusters[]; //offset into cluster_light_indices and light count
+};
+layout (std430, binding = 6) readonly buffer ClusterIndexBuffer {
+    uint cluster_light_indices[]; //point and spot lights, counted after the directional ones
+};
+uniform int clustered_lighting = 1;
+uniform vec4 cluster_viewport; //x, y, width, height of the viewport the clusters were built for
+uniform float cluster_near;
+uniform float cluster_slice_scale; //slices / log(far / near)
+
+int clusterIndex(in float view_depth)
+{
+     ivec2 tile = ivec2((gl_FragCoord.xy - cluster_viewport.xy) / cluster_viewport.zw * vec2(cluster_grid.xy));
+     tile = clamp(tile, ivec2(0), cluster_grid.xy - 1);
+     int slice = view_depth <= cluster_near ? 0 : int(log(view_depth / cluster_near) * cluster_slice_scale);
+     slice = clamp(slice, 0, cluster_grid.z - 1);
+     return tile.x + cluster_grid.x * (tile.y + cluster_grid.y * slice);
+}
+
+//Smoothly brings the light to zero at its range so the clusters can drop it beyond
+float rangeFade(in float l_length, in float range)
+{
+     float r = l_length / range;
+     float fade = clamp(1.0 - r * r * r * r, 0.0, 1.0);
+     return fade * fade;
+}
+
+//Fraction of the light reaching the point through the shadow view, points outside of it are lit
+float litFraction(in int view, in vec3 w_space_pos, in float bias)
+{
+     vec4 lv_space_pos = shadow_views[view].to_shadow_space * vec4(w_space_pos, 1.0);
+     if (lv_space_pos.w <= 0.0)
+          return 1.0;
+     lv_space_pos.xyz /= lv_space_pos.w;
+     if (any(lessThan(lv_space_pos.xyz, vec3(0.0))) || any(greaterThan(lv_space_pos.xyz, vec3(1.0))))
+          return 1.0;
+     //taps are kept inside the tile so they never read the neighbouring lights
+     const vec4 rect = shadow_views[view].rect;
+     const vec2 texel = 1.0 / vec2(textureSize(shadow_atlas, 0));
+     const vec2 uv = rect.xy + lv_space_pos.xy * rect.zw;
+     float lit = 0;
+     for (int i = 0; i < 4; i++)
+     {
+          vec2 tap = clamp(uv + poissonDisk[i] * texel * 1.5, rect.xy + texel * 0.5, rect.xy + rect.zw - texel * 0.5);
+          lit += 0.25 * texture(shadow_atlas, vec3(tap, lv_space_pos.z - bias));
+     }
+     return lit;
+}
+
+vec3 pointIllumination(in Light light, in vec3 w_space_pos, inout vec3 l)
 {
-     l = (light.position - w_space_pos);
+     l = light.position.xyz - w_space_pos;
      float l_length = length(l);
      l = normalize(l);
-     float intensity = light.intensity;
-     if(light.casting_shadows == 1)
+     float intensity = light.color.w;
+     if (light.shadow.y == 6)
      {
-          if(texture(shadow_map, vec4(l, l_length)) > l_length * 0.01)
-               intensity = 0;
+          //the cube face looking along the major axis, +x -x +y -y +z -z
+          vec3 d = -l;
+          vec3 a = abs(d);
+          int face = a.x >= a.y && a.x >= a.z ? (d.x > 0 ? 0 : 1) :
+               (a.y >= a.z ? (d.y > 0 ? 2 : 3) : (d.z > 0 ? 4 : 5));
+          intensity *= litFraction(light.shadow.x + face, w_space_pos, 0.0002);
      }
-
-     return intensity * normalize(light.color) / (0.001*l_length * l_length + 0.001*l_length);
+     return intensity * rangeFade(l_length, light.position.w) * normalize(light.color.xyz) /
+          (0.001*l_length * l_length + 0.001*l_length);
 }
 
-struct DLight{
-    vec3 direction;
-    vec3 color;
-    float intensity;
-    int casting_shadows;
-    mat4 to_light_view_space;
-};
-
-vec3 illuminationAt(in DLight light, in vec3 pos, in sampler2DShadow shadow_map, in vec3 w_space_pos, inout vec3 l)
+vec3 directionalIllumination(in Light light, in vec3 w_space_pos, inout vec3 l)
 {
-     l = -normalize(light.direction);
-     float intensity = light.intensity;
-
-     if(light.casting_shadows == 1)
+     l = -normalize(light.direction.xyz);
+     float intensity = light.color.w;
+     if (light.shadow.y > 0)
      {
-          vec4 lv_space_pos = light.to_light_view_space * vec4(w_space_pos, 1.0);
-          float shadow = 0;
-          for (int i=0;i<4;i++){
-                if(textureProj(shadow_map, lv_space_pos + vec4(poissonDisk[i]/700, 0, 0)) < lv_space_pos.z)
-                    shadow += 0.25;
+          //the first cascade containing the point has the finest texels, points outside all of them are lit
+          const vec2 texel = 1.0 / vec2(textureSize(shadow_atlas, 0));
+          for (int c = 0; c < light.shadow.y; c++)
+          {
+               const ShadowView view = shadow_views[light.shadow.x + c];
+               vec4 lv_space_pos = view.to_shadow_space * vec4(w_space_pos, 1.0);
+               const vec2 margin = texel * 2.0 / view.rect.zw;
+               if (lv_space_pos.w < 0.5 || any(lessThan(lv_space_pos.xyz, vec3(margin, 0.0))) ||
+                    any(greaterThan(lv_space_pos.xyz, vec3(1.0 - margin, 1.0))))
+                    continue;
+               intensity *= litFraction(light.shadow.x + c, w_space_pos, 0.0015);
+               break;
           }
-          intensity -= shadow;
      }
-     return intensity * normalize(light.color);
+     return intensity * normalize(light.color.xyz);
 }
-struct SLight{
-    vec3 position;
-    vec3 direction;
-    vec3 color;
-    float intensity;
-    float cutoff;
-    int casting_shadows;
-    mat4 to_light_view_space;
-};
-vec3 illuminationAt(in SLight light, in vec3 pos, in sampler2DShadow shadow_map, in vec3 w_space_pos, inout vec3 l)
+
+vec3 spotIllumination(in Light light, in vec3 w_space_pos, inout vec3 l)
 {
-     l = light.position - pos;
-     float l_length = length(light.position - pos);
+     l = light.position.xyz - w_space_pos;
+     float l_length = length(l);
      l = normalize(l);
-     const float spot_factor = dot(l, -normalize(light.direction));
+     const float cutoff = light.direction.w;
+     const float spot_factor = dot(l, -normalize(light.direction.xyz));
      float intensity = 0;
 
-     if (spot_factor > light.cutoff)
+     if (spot_factor > cutoff)
      {
-          intensity = light.intensity * 
-                    (1.0 - (1.0 - spot_factor) * 1.0/(1.0 - light.cutoff));
-          if(light.casting_shadows == 1)
-          {
-               vec4 lv_space_pos = light.to_light_view_space * vec4(w_space_pos, 1.0);
-               float shadow = 0;
-               for (int i=0;i<4;i++){
-                    if(textureProj(shadow_map, lv_space_pos + vec4(poissonDisk[i]/700, 0, 0)) < 1.0)
-                         shadow += 0.25;
-               }
-               intensity -= shadow;
-               //intensity *= textureProj(shadow_map, lv_space_pos);
-               intensity = clamp(intensity, 0.0, 1.0); 
-          }
+          intensity = light.color.w * (1.0 - (1.0 - spot_factor) * 1.0/(1.0 - cutoff));
+          if (light.shadow.y > 0)
+               intensity *= litFraction(light.shadow.x, w_space_pos, 0.0002);
+          intensity = clamp(intensity, 0.0, 1.0);
      }
-     return intensity * normalize(light.color) / (0.0005*l_length * l_length + 0.0001*l_length);
+     return intensity * rangeFade(l_length, light.position.w) * normalize(light.color.xyz) /
+          (0.0005*l_length * l_length + 0.0001*l_length);
 }
 
 
@@ -101,28 +152,16 @@ layout (location = 5) in vec2 tex_coord;
 layout (location = 6) in vec3 w_space_pos;
 layout (location = 7) in vec3 w_space_norm;
 layout (location = 8) in vec4 lv_space_pos;
+layout (location = 9) flat in vec3 material_ka;
+layout (location = 10) flat in vec3 material_kd;
+layout (location = 11) flat in vec3 material_ks;
+layout (location = 12) flat in float material_shininess;
+layout (location = 13) noperspective in vec3 edge_distance; //pixels to the triangle edges, far away without wireframe_overlay.geom
 
 //------------ Uniforms ------------
-uniform mat4 to_view_space; //mv
-uniform mat4 to_world_space; //m
+uniform mat4 view_matrix; //v
 uniform mat3 normals_to_view_space;
 
-uniform int p_light_count;
-uniform PLight p_lights[5];
-uniform samplerCubeShadow p_shadow_maps[5];
-uniform int d_light_count;
-uniform DLight d_lights[5];
-uniform sampler2DShadow d_shadow_maps[5];
-uniform int s_light_count;
-uniform SLight s_lights[5];
-uniform sampler2DShadow s_shadow_maps[5];
-
-uniform struct Material {
-     vec3 ka;
-     vec3 kd;
-     vec3 ks;
-     float shininess;
-}material;
 uniform int shading_mode;//0 = phong-color, 1 = editor mode
 uniform int has_texture[5] = {0,0,0,0,0};//[0] = ambient, [1] = diffuse, [2] = specular, [3] = normal, [4] = bump
 uniform sampler2D tex_list[5];
@@ -131,9 +170,38 @@ uniform samplerCube env_map;
 uniform int has_env_map = 0;
 uniform vec3 camera_pos;
 uniform int mirror_reflection = 0;
+uniform float wireframe_width = 1.0; //pixels
 
 out vec4 color;
 
+//Blinn-Phong contribution of one light, shading happens in view space
+vec3 shade(in Light light, in vec3 v_space_norm)
+{
+     vec3 l = vec3(0,0,0);
+     vec3 illumination = vec3(0,0,0); // light color * intensity
+     const int type = light.shadow.z;
+     if(type == 0) //point light soures
+          illumination = pointIllumination(light, w_space_pos, l);
+     else if(type == 1) //directional light sources
+          illumination = directionalIllumination(light, w_space_pos, l);
+     else
+          illumination = spotIllumination(light, w_space_pos, l);
+     //lights are evaluated in world space
+     l = normalize((view_matrix * vec4(l, 0)).xyz);
+
+     vec3 h = normalize(l + vec3(0,0,1)); //half vector
+
+     float cos_theta = dot(l, v_space_norm);
+     if(cos_theta < 0) //getting light from the back side of the surface
+          return vec3(0);
+     //Sample either texture or material color
+     vec3 diffuse =  (has_texture[1]==1 ? (texture(tex_list[1], tex_coord)).xyz :
+                                        material_kd) * max(cos_theta,0);
+     vec3 specular= (has_texture[2]==1 ? (texture(tex_list[2], tex_coord)).xyz :
+                                        material_ks) * pow(max(dot(h, v_space_norm),0), material_shininess);
+     return illumination * (specular + diffuse);
+}
+
 void main() {
      if(shading_mode == 0)//phong shading textures and environment maps
      {
@@ -142,45 +210,19 @@ void main() {
           vec3 v_space_norm = normalize( ( has_texture[3] == 1 ? 
           normals_to_view_space * texture(tex_list[3], tex_coord).xyz :
                                          v_space_norm) );
-          for(int i = 0; i < p_light_count + d_light_count + s_light_count; i++)
+          for(int i = 0; i < directional_light_count; i++)
+               color.xyz += shade(lights[i], v_space_norm);
+          if(clustered_lighting == 1)
           {
-               vec3 l = vec3(0,0,0);
-               vec3 illumination = vec3(0,0,0); // light color * intensity
-               //vec3 light_color = vec3(0,0,0);
-
-               const int d_light_index = i - p_light_count;
-               const int s_light_index = i - p_light_count - d_light_count;
-               
-               if(i < p_light_count) //point light soures
-               {
-                    illumination = illuminationAt(p_lights[i], v_space_pos, p_shadow_maps[i], w_space_pos, l);
-                    l = (to_view_space * inverse(to_world_space) * vec4(l, 0)).xyz;
-               }
-               else if(d_light_index < d_light_count) //directional light sources
-               {
-                    illumination = illuminationAt(d_lights[d_light_index], v_space_pos, d_shadow_maps[d_light_index], w_space_pos, l);
-               }
-               else
-               {
-                    illumination = illuminationAt(s_lights[s_light_index], v_space_pos, s_shadow_maps[s_light_index], w_space_pos, l);
-               }
-
-               vec3 h = normalize(l + vec3(0,0,1)); //half vector
-
-               float cos_theta = dot(l, v_space_norm);
-               if(cos_theta >= 0) //getting light from the front side of the surface
-               {    
-                    //Sample either texture or material color
-                    vec3 diffuse =  (has_texture[1]==1 ? (texture(tex_list[1], tex_coord)).xyz :
-                                                       material.kd) * max(cos_theta,0);
-                    vec3 specular= (has_texture[2]==1 ? (texture(tex_list[2], tex_coord)).xyz :
-                                                       material.ks) * pow(max(dot(h, v_space_norm),0), material.shininess);
-                    color += vec4(illumination * (specular + diffuse), 1);
-               }
+               const uvec2 cluster = clusters[clusterIndex(-v_space_pos.z)];
+               for(uint i = 0; i < cluster.y; i++)
+                    color.xyz += shade(lights[directional_light_count + int(cluster_light_indices[cluster.x + i])], v_space_norm);
           }
+          else for(int i = directional_light_count; i < light_count; i++)
+               color.xyz += shade(lights[i], v_space_norm);
           
           color = color + 0.2 * vec4( (has_texture[0]==1 ? (texture(tex_list[0], tex_coord)).xyz :
-                                                            material.ka), 1);
+                                                            material_ka), 1);
           if(has_env_map != 0)//sample environment map if it exists
           {
                vec3 env_color = texture(env_map, reflect(-camera_pos+w_space_pos, normalize(w_space_norm))).xyz;
@@ -200,4 +242,8 @@ void main() {
      {
           color = vec4(1,0,1,1);
      }
+
+     //wireframe overlay, antialiased over one pixel
+     const float edge = min(edge_distance.x, min(edge_distance.y, edge_distance.z));
+     color = mix(vec4(1,1,1,1), color, smoothstep(wireframe_width - 0.5, wireframe_width + 0.5, edge));
 }
\ No newline at end of file
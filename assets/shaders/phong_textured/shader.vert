@@ -11,8 +11,16 @@ layout (location = 5) out vec2 tex_coord;
 layout (location = 6) out vec3 w_space_pos;
 layout (location = 7) out vec3 w_space_norm;
 layout (location = 8) out vec4 lv_space_pos;
+layout (location = 9) flat out vec3 material_ka;
+layout (location = 10) flat out vec3 material_kd;
+layout (location = 11) flat out vec3 material_ks;
+layout (location = 12) flat out float material_shininess;
+layout (location = 13) noperspective out vec3 edge_distance; //replaced by wireframe_overlay.geom when it is attached
 
 
+//identical expression in the depth pre-pass and the shading pass, required for the equal depth test
+invariant gl_Position;
+
 uniform mat4 to_screen_space; // mvp
 uniform mat4 to_view_space; //mv
 uniform mat4 to_world_space; //m
@@ -22,6 +30,13 @@ uniform mat3 normals_to_view_space;
 uniform vec3 camera_pos;
 uniform int mirror_reflection = 0;
 
+uniform struct Material {
+     vec3 ka;
+     vec3 kd;
+     vec3 ks;
+     float shininess;
+}material;
+
 const mat4 scale_bias = mat4(vec4(0.5, 0.0, 0.0, 0.0), vec4(0.0, 0.5, 0.0, 0.0), vec4(0.0, 0.0, 0.5, 0.0), vec4(0.5, 0.5, 0.5, 1.0));
 
 void main() {
@@ -32,6 +47,12 @@ void main() {
 
     w_space_pos = (to_world_space * vec4(pos, 1.0)).xyz;
     w_space_norm = normals_to_world_space * norm;
+
+    material_ka = material.ka;
+    material_kd = material.kd;
+    material_ks = material.ks;
+    material_shininess = material.shininess;
+    edge_distance = vec3(1e6);
     
     if(mirror_reflection==1)
     {
@@ -2,6 +2,9 @@
 
 layout (location = 0) in vec3 pos;
 
+//identical expression in the depth pre-pass and the shading pass, required for the equal depth test
+invariant gl_Position;
+
 uniform mat4 to_screen_space; // mvp
 
 void main() {
@@ -0,0 +1,25 @@
+#version 460
+
+layout (location = 0) in vec3 pos;
+
+//Per draw data of the multi draw, same layout as phong_batched
+struct DrawData {
+    mat4 to_world_space; //m
+    mat4 normals_to_world_space;
+    vec4 ka;
+    vec4 kd;
+    vec4 ks;
+};
+layout (std430, binding = 0) readonly buffer DrawDataBuffer {
+    DrawData draws[];
+};
+
+//identical expression in the depth pre-pass and the shading pass, required for the equal depth test
+invariant gl_Position;
+
+uniform mat4 to_light_space; // light vp
+uniform int instance_offset = -1; //>= 0 while drawing instances of a single mesh
+
+void main() {
+    gl_Position = to_light_space * (draws[instance_offset >= 0 ? instance_offset + gl_InstanceID : gl_DrawID].to_world_space * vec4(pos, 1.0));
+}
@@ -0,0 +1,13 @@
+#version 450
+
+layout (location = 0) in vec3 pos;
+
+uniform mat4 to_world_space; // m
+uniform int face_mask = 63; //cube faces the mesh can cast on
+
+flat out int cast_faces;
+
+void main() {
+    gl_Position = to_world_space * vec4(pos, 1.0);
+    cast_faces = face_mask;
+}
@@ -0,0 +1,25 @@
+#version 460
+
+layout (location = 0) in vec3 pos;
+
+//Per draw data of the multi draw, same layout as phong_batched
+struct DrawData {
+    mat4 to_world_space; //m
+    mat4 normals_to_world_space;
+    vec4 ka; //w holds the cube faces the mesh can cast on
+    vec4 kd;
+    vec4 ks;
+};
+layout (std430, binding = 0) readonly buffer DrawDataBuffer {
+    DrawData draws[];
+};
+
+uniform int instance_offset = -1; //>= 0 while drawing instances of a single mesh
+
+flat out int cast_faces;
+
+void main() {
+    DrawData draw = draws[instance_offset >= 0 ? instance_offset + gl_InstanceID : gl_DrawID];
+    gl_Position = draw.to_world_space * vec4(pos, 1.0);
+    cast_faces = int(draw.ka.w);
+}
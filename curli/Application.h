@@ -3,6 +3,7 @@
 #include "Renderer.h"
 #include <GUIManager.h>
 #include <PhysicsIntegrator.h>
+#include <Benchmarks.h>
 
 template <class R, class G, class P>
 class Application
@@ -172,6 +173,79 @@ private:
 				}
 					
 			}
+			else if (std::string(argv[i]).compare("-bench") == 0)
+			{
+				i++;
+				std::string benchName = argv[i];
+				std::string path;
+				int count = 10000;
+				for (i++; i < argc; i++)
+				{
+					if (std::string(argv[i]).compare("--path") == 0)
+					{
+						i++;
+						path = argv[i];
+					}
+					else if (std::string(argv[i]).compare("--count") == 0)
+					{
+						i++;
+						count = std::stoi(argv[i]);
+					}
+					else
+					{
+						i--;
+						break;
+					}
+				}
+				if (benchName.compare("instancing") == 0)
+					bench::CreateInstancingScene(*scene, path, count);
+				else if (benchName.compare("boxes") == 0)
+					bench::CreateBoxesScene(*scene, path, count);
+				else if (benchName.compare("lights") == 0)
+					bench::CreateLightsScene(*scene, path, count);
+				else if (benchName.compare("tessellation") == 0)
+					bench::CreateTessellationScene(*scene, path, "../assets/images/teapot_disp.png", glm::min(count, 64));
+				else if (benchName.compare("lightbinning") == 0)
+				{
+					bench::RunLightBinningBenchmark(count);
+					std::exit(0);
+				}
+				else if (benchName.compare("spatialhash") == 0)
+				{
+					bench::RunSpatialHashBenchmark(path);
+					std::exit(0);
+				}
+				else if (benchName.compare("integrators") == 0)
+				{
+					bench::RunIntegratorBenchmark();
+					if (!path.empty())
+						bench::RunSoftBodySolverBenchmark(path);
+					std::exit(0);
+				}
+				else
+					printf("Unknown benchmark %s\n", benchName.c_str());
+			}
+			else if (std::string(argv[i]).compare("-integrator") == 0)
+			{
+				i++;
+				const std::string name = argv[i];
+				bool found = false;
+				for (int s = 0; s < (int)IntegrationScheme::Count; s++)
+				{
+					if (name.compare(IntegrationSchemeName((IntegrationScheme)s)) == 0)
+					{
+						ApplicationState::GetInstance().integrationScheme = (IntegrationScheme)s;
+						found = true;
+					}
+				}
+				if (!found)
+					printf("Unknown integrator %s\n", name.c_str());
+			}
+			else if (std::string(argv[i]).compare("-glvalidate") == 0)
+			{
+				i++;
+				ApplicationState::GetInstance().glValidateEveryNthFrame = std::stoi(argv[i]);
+			}
 			else if (std::string(argv[i]).compare("-skybox") == 0)
 			{
 				i++;
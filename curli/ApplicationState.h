@@ -1,8 +1,66 @@
 #pragma once
 #include <stdio.h>
+#include <stdint.h>
 #include <GLFWHandler.h>
 
 
+//per frame counters filled by the renderer
+struct RenderStats
+{
+	unsigned int draws = 0;
+	unsigned int batchedMeshes = 0;
+	unsigned int instances = 0;
+	unsigned int stateChanges = 0;
+	unsigned int skippedStateChanges = 0;
+	unsigned int visibleObjects = 0;
+	unsigned int culledObjects = 0;
+	unsigned int shadowCulledObjects = 0;
+	float cpuTime = 0.0f;//ms spent issuing the last frame
+	unsigned int glStateCalls = 0;//binds and state changes that reached GL
+	unsigned int skippedGLStateCalls = 0;//redundant ones skipped by GLState
+	unsigned int offscreenPasses = 0;//shadow map, cube face and rendered texture updates
+	unsigned int deferredOffscreenPasses = 0;//due updates pushed to later frames by the budget
+	float offscreenTime = 0.0f;//ms
+	float shadowAtlasUsage = 0.0f;//fraction of the shadow atlas handed out to lights
+	unsigned int clusterLightIndices = 0;//light references over all clusters
+	unsigned int maxLightsPerCluster = 0;
+	float lightBinningTime = 0.0f;//ms
+	uint64_t shadedSamples = 0;//samples that ran the shading of the main pass, measured a few frames late
+	float shadedSamplesPerPixel = 0.0f;//overdraw of the shading, at most 1 with the depth pre-pass
+	uint64_t tessellatedTriangles = 0;//generated by the displacement wireframe pass, measured a few frames late
+	float tessellationMaxEdge = 0.0f;//longest generated edge on screen in pixels, lower is finer
+};
+
+struct PhysicsStats
+{
+	unsigned int colliders = 0;//of the last step
+	unsigned int broadPhasePairs = 0;//of the last step
+	unsigned int contacts = 0;//summed over the steps of the last frame
+	unsigned int steps = 0;//physics steps of the last frame
+	float timeStep = 0.0f;//smallest step of the last frame
+	float droppedTime = 0.0f;//simulation time skipped because the budget ran out
+	unsigned int softBodyContacts = 0;//summed over the steps of the last frame
+	float hashBuildTime = 0.0f;//ms, summed over the steps of the last frame
+	float hashQueryTime = 0.0f;//ms, summed over the steps of the last frame
+};
+
+//time integration used for the rigid and soft bodies
+enum class IntegrationScheme
+{
+	ForwardEuler,//explicit rigid bodies, implicit (backward Euler) soft bodies
+	SymplecticEuler,
+	VelocityVerlet,
+	RK4,
+	XPBD,//symplectic Euler rigid bodies, position based soft bodies
+	Count
+};
+
+inline const char* IntegrationSchemeName(IntegrationScheme scheme)
+{
+	static const char* names[] = { "Forward Euler", "Symplectic Euler", "Velocity Verlet", "RK4", "XPBD" };
+	return names[(int)scheme];
+}
+
 //singleton class of ApplicationState
 class ApplicationState
 {
@@ -15,8 +73,30 @@ public:
 	entt::entity selectedObject;
 	bool physicsInteraction = false;
 	bool renderingWireframe = false;
+	bool batchStaticMeshes = true;
+	bool frustumCulling = true;
+	bool layeredPointShadows = true;//all six faces of a shadow cube map in one geometry shader pass
+	float shadowDistance = 60.0f;//view depth covered by the directional light shadow cascades
+	bool clusteredLighting = true;//fragments only iterate the point and spot lights binned to their cluster
+	float lightCutoff = 0.02f;//intensity at which point and spot lights are faded out, sets their range
+	bool depthPrePass = true;//lay down depth first so every pixel is shaded once
+	bool adaptiveTessellation = true;//per patch levels from the screen size of the edges, CTriMesh::tessellationLevel caps them
+	float tessellationEdgePixels = 8.0f;//target screen length of the generated edges
+	bool cullTessellationPatches = true;//drops displaced patches outside the view or facing away before tessellation
 	int renderEveryNthFrame = 2;
+	int glValidateEveryNthFrame = 0;//rendered frames between GL error checks, 0 disables them
+	float offscreenBudgetMs = 4.0f;//per rendered frame, spent on shadow maps and rendered textures
 	float simulationSpeed = 10.0f;
+	IntegrationScheme integrationScheme = IntegrationScheme::ForwardEuler;
+	int physicsSubsteps = 10;
+	bool adaptiveTimeStep = true;
+	float minTimeStep = 1e-4f;
+	float maxTimeStep = 1.0f / 60.0f;
+	float physicsBudgetMs = 10.0f;//per frame
+	bool softBodyCollisions = true;
+	bool batchedSoftBodySolve = false;//one block diagonal backward Euler solve for all soft bodies
+	RenderStats renderStats;
+	PhysicsStats physicsStats;
 
 	ApplicationState(const ApplicationState&) = delete;
 	void operator=(GLFWHandler const&) = delete;
@@ -0,0 +1,425 @@
+#pragma once
+#include <Culling.h>
+#include <algorithm>
+#include <vector>
+
+/*
+* Dynamic bounding volume hierarchy over axis aligned boxes that carry user data.
+* Leaves are inserted at the sibling that increases the surface area heuristic cost the least,
+* moved leaves are refit in place and Rebuild() rebuilds the internal nodes top down with a
+* binned SAH when the refits have degraded the tree. Leaf ids stay valid across rebuilds.
+*/
+template <typename T>
+class DynamicAABBTree
+{
+public:
+	/*
+	* Inserts a leaf and returns its id
+	*/
+	int Insert(const AABB& box, const T& data)
+	{
+		const int leaf = AllocateNode();
+		nodes[leaf].box = box;
+		nodes[leaf].data = data;
+		InsertLeaf(leaf);
+		leafCount++;
+		return leaf;
+	}
+
+	void Remove(int leaf)
+	{
+		RemoveLeaf(leaf);
+		FreeNode(leaf);
+		leafCount--;
+	}
+
+	/*
+	* Moves the leaf to the new box and refits its ancestors without changing the topology
+	*/
+	void Update(int leaf, const AABB& box)
+	{
+		nodes[leaf].box = box;
+		Refit(nodes[leaf].parent);
+	}
+
+	/*
+	* Rebuilds every internal node top down, splitting with a binned surface area heuristic
+	*/
+	void Rebuild()
+	{
+		std::vector<int> leaves;
+		leaves.reserve(leafCount);
+		for (int i = 0; i < (int)nodes.size(); i++)
+		{
+			if (!nodes[i].free && nodes[i].IsLeaf())
+				leaves.push_back(i);
+			else if (!nodes[i].free)
+				FreeNode(i);
+		}
+		root = leaves.empty() ? -1 : Build(leaves.data(), (int)leaves.size(), -1);
+		rebuildCost = GetCost();
+	}
+
+	/*
+	* Surface area heuristic cost of the tree relative to the area of the root
+	*/
+	float GetCost() const
+	{
+		if (root < 0 || nodes[root].box.GetSurfaceArea() <= 0.0f)
+			return 0.0f;
+		float area = 0.0f;
+		for (const auto& node : nodes)
+			if (!node.free && !node.IsLeaf())
+				area += node.box.GetSurfaceArea();
+		return area / nodes[root].box.GetSurfaceArea();
+	}
+
+	/*
+	* Cost right after the last rebuild, used to decide when the refits have degraded the tree enough
+	*/
+	float GetRebuildCost() const { return rebuildCost; }
+
+	/*
+	* Calls callback(data) for every leaf that overlaps the box
+	*/
+	template <typename F>
+	void Query(const AABB& box, F callback) const
+	{
+		Traverse([&](const AABB& nodeBox) { return nodeBox.Overlaps(box); }, callback);
+	}
+
+	/*
+	* Calls callback(data) for every leaf that intersects the frustum
+	*/
+	template <typename F>
+	void Query(const Frustum& frustum, F callback) const
+	{
+		Traverse([&](const AABB& nodeBox) { return frustum.Intersects(nodeBox); }, callback);
+	}
+
+	/*
+	* Visits the leaves hit by the ray closest first. callback(data, entryDistance) returns the distance
+	* of the hit it found, or a negative value, and the ray is clipped to the closest hit so far
+	*/
+	template <typename F>
+	void Raycast(glm::vec3 origin, glm::vec3 direction, float maxDistance, F callback) const
+	{
+		if (root < 0)
+			return;
+		const glm::vec3 invDirection = 1.0f / direction;
+		std::vector<std::pair<float, int>> stack;
+		float tEnter;
+		if (!nodes[root].box.IntersectsRay(origin, invDirection, maxDistance, tEnter))
+			return;
+		stack.push_back({ tEnter, root });
+		while (!stack.empty())
+		{
+			const auto [t, index] = stack.back();
+			stack.pop_back();
+			if (t > maxDistance)
+				continue;
+			const Node& node = nodes[index];
+			if (node.IsLeaf())
+			{
+				const float hit = callback(node.data, t);
+				if (hit >= 0.0f && hit < maxDistance)
+					maxDistance = hit;
+				continue;
+			}
+			float tLeft, tRight;
+			const bool hitLeft = nodes[node.left].box.IntersectsRay(origin, invDirection, maxDistance, tLeft);
+			const bool hitRight = nodes[node.right].box.IntersectsRay(origin, invDirection, maxDistance, tRight);
+			//push the farther child first so the closer one is visited next
+			if (hitLeft && hitRight && tLeft < tRight)
+			{
+				stack.push_back({ tRight, node.right });
+				stack.push_back({ tLeft, node.left });
+			}
+			else
+			{
+				if (hitLeft)
+					stack.push_back({ tLeft, node.left });
+				if (hitRight)
+					stack.push_back({ tRight, node.right });
+			}
+		}
+	}
+
+	const AABB& GetBox(int leaf) const { return nodes[leaf].box; }
+	const T& GetData(int leaf) const { return nodes[leaf].data; }
+	int GetLeafCount() const { return leafCount; }
+
+	void Clear()
+	{
+		nodes.clear();
+		freeList.clear();
+		root = -1;
+		leafCount = 0;
+		rebuildCost = 0.0f;
+	}
+
+private:
+	struct Node
+	{
+		AABB box;
+		T data = T();
+		int parent = -1;
+		int left = -1;
+		int right = -1;
+		bool free = false;
+		bool IsLeaf() const { return left < 0; }
+	};
+
+	std::vector<Node> nodes;
+	std::vector<int> freeList;
+	int root = -1;
+	int leafCount = 0;
+	float rebuildCost = 0.0f;
+
+	static constexpr int binCount = 12;
+
+	int AllocateNode()
+	{
+		if (freeList.empty())
+		{
+			nodes.push_back(Node());
+			return (int)nodes.size() - 1;
+		}
+		const int index = freeList.back();
+		freeList.pop_back();
+		nodes[index] = Node();
+		return index;
+	}
+
+	void FreeNode(int index)
+	{
+		nodes[index].free = true;
+		nodes[index].parent = nodes[index].left = nodes[index].right = -1;
+		freeList.push_back(index);
+	}
+
+	template <typename Test, typename F>
+	void Traverse(Test test, F callback) const
+	{
+		if (root < 0)
+			return;
+		int stack[64];
+		int stackSize = 0;
+		std::vector<int> overflow;
+		stack[stackSize++] = root;
+		while (stackSize > 0 || !overflow.empty())
+		{
+			int index;
+			if (!overflow.empty())
+			{
+				index = overflow.back();
+				overflow.pop_back();
+			}
+			else
+				index = stack[--stackSize];
+			const Node& node = nodes[index];
+			if (!test(node.box))
+				continue;
+			if (node.IsLeaf())
+			{
+				callback(node.data);
+				continue;
+			}
+			for (int child : { node.left, node.right })
+			{
+				if (stackSize < 64)
+					stack[stackSize++] = child;
+				else
+					overflow.push_back(child);
+			}
+		}
+	}
+
+	/*
+	* Walks down to the sibling with the cheapest SAH cost for the new leaf (Catto, Box2D)
+	*/
+	void InsertLeaf(int leaf)
+	{
+		if (root < 0)
+		{
+			root = leaf;
+			nodes[root].parent = -1;
+			return;
+		}
+
+		const AABB leafBox = nodes[leaf].box;
+		int index = root;
+		while (!nodes[index].IsLeaf())
+		{
+			const Node& node = nodes[index];
+			const float area = node.box.GetSurfaceArea();
+			const float combinedArea = AABB::Union(node.box, leafBox).GetSurfaceArea();
+			//cost of making a new parent for this node and the new leaf
+			const float cost = 2.0f * combinedArea;
+			//minimum cost of pushing the leaf further down the tree
+			const float inheritance = 2.0f * (combinedArea - area);
+			const float costLeft = DescendCost(node.left, leafBox) + inheritance;
+			const float costRight = DescendCost(node.right, leafBox) + inheritance;
+			if (cost < costLeft && cost < costRight)
+				break;
+			index = costLeft < costRight ? node.left : node.right;
+		}
+
+		const int sibling = index;
+		const int oldParent = nodes[sibling].parent;
+		const int newParent = AllocateNode();
+		nodes[newParent].parent = oldParent;
+		nodes[newParent].box = AABB::Union(leafBox, nodes[sibling].box);
+		nodes[newParent].left = sibling;
+		nodes[newParent].right = leaf;
+		nodes[sibling].parent = newParent;
+		nodes[leaf].parent = newParent;
+		if (oldParent < 0)
+			root = newParent;
+		else if (nodes[oldParent].left == sibling)
+			nodes[oldParent].left = newParent;
+		else
+			nodes[oldParent].right = newParent;
+
+		Refit(nodes[newParent].parent);
+	}
+
+	float DescendCost(int child, const AABB& leafBox) const
+	{
+		const float combinedArea = AABB::Union(nodes[child].box, leafBox).GetSurfaceArea();
+		if (nodes[child].IsLeaf())
+			return combinedArea;
+		return combinedArea - nodes[child].box.GetSurfaceArea();
+	}
+
+	void RemoveLeaf(int leaf)
+	{
+		if (leaf == root)
+		{
+			root = -1;
+			return;
+		}
+		const int parent = nodes[leaf].parent;
+		const int grandParent = nodes[parent].parent;
+		const int sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+		if (grandParent < 0)
+		{
+			root = sibling;
+			nodes[sibling].parent = -1;
+		}
+		else
+		{
+			if (nodes[grandParent].left == parent)
+				nodes[grandParent].left = sibling;
+			else
+				nodes[grandParent].right = sibling;
+			nodes[sibling].parent = grandParent;
+			Refit(grandParent);
+		}
+		FreeNode(parent);
+		nodes[leaf].parent = -1;
+	}
+
+	/*
+	* Recomputes the boxes from the node up to the root
+	*/
+	void Refit(int index)
+	{
+		while (index >= 0)
+		{
+			Node& node = nodes[index];
+			node.box = AABB::Union(nodes[node.left].box, nodes[node.right].box);
+			index = node.parent;
+		}
+	}
+
+	/*
+	* Builds the subtree over the leaves and returns its root
+	*/
+	int Build(int* leaves, int count, int parent)
+	{
+		if (count == 1)
+		{
+			nodes[leaves[0]].parent = parent;
+			return leaves[0];
+		}
+
+		AABB centroidBounds;
+		for (int i = 0; i < count; i++)
+			centroidBounds.Expand(nodes[leaves[i]].box.GetCenter());
+		const glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+		const int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+		int mid = count / 2;
+		if (extent[axis] > 0.0f)
+		{
+			//bin the centroids along the widest axis and pick the cheapest split plane
+			AABB binBoxes[binCount];
+			int binCounts[binCount] = { 0 };
+			const float scale = binCount / extent[axis];
+			auto binOf = [&](int leaf)
+			{
+				const int b = (int)((nodes[leaf].box.GetCenter()[axis] - centroidBounds.min[axis]) * scale);
+				return glm::clamp(b, 0, binCount - 1);
+			};
+			for (int i = 0; i < count; i++)
+			{
+				const int b = binOf(leaves[i]);
+				binBoxes[b].Expand(nodes[leaves[i]].box);
+				binCounts[b]++;
+			}
+
+			float leftArea[binCount - 1];
+			int leftCount[binCount - 1];
+			AABB accumulated;
+			int accumulatedCount = 0;
+			for (int i = 0; i < binCount - 1; i++)
+			{
+				accumulated.Expand(binBoxes[i]);
+				accumulatedCount += binCounts[i];
+				leftArea[i] = accumulated.GetSurfaceArea();
+				leftCount[i] = accumulatedCount;
+			}
+			float bestCost = FLT_MAX;
+			int bestSplit = -1;
+			accumulated = AABB();
+			accumulatedCount = 0;
+			for (int i = binCount - 1; i > 0; i--)
+			{
+				accumulated.Expand(binBoxes[i]);
+				accumulatedCount += binCounts[i];
+				if (leftCount[i - 1] == 0 || accumulatedCount == 0)
+					continue;
+				const float cost = leftArea[i - 1] * leftCount[i - 1] + accumulated.GetSurfaceArea() * accumulatedCount;
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestSplit = i;
+				}
+			}
+			if (bestSplit > 0)
+			{
+				int* split = std::partition(leaves, leaves + count,
+					[&](int leaf) { return binOf(leaf) < bestSplit; });
+				mid = (int)(split - leaves);
+			}
+		}
+		if (mid == 0 || mid == count)
+		{
+			//all centroids fall in one bin, split in the middle
+			mid = count / 2;
+			std::nth_element(leaves, leaves + mid, leaves + count, [&](int a, int b)
+				{ return nodes[a].box.GetCenter()[axis] < nodes[b].box.GetCenter()[axis]; });
+		}
+
+		const int index = AllocateNode();
+		nodes[index].parent = parent;
+		const int left = Build(leaves, mid, index);
+		const int right = Build(leaves + mid, count - mid, index);
+		//nodes may have been reallocated while building the children
+		nodes[index].left = left;
+		nodes[index].right = right;
+		nodes[index].box = AABB::Union(nodes[left].box, nodes[right].box);
+		return index;
+	}
+};
@@ -0,0 +1,397 @@
+#pragma once
+#include <Scene.h>
+#include <stdio.h>
+#include <string>
+#include <random>
+#include <chrono>
+#include <ApplicationState.h>
+#include <SoftBodyCollisions.h>
+#include <LightClusters.h>
+
+/*
+* Scenes and measurements used to benchmark parts of the engine.
+* Selected from the command line with -bench <name> [options]
+*/
+namespace bench
+{
+	/*
+	* Fills the scene with count instances of the mesh laid out on a jittered square grid.
+	* Instances are not listed in the scene objects so the GUI stays responsive
+	*/
+	inline void CreateInstancingScene(Scene& scene, const std::string& meshPath, int count, float spacing = 3.0f)
+	{
+		if (meshPath.empty())
+		{
+			printf("Instancing benchmark needs a mesh, pass it with --path\n");
+			return;
+		}
+		printf("Instancing benchmark: %d instances of %s\n", count, meshPath.c_str());
+		std::mt19937 rng(7);
+		std::uniform_real_distribution<float> jitter(-0.25f, 0.25f);
+		std::uniform_real_distribution<float> angle(0.0f, glm::two_pi<float>());
+		std::uniform_real_distribution<float> color(0.2f, 1.0f);
+
+		const int side = (int)glm::ceil(glm::sqrt((float)count));
+		const float halfExtent = 0.5f * spacing * (side - 1);
+		for (int i = 0; i < count; i++)
+		{
+			const glm::vec3 position(
+				(i % side) * spacing - halfExtent + jitter(rng) * spacing,
+				0.0f,
+				(i / side) * spacing - halfExtent + jitter(rng) * spacing);
+			auto entity = scene.CreateInstancedModelObject(meshPath, position,
+				glm::vec3(glm::radians(-90.f), angle(rng), 0.0f), glm::vec3(1.0f), false);
+			scene.registry.get<CPhongMaterial>(entity).diffuse = glm::vec3(color(rng), color(rng), color(rng));
+		}
+		if (scene.registry.view<CLight>().size() == 0)
+			scene.CreateDirectionalLight(glm::vec3(-1.0f, -1.0f, -0.5f), 1.0f, glm::vec3(1.0f));
+	}
+
+	/*
+	* Scatters count dim point and spot lights of random colors over the instancing scene of the mesh,
+	* their ranges cover a few meshes each so the light clusters stay sparse
+	*/
+	inline void CreateLightsScene(Scene& scene, const std::string& meshPath, int count)
+	{
+		const int meshCount = 1024;
+		const float spacing = 3.0f;
+		if (!meshPath.empty())
+			CreateInstancingScene(scene, meshPath, meshCount, spacing);
+		printf("Many lights benchmark: %d point and spot lights\n", count);
+		std::mt19937 rng(11);
+		const float halfExtent = 0.5f * spacing * glm::ceil(glm::sqrt((float)meshCount));
+		std::uniform_real_distribution<float> horizontal(-halfExtent, halfExtent);
+		std::uniform_real_distribution<float> height(1.0f, 6.0f);
+		std::uniform_real_distribution<float> intensity(0.005f, 0.02f);
+		std::uniform_real_distribution<float> color(0.0f, 1.0f);
+		for (int i = 0; i < count; i++)
+		{
+			const glm::vec3 position(horizontal(rng), height(rng), horizontal(rng));
+			const glm::vec3 lightColor(color(rng), color(rng), color(rng));
+			if (i % 4 == 3)
+				scene.CreateSpotLight(position, glm::vec3(0.0f, -1.0f, 0.0f), 0.8f, intensity(rng), lightColor);
+			else
+				scene.CreatePointLight(position, intensity(rng), lightColor);
+		}
+	}
+
+	/*
+	* Lines up count copies of the mesh with the displacement map, receding from the default camera so
+	* the adaptive levels fall off with distance. Turns the wireframe on since the displaced surfaces are
+	* drawn by the tessellated wireframe pass, triangles generated and the longest generated edge are
+	* shown in the stats panel
+	*/
+	inline void CreateTessellationScene(Scene& scene, const std::string& meshPath, const std::string& displacementPath,
+		int count)
+	{
+		if (meshPath.empty())
+		{
+			printf("Tessellation benchmark needs a mesh, pass it with --path\n");
+			return;
+		}
+		printf("Tessellation benchmark: %d copies of %s displaced by %s\n", count, meshPath.c_str(), displacementPath.c_str());
+		CTriMesh mesh(meshPath);
+		const glm::vec3 size = mesh.GetBoundingBoxMax() - mesh.GetBoundingBoxMin();
+		const float extent = glm::max(size.x, glm::max(size.y, size.z));
+		for (int i = 0; i < count; i++)
+		{
+			auto entity = scene.CreateModelObject(meshPath, glm::vec3(0.0f, 0.0f, -1.5f * extent * i),
+				glm::vec3(glm::radians(-90.f), 0.0f, 0.0f));
+			//the cap of the adaptive levels and the level without them
+			scene.registry.get<CTriMesh>(entity).tessellationLevel = 64;
+			auto& maps = scene.registry.emplace<CImageMaps>(entity);
+			maps.AddImageMap(ImageMap::BindingSlot::DISPLACEMENT, displacementPath);
+			maps.GetImageMap(ImageMap::BindingSlot::DISPLACEMENT).dispMultiplier = 0.05f * extent;
+		}
+		ApplicationState::GetInstance().renderingWireframe = true;
+		if (scene.registry.view<CLight>().size() == 0)
+			scene.CreateDirectionalLight(glm::vec3(-1.0f, -1.0f, -0.5f), 1.0f, glm::vec3(1.0f));
+	}
+
+	/*
+	* Drops count rigid bodies of the mesh, stacked as a cubic grid, onto a static ground box.
+	* Every body gets a box collider from its bounding box. Bodies are not listed in the scene objects
+	*/
+	inline void CreateBoxesScene(Scene& scene, const std::string& meshPath, int count, float spacing = 1.5f)
+	{
+		if (meshPath.empty())
+		{
+			printf("Rigid body benchmark needs a mesh, pass it with --path\n");
+			return;
+		}
+		printf("Rigid body benchmark: %d bodies of %s\n", count, meshPath.c_str());
+		std::mt19937 rng(7);
+		std::uniform_real_distribution<float> tilt(-0.3f, 0.3f);
+		std::uniform_real_distribution<float> color(0.2f, 1.0f);
+
+		CTriMesh mesh(meshPath);
+		const glm::vec3 size = mesh.GetBoundingBoxMax() - mesh.GetBoundingBoxMin();
+		const float bodySize = glm::max(size.x, glm::max(size.y, size.z));
+		const int side = (int)glm::ceil(glm::pow((float)count, 1.0f / 3.0f));
+		const float halfExtent = 0.5f * spacing * bodySize * (side - 1);
+
+		//the ground uses the same mesh scaled to a wide slab whose top is at y = 0
+		const float groundWidth = 2.0f * halfExtent + 4.0f * bodySize;
+		auto ground = scene.CreateSceneObject("ground");
+		scene.registry.emplace<CTriMesh>(ground, mesh);
+		auto& groundTransform = scene.registry.emplace<CTransform>(ground, glm::vec3(0.0f, -0.25f * bodySize, 0.0f),
+			glm::vec3(0.0f), glm::vec3(groundWidth, 0.5f * bodySize, groundWidth) / size);
+		groundTransform.SetPivot(mesh.GetBoundingBoxCenter());
+		scene.registry.emplace<CPhongMaterial>(ground);
+		scene.registry.emplace<CBoxCollider>(ground, mesh.GetBoundingBoxMin(), mesh.GetBoundingBoxMax(), 0.2f);
+
+		for (int i = 0; i < count; i++)
+		{
+			const glm::vec3 position(
+				(i % side) * spacing * bodySize - halfExtent,
+				((i / (side * side)) * spacing + 1.0f) * bodySize,
+				((i / side) % side) * spacing * bodySize - halfExtent);
+			auto entity = scene.registry.create();
+			scene.registry.emplace<CTriMesh>(entity, mesh);
+			auto& transform = scene.registry.emplace<CTransform>(entity, position,
+				glm::vec3(tilt(rng), tilt(rng), tilt(rng)), glm::vec3(1.0f));
+			transform.SetPivot(mesh.GetBoundingBoxCenter());
+			scene.registry.emplace<CPhongMaterial>(entity).diffuse = glm::vec3(color(rng), color(rng), color(rng));
+			scene.registry.emplace<CBoxCollider>(entity, mesh.GetBoundingBoxMin(), mesh.GetBoundingBoxMax(), 0.2f);
+			//added last so the rigid body picks up the transform and the mesh for its inertia tensor
+			scene.registry.emplace<CRigidBody>(entity, 1.0f, position, glm::vec3(0.0f), 0.0f, 9.81f);
+		}
+		if (scene.registry.view<CLight>().size() == 0)
+			scene.CreateDirectionalLight(glm::vec3(-1.0f, -1.0f, -0.5f), 1.0f, glm::vec3(1.0f));
+	}
+
+	/*
+	* Headless comparison of the integration schemes. A spinning box in free fall is checked against
+	* the analytic parabola and for energy drift, an undamped spring lattice is checked for energy drift
+	* and blow up. Prints one row per scheme and time step
+	*/
+	inline void RunIntegratorBenchmark(float duration = 2.0f)
+	{
+		const float timeSteps[] = { 1.0f / 240.0f, 1.0f / 120.0f, 1.0f / 60.0f, 1.0f / 30.0f, 1.0f / 15.0f };
+		const glm::vec3 p0(0.0f, 10.0f, 0.0f);
+		const glm::vec3 v0(2.0f, 5.0f, 0.0f);
+		const float g = 9.81f;
+
+		printf("Integrator benchmark: %.1f s simulated per run\n", duration);
+		printf("%-18s %-8s | %-12s %-12s %-10s | %-12s %-10s\n", "scheme", "dt",
+			"rb drift", "rb pos err", "rb ns/step", "sb drift", "sb us/step");
+		for (int s = 0; s < (int)IntegrationScheme::Count; s++)
+		{
+			const IntegrationScheme scheme = (IntegrationScheme)s;
+			for (float dt : timeSteps)
+			{
+				const int steps = (int)glm::round(duration / dt);
+
+				//box of 1 x 0.5 x 0.25 with unit mass, spinning around an unstable axis
+				CRigidBody rb(1.0f, p0, glm::vec3(0.0f), 0.0f, g);
+				const glm::vec3 extent(1.0f, 0.5f, 0.25f);
+				rb.SetInertiaTensorAtRest(glm::mat3(
+					(extent.y * extent.y + extent.z * extent.z) / 12.0f, 0.0f, 0.0f,
+					0.0f, (extent.x * extent.x + extent.z * extent.z) / 12.0f, 0.0f,
+					0.0f, 0.0f, (extent.x * extent.x + extent.y * extent.y) / 12.0f));
+				rb.linearMomentum = v0;
+				rb.angularMomentum = glm::vec3(0.01f, 0.5f, 0.02f);
+				const float rbStart = rb.GetEnergy();
+				auto begin = std::chrono::high_resolution_clock::now();
+				for (int i = 0; i < steps; i++)
+				{
+					switch (scheme)
+					{
+					case IntegrationScheme::ForwardEuler: rb.TakeFwEulerStep(dt); break;
+					case IntegrationScheme::SymplecticEuler:
+					case IntegrationScheme::XPBD: rb.TakeSymplecticEulerStep(dt); break;
+					case IntegrationScheme::VelocityVerlet: rb.TakeVelocityVerletStep(dt); break;
+					default: rb.TakeRK4Step(dt); break;
+					}
+				}
+				const double rbTime = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - begin).count();
+				const float t = steps * dt;
+				const glm::vec3 exact = p0 + v0 * t + glm::vec3(0.0f, -0.5f * g * t * t, 0.0f);
+				const float rbDrift = (rb.GetEnergy() - rbStart) / glm::abs(rbStart);
+				const float rbError = glm::length(rb.position - exact);
+
+				//3x3x3 lattice of nodes with edge and face diagonal springs, stretched by 10%
+				const int side = 3;
+				Eigen::VectorXf nodes(side * side * side * 3);
+				for (int i = 0; i < side * side * side; i++)
+					nodes.segment<3>(i * 3) = Eigen::Vector3f((float)(i % side), (float)((i / side) % side), (float)(i / (side * side)));
+				std::vector<Spring> springs;
+				for (int i = 0; i < side * side * side; i++)
+					for (int j = i + 1; j < side * side * side; j++)
+					{
+						const float length = (nodes.segment<3>(i * 3) - nodes.segment<3>(j * 3)).norm();
+						if (length < 1.5f)
+							springs.emplace_back(glm::ivec2(i, j), length);
+					}
+				nodes *= 1.1f;
+				std::unordered_map<int, int> surfaceIds;
+				CSoftBody sb(springs, nodes, surfaceIds);
+				sb.SetSpringKs(10.0f);
+				sb.SetSpringDampings(0.0f);
+				const float sbStart = sb.GetEnergy();
+				begin = std::chrono::high_resolution_clock::now();
+				for (int i = 0; i < steps; i++)
+				{
+					switch (scheme)
+					{
+					case IntegrationScheme::ForwardEuler: sb.TakeFwEulerStep(dt); break;
+					case IntegrationScheme::SymplecticEuler: sb.TakeSymplecticEulerStep(dt); break;
+					case IntegrationScheme::VelocityVerlet: sb.TakeVelocityVerletStep(dt); break;
+					case IntegrationScheme::XPBD: sb.TakeXPBDStep(dt); break;
+					default: sb.TakeRK4Step(dt); break;
+					}
+				}
+				const double sbTime = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - begin).count();
+				const float sbEnd = sb.GetEnergy();
+				const float sbDrift = (sbEnd - sbStart) / glm::abs(sbStart);
+				const bool unstable = std::isnan(sbEnd) || sbEnd > 100.0f * sbStart;
+
+				printf("%-18s 1/%-6.0f | %+-12.2e %-12.2e %-10.1f | ", IntegrationSchemeName(scheme), 1.0f / dt,
+					rbDrift, rbError, rbTime / steps);
+				if (unstable)
+					printf("%-12s %-10.1f\n", "unstable", sbTime / steps);
+				else
+					printf("%+-12.2e %-10.1f\n", sbDrift, sbTime / steps);
+			}
+		}
+		printf("Forward Euler steps the soft body explicitly here, FwEulerIntegrator uses the implicit backward Euler step,\n"
+			"XPBD the rigid body with symplectic Euler\n");
+	}
+
+	/*
+	* Times the implicit backward Euler step against the XPBD step on the tetrahedral mesh of a node/ele pair
+	*/
+	inline void RunSoftBodySolverBenchmark(const std::string& nodePath, int steps = 60, float dt = 1.0f / 60.0f)
+	{
+		const std::string elePath = nodePath.substr(0, nodePath.find_last_of('.')) + ".ele";
+		CTriMesh mesh;
+		std::vector<Spring> springs;
+		Eigen::VectorXf nodes;
+		std::unordered_map<int, int> surfaceIds;
+		std::vector<glm::ivec4> tets;
+		mesh.InitializeFrom(nodePath, elePath, springs, nodes, surfaceIds, &tets);
+
+		printf("Soft body solver benchmark: %d steps of 1/%.0f s\n", steps, 1.0f / dt);
+		for (IntegrationScheme scheme : { IntegrationScheme::ForwardEuler, IntegrationScheme::XPBD })
+		{
+			CSoftBody sb(springs, nodes, surfaceIds);
+			sb.SetTetrahedra(tets);
+			sb.gravity = 1.0f;
+			const auto begin = std::chrono::high_resolution_clock::now();
+			for (int i = 0; i < steps; i++)
+			{
+				if (scheme == IntegrationScheme::XPBD)
+					sb.TakeXPBDStep(dt);
+				else
+					sb.TakeBwEulerStep(dt);
+			}
+			const double time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - begin).count();
+			const float energy = sb.GetEnergy();
+			printf("%-18s %8.3f ms/step energy %s%.3e\n", scheme == IntegrationScheme::XPBD ? "XPBD" : "Backward Euler",
+				time / steps, std::isnan(energy) ? "unstable " : "", energy);
+		}
+	}
+
+	/*
+	* Drops a copy of the tetrahedral mesh onto another and times the spatial hash build and the contact
+	* queries of the soft body collisions per step
+	*/
+	inline void RunSpatialHashBenchmark(const std::string& nodePath, int steps = 120, float dt = 1.0f / 60.0f)
+	{
+		if (nodePath.empty())
+		{
+			printf("Spatial hash benchmark needs a tetrahedral mesh, pass its .node file with --path\n");
+			return;
+		}
+		const std::string elePath = nodePath.substr(0, nodePath.find_last_of('.')) + ".ele";
+		CTriMesh mesh;
+		std::vector<Spring> springs;
+		Eigen::VectorXf nodes;
+		std::unordered_map<int, int> surfaceIds;
+		std::vector<glm::ivec4> tets;
+		mesh.InitializeFrom(nodePath, elePath, springs, nodes, surfaceIds, &tets);
+
+		//the second copy starts above the first, overlapping its top fifth, and falls onto it
+		entt::registry registry;
+		float minZ = FLT_MAX, maxZ = -FLT_MAX;
+		for (int i = 2; i < nodes.size(); i += 3)
+		{
+			minZ = glm::min(minZ, nodes[i]);
+			maxZ = glm::max(maxZ, nodes[i]);
+		}
+		const float height = maxZ - minZ;
+		for (int copy = 0; copy < 2; copy++)
+		{
+			Eigen::VectorXf copyNodes = nodes;
+			for (int i = 2; i < copyNodes.size(); i += 3)
+				copyNodes[i] += copy * 0.8f * height;
+			auto& sb = registry.emplace<CSoftBody>(registry.create(), springs, copyNodes, surfaceIds);
+			sb.SetTetrahedra(tets);
+			sb.SetSurface(mesh);
+			sb.SetSpringKs(1000.0f);
+			sb.gravity = copy == 1 ? 1.0f : 0.0f;
+		}
+
+		SoftBodyCollisions collisions;
+		double buildTime = 0.0, queryTime = 0.0, stepTime = 0.0;
+		unsigned long long contacts = 0;
+		for (int i = 0; i < steps; i++)
+		{
+			const auto begin = std::chrono::high_resolution_clock::now();
+			registry.view<CSoftBody>().each([dt](CSoftBody& sb) { sb.TakeXPBDStep(dt); });
+			stepTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - begin).count();
+			contacts += collisions.Resolve(registry);
+			buildTime += collisions.GetBuildTime();
+			queryTime += collisions.GetQueryTime();
+		}
+		const CSoftBody& first = registry.get<CSoftBody>(registry.view<CSoftBody>().front());
+		printf("Spatial hash benchmark: 2 x %zu surface nodes, %zu surface triangles, %d steps\n",
+			first.surfaceNodes.size(), first.surfaceTriangles.size(), steps);
+		printf("hash build %.3f ms/step, contact query %.3f ms/step, XPBD steps %.3f ms/step, %.1f contacts/step\n",
+			buildTime / steps, queryTime / steps, stepTime / steps, (double)contacts / steps);
+	}
+
+	/*
+	* Headless timing of the clustered light binning. count lights of random ranges are scattered in
+	* front of an orbiting camera and binned every frame. Prints the binning time and how many lights a
+	* fragment iterates with and without the clusters
+	*/
+	inline void RunLightBinningBenchmark(int count, int frames = 200)
+	{
+		printf("Light binning benchmark: %d lights, %d frames, %d x %d x %d clusters\n", count, frames,
+			LightClusters::tilesX, LightClusters::tilesY, LightClusters::slices);
+		std::mt19937 rng(5);
+		const float extent = 100.0f;
+		std::uniform_real_distribution<float> position(-extent, extent);
+		std::uniform_real_distribution<float> range(2.0f, 12.0f);
+		std::vector<LightVolume> lights(count);
+		for (LightVolume& light : lights)
+			light = { glm::vec3(position(rng), 0.1f * position(rng), position(rng)), range(rng) };
+
+		const glm::mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 1000.0f);
+		LightClusters clusters;
+		double totalTime = 0.0, totalReferences = 0.0;
+		float minTime = FLT_MAX;
+		unsigned int maxLights = 0, occupiedClusters = 0;
+		for (int frame = 0; frame < frames; frame++)
+		{
+			const float angle = glm::two_pi<float>() * frame / frames;
+			const glm::vec3 eye(glm::cos(angle) * extent * 1.2f, 20.0f, glm::sin(angle) * extent * 1.2f);
+			const glm::mat4 view = glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+			clusters.Build(lights, view, projection, 0.1f, 1000.0f);
+			totalTime += clusters.GetBuildTime();
+			minTime = glm::min(minTime, clusters.GetBuildTime());
+			totalReferences += clusters.GetLightIndices().size();
+			maxLights = glm::max(maxLights, clusters.GetMaxLightsPerCluster());
+			if (frame == frames - 1)
+				for (const glm::uvec2& cluster : clusters.GetClusters())
+					occupiedClusters += cluster.y > 0 ? 1 : 0;
+		}
+		printf("binning %.3f ms/frame (min %.3f ms), %.0f light references/frame\n",
+			totalTime / frames, minTime, totalReferences / frames);
+		printf("lights per cluster: %.2f average, %u max, %u of %d clusters lit in the last frame\n",
+			totalReferences / frames / LightClusters::clusterCount, maxLights, occupiedClusters,
+			LightClusters::clusterCount);
+		printf("a fragment iterates at most %u lights instead of %d\n", maxLights, count);
+	}
+}
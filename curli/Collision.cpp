@@ -0,0 +1,377 @@
+#include <Collision.h>
+#include <MeshBVH.h>
+#include <ParallelFor.h>
+#include <float.h>
+#include <xmmintrin.h>
+#include <algorithm>
+#include <vector>
+
+OBB OBB::FromBox(glm::vec3 min, glm::vec3 max, const glm::mat4& model)
+{
+	OBB box;
+	box.center = glm::vec3(model * glm::vec4((min + max) * 0.5f, 1.0f));
+	const glm::vec3 localHalfExtents = (max - min) * 0.5f;
+	for (int i = 0; i < 3; i++)
+	{
+		const glm::vec3 column = glm::vec3(model[i]);
+		const float scale = glm::length(column);
+		box.axes[i] = scale > 0.0f ? column / scale : glm::vec3(i == 0, i == 1, i == 2);
+		box.halfExtents[i] = localHalfExtents[i] * scale;
+	}
+	return box;
+}
+
+void OBB::GetCorners(glm::vec3 corners[8]) const
+{
+	const glm::vec3 x = axes[0] * halfExtents.x;
+	const glm::vec3 y = axes[1] * halfExtents.y;
+	const glm::vec3 z = axes[2] * halfExtents.z;
+	corners[0] = center + x + y + z;
+	corners[1] = center + x + y - z;
+	corners[2] = center + x - y - z;
+	corners[3] = center + x - y + z;
+	corners[4] = center - x - y + z;
+	corners[5] = center - x - y - z;
+	corners[6] = center - x + y - z;
+	corners[7] = center - x + y + z;
+}
+
+AABB OBB::GetBounds() const
+{
+	glm::vec3 extent(0.0f);
+	for (int i = 0; i < 3; i++)
+		extent += glm::abs(axes[i]) * halfExtents[i];
+	return AABB(center - extent, center + extent);
+}
+
+//===============SAT helpers===============
+namespace
+{
+	//radius of the box projected on the axis
+	float projectedRadius(const OBB& box, glm::vec3 axis)
+	{
+		return box.halfExtents.x * glm::abs(glm::dot(box.axes[0], axis)) +
+			box.halfExtents.y * glm::abs(glm::dot(box.axes[1], axis)) +
+			box.halfExtents.z * glm::abs(glm::dot(box.axes[2], axis));
+	}
+
+	//corner of the box furthest along the direction
+	glm::vec3 support(const OBB& box, glm::vec3 direction)
+	{
+		glm::vec3 p = box.center;
+		for (int i = 0; i < 3; i++)
+			p += box.axes[i] * (glm::dot(box.axes[i], direction) >= 0.0f ? box.halfExtents[i] : -box.halfExtents[i]);
+		return p;
+	}
+
+	//the face of the box whose normal is most anti parallel to the normal, as a quad
+	void incidentFace(const OBB& box, glm::vec3 normal, glm::vec3 face[4])
+	{
+		int axis = 0;
+		float best = -FLT_MAX;
+		for (int i = 0; i < 3; i++)
+		{
+			const float d = glm::abs(glm::dot(box.axes[i], normal));
+			if (d > best)
+			{
+				best = d;
+				axis = i;
+			}
+		}
+		const float sign = glm::dot(box.axes[axis], normal) > 0.0f ? -1.0f : 1.0f;
+		const glm::vec3 faceCenter = box.center + box.axes[axis] * (sign * box.halfExtents[axis]);
+		const int u = (axis + 1) % 3;
+		const int v = (axis + 2) % 3;
+		const glm::vec3 du = box.axes[u] * box.halfExtents[u];
+		const glm::vec3 dv = box.axes[v] * box.halfExtents[v];
+		face[0] = faceCenter + du + dv;
+		face[1] = faceCenter - du + dv;
+		face[2] = faceCenter - du - dv;
+		face[3] = faceCenter + du - dv;
+	}
+
+	//Sutherland-Hodgman against the plane dot(n, p) <= d
+	int clipPolygon(const glm::vec3* in, int count, glm::vec3 n, float d, glm::vec3* out)
+	{
+		int outCount = 0;
+		for (int i = 0; i < count; i++)
+		{
+			const glm::vec3 a = in[i];
+			const glm::vec3 b = in[(i + 1) % count];
+			const float da = glm::dot(n, a) - d;
+			const float db = glm::dot(n, b) - d;
+			if (da <= 0.0f)
+				out[outCount++] = a;
+			if ((da < 0.0f && db > 0.0f) || (da > 0.0f && db < 0.0f))
+				out[outCount++] = a + (b - a) * (da / (da - db));
+		}
+		return outCount;
+	}
+
+	/*
+	* Contact points of a face contact. The reference face belongs to ref and faces along normal,
+	* which points from ref to inc
+	*/
+	void faceContact(const OBB& ref, int refAxis, const OBB& inc, glm::vec3 normal, ContactManifold& manifold)
+	{
+		glm::vec3 polygon[16];
+		glm::vec3 clipped[16];
+		incidentFace(inc, normal, polygon);
+		int count = 4;
+
+		//clip the incident face against the side planes of the reference face
+		for (int k = 1; k < 3 && count > 0; k++)
+		{
+			const int side = (refAxis + k) % 3;
+			const glm::vec3 sideNormal = ref.axes[side];
+			const float offset = glm::dot(sideNormal, ref.center);
+			count = clipPolygon(polygon, count, sideNormal, offset + ref.halfExtents[side], clipped);
+			count = clipPolygon(clipped, count, -sideNormal, -offset + ref.halfExtents[side], polygon);
+		}
+
+		//keep the points below the reference face, deepest first
+		const float refPlane = glm::dot(normal, ref.center) + projectedRadius(ref, normal);
+		ContactPoint candidates[16];
+		int candidateCount = 0;
+		for (int i = 0; i < count; i++)
+		{
+			const float depth = refPlane - glm::dot(normal, polygon[i]);
+			if (depth >= 0.0f)
+				candidates[candidateCount++] = { polygon[i] + normal * (depth * 0.5f), depth };
+		}
+		std::sort(candidates, candidates + candidateCount,
+			[](const ContactPoint& a, const ContactPoint& b) { return a.penetration > b.penetration; });
+		manifold.pointCount = glm::min(candidateCount, 4);
+		for (int i = 0; i < manifold.pointCount; i++)
+			manifold.points[i] = candidates[i];
+	}
+
+	/*
+	* Contact point of an edge contact, midway between the closest points of the two edges
+	*/
+	void edgeContact(const OBB& a, int axisA, const OBB& b, int axisB, glm::vec3 normal, float penetration,
+		ContactManifold& manifold)
+	{
+		//the edges touching are the ones on the supporting sides of each box
+		glm::vec3 pointA = a.center;
+		glm::vec3 pointB = b.center;
+		for (int i = 0; i < 3; i++)
+		{
+			if (i != axisA)
+				pointA += a.axes[i] * (glm::dot(a.axes[i], normal) > 0.0f ? a.halfExtents[i] : -a.halfExtents[i]);
+			if (i != axisB)
+				pointB += b.axes[i] * (glm::dot(b.axes[i], normal) > 0.0f ? -b.halfExtents[i] : b.halfExtents[i]);
+		}
+		const glm::vec3 dA = a.axes[axisA];
+		const glm::vec3 dB = b.axes[axisB];
+		const glm::vec3 r = pointA - pointB;
+		const float dAdB = glm::dot(dA, dB);
+		const float denominator = 1.0f - dAdB * dAdB;
+		float s = 0.0f;
+		float t = 0.0f;
+		if (denominator > 1e-6f)
+		{
+			s = (dAdB * glm::dot(dB, r) - glm::dot(dA, r)) / denominator;
+			s = glm::clamp(s, -a.halfExtents[axisA], a.halfExtents[axisA]);
+		}
+		t = glm::clamp(glm::dot(dB, r) + s * dAdB, -b.halfExtents[axisB], b.halfExtents[axisB]);
+		manifold.pointCount = 1;
+		manifold.points[0].position = ((pointA + dA * s) + (pointB + dB * t)) * 0.5f;
+		manifold.points[0].penetration = penetration;
+	}
+}
+
+bool CollideOBBs(const OBB& a, const OBB& b, ContactManifold& manifold)
+{
+	const glm::vec3 d = b.center - a.center;
+	float bestFacePenetration = FLT_MAX;
+	int bestFace = -1;
+	glm::vec3 bestFaceAxis(0.0f);
+	float bestEdgePenetration = FLT_MAX;
+	int bestEdgeA = -1;
+	int bestEdgeB = -1;
+	glm::vec3 bestEdgeAxis(0.0f);
+
+	//face axes of a (0-2) and b (3-5)
+	for (int i = 0; i < 6; i++)
+	{
+		const glm::vec3 axis = i < 3 ? a.axes[i] : b.axes[i - 3];
+		const float penetration = projectedRadius(a, axis) + projectedRadius(b, axis) - glm::abs(glm::dot(d, axis));
+		if (penetration < 0.0f)
+			return false;
+		if (penetration < bestFacePenetration)
+		{
+			bestFacePenetration = penetration;
+			bestFace = i;
+			bestFaceAxis = axis;
+		}
+	}
+
+	//edge axes
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			glm::vec3 axis = glm::cross(a.axes[i], b.axes[j]);
+			const float length = glm::length(axis);
+			if (length < 1e-4f)//parallel edges are covered by the face axes
+				continue;
+			axis /= length;
+			const float penetration = projectedRadius(a, axis) + projectedRadius(b, axis) - glm::abs(glm::dot(d, axis));
+			if (penetration < 0.0f)
+				return false;
+			if (penetration < bestEdgePenetration)
+			{
+				bestEdgePenetration = penetration;
+				bestEdgeA = i;
+				bestEdgeB = j;
+				bestEdgeAxis = axis;
+			}
+		}
+	}
+
+	//prefer face contacts unless an edge axis is clearly better, keeps resting contacts stable
+	if (bestEdgeA >= 0 && bestEdgePenetration < 0.95f * bestFacePenetration - 0.01f)
+	{
+		manifold.normal = glm::dot(bestEdgeAxis, d) < 0.0f ? -bestEdgeAxis : bestEdgeAxis;
+		edgeContact(a, bestEdgeA, b, bestEdgeB, manifold.normal, bestEdgePenetration, manifold);
+		return true;
+	}
+
+	manifold.normal = glm::dot(bestFaceAxis, d) < 0.0f ? -bestFaceAxis : bestFaceAxis;
+	if (bestFace < 3)
+		faceContact(a, bestFace, b, manifold.normal, manifold);
+	else
+		faceContact(b, bestFace - 3, a, -manifold.normal, manifold);
+
+	if (manifold.pointCount == 0)
+	{
+		//numerical corner case, fall back to the deepest corner of b
+		manifold.pointCount = 1;
+		manifold.points[0].position = support(b, -manifold.normal);
+		manifold.points[0].penetration = bestFacePenetration;
+	}
+	return true;
+}
+
+//===============Soft body nodes===============
+namespace
+{
+	constexpr int nodeBlockSize = 4096;//nodes per parallel task, multiple of 4
+
+	//moves the node onto the surface with the outward normal and reflects its velocity into the surface
+	inline void pushOut(float* position, float* velocity, glm::vec3 surfacePoint, glm::vec3 normal, float restitution)
+	{
+		position[0] = surfacePoint.x;
+		position[1] = surfacePoint.y;
+		position[2] = surfacePoint.z;
+		const float vn = velocity[0] * normal.x + velocity[1] * normal.y + velocity[2] * normal.z;
+		if (vn >= 0.0f)
+			return;
+		const float impulse = -(1.0f + restitution) * vn;
+		velocity[0] += impulse * normal.x;
+		velocity[1] += impulse * normal.y;
+		velocity[2] += impulse * normal.z;
+	}
+
+	void collideNodeRangeWithBox(float* positions, float* velocities, int begin, int end,
+		glm::vec3 min, glm::vec3 max, float restitution)
+	{
+		//four xyz nodes fill three registers, the bounds repeat every three floats: xyzx yzxy zxyz
+		const __m128 lo[3] = { _mm_setr_ps(min.x, min.y, min.z, min.x), _mm_setr_ps(min.y, min.z, min.x, min.y),
+			_mm_setr_ps(min.z, min.x, min.y, min.z) };
+		const __m128 hi[3] = { _mm_setr_ps(max.x, max.y, max.z, max.x), _mm_setr_ps(max.y, max.z, max.x, max.y),
+			_mm_setr_ps(max.z, max.x, max.y, max.z) };
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 reflect = _mm_set1_ps(-restitution);
+		const int vectorEnd = begin + (end - begin) / 4 * 4;
+		for (int i = begin; i < vectorEnd; i += 4)
+		{
+			float* p = positions + i * 3;
+			float* v = velocities + i * 3;
+			for (int r = 0; r < 3; r++)
+			{
+				const __m128 position = _mm_loadu_ps(p + r * 4);
+				const __m128 velocity = _mm_loadu_ps(v + r * 4);
+				//only the components moving further out of the box are reflected
+				const __m128 outward = _mm_or_ps(
+					_mm_and_ps(_mm_cmplt_ps(position, lo[r]), _mm_cmplt_ps(velocity, zero)),
+					_mm_and_ps(_mm_cmpgt_ps(position, hi[r]), _mm_cmpgt_ps(velocity, zero)));
+				_mm_storeu_ps(p + r * 4, _mm_min_ps(_mm_max_ps(position, lo[r]), hi[r]));
+				_mm_storeu_ps(v + r * 4, _mm_or_ps(_mm_and_ps(outward, _mm_mul_ps(velocity, reflect)),
+					_mm_andnot_ps(outward, velocity)));
+			}
+		}
+		for (int i = vectorEnd * 3; i < end * 3; i++)
+		{
+			const int axis = i % 3;
+			if ((positions[i] < min[axis] && velocities[i] < 0.0f) || (positions[i] > max[axis] && velocities[i] > 0.0f))
+				velocities[i] *= -restitution;
+			positions[i] = glm::clamp(positions[i], min[axis], max[axis]);
+		}
+	}
+}
+
+void CollideNodesWithBox(float* positions, float* velocities, int nodeCount, glm::vec3 min, glm::vec3 max, float restitution)
+{
+	forEachBlock(nodeCount, nodeBlockSize, [&](int begin, int end)
+		{
+			collideNodeRangeWithBox(positions, velocities, begin, end, min, max, restitution);
+		});
+}
+
+void CollideNodesWithPlane(float* positions, float* velocities, int nodeCount, glm::vec3 normal, float offset, float restitution)
+{
+	forEachBlock(nodeCount, nodeBlockSize, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				const glm::vec3 p(positions[i * 3], positions[i * 3 + 1], positions[i * 3 + 2]);
+				const float distance = glm::dot(normal, p) - offset;
+				if (distance < 0.0f)
+					pushOut(positions + i * 3, velocities + i * 3, p - distance * normal, normal, restitution);
+			}
+		});
+}
+
+void CollideNodesWithSphere(float* positions, float* velocities, int nodeCount, glm::vec3 center, float radius, float restitution)
+{
+	const float radiusSquared = radius * radius;
+	forEachBlock(nodeCount, nodeBlockSize, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				const glm::vec3 d = glm::vec3(positions[i * 3], positions[i * 3 + 1], positions[i * 3 + 2]) - center;
+				const float distanceSquared = glm::dot(d, d);
+				if (distanceSquared >= radiusSquared || distanceSquared < 1e-12f)
+					continue;
+				const glm::vec3 normal = d / glm::sqrt(distanceSquared);
+				pushOut(positions + i * 3, velocities + i * 3, center + normal * radius, normal, restitution);
+			}
+		});
+}
+
+void CollideNodesWithMesh(float* positions, float* velocities, int nodeCount, const MeshBVH& bvh,
+	const glm::mat4& model, float restitution)
+{
+	if (bvh.IsEmpty())
+		return;
+	const glm::mat4 inverseModel = glm::inverse(model);
+	const glm::mat3 normalMatrix = glm::transpose(glm::mat3(inverseModel));
+	const AABB& local = bvh.GetBounds();
+	const AABB bounds = OBB::FromBox(local.min, local.max, model).GetBounds();
+	forEachBlock(nodeCount, nodeBlockSize, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				const glm::vec3 p(positions[i * 3], positions[i * 3 + 1], positions[i * 3 + 2]);
+				if (glm::any(glm::lessThan(p, bounds.min)) || glm::any(glm::greaterThan(p, bounds.max)))
+					continue;
+				glm::vec3 closest, normal;
+				if (bvh.SignedDistance(glm::vec3(inverseModel * glm::vec4(p, 1.0f)), closest, normal) >= 0.0f)
+					continue;
+				pushOut(positions + i * 3, velocities + i * 3, glm::vec3(model * glm::vec4(closest, 1.0f)),
+					glm::normalize(normalMatrix * normal), restitution);
+			}
+		});
+}
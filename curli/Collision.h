@@ -0,0 +1,79 @@
+#pragma once
+#include <Culling.h>
+#include <glm/glm.hpp>
+
+class MeshBVH;
+
+/*
+* Oriented bounding box. Axes are unit length, scale of the model matrix goes to the half extents
+*/
+struct OBB
+{
+	glm::vec3 center = glm::vec3(0.0f);
+	glm::vec3 axes[3] = { glm::vec3(1, 0, 0), glm::vec3(0, 1, 0), glm::vec3(0, 0, 1) };
+	glm::vec3 halfExtents = glm::vec3(0.0f);
+
+	/*
+	* Places the local box min/max in the world with the model matrix
+	*/
+	static OBB FromBox(glm::vec3 min, glm::vec3 max, const glm::mat4& model);
+
+	/*
+	* Writes the 8 corners of the box to corners
+	*/
+	void GetCorners(glm::vec3 corners[8]) const;
+
+	/*
+	* Smallest axis aligned box that contains the oriented box
+	*/
+	AABB GetBounds() const;
+};
+
+struct ContactPoint
+{
+	glm::vec3 position = glm::vec3(0.0f);
+	float penetration = 0.0f;
+};
+
+/*
+* Up to four contact points of two touching bodies that share the normal pointing from the first body to the second
+*/
+struct ContactManifold
+{
+	glm::vec3 normal = glm::vec3(0.0f);
+	ContactPoint points[4];
+	int pointCount = 0;
+};
+
+/*
+* Separating axis test over the 15 candidate axes of two oriented boxes. If they overlap the manifold
+* is filled from the axis of least penetration: face contacts clip the incident face against the
+* reference face, edge contacts use the closest points of the two edges
+*/
+bool CollideOBBs(const OBB& a, const OBB& b, ContactManifold& manifold);
+
+//===============Soft body nodes===============
+//Nodes are flat xyz triplets as in CSoftBody. A node that left a collider is moved back onto its surface
+//and the velocity component into the surface is reflected, scaled by restitution. All run in parallel blocks
+
+/*
+* Keeps the nodes inside the box, an SSE clamp over four nodes at a time
+*/
+void CollideNodesWithBox(float* positions, float* velocities, int nodeCount, glm::vec3 min, glm::vec3 max, float restitution);
+
+/*
+* Keeps the nodes on the positive side of the plane dot(normal, p) = offset
+*/
+void CollideNodesWithPlane(float* positions, float* velocities, int nodeCount, glm::vec3 normal, float offset, float restitution);
+
+/*
+* Keeps the nodes outside the sphere
+*/
+void CollideNodesWithSphere(float* positions, float* velocities, int nodeCount, glm::vec3 center, float radius, float restitution);
+
+/*
+* Keeps the nodes outside the mesh, using the signed distance of the model space tree. Only nodes within
+* the world bounds of the mesh are queried
+*/
+void CollideNodesWithMesh(float* positions, float* velocities, int nodeCount, const MeshBVH& bvh,
+	const glm::mat4& model, float restitution);
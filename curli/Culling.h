@@ -0,0 +1,150 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <xmmintrin.h>
+#include <float.h>
+
+/*
+* Axis aligned bounding box. A default constructed box is empty and contains nothing
+*/
+struct AABB
+{
+	glm::vec3 min = glm::vec3(FLT_MAX);
+	glm::vec3 max = glm::vec3(-FLT_MAX);
+
+	AABB() {}
+	AABB(glm::vec3 min, glm::vec3 max) : min(min), max(max) {}
+
+	inline bool IsValid() const { return min.x <= max.x && min.y <= max.y && min.z <= max.z; }
+	inline glm::vec3 GetCenter() const { return (min + max) * 0.5f; }
+	inline glm::vec3 GetExtent() const { return (max - min) * 0.5f; }
+
+	inline void Expand(glm::vec3 point)
+	{
+		min = glm::min(min, point);
+		max = glm::max(max, point);
+	}
+
+	inline void Expand(const AABB& other)
+	{
+		min = glm::min(min, other.min);
+		max = glm::max(max, other.max);
+	}
+
+	inline bool Contains(const AABB& other) const
+	{
+		return glm::all(glm::lessThanEqual(min, other.min)) && glm::all(glm::greaterThanEqual(max, other.max));
+	}
+
+	inline bool Overlaps(const AABB& other) const
+	{
+		return glm::all(glm::lessThanEqual(min, other.max)) && glm::all(glm::greaterThanEqual(max, other.min));
+	}
+
+	inline float GetSurfaceArea() const
+	{
+		if (!IsValid())
+			return 0.0f;
+		const glm::vec3 d = max - min;
+		return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+
+	static inline AABB Union(const AABB& a, const AABB& b)
+	{
+		return AABB(glm::min(a.min, b.min), glm::max(a.max, b.max));
+	}
+
+	/*
+	* Slab test. invDirection is 1/direction of the ray, returns the entry distance in tEnter
+	*/
+	inline bool IntersectsRay(glm::vec3 origin, glm::vec3 invDirection, float maxDistance, float& tEnter) const
+	{
+		const glm::vec3 t0 = (min - origin) * invDirection;
+		const glm::vec3 t1 = (max - origin) * invDirection;
+		const glm::vec3 tNear = glm::min(t0, t1);
+		const glm::vec3 tFar = glm::max(t0, t1);
+		tEnter = glm::max(glm::max(tNear.x, tNear.y), glm::max(tNear.z, 0.0f));
+		const float tExit = glm::min(glm::min(tFar.x, tFar.y), glm::min(tFar.z, maxDistance));
+		return tEnter <= tExit;
+	}
+
+	/*
+	* Returns the box that tightly contains this box after it is transformed by the matrix (Arvo)
+	*/
+	inline AABB Transform(const glm::mat4& m) const
+	{
+		const glm::vec3 center = glm::vec3(m * glm::vec4(GetCenter(), 1.0f));
+		const glm::vec3 e = GetExtent();
+		const glm::vec3 extent(
+			glm::abs(m[0][0]) * e.x + glm::abs(m[1][0]) * e.y + glm::abs(m[2][0]) * e.z,
+			glm::abs(m[0][1]) * e.x + glm::abs(m[1][1]) * e.y + glm::abs(m[2][1]) * e.z,
+			glm::abs(m[0][2]) * e.x + glm::abs(m[1][2]) * e.y + glm::abs(m[2][2]) * e.z);
+		return AABB(center - extent, center + extent);
+	}
+};
+
+/*
+* Six clipping planes extracted from a view projection matrix (Gribb-Hartmann). Planes are
+* stored as structure of arrays padded to eight so a box is tested against four planes at a time.
+* Planes are not normalized since only the sign of the distance is used
+*/
+class Frustum
+{
+public:
+	Frustum() { Set(glm::mat4(1.0f)); }
+	explicit Frustum(const glm::mat4& viewProjection) { Set(viewProjection); }
+
+	void Set(const glm::mat4& m)
+	{
+		const glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+		const glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+		const glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+		const glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+		const glm::vec4 planes[8] = {
+			row3 + row0, row3 - row0,//left, right
+			row3 + row1, row3 - row1,//bottom, top
+			row3 + row2, row3 - row2,//near, far
+			glm::vec4(0, 0, 0, 1), glm::vec4(0, 0, 0, 1) };//padding, always inside
+		for (int i = 0; i < 8; i++)
+		{
+			nx[i] = planes[i].x; ny[i] = planes[i].y; nz[i] = planes[i].z; d[i] = planes[i].w;
+			absNx[i] = glm::abs(nx[i]); absNy[i] = glm::abs(ny[i]); absNz[i] = glm::abs(nz[i]);
+		}
+	}
+
+	/*
+	* Returns false if the box is completely outside of at least one plane.
+	* Empty boxes are treated as unbounded and always intersect
+	*/
+	inline bool Intersects(const AABB& box) const
+	{
+		if (!box.IsValid())
+			return true;
+		const glm::vec3 c = box.GetCenter();
+		const glm::vec3 e = box.GetExtent();
+		const __m128 cx = _mm_set1_ps(c.x), cy = _mm_set1_ps(c.y), cz = _mm_set1_ps(c.z);
+		const __m128 ex = _mm_set1_ps(e.x), ey = _mm_set1_ps(e.y), ez = _mm_set1_ps(e.z);
+		const __m128 zero = _mm_setzero_ps();
+		for (int i = 0; i < 8; i += 4)
+		{
+			//signed distance of the center plus the box radius projected on the plane normal
+			__m128 dist = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(_mm_load_ps(nx + i), cx), _mm_mul_ps(_mm_load_ps(ny + i), cy)),
+				_mm_add_ps(_mm_mul_ps(_mm_load_ps(nz + i), cz), _mm_load_ps(d + i)));
+			__m128 radius = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(_mm_load_ps(absNx + i), ex), _mm_mul_ps(_mm_load_ps(absNy + i), ey)),
+				_mm_mul_ps(_mm_load_ps(absNz + i), ez));
+			if (_mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(dist, radius), zero)) != 0)
+				return false;
+		}
+		return true;
+	}
+
+private:
+	alignas(16) float nx[8];
+	alignas(16) float ny[8];
+	alignas(16) float nz[8];
+	alignas(16) float d[8];
+	alignas(16) float absNx[8];
+	alignas(16) float absNy[8];
+	alignas(16) float absNz[8];
+};
@@ -6,7 +6,7 @@ int main(int argc, char const *argv[])
 {
 	//Eigen::initParallel();
 	printf("Set Eigen thread count to %d\n", Eigen::nbThreads());
-	Application<MultiTargetRenderer, gui::ControlPanel, FwEulerIntegrator> app(argc, argv);
+	Application<MultiTargetRenderer, gui::ControlPanel, SwitchableIntegrator> app(argc, argv);
 	app.Run();
 
     return 0;
@@ -0,0 +1,146 @@
+#pragma once
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <cstdio>
+#include <string>
+
+/*
+* OpenGL error checking, chosen at compile time with CURLI_GL_CHECKS (see CMakeLists.txt)
+* 0: GL_CALL is the bare call, errors are only looked for in validation frames
+* 1: glGetError after every GL_CALL, which synchronizes with the driver
+* 2: bare calls, errors are reported by the synchronous debug output with the object labels
+*/
+#ifndef CURLI_GL_CHECKS
+#define CURLI_GL_CHECKS 1
+#endif
+
+#if CURLI_GL_CHECKS == 1
+//define a macro that takes a function calls it and ctaches opengl errors
+#define GL_CALL(func) \
+do { \
+    func; \
+    GLenum error = glGetError(); \
+    if (error != GL_NO_ERROR) { \
+        const char* errorString = (const char*)glad_glGetString(GL_VERSION); \
+        const char* description = (const char*)glfwGetError(NULL); \
+        printf("OpenGL error 0x%08x (%s) at %s:%d - %s\n", error, errorString, __FILE__, __LINE__, description); \
+    } \
+} while (false)
+#else
+#define GL_CALL(func) \
+do { \
+    func; \
+} while (false)
+#endif
+
+namespace gldebug
+{
+	inline const char* SourceName(GLenum source)
+	{
+		switch (source) {
+		case GL_DEBUG_SOURCE_API:               return "api";
+		case GL_DEBUG_SOURCE_WINDOW_SYSTEM:     return "window";
+		case GL_DEBUG_SOURCE_SHADER_COMPILER:   return "shader";
+		case GL_DEBUG_SOURCE_THIRD_PARTY:       return "3rd party";
+		case GL_DEBUG_SOURCE_APPLICATION:       return "app";
+		default:                                return "UNKNOWN";
+		}
+	}
+
+	inline const char* TypeName(GLenum type)
+	{
+		switch (type) {
+		case GL_DEBUG_TYPE_ERROR:               return "error";
+		case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "deprecated";
+		case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR:  return "undefined";
+		case GL_DEBUG_TYPE_PORTABILITY:         return "portability";
+		case GL_DEBUG_TYPE_PERFORMANCE:         return "performance";
+		case GL_DEBUG_TYPE_OTHER:               return "other";
+		case GL_DEBUG_TYPE_MARKER:              return "marker";
+		default:                                return "UNKNOWN";
+		}
+	}
+
+	inline const char* SeverityName(GLenum severity)
+	{
+		switch (severity) {
+		case GL_DEBUG_SEVERITY_HIGH:            return "high";
+		case GL_DEBUG_SEVERITY_MEDIUM:          return "med";
+		case GL_DEBUG_SEVERITY_LOW:             return "low";
+		case GL_DEBUG_SEVERITY_NOTIFICATION:    return "notif";
+		default:                                return "UNKNOWN";
+		}
+	}
+
+	inline void APIENTRY MessageCallback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length,
+		const GLchar* message, const void* userParam)
+	{
+		if (severity != GL_DEBUG_SEVERITY_NOTIFICATION)
+			printf("GL Error type: %s severity: %s from: %s-\n\t %s\n", TypeName(type), SeverityName(severity),
+				SourceName(source), message);
+	}
+
+	/*
+	* Registers the debug output callback. The output stays on unless GL_CALL is the bare call, in which
+	* case only validation frames turn it on
+	*/
+	inline void Initialize()
+	{
+		if (!GLAD_GL_VERSION_4_3)
+			return;
+		glDebugMessageCallback(MessageCallback, nullptr);
+#if CURLI_GL_CHECKS == 0
+		glDisable(GL_DEBUG_OUTPUT);
+#elif CURLI_GL_CHECKS == 1
+		glEnable(GL_DEBUG_OUTPUT);
+#else
+		//messages arrive inside the offending call so a breakpoint in the callback shows the caller
+		glEnable(GL_DEBUG_OUTPUT);
+		glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+#endif
+	}
+
+	/*
+	* Names the object in the debug output messages
+	*/
+	inline void Label(GLenum identifier, GLuint name, const std::string& label)
+	{
+		if (GLAD_GL_VERSION_4_3 && !label.empty())
+			glObjectLabel(identifier, name, (GLsizei)label.size(), label.c_str());
+	}
+
+	/*
+	* Validation frames of soak tests run with the synchronous debug output on and check glGetError at
+	* their end, frames in between run without any checks
+	*/
+	inline void BeginValidationFrame()
+	{
+#if CURLI_GL_CHECKS == 0
+		if (!GLAD_GL_VERSION_4_3)
+			return;
+		glEnable(GL_DEBUG_OUTPUT);
+		glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+#endif
+	}
+
+	/*
+	* Reports the errors raised during the frame, returns the number of them
+	*/
+	inline int EndValidationFrame(long int frame)
+	{
+		int errorCount = 0;
+		for (GLenum error = glGetError(); error != GL_NO_ERROR && errorCount < 32; error = glGetError())
+		{
+			printf("OpenGL error 0x%08x in frame %ld\n", error, frame);
+			errorCount++;
+		}
+#if CURLI_GL_CHECKS == 0
+		if (GLAD_GL_VERSION_4_3)
+		{
+			glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+			glDisable(GL_DEBUG_OUTPUT);
+		}
+#endif
+		return errorCount;
+	}
+}
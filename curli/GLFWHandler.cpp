@@ -17,6 +17,9 @@ void GLFWHandler::InitAndCreateWindow(int width, int height, const char* title)
 		return;
 	}
 	
+#if CURLI_GL_CHECKS == 2
+	glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GLFW_TRUE);
+#endif
 	windowHandle = glfwCreateWindow(width, height, title, NULL, NULL);
 	glfwMakeContextCurrent(windowHandle);
 	glfwSwapInterval(1); // Enable vsync
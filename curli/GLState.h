@@ -0,0 +1,222 @@
+#pragma once
+#include <glad/glad.h>
+#include <GLDebug.h>
+#include <glm/glm.hpp>
+
+/*
+* CPU side copy of the OpenGL state changed by the wrappers in OpenGLProgram.h. Binds go through it so
+* the redundant ones are skipped, and the state to restore after an offscreen pass is read from here
+* instead of with glGet. Code changing this state behind its back has to call Invalidate
+*/
+class GLState
+{
+public:
+	static GLState& GetInstance()
+	{
+		static GLState instance;
+		return instance;
+	}
+
+	void BindFramebuffer(GLuint framebuffer)
+	{
+		if (Changed(boundFramebuffer, framebuffer))
+			GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, framebuffer));
+	}
+	GLuint GetFramebuffer() const { return boundFramebuffer == unknown ? 0 : boundFramebuffer; }
+
+	void Viewport(glm::ivec4 rect)
+	{
+		if (Changed(viewport, rect))
+			GL_CALL(glViewport(rect.x, rect.y, rect.z, rect.w));
+	}
+	void Viewport(int x, int y, int width, int height) { Viewport(glm::ivec4(x, y, width, height)); }
+	glm::ivec4 GetViewport() const { return viewport; }
+
+	void UseProgram(GLuint program)
+	{
+		if (Changed(usedProgram, program))
+			GL_CALL(glUseProgram(program));
+	}
+
+	void BindVertexArray(GLuint vao)
+	{
+		if (Changed(boundVertexArray, vao))
+			GL_CALL(glBindVertexArray(vao));
+	}
+
+	void ActiveTexture(GLenum unit)
+	{
+		if (Changed(activeUnit, unit))
+			GL_CALL(glActiveTexture(unit));
+	}
+
+	/*
+	* Binds the texture to the unit, the active unit is only changed if the binding is
+	*/
+	void BindTexture(GLenum unit, GLenum target, GLuint texture)
+	{
+		const int u = unit - GL_TEXTURE0;
+		const int t = TargetIndex(target);
+		if (t < 0 || u < 0 || u >= maxUnits)
+		{
+			ActiveTexture(unit);
+			issuedCalls++;
+			GL_CALL(glBindTexture(target, texture));
+			return;
+		}
+		if (Changed(textures[u][t], texture))
+		{
+			ActiveTexture(unit);
+			GL_CALL(glBindTexture(target, texture));
+		}
+	}
+
+	/*
+	* Binds the texture to the active unit, used when creating or updating textures
+	*/
+	void BindTexture(GLenum target, GLuint texture)
+	{
+		if (activeUnit == unknown)
+			ActiveTexture(GL_TEXTURE0);
+		BindTexture(activeUnit, target, texture);
+	}
+
+	void DepthMask(GLboolean mask)
+	{
+		if (Changed(depthMask, (GLuint)mask))
+			GL_CALL(glDepthMask(mask));
+	}
+
+	void DepthFunc(GLenum func)
+	{
+		if (Changed(depthFunc, (GLuint)func))
+			GL_CALL(glDepthFunc(func));
+	}
+
+	/*
+	* Binds the buffer to the generic binding point of the target. Only the shader storage target is cached,
+	* the others are always issued
+	*/
+	void BindBuffer(GLenum target, GLuint buffer)
+	{
+		if (target != GL_SHADER_STORAGE_BUFFER)
+		{
+			issuedCalls++;
+			GL_CALL(glBindBuffer(target, buffer));
+			return;
+		}
+		if (Changed(storageBuffer, buffer))
+			GL_CALL(glBindBuffer(target, buffer));
+	}
+
+	/*
+	* Binds the buffer to an indexed binding point, which binds it to the generic one as well
+	*/
+	void BindBufferBase(GLenum target, GLuint index, GLuint buffer)
+	{
+		issuedCalls++;
+		GL_CALL(glBindBufferBase(target, index, buffer));
+		if (target == GL_SHADER_STORAGE_BUFFER)
+			storageBuffer = buffer;
+	}
+
+	/*
+	* GL unbinds deleted objects and may hand their names out again
+	*/
+	void OnTextureDeleted(GLuint texture)
+	{
+		for (auto& unit : textures)
+			for (GLuint& bound : unit)
+				if (bound == texture)
+					bound = 0;
+	}
+	void OnBufferDeleted(GLuint buffer)
+	{
+		if (storageBuffer == buffer)
+			storageBuffer = 0;
+	}
+	void OnFramebufferDeleted(GLuint framebuffer)
+	{
+		if (boundFramebuffer == framebuffer)
+			boundFramebuffer = 0;
+	}
+	void OnVertexArrayDeleted(GLuint vao)
+	{
+		if (boundVertexArray == vao)
+			boundVertexArray = 0;
+	}
+	void OnProgramDeleted(GLuint program)
+	{
+		if (usedProgram == program)
+			usedProgram = unknown;
+	}
+
+	/*
+	* Forgets everything, the next call of each kind is issued
+	*/
+	void Invalidate()
+	{
+		boundFramebuffer = unknown;
+		viewport = glm::ivec4(-1);
+		usedProgram = unknown;
+		boundVertexArray = unknown;
+		activeUnit = unknown;
+		depthMask = unknown;
+		depthFunc = unknown;
+		storageBuffer = unknown;
+		for (auto& unit : textures)
+			for (GLuint& bound : unit)
+				bound = unknown;
+	}
+
+	unsigned int GetIssuedCalls() const { return issuedCalls; }
+	unsigned int GetSkippedCalls() const { return skippedCalls; }
+	void ResetCounters() { issuedCalls = 0; skippedCalls = 0; }
+
+	GLState(const GLState&) = delete;
+	void operator=(const GLState&) = delete;
+private:
+	static constexpr GLuint unknown = 0xFFFFFFFF;
+	static constexpr int maxUnits = 48;
+	static constexpr int targetCount = 4;
+
+	GLuint boundFramebuffer = unknown;
+	glm::ivec4 viewport = glm::ivec4(-1);
+	GLuint usedProgram = unknown;
+	GLuint boundVertexArray = unknown;
+	GLenum activeUnit = unknown;
+	GLuint depthMask = unknown;
+	GLuint depthFunc = unknown;
+	GLuint storageBuffer = unknown;
+	GLuint textures[maxUnits][targetCount];
+
+	unsigned int issuedCalls = 0;
+	unsigned int skippedCalls = 0;
+
+	GLState() { Invalidate(); }
+
+	static int TargetIndex(GLenum target)
+	{
+		switch (target)
+		{
+		case GL_TEXTURE_2D: return 0;
+		case GL_TEXTURE_CUBE_MAP: return 1;
+		case GL_TEXTURE_2D_ARRAY: return 2;
+		case GL_TEXTURE_CUBE_MAP_ARRAY: return 3;
+		default: return -1;
+		}
+	}
+
+	template <typename V>
+	bool Changed(V& cached, const V& value)
+	{
+		if (cached == value)
+		{
+			skippedCalls++;
+			return false;
+		}
+		cached = value;
+		issuedCalls++;
+		return true;
+	}
+};
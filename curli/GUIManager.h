@@ -122,7 +122,7 @@ namespace gui
 			const ImGuiViewport* stats_viewport = ImGui::GetMainViewport();
 			ImGui::SetNextWindowSize(ImVec2(stats_viewport->WorkSize.x / 8, 0));
 			
-			ImGui::SetNextWindowPos(ImVec2(5, stats_viewport->WorkSize.y - ImGui::GetCursorPos().y - ImGui::GetTextLineHeight() * 8));
+			ImGui::SetNextWindowPos(ImVec2(5, stats_viewport->WorkSize.y - ImGui::GetCursorPos().y - ImGui::GetTextLineHeight() * 33));
 			ImGui::Begin("Stats", NULL, ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoMove);
 			float nthFrame = ApplicationState::GetInstance().renderEveryNthFrame;
 
@@ -130,8 +130,54 @@ namespace gui
 
 			ImGui::Text("FPS: %.1f", ImGui::GetIO().Framerate / nthFrame);
 			ImGui::Text("Frame Time: %.3f ms", 1000.0f / ImGui::GetIO().Framerate * nthFrame);
+			const RenderStats& renderStats = ApplicationState::GetInstance().renderStats;
+			ImGui::Text("CPU Render Time: %.3f ms", renderStats.cpuTime);
+			ImGui::Text("Draw Calls: %u (batched meshes %u)", renderStats.draws, renderStats.batchedMeshes);
+			ImGui::Text("Instances: %u", renderStats.instances);
+			ImGui::Text("State Changes: %u (skipped %u)", renderStats.stateChanges, renderStats.skippedStateChanges);
+			ImGui::Text("GL State Calls: %u (skipped %u)", renderStats.glStateCalls, renderStats.skippedGLStateCalls);
+			ImGui::Text("Visible: %u Culled: %u (shadows %u)", renderStats.visibleObjects,
+				renderStats.culledObjects, renderStats.shadowCulledObjects);
+			ImGui::Text("Offscreen: %u passes %.2f ms (deferred %u)", renderStats.offscreenPasses,
+				renderStats.offscreenTime, renderStats.deferredOffscreenPasses);
+			ImGui::Text("Shadow Atlas: %.1f%% used", renderStats.shadowAtlasUsage * 100.0f);
+			ImGui::Text("Light Clusters: %u refs, max %u (%.2f ms)", renderStats.clusterLightIndices,
+				renderStats.maxLightsPerCluster, renderStats.lightBinningTime);
+			ImGui::Text("Shaded Samples: %.2f M (%.2f per pixel)", renderStats.shadedSamples / 1e6f,
+				renderStats.shadedSamplesPerPixel);
+			ImGui::Text("Tessellation: %llu triangles, longest edge %.1f px",
+				(unsigned long long)renderStats.tessellatedTriangles, renderStats.tessellationMaxEdge);
+			ImGui::SliderFloat("Offscreen Budget (ms)", &ApplicationState::GetInstance().offscreenBudgetMs, 0.5f, 33.f);
+			ImGui::SliderFloat("Shadow Distance", &ApplicationState::GetInstance().shadowDistance, 5.f, 500.f);
+			ImGui::SliderFloat("Tessellation Edge (px)", &ApplicationState::GetInstance().tessellationEdgePixels, 1.f, 64.f);
+			const PhysicsStats& physicsStats = ApplicationState::GetInstance().physicsStats;
+			ImGui::Text("Colliders: %u Pairs: %u Contacts: %u", physicsStats.colliders,
+				physicsStats.broadPhasePairs, physicsStats.contacts);
+			ImGui::Text("Steps: %u dt: %.2e s", physicsStats.steps, physicsStats.timeStep);
+			ImGui::Text("Soft Contacts: %u (hash %.2f ms, query %.2f ms)", physicsStats.softBodyContacts,
+				physicsStats.hashBuildTime, physicsStats.hashQueryTime);
+			if (physicsStats.droppedTime > 0.0f)
+				ImGui::Text("Over budget, dropped %.3f s", physicsStats.droppedTime);
 			ImGui::Separator();
 			ImGui::SliderFloat("Simmulation Speed", &ApplicationState::GetInstance().simulationSpeed, 0.f, 100.f);
+			IntegrationScheme& scheme = ApplicationState::GetInstance().integrationScheme;
+			if (ImGui::BeginCombo("Integrator", IntegrationSchemeName(scheme)))
+			{
+				for (int i = 0; i < (int)IntegrationScheme::Count; i++)
+					if (ImGui::Selectable(IntegrationSchemeName((IntegrationScheme)i), (int)scheme == i))
+						scheme = (IntegrationScheme)i;
+				ImGui::EndCombo();
+			}
+			ImGui::Checkbox("Soft Body Collisions", &ApplicationState::GetInstance().softBodyCollisions);
+			ImGui::Checkbox("Batched Soft Body Solve", &ApplicationState::GetInstance().batchedSoftBodySolve);
+			ImGui::Checkbox("Adaptive Time Step", &ApplicationState::GetInstance().adaptiveTimeStep);
+			if (ApplicationState::GetInstance().adaptiveTimeStep)
+			{
+				ImGui::InputFloat("Max Time Step", &ApplicationState::GetInstance().maxTimeStep, 0.001f, 0.01f, "%.4f");
+				ImGui::SliderFloat("Physics Budget (ms)", &ApplicationState::GetInstance().physicsBudgetMs, 1.f, 100.f);
+			}
+			else
+				ImGui::SliderInt("Substeps", &ApplicationState::GetInstance().physicsSubsteps, 1, 50);
 			ImGui::End();
 			
 		}
@@ -294,6 +340,13 @@ namespace gui
 				if (ImGui::BeginMenu("View"))
 				{
 					ImGui::MenuItem("Wireframes", "", &ApplicationState::GetInstance().renderingWireframe);
+					ImGui::MenuItem("Batch Static Meshes", "", &ApplicationState::GetInstance().batchStaticMeshes);
+					ImGui::MenuItem("Frustum Culling", "", &ApplicationState::GetInstance().frustumCulling);
+					ImGui::MenuItem("Single Pass Point Shadows", "", &ApplicationState::GetInstance().layeredPointShadows);
+					ImGui::MenuItem("Clustered Lighting", "", &ApplicationState::GetInstance().clusteredLighting);
+					ImGui::MenuItem("Depth Pre-Pass", "", &ApplicationState::GetInstance().depthPrePass);
+					ImGui::MenuItem("Adaptive Tessellation", "", &ApplicationState::GetInstance().adaptiveTessellation);
+					ImGui::MenuItem("Cull Tessellation Patches", "", &ApplicationState::GetInstance().cullTessellationPatches);
 					ImGui::EndMenu();
 				}
 				ImGui::EndMainMenuBar();
@@ -311,12 +364,17 @@ namespace gui
 						"PhongMaterial", "Image Map", "Light", 
 						"Skybox", "Physics Bounds",
 						"VelocityField2D", "ForceField2D",
-						"RigidBody", "Box Collider", "SoftBody"};
+						"RigidBody", "Box Collider", "SoftBody",
+						"Instanced", "Plane Collider", "Sphere Collider",
+						"Mesh Collider"};
 				if (ImGui::BeginListBox("Add Component", 
 					ImVec2(0, 5 * ImGui::GetTextLineHeightWithSpacing())))
 				{
 					for (int n = 0; n < IM_ARRAYSIZE(components); n++)
 					{
+						//instancing is set up by the scene when it shares a mesh asset
+						if ((CType)n == CType::Instanced)
+							continue;
 						if (!scene->EntityHas(selectedSceneObject, ((CType)n)) && ImGui::Selectable(components[n]))
 						{
 							switch (((CType) n))
@@ -376,6 +434,19 @@ namespace gui
 							case CType::SoftBody:
 								scene->registry.emplace_or_replace<CSoftBody>(selectedSceneObject);//empty
 								break;
+							case CType::PlaneCollider:
+								scene->registry.emplace_or_replace<CPlaneCollider>(selectedSceneObject);
+								break;
+							case CType::SphereCollider:
+							{
+								auto* transform = scene->registry.try_get<CTransform>(selectedSceneObject);
+								scene->registry.emplace_or_replace<CSphereCollider>(selectedSceneObject,
+									transform ? transform->GetPosition() : glm::vec3(0.0f));
+							}
+								break;
+							case CType::MeshCollider:
+								scene->registry.emplace_or_replace<CMeshCollider>(selectedSceneObject);//uses the CTriMesh and CTransform
+								break;
 							case CType::Count:
 								break;
 							default:
@@ -390,6 +461,8 @@ namespace gui
 				{
 					for (int n = 0; n < IM_ARRAYSIZE(components); n++)
 					{
+						if ((CType)n == CType::Instanced)
+							continue;
 						if (scene->EntityHas(selectedSceneObject, ((CType)n)) && ImGui::Selectable(components[n]))
 						{
 							switch (((CType)n))
@@ -427,6 +500,15 @@ namespace gui
 							case CType::SoftBody:
 								scene->registry.erase<CSoftBody>(selectedSceneObject);
 								break;
+							case CType::PlaneCollider:
+								scene->registry.erase<CPlaneCollider>(selectedSceneObject);
+								break;
+							case CType::SphereCollider:
+								scene->registry.erase<CSphereCollider>(selectedSceneObject);
+								break;
+							case CType::MeshCollider:
+								scene->registry.erase<CMeshCollider>(selectedSceneObject);
+								break;
 							case CType::Count:
 								break;
 							default:
@@ -616,7 +698,7 @@ namespace gui
 								bool shadow = l.IsCastingShadows();
 								if(ImGui::ToggleButton("shadow", &shadow))
 									l.SetCastingShadows(shadow);
-								if (shadow && l.GetLightType() != LightType::POINT)
+								if (shadow && l.glID != 0)//the whole shadow atlas
 								{
 									ImVec2 viewportPanelSize = ImGui::GetContentRegionAvail();
 									ImGui::Image((void*)(intptr_t) l.glID,
@@ -916,6 +998,42 @@ namespace gui
 								if (ImGui::DragFloat3("Min", &min[0], 0.01f)) c.SetMin(min);
 								if (ImGui::DragFloat3("Max", &max[0], 0.01f)) c.SetMax(max);
 								ImGui::DragFloat("Elasticity", &c.elasticity, 0.0001f, 0.0f);
+								ImGui::DragFloat("Friction", &c.friction, 0.001f, 0.0f);
+								ImGui::EndTabItem();
+							}
+						});
+				//Draw the soft body obstacle tabs
+				scene->registry.view<CPlaneCollider>()
+					.each([&](auto e, auto& c)
+						{
+							if (e == selectedSceneObject && ImGui::BeginTabItem("Plane Collider"))
+							{
+								if (ImGui::DragFloat3("Normal", &c.normal[0], 0.01f) && glm::length(c.normal) > 0.0f)
+									c.normal = glm::normalize(c.normal);
+								ImGui::DragFloat("Offset", &c.offset, 0.01f);
+								ImGui::DragFloat("Restitution", &c.restitution, 0.001f, 0.0f, 1.0f);
+								ImGui::EndTabItem();
+							}
+						});
+				scene->registry.view<CSphereCollider>()
+					.each([&](auto e, auto& c)
+						{
+							if (e == selectedSceneObject && ImGui::BeginTabItem("Sphere Collider"))
+							{
+								ImGui::DragFloat3("Center", &c.center[0], 0.01f);
+								ImGui::DragFloat("Radius", &c.radius, 0.01f, 0.0f);
+								ImGui::DragFloat("Restitution", &c.restitution, 0.001f, 0.0f, 1.0f);
+								ImGui::EndTabItem();
+							}
+						});
+				scene->registry.view<CMeshCollider>()
+					.each([&](auto e, auto& c)
+						{
+							if (e == selectedSceneObject && ImGui::BeginTabItem("Mesh Collider"))
+							{
+								if (!scene->registry.all_of<CTriMesh, CTransform>(e))
+									ImGui::Text("Needs a TriMesh and a Transform");
+								ImGui::DragFloat("Restitution", &c.restitution, 0.001f, 0.0f, 1.0f);
 								ImGui::EndTabItem();
 							}
 						});
@@ -946,6 +1064,9 @@ namespace gui
 								{
 									s.SetSpringDampings(damping);
 								}
+								ImGui::SliderInt("XPBD Iterations", &s.xpbdIterations, 1, 50);
+								ImGui::SameLine();
+								ImGui::DragFloat("Volume Compliance", &s.volumeCompliance, 0.001f, 0.0f, 10.0f);
 								ImGui::PopItemWidth();
 
 
@@ -956,6 +1077,9 @@ namespace gui
 								ImGui::Text("# Springs:");
 								ImGui::SameLine();
 								ImGui::TextColored(ImColor(0.6f, 0.7f, 0.8f), "%d", s.springs.size());
+								ImGui::Text("# Tetrahedra:");
+								ImGui::SameLine();
+								ImGui::TextColored(ImColor(0.6f, 0.7f, 0.8f), "%d", s.tetrahedra.size());
 								ImGui::EndTabItem();
 							}
 						});
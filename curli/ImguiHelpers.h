@@ -1,6 +1,7 @@
 #pragma once
 #include <imgui.h>
 #include <glad/glad.h>
+#include <GLState.h>
 #include <backends/imgui_impl_glfw.h>
 #include <backends/imgui_impl_opengl3.h>
 
@@ -106,7 +107,8 @@ namespace gui
 	{
 		ImGui::Render();
 		ImGuiIO& io = ImGui::GetIO();
-		glViewport(0, 0, (GLsizei)io.DisplaySize.x, (GLsizei)io.DisplaySize.y);
+		GLState::GetInstance().Viewport(0, 0, (int)io.DisplaySize.x, (int)io.DisplaySize.y);
+		//restores the state it changes so the cache stays valid
 		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 	}
 
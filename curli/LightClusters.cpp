@@ -0,0 +1,161 @@
+#include <LightClusters.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <execution>
+#include <numeric>
+#include <float.h>
+#include <xmmintrin.h>
+
+//calls function(light, cluster) for every cluster of the slice each light overlaps
+template <typename F>
+void LightClusters::ForEachLightTile(int slice, F function) const
+{
+	const float sliceMin = slice == 0 ? near : SliceStart(slice);
+	const float sliceMax = slice == slices - 1 ? FLT_MAX : SliceStart(slice + 1);
+	for (int light = 0; light < (int)sliceRanges.size(); light++)
+	{
+		if (slice < sliceRanges[light].x || slice > sliceRanges[light].y)
+			continue;
+		const float depthMin = glm::max(sliceMin, viewDepth[light] - radius[light]);
+		const float depthMax = glm::min(sliceMax, viewDepth[light] + radius[light]);
+		glm::ivec2 lo, hi;
+		if (!TileRange(light, depthMin, depthMax, lo, hi))
+			continue;
+		for (int y = lo.y; y <= hi.y; y++)
+			for (int x = lo.x; x <= hi.x; x++)
+				function(light, x + tilesX * (y + tilesY * slice));
+	}
+}
+
+void LightClusters::Build(const std::vector<LightVolume>& lights, const glm::mat4& view, const glm::mat4& projection,
+	float near, float far)
+{
+	const auto start = std::chrono::high_resolution_clock::now();
+	this->projection = projection;
+	this->near = glm::max(near, 1e-3f);
+	this->far = glm::max(far, this->near * 1.01f);
+	sliceScale = (float)slices / std::log(this->far / this->near);
+
+	//view space centers, four lights per iteration. A light is x y z radius, four of them transpose
+	//into one register per component
+	const int count = (int)lights.size();
+	static_assert(sizeof(LightVolume) == 4 * sizeof(float), "LightVolume is loaded as one register");
+	viewX.resize(count);
+	viewY.resize(count);
+	viewDepth.resize(count);
+	radius.resize(count);
+	const __m128 row0[4] = { _mm_set1_ps(view[0][0]), _mm_set1_ps(view[1][0]), _mm_set1_ps(view[2][0]), _mm_set1_ps(view[3][0]) };
+	const __m128 row1[4] = { _mm_set1_ps(view[0][1]), _mm_set1_ps(view[1][1]), _mm_set1_ps(view[2][1]), _mm_set1_ps(view[3][1]) };
+	//depth is the negated view space z
+	const __m128 row2[4] = { _mm_set1_ps(-view[0][2]), _mm_set1_ps(-view[1][2]), _mm_set1_ps(-view[2][2]), _mm_set1_ps(-view[3][2]) };
+	const int vectorEnd = count / 4 * 4;
+	for (int i = 0; i < vectorEnd; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(&lights[i].center.x);
+		__m128 y = _mm_loadu_ps(&lights[i + 1].center.x);
+		__m128 z = _mm_loadu_ps(&lights[i + 2].center.x);
+		__m128 r = _mm_loadu_ps(&lights[i + 3].center.x);
+		_MM_TRANSPOSE4_PS(x, y, z, r);
+		auto transform = [&](const __m128* row)
+		{
+			return _mm_add_ps(_mm_add_ps(_mm_mul_ps(row[0], x), _mm_mul_ps(row[1], y)),
+				_mm_add_ps(_mm_mul_ps(row[2], z), row[3]));
+		};
+		_mm_storeu_ps(&viewX[i], transform(row0));
+		_mm_storeu_ps(&viewY[i], transform(row1));
+		_mm_storeu_ps(&viewDepth[i], transform(row2));
+		_mm_storeu_ps(&radius[i], r);
+	}
+	for (int i = vectorEnd; i < count; i++)
+	{
+		const glm::vec4 p = view * glm::vec4(lights[i].center, 1.0f);
+		viewX[i] = p.x;
+		viewY[i] = p.y;
+		viewDepth[i] = -p.z;
+		radius[i] = lights[i].radius;
+	}
+
+	//slices each light reaches, lights behind the near plane are dropped
+	sliceRanges.resize(count);
+	for (int i = 0; i < count; i++)
+	{
+		if (viewDepth[i] + radius[i] < this->near)
+			sliceRanges[i] = glm::ivec2(1, 0);
+		else
+			sliceRanges[i] = glm::ivec2(SliceOf(viewDepth[i] - radius[i]), SliceOf(viewDepth[i] + radius[i]));
+	}
+
+	//count, scan and fill. Every slice is written by a single task so no atomics are needed
+	clusters.assign(clusterCount, glm::uvec2(0));
+	std::vector<int> sliceIds(slices);
+	std::iota(sliceIds.begin(), sliceIds.end(), 0);
+	std::for_each(std::execution::par, sliceIds.begin(), sliceIds.end(), [&](int slice)
+		{
+			ForEachLightTile(slice, [&](int light, int cluster) { clusters[cluster].y++; });
+		});
+
+	unsigned int offset = 0;
+	maxLightsPerCluster = 0;
+	for (glm::uvec2& cluster : clusters)
+	{
+		cluster.x = offset;
+		offset += cluster.y;
+		maxLightsPerCluster = glm::max(maxLightsPerCluster, cluster.y);
+	}
+	lightIndices.resize(offset);
+
+	std::for_each(std::execution::par, sliceIds.begin(), sliceIds.end(), [&](int slice)
+		{
+			std::vector<unsigned int> cursor(tilesX * tilesY);
+			const int first = slice * tilesX * tilesY;
+			for (int c = 0; c < tilesX * tilesY; c++)
+				cursor[c] = clusters[first + c].x;
+			ForEachLightTile(slice, [&](int light, int cluster)
+				{
+					lightIndices[cursor[cluster - first]++] = (uint32_t)light;
+				});
+		});
+
+	buildTime = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+int LightClusters::SliceOf(float depth) const
+{
+	if (depth <= near)
+		return 0;
+	return glm::clamp((int)(std::log(depth / near) * sliceScale), 0, slices - 1);
+}
+
+float LightClusters::SliceStart(int slice) const
+{
+	return near * std::exp((float)slice / sliceScale);
+}
+
+bool LightClusters::TileRange(int light, float depthMin, float depthMax, glm::ivec2& lo, glm::ivec2& hi) const
+{
+	//the projection is linear fractional in x, y and depth, so the sphere's box extremes are at its corners
+	const glm::mat4& p = projection;
+	glm::vec2 ndcMin(FLT_MAX), ndcMax(-FLT_MAX);
+	for (int c = 0; c < 4; c++)
+	{
+		const float depth = c & 1 ? depthMax : depthMin;
+		const float w = p[2][3] * -depth + p[3][3];
+		if (w <= 0.0f)
+			return false;
+		const float x = viewX[light] + (c & 2 ? radius[light] : -radius[light]);
+		const float ndcX0 = (p[0][0] * x + p[2][0] * -depth + p[3][0]) / w;
+		const float y0 = viewY[light] - radius[light];
+		const float y1 = viewY[light] + radius[light];
+		const float ndcY0 = (p[1][1] * y0 + p[2][1] * -depth + p[3][1]) / w;
+		const float ndcY1 = (p[1][1] * y1 + p[2][1] * -depth + p[3][1]) / w;
+		ndcMin = glm::min(ndcMin, glm::vec2(ndcX0, glm::min(ndcY0, ndcY1)));
+		ndcMax = glm::max(ndcMax, glm::vec2(ndcX0, glm::max(ndcY0, ndcY1)));
+	}
+	if (ndcMax.x < -1.0f || ndcMax.y < -1.0f || ndcMin.x > 1.0f || ndcMin.y > 1.0f)
+		return false;
+	const glm::vec2 tiles(tilesX, tilesY);
+	lo = glm::clamp(glm::ivec2(glm::floor((ndcMin * 0.5f + 0.5f) * tiles)), glm::ivec2(0), glm::ivec2(tilesX - 1, tilesY - 1));
+	hi = glm::clamp(glm::ivec2(glm::floor((ndcMax * 0.5f + 0.5f) * tiles)), glm::ivec2(0), glm::ivec2(tilesX - 1, tilesY - 1));
+	return true;
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <stdint.h>
+
+/*
+* World space sphere bounding the volume a light reaches
+*/
+struct LightVolume
+{
+	glm::vec3 center;
+	float radius;
+};
+
+/*
+* Clustered forward light binning. The view frustum is split into a grid of froxels, screen tiles
+* times exponential depth slices, and every light is listed in the clusters its bounding sphere
+* overlaps. The fragment shader looks up its cluster and only iterates those lights.
+* Binning runs on the CPU without GL, the light spheres are moved to view space four at a time with
+* SSE and the depth slices are filled in parallel, each slice by one task
+*/
+class LightClusters
+{
+public:
+	static constexpr int tilesX = 16;
+	static constexpr int tilesY = 9;
+	static constexpr int slices = 24;
+	static constexpr int clusterCount = tilesX * tilesY * slices;
+
+	/*
+	* Bins the lights for a camera. near and far bound the sliced depth range, fragments and lights
+	* outside of it fall into the first or the last slice
+	*/
+	void Build(const std::vector<LightVolume>& lights, const glm::mat4& view, const glm::mat4& projection,
+		float near, float far);
+
+	/*
+	* Offset into GetLightIndices and light count of each cluster, x + tilesX * (y + tilesY * slice)
+	*/
+	const std::vector<glm::uvec2>& GetClusters() const { return clusters; }
+	const std::vector<uint32_t>& GetLightIndices() const { return lightIndices; }
+
+	float GetNear() const { return near; }
+	float GetFar() const { return far; }
+	float GetSliceScale() const { return sliceScale; }//slices per unit of log(depth / near)
+	unsigned int GetMaxLightsPerCluster() const { return maxLightsPerCluster; }
+	float GetBuildTime() const { return buildTime; }//ms
+
+	/*
+	* Depth slice of a positive view depth, same mapping as phong_textured/shader.frag
+	*/
+	int SliceOf(float depth) const;
+
+private:
+	//light spheres in view space as structure of arrays, depth is positive in front of the camera
+	std::vector<float> viewX, viewY, viewDepth, radius;
+	std::vector<glm::ivec2> sliceRanges;//first and last slice of every light, empty if culled
+	std::vector<glm::uvec2> clusters;
+	std::vector<uint32_t> lightIndices;
+	glm::mat4 projection = glm::mat4(1.0f);
+	float near = 0.1f;
+	float far = 1000.0f;
+	float sliceScale = 1.0f;//slices / log(far / near)
+	unsigned int maxLightsPerCluster = 0;
+	float buildTime = 0.0f;
+
+	float SliceStart(int slice) const;
+	/*
+	* Tile rectangle covered by the light inside the depth range, false if it misses the screen
+	*/
+	bool TileRange(int light, float depthMin, float depthMax, glm::ivec2& lo, glm::ivec2& hi) const;
+	template <typename F>
+	void ForEachLightTile(int slice, F function) const;
+};
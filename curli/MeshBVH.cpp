@@ -0,0 +1,408 @@
+#include <MeshBVH.h>
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <numeric>
+#include <tuple>
+#include <unordered_map>
+
+namespace
+{
+	//squared distance from the point to the box, zero inside
+	float distanceSquared(const AABB& box, glm::vec3 point)
+	{
+		const glm::vec3 d = glm::max(glm::max(box.min - point, point - box.max), glm::vec3(0.0f));
+		return glm::dot(d, d);
+	}
+
+	//features of a triangle a closest point can lie on, indexing the pseudonormals
+	enum Feature { vertexA, vertexB, vertexC, edgeAB, edgeBC, edgeCA, faceInterior };
+
+	//closest point on the triangle abc to p (Ericson, Real-Time Collision Detection 5.1.5), writes the feature it lies on
+	glm::vec3 closestPointOnTriangle(glm::vec3 p, glm::vec3 a, glm::vec3 b, glm::vec3 c, int& feature)
+	{
+		const glm::vec3 ab = b - a;
+		const glm::vec3 ac = c - a;
+		const glm::vec3 ap = p - a;
+		const float d1 = glm::dot(ab, ap);
+		const float d2 = glm::dot(ac, ap);
+		feature = vertexA;
+		if (d1 <= 0.0f && d2 <= 0.0f)
+			return a;
+
+		const glm::vec3 bp = p - b;
+		const float d3 = glm::dot(ab, bp);
+		const float d4 = glm::dot(ac, bp);
+		feature = vertexB;
+		if (d3 >= 0.0f && d4 <= d3)
+			return b;
+
+		const float vc = d1 * d4 - d3 * d2;
+		feature = edgeAB;
+		if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+			return a + ab * (d1 / (d1 - d3));
+
+		const glm::vec3 cp = p - c;
+		const float d5 = glm::dot(ab, cp);
+		const float d6 = glm::dot(ac, cp);
+		feature = vertexC;
+		if (d6 >= 0.0f && d5 <= d6)
+			return c;
+
+		const float vb = d5 * d2 - d1 * d6;
+		feature = edgeCA;
+		if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+			return a + ac * (d2 / (d2 - d6));
+
+		const float va = d3 * d6 - d5 * d4;
+		feature = edgeBC;
+		if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+			return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+		feature = faceInterior;
+		const float denominator = 1.0f / (va + vb + vc);
+		return a + ab * (vb * denominator) + ac * (vc * denominator);
+	}
+
+	//angle between two edges leaving the same corner
+	float cornerAngle(glm::vec3 e0, glm::vec3 e1)
+	{
+		const float lengths = glm::length(e0) * glm::length(e1);
+		return lengths > 0.0f ? glm::acos(glm::clamp(glm::dot(e0, e1) / lengths, -1.0f, 1.0f)) : 0.0f;
+	}
+
+	glm::vec3 normalizeOrZero(glm::vec3 v)
+	{
+		const float length = glm::length(v);
+		return length > 0.0f ? v / length : glm::vec3(0.0f);
+	}
+
+	//Moller-Trumbore, returns the distance along the direction or a negative value on a miss
+	float intersectTriangle(glm::vec3 origin, glm::vec3 direction, glm::vec3 v0, glm::vec3 v1, glm::vec3 v2)
+	{
+		const glm::vec3 e1 = v1 - v0;
+		const glm::vec3 e2 = v2 - v0;
+		const glm::vec3 p = glm::cross(direction, e2);
+		const float det = glm::dot(e1, p);
+		if (glm::abs(det) < 1e-12f)
+			return -1.0f;
+		const float invDet = 1.0f / det;
+		const glm::vec3 s = origin - v0;
+		const float u = glm::dot(s, p) * invDet;
+		if (u < 0.0f || u > 1.0f)
+			return -1.0f;
+		const glm::vec3 q = glm::cross(s, e1);
+		const float v = glm::dot(direction, q) * invDet;
+		if (v < 0.0f || u + v > 1.0f)
+			return -1.0f;
+		return glm::dot(e2, q) * invDet;
+	}
+
+	//splits deeper than this fall back to the median so traversal stacks stay small
+	constexpr int maxSAHDepth = 32;
+	constexpr int stackSize = 64;
+}
+
+void MeshBVH::Build(const std::vector<glm::vec3>& vertices, const std::vector<glm::uvec3>& faces)
+{
+	Clear();
+	std::vector<Triangle> source;
+	std::vector<AABB> boxes;
+	source.reserve(faces.size());
+	boxes.reserve(faces.size());
+	for (unsigned int i = 0; i < faces.size(); i++)
+	{
+		const glm::uvec3 face = faces[i];
+		if (face.x >= vertices.size() || face.y >= vertices.size() || face.z >= vertices.size())
+			continue;
+		const Triangle triangle = { vertices[face.x], vertices[face.y], vertices[face.z], i };
+		if (glm::any(glm::isnan(triangle.v0)) || glm::any(glm::isnan(triangle.v1)) || glm::any(glm::isnan(triangle.v2)))
+			continue;
+		AABB box;
+		box.Expand(triangle.v0);
+		box.Expand(triangle.v1);
+		box.Expand(triangle.v2);
+		source.push_back(triangle);
+		boxes.push_back(box);
+	}
+	if (source.empty())
+		return;
+
+	std::vector<int> order(source.size());
+	std::iota(order.begin(), order.end(), 0);
+	nodes.reserve(2 * source.size() / maxLeafSize + 1);
+	nodes.emplace_back();
+	BuildNode(0, 0, (int)order.size(), 0, boxes, order);
+
+	triangles.reserve(order.size());
+	for (int i : order)
+		triangles.push_back(source[i]);
+	BuildPseudonormals(vertices, faces);
+}
+
+void MeshBVH::BuildPseudonormals(const std::vector<glm::vec3>& vertices, const std::vector<glm::uvec3>& faces)
+{
+	//meshes split vertices at texture and normal seams, weld them by position so the normals see all adjacent faces
+	std::vector<unsigned int> weld(vertices.size());
+	std::map<std::tuple<float, float, float>, unsigned int> positions;
+	for (unsigned int i = 0; i < vertices.size(); i++)
+		weld[i] = positions.emplace(std::make_tuple(vertices[i].x, vertices[i].y, vertices[i].z), i).first->second;
+	auto edgeKey = [&](unsigned int a, unsigned int b)
+	{
+		a = weld[a];
+		b = weld[b];
+		return a < b ? (uint64_t)a << 32 | b : (uint64_t)b << 32 | a;
+	};
+
+	//vertex normals weight the faces by their angle at the vertex, edge normals add the two adjacent faces
+	std::vector<glm::vec3> vertexNormals(vertices.size(), glm::vec3(0.0f));
+	std::unordered_map<uint64_t, glm::vec3> edgeNormals;
+	edgeNormals.reserve(triangles.size() * 3 / 2);
+	for (const Triangle& triangle : triangles)
+	{
+		const glm::uvec3 face = faces[triangle.face];
+		const glm::vec3 normal = normalizeOrZero(glm::cross(triangle.v1 - triangle.v0, triangle.v2 - triangle.v0));
+		vertexNormals[weld[face.x]] += normal * cornerAngle(triangle.v1 - triangle.v0, triangle.v2 - triangle.v0);
+		vertexNormals[weld[face.y]] += normal * cornerAngle(triangle.v2 - triangle.v1, triangle.v0 - triangle.v1);
+		vertexNormals[weld[face.z]] += normal * cornerAngle(triangle.v0 - triangle.v2, triangle.v1 - triangle.v2);
+		edgeNormals[edgeKey(face.x, face.y)] += normal;
+		edgeNormals[edgeKey(face.y, face.z)] += normal;
+		edgeNormals[edgeKey(face.z, face.x)] += normal;
+	}
+
+	pseudonormals.reserve(triangles.size());
+	for (const Triangle& triangle : triangles)
+	{
+		const glm::uvec3 face = faces[triangle.face];
+		Pseudonormals normals;
+		normals.feature[vertexA] = normalizeOrZero(vertexNormals[weld[face.x]]);
+		normals.feature[vertexB] = normalizeOrZero(vertexNormals[weld[face.y]]);
+		normals.feature[vertexC] = normalizeOrZero(vertexNormals[weld[face.z]]);
+		normals.feature[edgeAB] = normalizeOrZero(edgeNormals[edgeKey(face.x, face.y)]);
+		normals.feature[edgeBC] = normalizeOrZero(edgeNormals[edgeKey(face.y, face.z)]);
+		normals.feature[edgeCA] = normalizeOrZero(edgeNormals[edgeKey(face.z, face.x)]);
+		normals.feature[faceInterior] = normalizeOrZero(glm::cross(triangle.v1 - triangle.v0, triangle.v2 - triangle.v0));
+		pseudonormals.push_back(normals);
+	}
+}
+
+void MeshBVH::Clear()
+{
+	nodes.clear();
+	triangles.clear();
+	pseudonormals.clear();
+}
+
+void MeshBVH::BuildNode(int index, int start, int count, int depth, const std::vector<AABB>& boxes, std::vector<int>& order)
+{
+	int* items = order.data() + start;
+	AABB box;
+	AABB centroidBounds;
+	for (int i = 0; i < count; i++)
+	{
+		box.Expand(boxes[items[i]]);
+		centroidBounds.Expand(boxes[items[i]].GetCenter());
+	}
+	nodes[index].box = box;
+	if (count <= maxLeafSize)
+	{
+		nodes[index].start = start;
+		nodes[index].count = count;
+		return;
+	}
+
+	const glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+	const int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+	int mid = 0;
+	if (extent[axis] > 0.0f && depth < maxSAHDepth)
+	{
+		//bin the centroids along the widest axis and pick the cheapest split plane
+		AABB binBoxes[binCount];
+		int binCounts[binCount] = { 0 };
+		const float scale = binCount / extent[axis];
+		auto binOf = [&](int item)
+		{
+			const int b = (int)((boxes[item].GetCenter()[axis] - centroidBounds.min[axis]) * scale);
+			return glm::clamp(b, 0, binCount - 1);
+		};
+		for (int i = 0; i < count; i++)
+		{
+			const int b = binOf(items[i]);
+			binBoxes[b].Expand(boxes[items[i]]);
+			binCounts[b]++;
+		}
+
+		float leftArea[binCount - 1];
+		int leftCount[binCount - 1];
+		AABB accumulated;
+		int accumulatedCount = 0;
+		for (int i = 0; i < binCount - 1; i++)
+		{
+			accumulated.Expand(binBoxes[i]);
+			accumulatedCount += binCounts[i];
+			leftArea[i] = accumulated.GetSurfaceArea();
+			leftCount[i] = accumulatedCount;
+		}
+		float bestCost = FLT_MAX;
+		int bestSplit = -1;
+		accumulated = AABB();
+		accumulatedCount = 0;
+		for (int i = binCount - 1; i > 0; i--)
+		{
+			accumulated.Expand(binBoxes[i]);
+			accumulatedCount += binCounts[i];
+			if (leftCount[i - 1] == 0 || accumulatedCount == 0)
+				continue;
+			const float cost = leftArea[i - 1] * leftCount[i - 1] + accumulated.GetSurfaceArea() * accumulatedCount;
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestSplit = i;
+			}
+		}
+		if (bestSplit > 0)
+			mid = (int)(std::partition(items, items + count, [&](int item) { return binOf(item) < bestSplit; }) - items);
+	}
+	if (mid == 0 || mid == count)
+	{
+		mid = count / 2;
+		std::nth_element(items, items + mid, items + count, [&](int a, int b)
+			{ return boxes[a].GetCenter()[axis] < boxes[b].GetCenter()[axis]; });
+	}
+
+	//the left child directly follows its parent
+	const int left = (int)nodes.size();
+	nodes.emplace_back();
+	BuildNode(left, start, mid, depth + 1, boxes, order);
+	const int right = (int)nodes.size();
+	nodes.emplace_back();
+	BuildNode(right, start + mid, count - mid, depth + 1, boxes, order);
+	nodes[index].start = right;
+	nodes[index].count = 0;
+}
+
+int MeshBVH::ClosestTriangle(glm::vec3 point, glm::vec3& closest, int& feature) const
+{
+	if (nodes.empty())
+		return -1;
+	float bestDistance = FLT_MAX;
+	int bestTriangle = -1;
+	int stack[stackSize];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		const int index = stack[--top];
+		const Node& node = nodes[index];
+		if (distanceSquared(node.box, point) >= bestDistance)
+			continue;
+		if (node.IsLeaf())
+		{
+			for (int i = node.start; i < node.start + node.count; i++)
+			{
+				const Triangle& triangle = triangles[i];
+				int candidateFeature;
+				const glm::vec3 candidate = closestPointOnTriangle(point, triangle.v0, triangle.v1, triangle.v2, candidateFeature);
+				const glm::vec3 d = candidate - point;
+				const float distance = glm::dot(d, d);
+				if (distance < bestDistance)
+				{
+					bestDistance = distance;
+					bestTriangle = i;
+					closest = candidate;
+					feature = candidateFeature;
+				}
+			}
+			continue;
+		}
+		//visit the nearer child first so the far one is more likely to be pruned
+		int nearChild = index + 1;
+		int farChild = node.start;
+		float nearDistance = distanceSquared(nodes[nearChild].box, point);
+		float farDistance = distanceSquared(nodes[farChild].box, point);
+		if (farDistance < nearDistance)
+		{
+			std::swap(nearChild, farChild);
+			std::swap(nearDistance, farDistance);
+		}
+		if (farDistance < bestDistance)
+			stack[top++] = farChild;
+		if (nearDistance < bestDistance)
+			stack[top++] = nearChild;
+	}
+	return bestTriangle;
+}
+
+int MeshBVH::ClosestPoint(glm::vec3 point, glm::vec3& closest) const
+{
+	int feature;
+	const int triangle = ClosestTriangle(point, closest, feature);
+	return triangle >= 0 ? (int)triangles[triangle].face : -1;
+}
+
+float MeshBVH::SignedDistance(glm::vec3 point, glm::vec3& closest, glm::vec3& normal) const
+{
+	int feature;
+	const int index = ClosestTriangle(point, closest, feature);
+	if (index < 0)
+		return FLT_MAX;
+	//the pseudonormal of the feature holding the closest point gives the right side even when it is
+	//a vertex or edge shared with faces that point elsewhere (Baerentzen and Aanaes)
+	normal = pseudonormals[index].feature[feature];
+	const float distance = glm::length(point - closest);
+	return glm::dot(point - closest, normal) < 0.0f ? -distance : distance;
+}
+
+int MeshBVH::Raycast(glm::vec3 origin, glm::vec3 direction, float& t, float maxDistance) const
+{
+	if (nodes.empty())
+		return -1;
+	const glm::vec3 invDirection = 1.0f / direction;
+	t = maxDistance;
+	int hitFace = -1;
+	float tEnter;
+	if (!nodes[0].box.IntersectsRay(origin, invDirection, t, tEnter))
+		return -1;
+	//nodes are pushed with their entry distance and skipped once a closer hit is found
+	struct Entry { float tEnter; int index; };
+	Entry stack[stackSize];
+	int top = 0;
+	stack[top++] = { tEnter, 0 };
+	while (top > 0)
+	{
+		const Entry entry = stack[--top];
+		if (entry.tEnter > t)
+			continue;
+		const Node& node = nodes[entry.index];
+		if (node.IsLeaf())
+		{
+			for (int i = node.start; i < node.start + node.count; i++)
+			{
+				const Triangle& triangle = triangles[i];
+				const float hit = intersectTriangle(origin, direction, triangle.v0, triangle.v1, triangle.v2);
+				if (hit > 0.0f && hit < t)
+				{
+					t = hit;
+					hitFace = (int)triangle.face;
+				}
+			}
+			continue;
+		}
+		Entry nearChild = { 0.0f, entry.index + 1 };
+		Entry farChild = { 0.0f, node.start };
+		const bool hitNear = nodes[nearChild.index].box.IntersectsRay(origin, invDirection, t, nearChild.tEnter);
+		const bool hitFar = nodes[farChild.index].box.IntersectsRay(origin, invDirection, t, farChild.tEnter);
+		if (hitNear && hitFar)
+		{
+			if (farChild.tEnter < nearChild.tEnter)
+				std::swap(nearChild, farChild);
+			stack[top++] = farChild;
+			stack[top++] = nearChild;
+		}
+		else if (hitNear)
+			stack[top++] = nearChild;
+		else if (hitFar)
+			stack[top++] = farChild;
+	}
+	return hitFace;
+}
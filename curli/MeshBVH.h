@@ -0,0 +1,74 @@
+#pragma once
+#include <Culling.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+/*
+* Static bounding volume hierarchy over the triangles of a mesh, used for exact closest point and ray
+* queries in model space. Nodes are stored depth first so a left child directly follows its parent,
+* leaves own a range of the triangles which are copied in leaf order for cache friendly traversal
+*/
+class MeshBVH
+{
+public:
+	/*
+	* Builds the tree top down with a binned surface area heuristic. Faces with NaN vertices are skipped
+	*/
+	void Build(const std::vector<glm::vec3>& vertices, const std::vector<glm::uvec3>& faces);
+	void Clear();
+	bool IsEmpty() const { return nodes.empty(); }
+
+	/*
+	* Writes the point on the surface closest to point into closest and returns its face index,
+	* or -1 if the tree is empty
+	*/
+	int ClosestPoint(glm::vec3 point, glm::vec3& closest) const;
+
+	/*
+	* Distance to the surface, negative inside. The side comes from the angle weighted pseudonormal of the
+	* face, edge or vertex the closest point lies on, which is also written to normal. Assumes a closed
+	* mesh with counter clockwise faces and returns FLT_MAX if the tree is empty
+	*/
+	float SignedDistance(glm::vec3 point, glm::vec3& closest, glm::vec3& normal) const;
+
+	/*
+	* Returns the index of the closest face hit by the ray and its distance along the direction in t,
+	* or -1 if nothing is hit within maxDistance
+	*/
+	int Raycast(glm::vec3 origin, glm::vec3 direction, float& t, float maxDistance = FLT_MAX) const;
+
+	const AABB& GetBounds() const { return nodes.front().box; }
+
+private:
+	struct Node
+	{
+		AABB box;
+		int start = 0;//first triangle of a leaf, right child of an internal node
+		int count = 0;//number of triangles, 0 for internal nodes
+		bool IsLeaf() const { return count > 0; }
+	};
+
+	struct Triangle
+	{
+		glm::vec3 v0, v1, v2;
+		unsigned int face;
+	};
+
+	std::vector<Node> nodes;
+	std::vector<Triangle> triangles;
+
+	//normals of the vertices, edges and interior of each triangle, indexed like triangles
+	struct Pseudonormals
+	{
+		glm::vec3 feature[7];
+	};
+	std::vector<Pseudonormals> pseudonormals;
+
+	static constexpr int binCount = 12;
+	static constexpr int maxLeafSize = 4;
+
+	void BuildNode(int index, int start, int count, int depth, const std::vector<AABB>& boxes, std::vector<int>& order);
+	void BuildPseudonormals(const std::vector<glm::vec3>& vertices, const std::vector<glm::uvec3>& faces);
+	//index into triangles of the closest one and the feature the point lies on, -1 if the tree is empty
+	int ClosestTriangle(glm::vec3 point, glm::vec3& closest, int& feature) const;
+};
@@ -0,0 +1,98 @@
+#include <OffscreenScheduler.h>
+#include <algorithm>
+#include <chrono>
+
+void OffscreenScheduler::BeginFrame(const std::vector<AABB>& movedBounds)
+{
+	frame++;
+	moved = movedBounds;
+	requests.clear();
+}
+
+void OffscreenScheduler::Submit(uint64_t key, float weight, const glm::mat4& matrix, int minInterval, int maxInterval,
+	std::function<void()> render)
+{
+	Submit(key, weight, &matrix, 1, minInterval, maxInterval, std::move(render));
+}
+
+void OffscreenScheduler::Submit(uint64_t key, float weight, const glm::mat4* matrices, int matrixCount, int minInterval,
+	int maxInterval, std::function<void()> render)
+{
+	Target& target = targets[key];
+	target.submittedFrame = frame;
+	//the dirty flag sticks until the target is redrawn, so movement seen while it waits is not lost
+	bool changed = !target.rendered || (int)target.matrices.size() != matrixCount;
+	for (int i = 0; i < matrixCount && !changed; i++)
+		changed = target.matrices[i] != matrices[i] || SeesMovement(matrices[i]);
+	if (changed)
+		target.dirty = true;
+	target.matrices.assign(matrices, matrices + matrixCount);
+
+	const long int framesSince = target.rendered ? frame - target.lastFrame : maxInterval;
+	const bool due = (target.dirty && framesSince >= minInterval) || framesSince >= maxInterval;
+	if (!due)
+		return;
+	//never drawn targets first, then dirty ones, older ones win among equals
+	float priority = weight * (float)(framesSince + 1);
+	if (target.dirty)
+		priority *= 4.0f;
+	if (!target.rendered)
+		priority += 1e6f;
+	requests.push_back({ key, priority, std::move(render) });
+}
+
+void OffscreenScheduler::Run(float budgetMs)
+{
+	renderedPasses = 0;
+	deferredPasses = 0;
+	time = 0.0f;
+	std::sort(requests.begin(), requests.end(),
+		[](const Request& a, const Request& b) { return a.priority > b.priority; });
+
+	for (Request& request : requests)
+	{
+		Target& target = targets[request.key];
+		//cheaper passes further down the list may still fit
+		if (renderedPasses > 0 && time + target.cost > budgetMs)
+		{
+			deferredPasses++;
+			continue;
+		}
+		auto start = std::chrono::high_resolution_clock::now();
+		request.render();
+		const float elapsed = std::chrono::duration<float, std::milli>(
+			std::chrono::high_resolution_clock::now() - start).count();
+		target.cost = target.rendered ? glm::mix(target.cost, elapsed, 0.25f) : elapsed;
+		target.lastFrame = frame;
+		target.rendered = true;
+		target.dirty = false;
+		time += elapsed;
+		renderedPasses++;
+	}
+	requests.clear();
+
+	for (auto it = targets.begin(); it != targets.end();)
+	{
+		if (it->second.submittedFrame != frame)
+			it = targets.erase(it);
+		else
+			++it;
+	}
+}
+
+void OffscreenScheduler::Invalidate()
+{
+	for (auto& [key, target] : targets)
+		target.dirty = true;
+}
+
+bool OffscreenScheduler::SeesMovement(const glm::mat4& matrix) const
+{
+	if (moved.empty())
+		return false;
+	const Frustum frustum(matrix);
+	for (const AABB& box : moved)
+		if (frustum.Intersects(box))
+			return true;
+	return false;
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <Culling.h>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+/*
+* Time slices the offscreen passes (shadow maps, cube map faces and rendered textures) over frames.
+* The renderer submits every target each frame with the matrix it would be rendered with, a weight and
+* the range of frames between its updates. A target is dirty when its matrix changed or something moved
+* inside its frustum, dirty targets are redrawn after minInterval frames and clean ones only after
+* maxInterval. Due targets run by priority until the frame's ms budget is spent, so a static scene
+* renders almost nothing offscreen
+*/
+class OffscreenScheduler
+{
+public:
+	enum class TargetKind : uint8_t
+	{
+		ShadowMap,
+		ShadowCubeFace,
+		ShadowCube,//all faces in one layered pass
+		ShadowCascade,
+		EnvMapFace,
+		RenderedTexture
+	};
+
+	static uint64_t MakeKey(uint32_t id, TargetKind kind, int face = 0)
+	{
+		return ((uint64_t)id << 16) | ((uint64_t)kind << 8) | (uint64_t)(face & 0xFF);
+	}
+
+	/*
+	* Starts collecting the targets of a rendered frame. movedBounds are the world boxes that changed
+	* since the last one, see Scene::GetMovedBounds
+	*/
+	void BeginFrame(const std::vector<AABB>& movedBounds);
+
+	/*
+	* Registers a target for this frame, render is only called from Run if it gets scheduled
+	*/
+	void Submit(uint64_t key, float weight, const glm::mat4& matrix, int minInterval, int maxInterval,
+		std::function<void()> render);
+
+	/*
+	* Same for targets rendered with several matrices in one pass, movement inside any of them makes the
+	* target dirty
+	*/
+	void Submit(uint64_t key, float weight, const glm::mat4* matrices, int matrixCount, int minInterval,
+		int maxInterval, std::function<void()> render);
+
+	/*
+	* Runs the due targets by priority within budgetMs, at least one runs when any is due.
+	* Targets that were not submitted this frame are forgotten
+	*/
+	void Run(float budgetMs);
+
+	/*
+	* Redraws every target on its next submission
+	*/
+	void Invalidate();
+
+	/*
+	* Drops the target, used when its texture storage moved and it has to be drawn again right away
+	*/
+	void Forget(uint64_t key) { targets.erase(key); }
+
+	unsigned int GetRenderedPasses() const { return renderedPasses; }
+	unsigned int GetDeferredPasses() const { return deferredPasses; }//due but over the budget
+	float GetTime() const { return time; }//ms spent in the passes of the last Run
+
+private:
+	struct Target
+	{
+		std::vector<glm::mat4> matrices;
+		long int lastFrame = 0;
+		long int submittedFrame = -1;
+		float cost = 0.0f;//moving average of the ms it takes to submit the pass
+		bool rendered = false;
+		bool dirty = true;
+	};
+
+	struct Request
+	{
+		uint64_t key;
+		float priority;
+		std::function<void()> render;
+	};
+
+	std::unordered_map<uint64_t, Target> targets;
+	std::vector<Request> requests;
+	std::vector<AABB> moved;
+	long int frame = 0;
+	unsigned int renderedPasses = 0;
+	unsigned int deferredPasses = 0;
+	float time = 0.0f;
+
+	bool SeesMovement(const glm::mat4& matrix) const;
+};
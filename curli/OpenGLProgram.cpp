@@ -2,7 +2,7 @@
 
 void OpenGLProgram::Use()
 {
-	GL_CALL(glUseProgram(glID));
+	GLState::GetInstance().UseProgram(glID);
 }
 
 bool OpenGLProgram::CreatePipelineFromFiles(const char* filePathVert, const char* filePathFrag,
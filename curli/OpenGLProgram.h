@@ -7,78 +7,12 @@
 #include <string>
 #include <glm/glm.hpp>
 #include <vector>
+#include <algorithm>
 #include <Scene.h>
+#include <GLDebug.h>
+#include <GLState.h>
 #include <windows.h>
 
-//void APIENTRY GLDebugMessageCallback(
-//	GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length,
-//	const GLchar* msg, const void* data)
-//{
-//	std::string _source;
-//	switch (source) {
-//	case GL_DEBUG_SOURCE_API:               _source = "api"; break;
-//	case GL_DEBUG_SOURCE_WINDOW_SYSTEM:     _source = "window"; break;
-//	case GL_DEBUG_SOURCE_SHADER_COMPILER:   _source = "shader"; break;
-//	case GL_DEBUG_SOURCE_THIRD_PARTY:       _source = "3rd party"; break;
-//	case GL_DEBUG_SOURCE_APPLICATION:       _source = "app"; break;
-//	case GL_DEBUG_SOURCE_OTHER:             _source = "UNKNOWN"; break;
-//	default: _source = "UNKNOWN"; break;
-//	}
-//
-//	std::string _type;
-//	switch (type) {
-//	case GL_DEBUG_TYPE_ERROR:               _type = "error"; break;
-//	case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: _type = "deprecated"; break;
-//	case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR:  _type = "undefined"; break;
-//	case GL_DEBUG_TYPE_PORTABILITY:         _type = "portability"; break;
-//	case GL_DEBUG_TYPE_PERFORMANCE:         _type = "performance"; break;
-//	case GL_DEBUG_TYPE_OTHER:               _type = "other"; break;
-//	case GL_DEBUG_TYPE_MARKER:              _type = "marker"; break;
-//	default: _type = "UNKNOWN"; break;
-//	}
-//
-//	std::string _severity;
-//	//console color char for plain printf
-//	
-//	switch (severity) {
-//	case GL_DEBUG_SEVERITY_HIGH:
-//		_severity = "high";
-//		system("color 4");
-//		break;
-//	case GL_DEBUG_SEVERITY_MEDIUM:
-//		_severity = "med";
-//		system("color 6");
-//		break;
-//	case GL_DEBUG_SEVERITY_LOW:
-//		_severity = "low";
-//		system("color 2");
-//		break;
-//	case GL_DEBUG_SEVERITY_NOTIFICATION:
-//		_severity = "notif";
-//		system("color 7");
-//		break;
-//	default:
-//		_severity = "UNKNOWN";
-//		system("color 1");
-//		break;
-//	}
-//
-//	if (severity != GL_DEBUG_SEVERITY_NOTIFICATION) {
-//		printf("GL Error type: %s severity: %s from: %s-\n\t %s", _type.c_str(), _severity.c_str(), _source.c_str(), msg);
-//	}
-//}
-
-//define a macro that takes a function calls it and ctaches opengl errors
-#define GL_CALL(func) \
-do { \
-    func; \
-    GLenum error = glGetError(); \
-    if (error != GL_NO_ERROR) { \
-        const char* errorString = (const char*)glad_glGetString(GL_VERSION); \
-        const char* description = (const char*)glfwGetError(NULL); \
-        printf("OpenGL error 0x%08x (%s) at %s:%d - %s\n", error, errorString, __FILE__, __LINE__, description); \
-    } \
-} while (false)
 
 struct Shader
 {
@@ -168,6 +102,7 @@ struct Shader
 		}
 
 		fileStream.close();
+		gldebug::Label(GL_SHADER, glID, filePath);
 		SetSource(content.c_str(), compile);
 	}
 };
@@ -192,6 +127,7 @@ public:
 	{
 		GL_CALL(glGenBuffers(1, &glID));
 		GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, glID));
+		gldebug::Label(GL_BUFFER, glID, attribName);
 
 		unsigned int t_size = 0;
 		switch (type)
@@ -298,7 +234,7 @@ public:
 	VertexArrayObject()
 	{
 		GL_CALL(glGenVertexArrays(1, &glID));
-		GL_CALL(glBindVertexArray(glID));
+		GLState::GetInstance().BindVertexArray(glID);
 		initialized = true;
 	}
 
@@ -319,7 +255,7 @@ public:
 	*/
 	void Bind()
 	{
-		GL_CALL(glBindVertexArray(glID));
+		GLState::GetInstance().BindVertexArray(glID);
 	}
 
 	/*
@@ -349,6 +285,7 @@ public:
 	void Delete()
 	{
 		GL_CALL(glDeleteVertexArrays(1, &glID));
+		GLState::GetInstance().OnVertexArrayDeleted(glID);
 		for (unsigned int i = 0; i < VBOs.size(); i++)
 		{
 			GL_CALL(glDeleteBuffers(1, &VBOs[i].glID));
@@ -377,20 +314,23 @@ public:
 	}
 
 	/*
-	* Draws the VAO using either glDrawArrays or glDrawArrays with the specified mode
+	* Draws the VAO using either glDrawArrays or glDrawArrays with the specified mode.
+	* bindVAO can be set to false when the caller knows the VAO is already bound
 	*/
-	void Draw(GLenum mode)
+	void Draw(GLenum mode, bool bindVAO = true)
 	{
 		if (!visible)
 			return;
 
-		if (VBOs.size() == 0)
+		//streamed attributes are not in VBOs, indexed VAOs draw without them
+		if (VBOs.size() == 0 && numIndices == 0)
 		{
 			//printf("No VBOs in VAO\n");
 			return;
 		}
 
-		Bind();
+		if (bindVAO)
+			Bind();
 
 		if (numIndices == 0)
 		{
@@ -409,6 +349,26 @@ public:
 		Draw(drawMode);
 	}
 	/*
+	* Draws instanceCount copies of the VAO with the set mode. Ignores the visible flag since
+	* the visibility of instances is decided by whoever fills the per instance data
+	*/
+	void DrawInstanced(GLsizei instanceCount)
+	{
+		if ((VBOs.size() == 0 && numIndices == 0) || instanceCount == 0)
+			return;
+
+		Bind();
+
+		if (numIndices == 0)
+		{
+			GL_CALL(glDrawArraysInstanced(drawMode, 0, VBOs[0].dataSize, instanceCount));
+		}
+		else
+		{
+			GL_CALL(glDrawElementsInstanced(drawMode, numIndices, GL_UNSIGNED_INT, 0, instanceCount));
+		}
+	}
+	/*
 	* Set the render type of the VAO which sets the uniform used in shaders
 	*/
 	/*void SetRenderType(RenderType type) { renderType = type; }
@@ -425,6 +385,583 @@ private:
 	GLenum drawMode = GL_TRIANGLES;
 };
 
+/*
+* Vertex buffer for vec3 attributes rewritten every frame. Its immutable storage holds regionCount copies
+* of the attributes and stays mapped. Each upload writes the region the GPU finished reading, waiting on
+* the fence placed after the draws that read it, and points the attributes of the VAO at that region, so
+* the buffer is never re-specified and the draws in flight are never synchronized with
+*/
+struct StreamingVertexBuffer
+{
+public:
+	static constexpr int regionCount = 3;
+
+	/*
+	* Creates the storage for vertexCount vertices of every attribute, fills the first region with the
+	* initial data and sets the attributes up in the bound VAO
+	*/
+	void Create(const std::vector<std::string>& attribNames, const std::vector<const void*>& data,
+		unsigned int vertexCount, GLuint programID)
+	{
+		this->vertexCount = vertexCount;
+		attribLocations.clear();
+		for (const std::string& name : attribNames)
+		{
+			GLint loc;
+			GL_CALL(loc = glGetAttribLocation(programID, name.c_str()));
+			attribLocations.push_back(loc);
+		}
+		regionSize = attribLocations.size() * vertexCount * sizeof(glm::vec3);
+
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		GL_CALL(glGenBuffers(1, &glID));
+		GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, glID));
+		GL_CALL(glBufferStorage(GL_ARRAY_BUFFER, regionSize * regionCount, nullptr, flags));
+		gldebug::Label(GL_BUFFER, glID, "streamed " + attribNames.front());
+		GL_CALL(mapped = (char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, regionSize * regionCount, flags));
+		if (mapped == nullptr)
+		{
+			printf("Could not map the streaming vertex buffer\n");
+			return;
+		}
+		Write(0, data);
+
+		for (GLint loc : attribLocations)
+			if (loc >= 0)
+				GL_CALL(glEnableVertexAttribArray(loc));
+		region = 0;
+		PointAttributes();
+	}
+
+	/*
+	* Copies the attributes, in the order of their names, to the next free region and points the VAO at it
+	*/
+	void Upload(GLuint vaoID, const std::vector<const void*>& data)
+	{
+		if (mapped == nullptr)
+			return;
+		//the draws issued since the last upload read the current region
+		if (fences[region])
+			GL_CALL(glDeleteSync(fences[region]));
+		GL_CALL(fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+
+		region = (region + 1) % regionCount;
+		if (fences[region])
+		{
+			//only blocks when the GPU is regionCount - 1 uploads behind
+			GLenum status = GL_TIMEOUT_EXPIRED;
+			while (status == GL_TIMEOUT_EXPIRED)
+				GL_CALL(status = glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000));
+			GL_CALL(glDeleteSync(fences[region]));
+			fences[region] = 0;
+		}
+		Write(region, data);
+
+		GLState::GetInstance().BindVertexArray(vaoID);
+		PointAttributes();
+	}
+
+	void Delete()
+	{
+		for (GLsync& fence : fences)
+		{
+			if (fence)
+				GL_CALL(glDeleteSync(fence));
+			fence = 0;
+		}
+		if (glID != 0)
+		{
+			GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, glID));
+			GL_CALL(glUnmapBuffer(GL_ARRAY_BUFFER));
+			GL_CALL(glDeleteBuffers(1, &glID));
+		}
+		glID = 0;
+		mapped = nullptr;
+	}
+
+	GLuint GetGLID() { return glID; }
+
+private:
+	GLuint glID = 0;
+	char* mapped = nullptr;
+	size_t regionSize = 0;
+	unsigned int vertexCount = 0;
+	int region = 0;
+	GLsync fences[regionCount] = {};
+	std::vector<GLint> attribLocations;
+
+	void Write(int r, const std::vector<const void*>& data)
+	{
+		const size_t attribSize = vertexCount * sizeof(glm::vec3);
+		for (size_t a = 0; a < attribLocations.size() && a < data.size(); a++)
+			if (data[a] != nullptr)
+				memcpy(mapped + r * regionSize + a * attribSize, data[a], attribSize);
+	}
+
+	void PointAttributes()
+	{
+		GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, glID));
+		const size_t attribSize = vertexCount * sizeof(glm::vec3);
+		for (size_t a = 0; a < attribLocations.size(); a++)
+			if (attribLocations[a] >= 0)
+				GL_CALL(glVertexAttribPointer(attribLocations[a], 3, GL_FLOAT, GL_FALSE, 0,
+					(void*)(region * regionSize + a * attribSize)));
+	}
+};
+
+/*
+* Shader storage buffer that is re-specified whenever new data is set
+*/
+struct ShaderStorageBuffer
+{
+public:
+	void SetData(const void* data, size_t size, GLenum usage = GL_STREAM_DRAW)
+	{
+		if (glID == 0)
+			GL_CALL(glGenBuffers(1, &glID));
+		GLState::GetInstance().BindBuffer(GL_SHADER_STORAGE_BUFFER, glID);
+		GL_CALL(glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, usage));
+		dataSize = size;
+	}
+
+	void BindBase(GLuint binding)
+	{
+		GLState::GetInstance().BindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, glID);
+	}
+
+	/*
+	* Reads the buffer back, waits for the GPU if it still writes to it. Shader writes have to be made
+	* visible with glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT) first
+	*/
+	void GetData(void* data, size_t size)
+	{
+		GLState::GetInstance().BindBuffer(GL_SHADER_STORAGE_BUFFER, glID);
+		GL_CALL(glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, data));
+	}
+
+	void Delete()
+	{
+		if (glID != 0)
+		{
+			GL_CALL(glDeleteBuffers(1, &glID));
+			GLState::GetInstance().OnBufferDeleted(glID);
+		}
+		glID = 0;
+		dataSize = 0;
+	}
+
+	GLuint GetGLID() { return glID; }
+	size_t GetSize() { return dataSize; }
+
+private:
+	GLuint glID = 0;
+	size_t dataSize = 0;
+};
+
+/*
+* Counter query (GL_SAMPLES_PASSED, GL_PRIMITIVES_GENERATED, ...) read back a few frames late, so
+* reading it never waits for the GPU. Passes whose query slot is still in flight are not measured
+*/
+struct DelayedQuery
+{
+public:
+	DelayedQuery(GLenum target) : target(target) {}
+
+	bool Begin()
+	{
+		if (queries[0] == 0)
+			GL_CALL(glGenQueries(queryCount, queries));
+		if (pending[next] && !Collect(next))
+			return false;
+		GL_CALL(glBeginQuery(target, queries[next]));
+		return true;
+	}
+
+	void End()
+	{
+		GL_CALL(glEndQuery(target));
+		pending[next] = true;
+		next = (next + 1) % queryCount;
+	}
+
+	/*
+	* Count of the most recent pass whose result arrived. Slots are collected oldest first so the
+	* newest available one is written last
+	*/
+	GLuint64 GetLatest()
+	{
+		for (int i = 0; i < queryCount; i++)
+		{
+			const int slot = (next + i) % queryCount;
+			if (pending[slot])
+				Collect(slot);
+		}
+		return latest;
+	}
+
+	void Delete()
+	{
+		if (queries[0] != 0)
+			GL_CALL(glDeleteQueries(queryCount, queries));
+		queries[0] = 0;
+	}
+
+private:
+	static constexpr int queryCount = 4;
+	GLenum target;
+	GLuint queries[queryCount] = { 0 };
+	bool pending[queryCount] = { false };
+	int next = 0;
+	GLuint64 latest = 0;
+
+	bool Collect(int slot)
+	{
+		GLint available = 0;
+		GL_CALL(glGetQueryObjectiv(queries[slot], GL_QUERY_RESULT_AVAILABLE, &available));
+		if (!available)
+			return false;
+		GLuint64 samples = 0;
+		GL_CALL(glGetQueryObjectui64v(queries[slot], GL_QUERY_RESULT, &samples));
+		pending[slot] = false;
+		latest = samples;
+		return true;
+	}
+};
+
+/*
+* Shader storage buffer holding one T that a pass writes and the CPU reads back a few frames late, so
+* reading it never waits for the GPU. Like DelayedQuery, passes whose buffer is still in flight are not measured
+*/
+template <typename T>
+struct DelayedReadback
+{
+public:
+	/*
+	* Resets the next buffer of the ring to initial and binds it, false if it is still in flight
+	*/
+	bool Begin(GLuint binding, const T& initial)
+	{
+		if (pending[next] && !Collect(next))
+			return false;
+		buffers[next].SetData(&initial, sizeof(T));
+		buffers[next].BindBase(binding);
+		return true;
+	}
+
+	void End()
+	{
+		//the shader writes have to be visible to the readback
+		GL_CALL(glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT));
+		GL_CALL(fences[next] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+		pending[next] = true;
+		next = (next + 1) % bufferCount;
+	}
+
+	/*
+	* Value of the most recent pass whose buffer is ready, collected oldest first
+	*/
+	T GetLatest()
+	{
+		for (int i = 0; i < bufferCount; i++)
+		{
+			const int slot = (next + i) % bufferCount;
+			if (pending[slot])
+				Collect(slot);
+		}
+		return latest;
+	}
+
+	void Delete()
+	{
+		for (int i = 0; i < bufferCount; i++)
+		{
+			if (fences[i])
+				GL_CALL(glDeleteSync(fences[i]));
+			fences[i] = 0;
+			pending[i] = false;
+			buffers[i].Delete();
+		}
+	}
+
+private:
+	static constexpr int bufferCount = 4;
+	ShaderStorageBuffer buffers[bufferCount];
+	GLsync fences[bufferCount] = {};
+	bool pending[bufferCount] = { false };
+	int next = 0;
+	T latest = T();
+
+	bool Collect(int slot)
+	{
+		GLenum status;
+		GL_CALL(status = glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 0));
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			return false;
+		GL_CALL(glDeleteSync(fences[slot]));
+		fences[slot] = 0;
+		buffers[slot].GetData(&latest, sizeof(T));
+		pending[slot] = false;
+		return true;
+	}
+};
+
+/*
+* Command layout consumed by glMultiDrawElementsIndirect
+*/
+struct DrawElementsIndirectCommand
+{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+/*
+* Large shared vertex/index buffers that many static meshes are suballocated into
+* so they can all be drawn with a single glMultiDrawElementsIndirect call.
+* Vertex layout is fixed to pos(0) norm(1) texc(2), per draw data is read from
+* a shader storage buffer indexed with gl_DrawID.
+*/
+struct MeshBatch
+{
+public:
+	struct Range
+	{
+		unsigned int first = 0;
+		unsigned int count = 0;
+	};
+	struct Allocation
+	{
+		Range vertices;
+		Range indices;
+		bool used = false;
+	};
+
+	/*
+	* Creates the shared buffers with the given initial capacities
+	*/
+	void Initialize(unsigned int vertexCapacity, unsigned int indexCapacity)
+	{
+		GL_CALL(glGenVertexArrays(1, &vaoID));
+		GL_CALL(glGenBuffers(1, &indirectBufferID));
+		GL_CALL(glGenBuffers(1, &drawDataBufferID));
+		CreateBuffers(vertexCapacity, indexCapacity);
+		vertexFreeList.push_back({ 0, vertexCapacity });
+		indexFreeList.push_back({ 0, indexCapacity });
+		initialized = true;
+	}
+
+	bool IsInitialized() { return initialized; }
+
+	/*
+	* Copies a mesh into the shared buffers and returns its slot, growing the buffers if needed.
+	* norm and texc can be nullptr in which case zeros are uploaded
+	*/
+	int Add(const float* pos, const float* norm, const float* texc, unsigned int numVertices,
+		const unsigned int* indices, unsigned int numIndices)
+	{
+		Allocation alloc;
+		alloc.used = true;
+		while (!AllocateRange(vertexFreeList, numVertices, alloc.vertices))
+			Grow(glm::max(vertexCapacity * 2, vertexCapacity + numVertices), indexCapacity);
+		while (!AllocateRange(indexFreeList, numIndices, alloc.indices))
+			Grow(vertexCapacity, glm::max(indexCapacity * 2, indexCapacity + numIndices));
+
+		std::vector<float> zeros;
+		if (norm == nullptr || texc == nullptr)
+			zeros.resize(numVertices * 3, 0.0f);
+		GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, posBufferID));
+		GL_CALL(glBufferSubData(GL_ARRAY_BUFFER, alloc.vertices.first * 3 * sizeof(float),
+			numVertices * 3 * sizeof(float), pos));
+		GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, normBufferID));
+		GL_CALL(glBufferSubData(GL_ARRAY_BUFFER, alloc.vertices.first * 3 * sizeof(float),
+			numVertices * 3 * sizeof(float), norm ? norm : zeros.data()));
+		GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, texcBufferID));
+		GL_CALL(glBufferSubData(GL_ARRAY_BUFFER, alloc.vertices.first * 2 * sizeof(float),
+			numVertices * 2 * sizeof(float), texc ? texc : zeros.data()));
+		GL_CALL(glBindBuffer(GL_COPY_WRITE_BUFFER, indexBufferID));
+		GL_CALL(glBufferSubData(GL_COPY_WRITE_BUFFER, alloc.indices.first * sizeof(unsigned int),
+			numIndices * sizeof(unsigned int), indices));
+
+		for (int i = 0; i < allocations.size(); i++)
+		{
+			if (!allocations[i].used)
+			{
+				allocations[i] = alloc;
+				return i;
+			}
+		}
+		allocations.push_back(alloc);
+		return allocations.size() - 1;
+	}
+
+	/*
+	* Releases the ranges of a slot so they can be reused by later meshes
+	*/
+	void Remove(int slot)
+	{
+		if (slot < 0 || slot >= allocations.size() || !allocations[slot].used)
+			return;
+		FreeRange(vertexFreeList, allocations[slot].vertices);
+		FreeRange(indexFreeList, allocations[slot].indices);
+		allocations[slot].used = false;
+	}
+
+	/*
+	* Fills an indirect command that draws the mesh in the slot
+	*/
+	DrawElementsIndirectCommand GetCommand(int slot, unsigned int baseInstance = 0)
+	{
+		DrawElementsIndirectCommand cmd;
+		cmd.count = allocations[slot].indices.count;
+		cmd.instanceCount = 1;
+		cmd.firstIndex = allocations[slot].indices.first;
+		cmd.baseVertex = (GLint)allocations[slot].vertices.first;
+		cmd.baseInstance = baseInstance;
+		return cmd;
+	}
+
+	/*
+	* Uploads the commands and per draw data then issues them with one glMultiDrawElementsIndirect.
+	* Per draw data is bound to the shader storage binding point drawDataBinding
+	*/
+	void Draw(const std::vector<DrawElementsIndirectCommand>& commands, const void* drawData,
+		size_t drawDataSize, GLuint drawDataBinding = 0, GLenum mode = GL_TRIANGLES)
+	{
+		if (commands.empty())
+			return;
+		GLState::GetInstance().BindVertexArray(vaoID);
+		GL_CALL(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBufferID));
+		GL_CALL(glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand),
+			commands.data(), GL_STREAM_DRAW));
+		GLState::GetInstance().BindBuffer(GL_SHADER_STORAGE_BUFFER, drawDataBufferID);
+		GL_CALL(glBufferData(GL_SHADER_STORAGE_BUFFER, drawDataSize, drawData, GL_STREAM_DRAW));
+		GLState::GetInstance().BindBufferBase(GL_SHADER_STORAGE_BUFFER, drawDataBinding, drawDataBufferID);
+		GL_CALL(glMultiDrawElementsIndirect(mode, GL_UNSIGNED_INT, nullptr, commands.size(), 0));
+	}
+
+	void Delete()
+	{
+		GL_CALL(glDeleteVertexArrays(1, &vaoID));
+		GLState::GetInstance().OnVertexArrayDeleted(vaoID);
+		GLuint buffers[] = { posBufferID, normBufferID, texcBufferID, indexBufferID,
+			indirectBufferID, drawDataBufferID };
+		GL_CALL(glDeleteBuffers(6, buffers));
+		GLState::GetInstance().OnBufferDeleted(drawDataBufferID);
+		allocations.clear();
+		vertexFreeList.clear();
+		indexFreeList.clear();
+		initialized = false;
+	}
+
+private:
+	bool initialized = false;
+	GLuint vaoID = 0;
+	GLuint posBufferID = 0, normBufferID = 0, texcBufferID = 0, indexBufferID = 0;
+	GLuint indirectBufferID = 0, drawDataBufferID = 0;
+	unsigned int vertexCapacity = 0;
+	unsigned int indexCapacity = 0;
+
+	std::vector<Allocation> allocations;
+	std::vector<Range> vertexFreeList;
+	std::vector<Range> indexFreeList;
+
+	/*
+	* Creates the vertex/index buffers and points the VAO attributes to them
+	*/
+	void CreateBuffers(unsigned int vCapacity, unsigned int iCapacity)
+	{
+		vertexCapacity = vCapacity;
+		indexCapacity = iCapacity;
+		GLState::GetInstance().BindVertexArray(vaoID);
+		GLuint* vbos[] = { &posBufferID, &normBufferID, &texcBufferID };
+		const GLint sizes[] = { 3, 3, 2 };
+		for (GLuint loc = 0; loc < 3; loc++)
+		{
+			GL_CALL(glGenBuffers(1, vbos[loc]));
+			GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, *vbos[loc]));
+			GL_CALL(glBufferData(GL_ARRAY_BUFFER, vCapacity * sizes[loc] * sizeof(float), nullptr, GL_STATIC_DRAW));
+			GL_CALL(glEnableVertexAttribArray(loc));
+			GL_CALL(glVertexAttribPointer(loc, sizes[loc], GL_FLOAT, GL_FALSE, 0, (void*)0));
+		}
+		GL_CALL(glGenBuffers(1, &indexBufferID));
+		GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID));
+		GL_CALL(glBufferData(GL_ELEMENT_ARRAY_BUFFER, iCapacity * sizeof(unsigned int), nullptr, GL_STATIC_DRAW));
+		GLState::GetInstance().BindVertexArray(0);
+	}
+
+	/*
+	* Reallocates the shared buffers with larger capacities and copies the old contents over
+	*/
+	void Grow(unsigned int newVertexCapacity, unsigned int newIndexCapacity)
+	{
+		const GLuint oldBuffers[] = { posBufferID, normBufferID, texcBufferID, indexBufferID };
+		const unsigned int oldVertexCapacity = vertexCapacity;
+		const unsigned int oldIndexCapacity = indexCapacity;
+		CreateBuffers(newVertexCapacity, newIndexCapacity);
+
+		const GLuint newBuffers[] = { posBufferID, normBufferID, texcBufferID, indexBufferID };
+		const GLsizeiptr oldSizes[] = {
+			GLsizeiptr(oldVertexCapacity * 3 * sizeof(float)), GLsizeiptr(oldVertexCapacity * 3 * sizeof(float)),
+			GLsizeiptr(oldVertexCapacity * 2 * sizeof(float)), GLsizeiptr(oldIndexCapacity * sizeof(unsigned int)) };
+		for (int i = 0; i < 4; i++)
+		{
+			GL_CALL(glBindBuffer(GL_COPY_READ_BUFFER, oldBuffers[i]));
+			GL_CALL(glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffers[i]));
+			GL_CALL(glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldSizes[i]));
+		}
+		GL_CALL(glDeleteBuffers(4, oldBuffers));
+
+		if (newVertexCapacity > oldVertexCapacity)
+			FreeRange(vertexFreeList, { oldVertexCapacity, newVertexCapacity - oldVertexCapacity });
+		if (newIndexCapacity > oldIndexCapacity)
+			FreeRange(indexFreeList, { oldIndexCapacity, newIndexCapacity - oldIndexCapacity });
+	}
+
+	/*
+	* First fit allocation from a sorted free list
+	*/
+	static bool AllocateRange(std::vector<Range>& freeList, unsigned int count, Range& out)
+	{
+		for (auto it = freeList.begin(); it != freeList.end(); ++it)
+		{
+			if (it->count >= count)
+			{
+				out = { it->first, count };
+				it->first += count;
+				it->count -= count;
+				if (it->count == 0)
+					freeList.erase(it);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/*
+	* Returns a range to the free list, merging it with its neighbours
+	*/
+	static void FreeRange(std::vector<Range>& freeList, Range range)
+	{
+		if (range.count == 0)
+			return;
+		auto it = std::lower_bound(freeList.begin(), freeList.end(), range,
+			[](const Range& a, const Range& b) { return a.first < b.first; });
+		it = freeList.insert(it, range);
+		if (it + 1 != freeList.end() && it->first + it->count == (it + 1)->first)
+		{
+			it->count += (it + 1)->count;
+			freeList.erase(it + 1);
+		}
+		if (it != freeList.begin() && (it - 1)->first + (it - 1)->count == it->first)
+		{
+			(it - 1)->count += it->count;
+			freeList.erase(it);
+		}
+	}
+};
+
 struct Texture2D
 {
 public:
@@ -435,7 +972,7 @@ public:
 		mipmapLevel(mipmapLevel), wrapS(wrapS), wrapT(wrapT)
 	{
 		GL_CALL(glGenTextures(1, &glID));
-		GL_CALL(glBindTexture(GL_TEXTURE_2D, glID));
+		GLState::GetInstance().BindTexture(GL_TEXTURE_2D, glID);
 
 		GL_CALL(glTexImage2D(
 			GL_TEXTURE_2D,
@@ -478,13 +1015,13 @@ public:
 
 	void SetParami(GLenum param, GLenum value)
 	{
-		GL_CALL(glBindTexture(GL_TEXTURE_2D, glID));
+		GLState::GetInstance().BindTexture(GL_TEXTURE_2D, glID);
 		GL_CALL(glTexParameteri(GL_TEXTURE_2D, param, value));
 	}
 	
 	void SetParamf(GLenum param, GLfloat value)
 	{
-		GL_CALL(glBindTexture(GL_TEXTURE_2D, glID));
+		GLState::GetInstance().BindTexture(GL_TEXTURE_2D, glID);
 		GL_CALL(glTexParameterf(GL_TEXTURE_2D, param, value));
 	}
 	
@@ -493,17 +1030,17 @@ public:
 	void Delete()
 	{
 		GL_CALL(glDeleteTextures(1, &glID));
+		GLState::GetInstance().OnTextureDeleted(glID);
 	}
 
 	void Bind()
 	{
-		GL_CALL(glActiveTexture(textUnit));
-		GL_CALL(glBindTexture(GL_TEXTURE_2D, glID));
+		GLState::GetInstance().BindTexture(textUnit, GL_TEXTURE_2D, glID);
 	}
 
 	void Unbind()
 	{
-		GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
+		GLState::GetInstance().BindTexture(textUnit, GL_TEXTURE_2D, 0);
 	}
 
 	int GetTextureUnitNum()
@@ -536,11 +1073,10 @@ struct RenderedTexture2D
 		texture(nullptr, dims,textUnit, wrapS, wrapT, dataType, format, mipmapLevel)
 	{
 		//Get the renderer state
-		GLint origFB;
-		GL_CALL(glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &origFB));
+		const GLuint origFB = GLState::GetInstance().GetFramebuffer();
 
 		GL_CALL(glGenFramebuffers(1, &frameBufferID));
-		GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, frameBufferID));
+		GLState::GetInstance().BindFramebuffer(frameBufferID);
 
 		if (hasDepthBuffer)
 		{
@@ -548,7 +1084,6 @@ struct RenderedTexture2D
 			GL_CALL(glBindRenderbuffer(GL_RENDERBUFFER, depthBufferID));
 			GL_CALL(glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, dims.x, dims.y));
 		}
-		GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, frameBufferID)); //For safety
 		GL_CALL(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, 
 			GL_RENDERBUFFER, depthBufferID));
 		GL_CALL(glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture.GetGLID(), 0));
@@ -558,7 +1093,7 @@ struct RenderedTexture2D
 
 		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
 			std::cout << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!" << std::endl;
-		GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, origFB));
+		GLState::GetInstance().BindFramebuffer(origFB);
 	}
 
 	RenderedTexture2D(const RenderedTexture2D& other)
@@ -572,22 +1107,21 @@ struct RenderedTexture2D
 	void Render(std::function <void()> renderFunc)
 	{
 		//Get the renderer state
-		GLint origFB;
-		GL_CALL(glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &origFB));
-		GLint origViewport[4];
-		GL_CALL(glGetIntegerv(GL_VIEWPORT, origViewport));
+		GLState& state = GLState::GetInstance();
+		const GLuint origFB = state.GetFramebuffer();
+		const glm::ivec4 origViewport = state.GetViewport();
 		
 		//Render the scene
-		GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, frameBufferID));
-		GL_CALL(glViewport(0, 0, dims.x, dims.y));
+		state.BindFramebuffer(frameBufferID);
+		state.Viewport(0, 0, dims.x, dims.y);
 		auto mask = GL_COLOR_BUFFER_BIT | (hasDepth ? GL_DEPTH_BUFFER_BIT : 0);
 		GL_CALL(glClear(mask));
 		renderFunc();//Tell how the scene is going to be rendered
 		
 		//Restore the renderer
 		GL_CALL(glGenerateTextureMipmap(texture.GetGLID()));
-		GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, origFB));
-		GL_CALL(glViewport(origViewport[0], origViewport[1], origViewport[2], origViewport[3]));
+		state.BindFramebuffer(origFB);
+		state.Viewport(origViewport);
 		GL_CALL(glClear(mask));
 	}
 
@@ -600,6 +1134,7 @@ struct RenderedTexture2D
 	{
 		texture.Delete();
 		GL_CALL(glDeleteFramebuffers(1, &frameBufferID));
+		GLState::GetInstance().OnFramebufferDeleted(frameBufferID);
 		if (hasDepth)
 			GL_CALL(glDeleteRenderbuffers(1, &depthBufferID));
 	}
@@ -611,99 +1146,104 @@ struct RenderedTexture2D
 	bool hasDepth;
 };
 
-struct ShadowTexture
+/*
+* One depth texture holding the shadow maps of every light in tiles handed out by AtlasPacker.
+* All shadow passes render into the same framebuffer, each one restricted to its tiles
+*/
+struct ShadowAtlasTexture
 {
-	ShadowTexture(glm::uvec2 dims, GLenum texUnit = GL_TEXTURE10)
-		:dims(dims), texUnit(texUnit)
+	ShadowAtlasTexture(unsigned int size, GLenum texUnit = GL_TEXTURE10)
+		:size(size), texUnit(texUnit)
 	{
-		//configure depth texture
 		GL_CALL(glGenTextures(1, &glID));
-		GL_CALL(glBindTexture(GL_TEXTURE_2D, glID));
-		
-		GL_CALL(glTexImage2D(GL_TEXTURE_2D, 
-			0, GL_DEPTH_COMPONENT24,
-			dims.x, dims.y,
-			0, GL_DEPTH_COMPONENT,
-			GL_FLOAT, 0));
+		GLState::GetInstance().BindTexture(GL_TEXTURE_2D, glID);
+		gldebug::Label(GL_TEXTURE, glID, "shadow atlas");
 
+		GL_CALL(glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT24, size, size));
 		GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
 		GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
 		GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE));
 		GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL));
 		GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
 		GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
-		
-		//save the renderer state
-		GLint origFB;
-		GL_CALL(glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &origFB));
 
-		//configure framebuffer
+		const GLuint origFB = GLState::GetInstance().GetFramebuffer();
 		GL_CALL(glGenFramebuffers(1, &frameBufferID));
-		GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, frameBufferID));
-		GL_CALL(glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, glID, 0););//different
-		
+		GLState::GetInstance().BindFramebuffer(frameBufferID);
+		GL_CALL(glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, glID, 0));
 		GL_CALL(glDrawBuffer(GL_NONE));
 		GL_CALL(glReadBuffer(GL_NONE));
-
 		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
 			std::cout << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!" << std::endl;
-		//preserve render state
-		GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, origFB));
+		gldebug::Label(GL_FRAMEBUFFER, frameBufferID, "shadow atlas");
+		GLState::GetInstance().BindFramebuffer(origFB);
 	}
-	
-	~ShadowTexture()
-	{}
-	
-	void Render(std::function <void()> renderFunc)
+
+	/*
+	* Clears the tile and renders into it, rect is x, y, width, height in texels
+	*/
+	void Render(glm::ivec4 rect, std::function <void()> renderFunc)
 	{
-		//Get the renderer state
-		GLint origFB;
-		GL_CALL(glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &origFB));
-		GLint origViewport[4];
-		GL_CALL(glGetIntegerv(GL_VIEWPORT, origViewport));
+		RenderViews(&rect, 1, renderFunc);
+	}
 
-		//Render the scene
-		GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, frameBufferID));
-		GL_CALL(glViewport(0, 0, dims.x, dims.y));
-		auto mask = GL_DEPTH_BUFFER_BIT;
-		GL_CALL(glClear(mask));
-		//glEnable(GL_CULL_FACE);
-		GL_CALL(glCullFace(GL_FRONT));
-		renderFunc();//Tell how the scene is going to be rendered
-		GL_CALL(glCullFace(GL_BACK));
-		GL_CALL(glDisable(GL_CULL_FACE));
+	/*
+	* Clears the tiles and renders them in one pass with one viewport per tile, renderFunc has to
+	* route the primitives to their tile with gl_ViewportIndex
+	*/
+	void RenderViews(const glm::ivec4* rects, int count, std::function <void()> renderFunc)
+	{
+		GLState& state = GLState::GetInstance();
+		const GLuint origFB = state.GetFramebuffer();
+		const glm::ivec4 origViewport = state.GetViewport();
 
-		//Restore the renderer
-		GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, origFB));
-		GL_CALL(glViewport(origViewport[0], origViewport[1], origViewport[2], origViewport[3]));
-		GL_CALL(glClear(mask));
+		state.BindFramebuffer(frameBufferID);
+		//scissors keep the clears and any guard band rasterization inside the tiles
+		GL_CALL(glEnable(GL_SCISSOR_TEST));
+		for (int i = 0; i < count; i++)
+		{
+			GL_CALL(glScissor(rects[i].x, rects[i].y, rects[i].z, rects[i].w));
+			GL_CALL(glClear(GL_DEPTH_BUFFER_BIT));
+		}
+		//viewport 0 goes through the state cache, the restore below resets the others with it
+		state.Viewport(rects[0]);
+		for (int i = 0; i < count; i++)
+		{
+			GL_CALL(glScissorIndexed(i, rects[i].x, rects[i].y, rects[i].z, rects[i].w));
+			if (i > 0)
+				GL_CALL(glViewportIndexedf(i, (float)rects[i].x, (float)rects[i].y, (float)rects[i].z, (float)rects[i].w));
+		}
+		renderFunc();
+		GL_CALL(glDisable(GL_SCISSOR_TEST));
+
+		state.BindFramebuffer(origFB);
+		state.Viewport(origViewport);
+		if (count > 1)
+			GL_CALL(glViewport(origViewport.x, origViewport.y, origViewport.z, origViewport.w));
 	}
 
 	void Bind()
 	{
-		GL_CALL(glActiveTexture(texUnit));
-		GL_CALL(glBindTexture(GL_TEXTURE_2D, glID));
+		GLState::GetInstance().BindTexture(texUnit, GL_TEXTURE_2D, glID);
 	}
 
 	void Delete()
 	{
 		GL_CALL(glDeleteFramebuffers(1, &frameBufferID));
-		GL_CALL(glDeleteRenderbuffers(1, &depthBufferID));
+		GLState::GetInstance().OnFramebufferDeleted(frameBufferID);
+		GL_CALL(glDeleteTextures(1, &glID));
+		GLState::GetInstance().OnTextureDeleted(glID);
 	}
 
-	GLuint GetGLID()
-	{
-		return glID;
-	}
+	GLuint GetGLID() { return glID; }
+	unsigned int GetSize() { return size; }
+	int GetTextureUnit() { return texUnit - GL_TEXTURE0; }
 
 private:
 	GLuint frameBufferID;
-	GLuint depthBufferID;
 	GLuint glID;
-	glm::uvec2 dims;
-	
-	GLuint texUnit;
-	
+	unsigned int size;
+	GLenum texUnit;
 };
 
 struct CubeMappedTexture
@@ -718,7 +1258,7 @@ struct CubeMappedTexture
 	{
 		GL_CALL(glGenTextures(1, &glID));
 		
-		GL_CALL(glBindTexture(GL_TEXTURE_CUBE_MAP, glID));
+		GLState::GetInstance().BindTexture(GL_TEXTURE_CUBE_MAP, glID);
 
 		size_t typeSize = 0;
 		
@@ -788,17 +1328,15 @@ struct CubeMappedTexture
 			wrapT, dataType, format, mipmapLevel)
 	{
 		//Get the renderer state
-		GLint origFB;
-		GL_CALL(glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &origFB));
+		const GLuint origFB = GLState::GetInstance().GetFramebuffer();
 
 		GL_CALL(glGenFramebuffers(1, &frameBufferID));
-		GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, frameBufferID));
+		GLState::GetInstance().BindFramebuffer(frameBufferID);
 
 		GL_CALL(glGenRenderbuffers(1, &depthBufferID));
 		GL_CALL(glBindRenderbuffer(GL_RENDERBUFFER, depthBufferID));
 		GL_CALL(glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, dims.x, dims.y));
 		
-		GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, frameBufferID)); //For safety
 		GL_CALL(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
 			GL_RENDERBUFFER, depthBufferID));
 		GL_CALL(glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, glID , 0));
@@ -808,7 +1346,7 @@ struct CubeMappedTexture
 
 		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
 			std::cout << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!" << std::endl;
-		GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, origFB));
+		GLState::GetInstance().BindFramebuffer(origFB);
 	}
 
 	CubeMappedTexture(const CubeMappedTexture& other)
@@ -824,14 +1362,13 @@ struct CubeMappedTexture
 	void RenderSide(int i, std::function <void()> renderFunc, bool lastFace = false)
 	{
 		//Get the renderer state
-		GLint origFB;
-		GL_CALL(glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &origFB));
-		GLint origViewport[4];
-		GL_CALL(glGetIntegerv(GL_VIEWPORT, origViewport));
+		GLState& state = GLState::GetInstance();
+		const GLuint origFB = state.GetFramebuffer();
+		const glm::ivec4 origViewport = state.GetViewport();
 
 		//Render the scene
-		GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, frameBufferID));
-		GL_CALL(glViewport(0, 0, dims.x, dims.y));
+		state.BindFramebuffer(frameBufferID);
+		state.Viewport(0, 0, dims.x, dims.y);
 		auto mask = GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT;
 		GL_CALL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
 			GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, glID, 0));
@@ -841,8 +1378,8 @@ struct CubeMappedTexture
 
 		//Restore the renderer
 		GL_CALL(glGenerateTextureMipmap(glID));
-		GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, origFB));
-		GL_CALL(glViewport(origViewport[0], origViewport[1], origViewport[2], origViewport[3]));
+		state.BindFramebuffer(origFB);
+		state.Viewport(origViewport);
 		if (lastFace)
 			GL_CALL(glClear(mask));
 	}
@@ -855,19 +1392,18 @@ struct CubeMappedTexture
 
 	void Bind()
 	{
-		GL_CALL(glActiveTexture(textUnit));
-		GL_CALL(glBindTexture(GL_TEXTURE_CUBE_MAP, glID));
+		GLState::GetInstance().BindTexture(textUnit, GL_TEXTURE_CUBE_MAP, glID);
 	}
 
 	void Unbind()
 	{
-		GL_CALL(glActiveTexture(textUnit));
-		GL_CALL(glBindTexture(GL_TEXTURE_CUBE_MAP, 0));
+		GLState::GetInstance().BindTexture(textUnit, GL_TEXTURE_CUBE_MAP, 0);
 	}
 
 	void Delete()
 	{
 		GL_CALL(glDeleteTextures(1, &glID));
+		GLState::GetInstance().OnTextureDeleted(glID);
 	}
 
 	GLuint GetGLID()
@@ -898,209 +1434,19 @@ private:
 	GLuint depthBufferID = 0;
 };
 
-struct ShadowCubeTexture
-{
-public:
-	ShadowCubeTexture(glm::uvec2 dims, GLenum textUnit = GL_TEXTURE10)
-		:dims(dims), textUnit(textUnit)
-	{
-		GL_CALL(glGenTextures(1, &glID));
-		GL_CALL(glBindTexture(GL_TEXTURE_CUBE_MAP, glID));
-
-		GL_CALL(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
-		GL_CALL(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
-		GL_CALL(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE));
-		GL_CALL(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL));
-		GL_CALL(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
-		GL_CALL(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
-		GL_CALL(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE));
-		
-		GLint origFB;
-		GL_CALL(glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &origFB));
-		
-		GL_CALL(glGenFramebuffers(1, &frameBufferID));
-		GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, frameBufferID));
-
-		GL_CALL(glDrawBuffer(GL_NONE));
-		GL_CALL(glReadBuffer(GL_NONE));
-
-		for (unsigned int i = 0; i < 6; ++i)
-		{
-			GL_CALL(glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_DEPTH_COMPONENT24,
-				dims.x, dims.y, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL));
-			
-			GL_CALL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
-				GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, glID, 0));
-		}
-
-
-		//Get the renderer state
-		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-			std::cout << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!" << std::endl;
-		}
-		//Rebind the scene FB
-		GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, origFB));
-	}
-	
-	//Copy constructor
-	ShadowCubeTexture(const ShadowCubeTexture& other)
-	{
-		glID = other.glID;
-		dims = other.dims;
-		textUnit = other.textUnit;
-		frameBufferID = other.frameBufferID;
-		depthBufferID = other.depthBufferID;
-	}
-	~ShadowCubeTexture()
-	{}
-
-	void RenderSide(int i, std::function <void()> renderFunc, bool lastFace = false)
-	{
-		//Get the renderer state
-		GLint origFB;
-		GL_CALL(glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &origFB));
-		GLint origViewport[4];
-		GL_CALL(glGetIntegerv(GL_VIEWPORT, origViewport));
-
-		//Render the scene
-		GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, frameBufferID));
-		GL_CALL(glViewport(0, 0, dims.x, dims.y));
-		auto mask = GL_DEPTH_BUFFER_BIT;
-		
-		GL_CALL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, 
-			GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, glID, 0));
-		/*if (!lastFace)*/
-			//GL_CALL(glClear(mask));
-		renderFunc();//Tell how the scene is going to be rendered
-
-		//Restore the renderer
-		//GL_CALL(glGenerateTextureMipmap(glID));
-		if (lastFace)
-			GL_CALL(glClear(mask));
-		GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, origFB));
-		GL_CALL(glViewport(origViewport[0], origViewport[1], origViewport[2], origViewport[3]));
-	}
-
-	void RenderAll(std::function <void()> renderFunc)
-	{
-		for (int i = 0; i < 6; i++)
-			RenderSide(i, renderFunc);
-	}
-
-	void Bind()
-	{
-		GL_CALL(glActiveTexture(textUnit));
-		GL_CALL(glBindTexture(GL_TEXTURE_CUBE_MAP, glID));
-	}
-
-	void Unbind()
-	{
-		GL_CALL(glActiveTexture(textUnit));
-		GL_CALL(glBindTexture(GL_TEXTURE_CUBE_MAP, 0));
-	}
-
-	void Delete()
-	{
-		GL_CALL(glDeleteTextures(1, &glID));
-	}
-
-	GLuint GetGLID()
-	{
-		return glID;
-	}
-
-	glm::uvec2 GetDims()
-	{
-		return dims;
-	}
-	
-	
-		
-private:
-	GLuint glID;
-	glm::uvec2 dims;
-	
-	GLenum dataType = GL_UNSIGNED_BYTE;
-
-	GLenum textUnit;
-
-	GLuint frameBufferID = 0;
-	GLuint depthBufferID = 0;
-};
-
 class OpenGLProgram
 {
 public:
 	std::vector<VertexArrayObject> vaos;
 	std::vector<Texture2D> textures;
 	std::vector<RenderedTexture2D> renderedTextures;
-	std::vector<ShadowTexture> shadowTextures;
 	std::vector<CubeMappedTexture> cubeMaps;
-	std::vector<ShadowCubeTexture> shadowCubeMaps;
 	
 	OpenGLProgram()
 	{
 		GL_CALL(glID = glCreateProgram());
 		GL_CALL(glEnable(GL_DEPTH_TEST));
 		GL_CALL(glClearColor(clearColor.x, clearColor.y, clearColor.z, clearColor.w));
-
-		glDebugMessageCallback(//create empty lambda here
-			[](GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* userParam)
-			{
-				std::string _source;
-				switch (source) {
-				case GL_DEBUG_SOURCE_API:               _source = "api"; break;
-				case GL_DEBUG_SOURCE_WINDOW_SYSTEM:     _source = "window"; break;
-				case GL_DEBUG_SOURCE_SHADER_COMPILER:   _source = "shader"; break;
-				case GL_DEBUG_SOURCE_THIRD_PARTY:       _source = "3rd party"; break;
-				case GL_DEBUG_SOURCE_APPLICATION:       _source = "app"; break;
-				case GL_DEBUG_SOURCE_OTHER:             _source = "UNKNOWN"; break;
-				default: _source = "UNKNOWN"; break;
-				}
-
-				std::string _type;
-				switch (type) {
-				case GL_DEBUG_TYPE_ERROR:               _type = "error"; break;
-				case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: _type = "deprecated"; break;
-				case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR:  _type = "undefined"; break;
-				case GL_DEBUG_TYPE_PORTABILITY:         _type = "portability"; break;
-				case GL_DEBUG_TYPE_PERFORMANCE:         _type = "performance"; break;
-				case GL_DEBUG_TYPE_OTHER:               _type = "other"; break;
-				case GL_DEBUG_TYPE_MARKER:              _type = "marker"; break;
-				default: _type = "UNKNOWN"; break;
-				}
-
-				std::string _severity;
-				//console color char for plain printf
-
-				switch (severity) {
-				case GL_DEBUG_SEVERITY_HIGH:
-					_severity = "high";
-					//system("color 4");
-					break;
-				case GL_DEBUG_SEVERITY_MEDIUM:
-					_severity = "med";
-					//system("color 6");
-					break;
-				case GL_DEBUG_SEVERITY_LOW:
-					_severity = "low";
-					//system("color 2");
-					break;
-				case GL_DEBUG_SEVERITY_NOTIFICATION:
-					_severity = "notif";
-					//system("color 7");
-					break;
-				default:
-					_severity = "UNKNOWN";
-					//system("color 1");
-					break;
-				}
-
-				if (severity != GL_DEBUG_SEVERITY_NOTIFICATION) {
-					printf("GL Error type: %s severity: %s from: %s-\n\t %s", _type.c_str(), _severity.c_str(), _source.c_str(), message);
-				}
-				//system("color 7");
-			}, 0);
 		
 		vertexShader = new Shader(GL_VERTEX_SHADER);
 		fragmentShader = new Shader(GL_FRAGMENT_SHADER);
@@ -1108,6 +1454,7 @@ public:
 	~OpenGLProgram()
 	{
 		GL_CALL(glDeleteProgram(glID));
+		GLState::GetInstance().OnProgramDeleted(glID);
 		delete vertexShader;
 		delete fragmentShader;
 		if (geometryShader)
@@ -0,0 +1,20 @@
+#pragma once
+#include <algorithm>
+#include <execution>
+#include <numeric>
+#include <vector>
+
+/*
+* Runs function(begin, end) over blocks of [0, count) in parallel. Blocks are blockSize long except
+* the last one, so a multiple of 4 keeps the SIMD loops of all but the last block free of a remainder
+*/
+template <typename F>
+void forEachBlock(int count, int blockSize, F function)
+{
+	std::vector<int> blocks((count + blockSize - 1) / blockSize);
+	std::iota(blocks.begin(), blocks.end(), 0);
+	std::for_each(std::execution::par, blocks.begin(), blocks.end(), [&](int block)
+		{
+			function(block * blockSize, std::min(count, (block + 1) * blockSize));
+		});
+}
@@ -3,6 +3,8 @@
 #include <GLFWHandler.h>
 #include <glm/gtx/component_wise.hpp>
 #include <ApplicationState.h>
+#include <RigidBodyBatch.h>
+#include <SoftBodyCollisions.h>
 #include <future>
 
 template <typename T>
@@ -18,16 +20,28 @@ public:
 	void Update()
 	{
 			float deltaTime = (GLFWHandler::GetInstance().GetTime() - t) * ApplicationState::GetInstance().simulationSpeed;
-			float tStepSize = deltaTime / static_cast<float>(stepCount);
-			for (float step = 0; step < deltaTime; step += tStepSize) {
-				static_cast<T*>(this)->Synchronize();
-				static_cast<T*>(this)->Integrate(tStepSize);
+			//the stats cover the frame, the substeps add their contacts to them
+			ApplicationState::GetInstance().physicsStats = PhysicsStats();
+			if (ApplicationState::GetInstance().adaptiveTimeStep)
+				StepAdaptive(deltaTime);
+			else
+			{
+				PhysicsStats& stats = ApplicationState::GetInstance().physicsStats;
+				float tStepSize = deltaTime / static_cast<float>(glm::max(1, ApplicationState::GetInstance().physicsSubsteps));
+				stats.steps = 0;
+				stats.timeStep = tStepSize;
+				stats.droppedTime = 0.0f;
+				for (float step = 0; step < deltaTime; step += tStepSize) {
+					static_cast<T*>(this)->Synchronize();
+					static_cast<T*>(this)->Integrate(tStepSize);
+					stats.steps++;
+				}
 			}
 
 		static int i = 0;
 		
 		scene->registry.view<CSoftBody>()
-			.each([&](const auto entity, CSoftBody sb)
+			.each([&](const auto entity, CSoftBody& sb)
 				{
 					//Create event 
 					Event event;
@@ -49,26 +63,59 @@ public:
 	*/
 	void Synchronize() 
 	{
+		//bodies and colliders that did not move are skipped
 		scene->registry.view<CRigidBody, CTransform>()
 		.each([&](CRigidBody& rigidBody, CTransform& transform)
 		{
-			transform.SetPosition(rigidBody.position);
-			transform.SetEulerRotation(rigidBody.GetOrientationMatrix());
+			rigidBody.SynchronizeTransform(transform);
 			//transform.Update();
 		});
 		
-		scene->registry.view<CBoxCollider, CTransform, CTriMesh>()
-		.each([&](CBoxCollider& collider, CTransform& transform, CTriMesh& mesh)
+		scene->registry.view<CBoxCollider, CTransform>()
+		.each([&](CBoxCollider& collider, CTransform& transform)
 		{
-			collider.SetBounds(transform.GetModelMatrix() * glm::vec4(mesh.GetBoundingBoxMin(), 1.0f),
-			transform.GetModelMatrix() * glm::vec4(mesh.GetBoundingBoxMax(), 1.0f));
+			collider.SetTransform(transform);
 		});
 	};
+
+	/*
+	* Synchronizes only the transform and collider of the entity
+	*/
+	void SynchronizeBody(entt::entity entity)
+	{
+		auto* transform = scene->registry.try_get<CTransform>(entity);
+		if (!transform)
+			return;
+		if (auto* rigidBody = scene->registry.try_get<CRigidBody>(entity))
+			rigidBody->SynchronizeTransform(*transform);
+		if (auto* collider = scene->registry.try_get<CBoxCollider>(entity))
+			collider->SetTransform(*transform);
+	}
 	
 	/*
 	* Integrates the scene forward in time by dt
 	*/
 	virtual void Integrate(float dt) = 0;
+
+	/*
+	* Scheme used for the soft bodies, decides the stable time step of the adaptive stepping
+	*/
+	IntegrationScheme GetScheme() const { return IntegrationScheme::ForwardEuler; }
+
+	/*
+	* Largest time step the soft bodies of the scene can take with the scheme of the integrator
+	*/
+	float EstimateTimeStep()
+	{
+		const float limit = StabilityLimit(static_cast<T*>(this)->GetScheme()) * stabilitySafety;
+		float dt = FLT_MAX;
+		scene->registry.view<CSoftBody>()
+		.each([&](CSoftBody& sb)
+		{
+			dt = glm::min(dt, sb.EstimateTimeStep(limit, courantNumber));
+		});
+		return dt;
+	}
 	
 	/*
 	* Called by DispatchEvent when mouse buttons are used
@@ -96,6 +143,9 @@ public:
 	void OnMouseMove(double x, double y) {
 		bool updateMousePos = true;
 		glm::vec2 deltaPos(prevMousePos.x - x, prevMousePos.y - y);
+		//hovering with shift held picks the object under the cursor so it can be dragged
+		if (shiftDown && !m1Down && !m2Down)
+			PickObjectAt(x, y);
 		entt::entity curEntity = ApplicationState::GetInstance().selectedObject;
 		
 		auto* rb = scene->registry.try_get<CRigidBody>(curEntity);
@@ -155,6 +205,258 @@ public:
 	};
 	
 protected:
+	/*
+	* Casts a ray from the camera through the cursor against the scene BVH and selects the closest object hit
+	*/
+	void PickObjectAt(double x, double y)
+	{
+		int width, height;
+		glfwGetWindowSize(GLFWHandler::GetInstance().GetWindowPointer(), &width, &height);
+		if (width <= 0 || height <= 0)
+			return;
+		const glm::vec2 ndc(2.0f * (float)x / width - 1.0f, 1.0f - 2.0f * (float)y / height);
+		const glm::mat4 invViewProjection =
+			glm::inverse(scene->camera.GetProjectionMatrix() * scene->camera.GetViewMatrix());
+		const glm::vec4 nearPoint = invViewProjection * glm::vec4(ndc, -1.0f, 1.0f);
+		const glm::vec4 farPoint = invViewProjection * glm::vec4(ndc, 1.0f, 1.0f);
+		const glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+		const glm::vec3 direction = glm::normalize(glm::vec3(farPoint) / farPoint.w - origin);
+
+		float distance;
+		entt::entity hit = scene->Raycast(origin, direction, distance);
+		if (hit != entt::null)
+			ApplicationState::GetInstance().selectedObject = hit;
+	}
+
+	/*
+	* Collides the box colliders with each other. Candidate pairs come from a tree over fattened boxes,
+	* touching pairs get OBB contact manifolds that are resolved with sequential impulses.
+	* Colliders without a rigid body, or with zero mass, are static
+	*/
+	void ResolveBodyCollisions()
+	{
+		PhysicsStats& stats = ApplicationState::GetInstance().physicsStats;
+		stats.colliders = 0;
+		stats.broadPhasePairs = 0;
+		UpdateBroadPhase();
+
+		solverBodies.clear();
+		solverBodyIndices.clear();
+		constraints.clear();
+		scene->registry.view<CBoxCollider>()
+		.each([&](auto entity, CBoxCollider& collider)
+		{
+			stats.colliders++;
+			const bool isDynamic = IsDynamic(entity);
+			//leaves are fat so the tight box finds every pair that may touch
+			broadPhase.Query(collider.GetOBB().GetBounds(), [&](entt::entity other)
+			{
+				if (other <= entity || (!isDynamic && !IsDynamic(other)))
+					return;
+				stats.broadPhasePairs++;
+				const CBoxCollider& otherCollider = scene->registry.get<CBoxCollider>(other);
+				ContactManifold manifold;
+				if (!collider.CollidingWith(otherCollider, manifold))
+					return;
+				AddContactConstraints(SolverBodyOf(entity), SolverBodyOf(other), manifold,
+					glm::min(collider.elasticity, otherCollider.elasticity),
+					glm::sqrt(collider.friction * otherCollider.friction));
+				stats.contacts += manifold.pointCount;
+			});
+		});
+
+		for (int i = 0; i < solverIterations; i++)
+			for (auto& constraint : constraints)
+				SolveContactConstraint(constraint);
+
+		//push the bodies apart along the normal, split by their inverse masses
+		for (const auto& constraint : constraints)
+		{
+			SolverBody& a = solverBodies[constraint.a];
+			SolverBody& b = solverBodies[constraint.b];
+			const float invMassSum = a.invMass + b.invMass;
+			const float depth = constraint.penetration - penetrationSlop;
+			if (invMassSum <= 0.0f || depth <= 0.0f)
+				continue;
+			const glm::vec3 correction = constraint.normal *
+				(depth * positionCorrection * constraint.weight / invMassSum);
+			if (a.rigidBody)
+				a.rigidBody->position -= correction * a.invMass;
+			if (b.rigidBody)
+				b.rigidBody->position += correction * b.invMass;
+		}
+	}
+
+	/*
+	* Steps the bodies with the scheme, then resolves the world bounds and body-body collisions
+	*/
+	void IntegrateWith(IntegrationScheme scheme, float dt)
+	{
+		const bool hasVelocityFields = scene->registry.view<CVelocityField2D>().size() > 0;
+		const bool hasForceFields = scene->registry.view<CForceField2D>().size() > 0;
+		batch.Clear();
+		scene->registry.view<CRigidBody>()
+		.each([&](auto entity, CRigidBody& rb)
+		{
+			glm::vec3 vFromField = hasVelocityFields ? AccumilateVelocityFields(rb.position) : glm::vec3(0.0f);
+			if (glm::length(vFromField) > 0.0f)
+			{
+				//rb.velocity = vFromField;
+				rb.position += vFromField * dt;
+				return;
+			}
+			if (hasForceFields && rb.mass > 0.0000001f)
+				rb.ApplyLinearImpulse(AccumilateForceFields(rb.position) * dt);
+			switch (scheme)
+			{
+			case IntegrationScheme::ForwardEuler: batch.Add(entity, rb); break;//stepped together below
+			case IntegrationScheme::SymplecticEuler:
+			case IntegrationScheme::XPBD: rb.TakeSymplecticEulerStep(dt); break;
+			case IntegrationScheme::VelocityVerlet: rb.TakeVelocityVerletStep(dt); break;
+			case IntegrationScheme::RK4: rb.TakeRK4Step(dt); break;
+			}
+		});
+		//free flight of every forward Euler body at once, only the bodies that moved are synchronized
+		batch.Integrate(dt);
+		batch.Scatter(scene->registry);
+
+		Synchronize();
+		ResolveBoundsCollisions();
+		//body-body collisions are resolved after every body has moved
+		Synchronize();
+		ResolveBodyCollisions();
+
+		softBodies.clear();
+		softBodyPointers.clear();
+		scene->registry.view<CSoftBody>()
+		.each([&](auto entity, CSoftBody& sb)
+		{
+			softBodies.emplace_back(entity, &sb);
+			softBodyPointers.push_back(&sb);
+		});
+		//stiff springs need the implicit step, optionally solved for all bodies at once
+		const bool batchedSolve = scheme == IntegrationScheme::ForwardEuler && softBodies.size() > 1 &&
+			ApplicationState::GetInstance().batchedSoftBodySolve;
+		if (batchedSolve)
+			CSoftBody::TakeBwEulerStep(softBodyPointers, dt);
+		else
+		{
+			//one task per body, the bodies share no state while stepping
+			std::for_each(std::execution::par, softBodyPointers.begin(), softBodyPointers.end(), [&](CSoftBody* sb)
+			{
+				switch (scheme)
+				{
+				case IntegrationScheme::ForwardEuler: sb->TakeBwEulerStep(dt); break;
+				case IntegrationScheme::SymplecticEuler: sb->TakeSymplecticEulerStep(dt); break;
+				case IntegrationScheme::VelocityVerlet: sb->TakeVelocityVerletStep(dt); break;
+				case IntegrationScheme::RK4: sb->TakeRK4Step(dt); break;
+				case IntegrationScheme::XPBD: sb->TakeXPBDStep(dt); break;
+				default: break;
+				}
+			});
+		}
+		//the collision passes are parallel over the nodes and read the registry, so the bodies go one by one
+		for (auto& [entity, sb] : softBodies)
+			ResolveSoftBodyCollisions(entity, *sb);
+		if (ApplicationState::GetInstance().softBodyCollisions)
+		{
+			PhysicsStats& stats = ApplicationState::GetInstance().physicsStats;
+			stats.softBodyContacts += softBodyCollisions.Resolve(scene->registry);
+			stats.hashBuildTime += softBodyCollisions.GetBuildTime();
+			stats.hashQueryTime += softBodyCollisions.GetQueryTime();
+		}
+	}
+
+	/*
+	* Bounces the rigid bodies with box colliders off the world bounds
+	*/
+	void ResolveBoundsCollisions()
+	{
+		entt::entity boundsEntity = scene->registry.view<CPhysicsBounds>().front();
+		auto* bounds = boundsEntity != entt::null ? scene->registry.try_get<CPhysicsBounds>(boundsEntity) : nullptr;
+		if (!bounds)
+			return;
+		scene->registry.view<CRigidBody, CBoxCollider>()
+		.each([bounds, this](auto entity, CRigidBody& rb, CBoxCollider& boxCollider)
+		{
+			glm::vec3 collisionNormal(0.0f);
+			glm::vec3 collisionVert(0.0f);
+			float penetration = 0;
+			if ( bounds->IsCollidingWith(boxCollider, collisionNormal, collisionVert, penetration) ) //Resolve the collision
+			{
+				//Check if object has sufficient momentum to bounce of the object
+				if (glm::abs(glm::dot(collisionNormal, rb.linearMomentum)) < 0.001f )
+				{
+					//if not the object is residing the boundary dont test for collision
+					rb.linearMomentum -= collisionNormal * rb.linearMomentum;
+					//rb.angularMomentum = glm::vec3(0);
+					//return;
+				}
+
+				//For more accurate collisions find the closest point on the surface of the model
+				const glm::mat4 modelMat = scene->registry.get<CTransform>(entity).GetModelMatrix();
+				const glm::vec3 modelSpaceCollisionVert = 
+					glm::inverse(modelMat) * glm::vec4(collisionVert,1.f);
+				const glm::vec3 accurateCollisionVert = modelMat * glm::vec4(scene->registry.get<CTriMesh>(entity).
+					ClosestPointTo(modelSpaceCollisionVert), 1.0f);
+
+				const glm::vec3 r = accurateCollisionVert - rb.position;
+				float impulseMag = bounds->MagImpulseCollistionFrom(
+					boxCollider.elasticity, rb.mass,
+					rb.GetInertiaTensor(), rb.GetVelocity(),
+					collisionNormal, r);
+				
+				rb.ApplyLinearImpulse(collisionNormal * impulseMag);
+				const auto angImp = impulseMag * glm::cross(r, collisionNormal) *1.f;
+				rb.ApplyAngularImpulse(angImp);
+				int colCounter = 0;
+				do
+				{
+					rb.position -= penetration * collisionNormal;//Apply perturbation until no longer colliding
+					rb.linearMomentum -= penetration * collisionNormal;
+					this->SynchronizeBody(entity);
+					if (colCounter++ > 5)
+						break;
+					
+				} while (bounds->IsCollidingWith(boxCollider, collisionNormal, collisionVert, penetration));
+			}
+		});
+	}
+
+	/*
+	* Keeps the soft body nodes inside the world bounds and outside the static plane, sphere and mesh colliders
+	*/
+	void ResolveSoftBodyCollisions(entt::entity entity, CSoftBody& sb)
+	{
+		const int nodeCount = (int)sb.nodePositions.size() / 3;
+		if (nodeCount == 0 || sb.nodeVelocities.size() != sb.nodePositions.size())
+			return;
+		float* positions = sb.nodePositions.data();
+		float* velocities = sb.nodeVelocities.data();
+
+		entt::entity boundsEntity = scene->registry.view<CPhysicsBounds>().front();
+		auto* bounds = boundsEntity != entt::null ? scene->registry.try_get<CPhysicsBounds>(boundsEntity) : nullptr;
+		if (bounds)
+			CollideNodesWithBox(positions, velocities, nodeCount, bounds->GetMin(), bounds->GetMax(), 1.0f);
+		scene->registry.view<CPlaneCollider>()
+		.each([&](CPlaneCollider& plane)
+		{
+			CollideNodesWithPlane(positions, velocities, nodeCount, plane.normal, plane.offset, plane.restitution);
+		});
+		scene->registry.view<CSphereCollider>()
+		.each([&](CSphereCollider& sphere)
+		{
+			CollideNodesWithSphere(positions, velocities, nodeCount, sphere.center, sphere.radius, sphere.restitution);
+		});
+		scene->registry.view<CMeshCollider, CTriMesh, CTransform>()
+		.each([&](auto other, CMeshCollider& collider, CTriMesh& mesh, CTransform& transform)
+		{
+			if (other != entity)
+				CollideNodesWithMesh(positions, velocities, nodeCount, mesh.GetBVH(), transform.GetModelMatrix(),
+					collider.restitution);
+		});
+	}
+
 	glm::vec3& AccumilateVelocityFields(glm::vec3 pos)
 	{
 		glm::vec3 vFromField = glm::vec3(0.0f);
@@ -177,7 +479,6 @@ protected:
 	}
 	
 	std::shared_ptr<Scene> scene;
-	int stepCount = 10;
 	float t = 0.0f;
 	
 	bool m1Down = false;
@@ -186,6 +487,250 @@ protected:
 
 	bool shiftDown = false;
 	int randomNode;
+
+private:
+	//fraction of the stability limit and of the shortest spring used by the adaptive steps
+	static constexpr float stabilitySafety = 0.5f;
+	static constexpr float courantNumber = 0.5f;
+
+	//largest stable omega * dt of the explicit soft body steps, 0 for the implicit ones
+	static float StabilityLimit(IntegrationScheme scheme)
+	{
+		switch (scheme)
+		{
+		case IntegrationScheme::SymplecticEuler:
+		case IntegrationScheme::VelocityVerlet: return 2.0f;
+		case IntegrationScheme::RK4: return 2.78f;
+		default: return 0.0f;
+		}
+	}
+
+	/*
+	* Covers deltaTime with steps as large as the soft bodies allow, within the limits of the
+	* ApplicationState. Simulation time left when the compute budget runs out is dropped so a slow
+	* frame does not make the next one slower
+	*/
+	void StepAdaptive(float deltaTime)
+	{
+		ApplicationState& state = ApplicationState::GetInstance();
+		PhysicsStats& stats = state.physicsStats;
+		const float minStep = glm::max(state.minTimeStep, 1e-6f);
+		const float maxStep = glm::max(state.maxTimeStep, minStep);
+		const double deadline = GLFWHandler::GetInstance().GetTime() + state.physicsBudgetMs * 0.001;
+		stats.steps = 0;
+		stats.timeStep = maxStep;
+		float remaining = deltaTime;
+		while (remaining > 0.0f)
+		{
+			const float dt = glm::clamp(static_cast<T*>(this)->EstimateTimeStep(), minStep, maxStep);
+			stats.timeStep = glm::min(stats.timeStep, dt);
+			static_cast<T*>(this)->Synchronize();
+			static_cast<T*>(this)->Integrate(glm::min(dt, remaining));
+			remaining -= dt;
+			stats.steps++;
+			if (GLFWHandler::GetInstance().GetTime() > deadline)
+				break;
+		}
+		stats.droppedTime = glm::max(remaining, 0.0f);
+	}
+
+	struct BroadPhaseProxy
+	{
+		int leaf = -1;
+		unsigned int frame = 0;
+	};
+
+	struct SolverBody
+	{
+		CRigidBody* rigidBody = nullptr;//null for static colliders
+		float invMass = 0.0f;
+		glm::mat3 invInertia = glm::mat3(0.0f);
+	};
+
+	//one contact point of a manifold
+	struct ContactConstraint
+	{
+		int a, b;
+		glm::vec3 normal;//from a to b
+		glm::vec3 tangents[2];
+		glm::vec3 rA, rB;//contact point relative to the body positions
+		float normalMass;
+		float tangentMass[2];
+		float targetVelocity;//separating velocity from restitution
+		float friction;
+		float penetration;
+		float weight;//1 / number of points in the manifold
+		float normalImpulse = 0.0f;
+		float tangentImpulses[2] = { 0.0f, 0.0f };
+	};
+
+	RigidBodyBatch batch;
+	SoftBodyCollisions softBodyCollisions;
+	std::vector<std::pair<entt::entity, CSoftBody*>> softBodies;
+	std::vector<CSoftBody*> softBodyPointers;
+
+	DynamicAABBTree<entt::entity> broadPhase;
+	std::unordered_map<entt::entity, BroadPhaseProxy> broadPhaseProxies;
+	unsigned int broadPhaseFrame = 0;
+	int stepsSinceRebuild = 0;
+
+	std::vector<SolverBody> solverBodies;
+	std::unordered_map<entt::entity, int> solverBodyIndices;
+	std::vector<ContactConstraint> constraints;
+
+	static constexpr float broadPhaseMargin = 0.1f;
+	static constexpr int broadPhaseRebuildInterval = 30;
+	static constexpr float broadPhaseRebuildThreshold = 1.5f;
+	static constexpr int solverIterations = 4;
+	static constexpr float restitutionThreshold = 0.5f;
+	static constexpr float penetrationSlop = 0.005f;
+	static constexpr float positionCorrection = 0.8f;
+
+	bool IsDynamic(entt::entity entity)
+	{
+		auto* rigidBody = scene->registry.try_get<CRigidBody>(entity);
+		return rigidBody && rigidBody->mass > 0.0000001f;
+	}
+
+	/*
+	* Moves the broad phase leaves whose collider left its fat box and drops the removed colliders
+	*/
+	void UpdateBroadPhase()
+	{
+		broadPhaseFrame++;
+		scene->registry.view<CBoxCollider>()
+		.each([&](auto entity, CBoxCollider& collider)
+		{
+			const AABB box = collider.GetOBB().GetBounds();
+			const AABB fatBox(box.min - glm::vec3(broadPhaseMargin), box.max + glm::vec3(broadPhaseMargin));
+			BroadPhaseProxy& proxy = broadPhaseProxies[entity];
+			proxy.frame = broadPhaseFrame;
+			if (proxy.leaf < 0)
+				proxy.leaf = broadPhase.Insert(fatBox, entity);
+			else if (!broadPhase.GetBox(proxy.leaf).Contains(box))
+				broadPhase.Update(proxy.leaf, fatBox);
+		});
+
+		for (auto it = broadPhaseProxies.begin(); it != broadPhaseProxies.end();)
+		{
+			if (it->second.frame == broadPhaseFrame)
+			{
+				++it;
+				continue;
+			}
+			broadPhase.Remove(it->second.leaf);
+			it = broadPhaseProxies.erase(it);
+		}
+
+		if (++stepsSinceRebuild >= broadPhaseRebuildInterval)
+		{
+			stepsSinceRebuild = 0;
+			if (broadPhase.GetCost() > broadPhaseRebuildThreshold * broadPhase.GetRebuildCost())
+				broadPhase.Rebuild();
+		}
+	}
+
+	int SolverBodyOf(entt::entity entity)
+	{
+		auto it = solverBodyIndices.find(entity);
+		if (it != solverBodyIndices.end())
+			return it->second;
+		SolverBody body;
+		if (IsDynamic(entity))
+		{
+			body.rigidBody = &scene->registry.get<CRigidBody>(entity);
+			body.invMass = 1.0f / body.rigidBody->mass;
+			body.invInertia = body.rigidBody->GetInverseInertiaTensor();
+		}
+		solverBodies.push_back(body);
+		solverBodyIndices[entity] = (int)solverBodies.size() - 1;
+		return (int)solverBodies.size() - 1;
+	}
+
+	glm::vec3 VelocityAt(const SolverBody& body, glm::vec3 r)
+	{
+		if (!body.rigidBody)
+			return glm::vec3(0.0f);
+		return body.rigidBody->linearMomentum * body.invMass +
+			glm::cross(body.invInertia * body.rigidBody->angularMomentum, r);
+	}
+
+	void ApplyImpulseAt(SolverBody& body, glm::vec3 r, glm::vec3 impulse)
+	{
+		if (!body.rigidBody)
+			return;
+		body.rigidBody->ApplyLinearImpulse(impulse);
+		body.rigidBody->ApplyAngularImpulse(glm::cross(r, impulse));
+	}
+
+	//1 / (effective mass of the two bodies along the direction at the contact)
+	float EffectiveMass(const SolverBody& a, const SolverBody& b, glm::vec3 rA, glm::vec3 rB, glm::vec3 direction)
+	{
+		const float k = a.invMass + b.invMass + glm::dot(direction,
+			glm::cross(a.invInertia * glm::cross(rA, direction), rA) +
+			glm::cross(b.invInertia * glm::cross(rB, direction), rB));
+		return k > 0.0f ? 1.0f / k : 0.0f;
+	}
+
+	void AddContactConstraints(int a, int b, const ContactManifold& manifold, float restitution, float friction)
+	{
+		const SolverBody& bodyA = solverBodies[a];
+		const SolverBody& bodyB = solverBodies[b];
+		const glm::vec3 n = manifold.normal;
+		ContactConstraint constraint;
+		constraint.a = a;
+		constraint.b = b;
+		constraint.normal = n;
+		constraint.tangents[0] = glm::abs(n.x) > 0.57735f ?
+			glm::normalize(glm::vec3(n.y, -n.x, 0.0f)) : glm::normalize(glm::vec3(0.0f, n.z, -n.y));
+		constraint.tangents[1] = glm::cross(n, constraint.tangents[0]);
+		constraint.friction = friction;
+		constraint.weight = 1.0f / manifold.pointCount;
+		for (int i = 0; i < manifold.pointCount; i++)
+		{
+			const glm::vec3 p = manifold.points[i].position;
+			constraint.rA = bodyA.rigidBody ? p - bodyA.rigidBody->position : glm::vec3(0.0f);
+			constraint.rB = bodyB.rigidBody ? p - bodyB.rigidBody->position : glm::vec3(0.0f);
+			constraint.normalMass = EffectiveMass(bodyA, bodyB, constraint.rA, constraint.rB, n);
+			for (int k = 0; k < 2; k++)
+				constraint.tangentMass[k] = EffectiveMass(bodyA, bodyB, constraint.rA, constraint.rB, constraint.tangents[k]);
+			//only bounce when approaching fast enough, resting contacts would jitter otherwise
+			const float approach = glm::dot(VelocityAt(bodyB, constraint.rB) - VelocityAt(bodyA, constraint.rA), n);
+			constraint.targetVelocity = approach < -restitutionThreshold ? -restitution * approach : 0.0f;
+			constraint.penetration = manifold.points[i].penetration;
+			constraints.push_back(constraint);
+		}
+	}
+
+	/*
+	* One sequential impulse iteration. Accumulated impulses are clamped so the normal impulse
+	* never pulls and friction stays inside the Coulomb cone
+	*/
+	void SolveContactConstraint(ContactConstraint& c)
+	{
+		SolverBody& a = solverBodies[c.a];
+		SolverBody& b = solverBodies[c.b];
+
+		glm::vec3 relativeVelocity = VelocityAt(b, c.rB) - VelocityAt(a, c.rA);
+		const float maxFriction = c.friction * c.normalImpulse;
+		for (int k = 0; k < 2; k++)
+		{
+			const float lambda = -c.tangentMass[k] * glm::dot(relativeVelocity, c.tangents[k]);
+			const float accumulated = glm::clamp(c.tangentImpulses[k] + lambda, -maxFriction, maxFriction);
+			const glm::vec3 impulse = c.tangents[k] * (accumulated - c.tangentImpulses[k]);
+			c.tangentImpulses[k] = accumulated;
+			ApplyImpulseAt(a, c.rA, -impulse);
+			ApplyImpulseAt(b, c.rB, impulse);
+		}
+
+		relativeVelocity = VelocityAt(b, c.rB) - VelocityAt(a, c.rA);
+		const float lambda = c.normalMass * (c.targetVelocity - glm::dot(relativeVelocity, c.normal));
+		const float accumulated = glm::max(c.normalImpulse + lambda, 0.0f);
+		const glm::vec3 impulse = c.normal * (accumulated - c.normalImpulse);
+		c.normalImpulse = accumulated;
+		ApplyImpulseAt(a, c.rA, -impulse);
+		ApplyImpulseAt(b, c.rB, impulse);
+	}
 };
 
 class EmptyIntegrator : public PhysicsIntegrator<EmptyIntegrator>
@@ -206,133 +751,81 @@ public:
 
 	void Integrate(float dt) override
 	{
-		scene->registry.view<CRigidBody>()
-		.each([dt, this](auto entity, CRigidBody& rb)
-		{
-			glm::vec3 vFromField = AccumilateVelocityFields(rb.position);
-			if (glm::length(vFromField) > 0.0f)
-			{
-				//rb.velocity = vFromField;
-				rb.position += vFromField * dt;
-			}
-			else 
-			{
+		IntegrateWith(IntegrationScheme::ForwardEuler, dt);
+	}
+};
 
-				glm::vec3 fFromField = AccumilateForceFields(rb.position);
-				if (rb.mass > 0.0000001f)
-					rb.ApplyLinearImpulse(fFromField * dt);
+class SymplecticEulerIntegrator : public PhysicsIntegrator<SymplecticEulerIntegrator>
+{
+public:
+	SymplecticEulerIntegrator(std::shared_ptr<Scene> scene) : PhysicsIntegrator(scene) {}
+	~SymplecticEulerIntegrator() {}
 
-				rb.TakeFwEulerStep(dt);
+	void Integrate(float dt) override
+	{
+		IntegrateWith(IntegrationScheme::SymplecticEuler, dt);
+	}
 
-				//check for collisions with world boundary
-				auto* boxCollider = scene->registry.try_get<CBoxCollider>(entity);
-				if (boxCollider)
-				{
-					entt::entity e = scene->registry.view<CPhysicsBounds>().front();
-					//check if null entity
-					if (e != entt::null)
-					{
-						auto* bounds = scene->registry.try_get<CPhysicsBounds>(e);
-						if (bounds)
-						{	
-							glm::vec3 collisionNormal(0.0f);
-							glm::vec3 collisionVert(0.0f);
-							float penetration = 0;
-							if ( bounds->IsCollidingWith(*boxCollider, collisionNormal, collisionVert, penetration) ) //Resolve the collision
-							{
-								//Check if object has sufficient momentum to bounce of the object
-								if (glm::abs(glm::dot(collisionNormal, rb.linearMomentum)) < 0.001f )
-								{
-									//if not the object is residing the boundary dont test for collision
-									rb.linearMomentum -= collisionNormal * rb.linearMomentum;
-									//rb.angularMomentum = glm::vec3(0);
-									//return;
-								}
-
-								//For more accurate collisions find the closest vertex on model
-								const glm::mat4 modelMat = scene->registry.get<CTransform>(entity).GetModelMatrix();
-								const glm::vec3 modelSpaceCollisionVert = 
-									glm::inverse(modelMat) * glm::vec4(collisionVert,1.f);
-								const glm::vec3 accurateCollisionVert = modelMat * glm::vec4(scene->registry.get<CTriMesh>(entity).
-									ApproximateTheClosestPointTo(modelSpaceCollisionVert, max(1, scene->registry.get<CTriMesh>(entity).GetNumVertices()/10)), 1.0f);
-
-								const glm::vec3 r = collisionVert - rb.position;
-								float impulseMag = bounds->MagImpulseCollistionFrom(
-									boxCollider->elasticity, rb.mass,
-									rb.GetInertiaTensor(), rb.GetVelocity(),
-									collisionNormal, r);
-								
-								rb.ApplyLinearImpulse(collisionNormal * impulseMag);
-								const auto angImp = impulseMag * glm::cross(r, collisionNormal) *1.f;
-								rb.ApplyAngularImpulse(angImp);
-								int colCounter = 0;
-								do
-								{
-									rb.position -= penetration * collisionNormal;//Apply perturbation until no longer colliding
-									rb.linearMomentum -= penetration * collisionNormal;
-									this->Synchronize();
-									if (colCounter++ > 5)
-										break;
-									
-								} while (bounds->IsCollidingWith(*boxCollider, collisionNormal, collisionVert, penetration));
-							}
-						}
-					}	
-				}				
-			}
-		});
+	IntegrationScheme GetScheme() const { return IntegrationScheme::SymplecticEuler; }
+};
 
-		scene->registry.view<CSoftBody>()
-		.each([dt, this](auto entity, CSoftBody& sb)
-		{
-			sb.TakeBwEulerStep(dt);
-			//test collision
-			entt::entity e = scene->registry.view<CPhysicsBounds>().front();
-			//check if null entity
-			if (e != entt::null)
-			{
-				auto* bounds = scene->registry.try_get<CPhysicsBounds>(e);
-				if (bounds)
-				{
-					for (int i = 0; i < sb.nodePositions.size() / 3; i++)
-					{
-						Eigen::Ref<Eigen::Vector3f> p = sb.nodePositions.segment<3>(i * 3);
-						Eigen::Vector3f colNormal = Eigen::Vector3f(0, 0, 0);
-						float perturb;
-						bool collision = false;
-#pragma unroll
-						for (int j = 0; j < 3; j++)
-						{
-							if (bounds->GetMin()[j] > p(j))
-							{
-								colNormal[j] = 1;
-								collision = true;
-								perturb = bounds->GetMin()[j] - p(j);
-								//p.cwiseMax(Eigen::Vector3f(bounds->GetMin()[0], bounds->GetMin()[1], bounds->GetMin()[2]));
-							}
-							else if (bounds->GetMax()[j] < p(j))
-							{
-								colNormal[j] = -1.f;
-								collision = true;
-								perturb = bounds->GetMax()[j] - p(j);
-								//p.cwiseMin(Eigen::Vector3f(bounds->GetMax()[0], bounds->GetMax()[1], bounds->GetMax()[2]));
-							}
-						}
-						
-						if (collision)
-						{
-							colNormal.normalize();
-							Eigen::Vector3f vIn = sb.nodeVelocities.segment<3>(i * 3);
-							Eigen::Vector3f impulse = vIn.dot(colNormal) * colNormal * -2.f;
-							sb.ApplyImpulse(impulse * 1.f, i);
-							p += perturb * colNormal;
-							/*printf("Collision. Applied impulse %f %f %f\n", impulse(0), impulse(1), impulse(2));*/
-						}
-					}
-				}
-			}
-		});
+class VelocityVerletIntegrator : public PhysicsIntegrator<VelocityVerletIntegrator>
+{
+public:
+	VelocityVerletIntegrator(std::shared_ptr<Scene> scene) : PhysicsIntegrator(scene) {}
+	~VelocityVerletIntegrator() {}
+
+	void Integrate(float dt) override
+	{
+		IntegrateWith(IntegrationScheme::VelocityVerlet, dt);
 	}
+
+	IntegrationScheme GetScheme() const { return IntegrationScheme::VelocityVerlet; }
+};
+
+class RK4Integrator : public PhysicsIntegrator<RK4Integrator>
+{
+public:
+	RK4Integrator(std::shared_ptr<Scene> scene) : PhysicsIntegrator(scene) {}
+	~RK4Integrator() {}
+
+	void Integrate(float dt) override
+	{
+		IntegrateWith(IntegrationScheme::RK4, dt);
+	}
+
+	IntegrationScheme GetScheme() const { return IntegrationScheme::RK4; }
+};
+
+class XPBDIntegrator : public PhysicsIntegrator<XPBDIntegrator>
+{
+public:
+	XPBDIntegrator(std::shared_ptr<Scene> scene) : PhysicsIntegrator(scene) {}
+	~XPBDIntegrator() {}
+
+	void Integrate(float dt) override
+	{
+		IntegrateWith(IntegrationScheme::XPBD, dt);
+	}
+
+	IntegrationScheme GetScheme() const { return IntegrationScheme::XPBD; }
+};
+
+/*
+* Integrates with the scheme selected in the ApplicationState so it can be changed at runtime
+*/
+class SwitchableIntegrator : public PhysicsIntegrator<SwitchableIntegrator>
+{
+public:
+	SwitchableIntegrator(std::shared_ptr<Scene> scene) : PhysicsIntegrator(scene) {}
+	~SwitchableIntegrator() {}
+
+	void Integrate(float dt) override
+	{
+		IntegrateWith(ApplicationState::GetInstance().integrationScheme, dt);
+	}
+
+	IntegrationScheme GetScheme() const { return ApplicationState::GetInstance().integrationScheme; }
 };
 
 class BwEulerIntegrator : public PhysicsIntegrator<BwEulerIntegrator>
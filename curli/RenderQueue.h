@@ -0,0 +1,190 @@
+#pragma once
+#include <Scene.h>
+#include <algorithm>
+#include <array>
+#include <map>
+#include <vector>
+
+/*
+* A single mesh draw collected by the render queue. Holds everything the main
+* pass needs to issue the draw so the registry is not touched again while submitting.
+*/
+struct DrawItem
+{
+	entt::entity entity = entt::null;
+	uint64_t sortKey = 0;
+
+	unsigned int vaoIndex = 0;
+	int textureIndices[5] = { -1,-1,-1,-1,-1 };
+	int envMapIndex = -1;
+	bool mirrorReflection = false;
+	ShadingMode shadingMode = ShadingMode::PHONG;
+	CPhongMaterial* material = nullptr;
+
+	glm::mat4 model = glm::mat4(1.0f);
+	float viewDepth = 0.0f;
+};
+
+/*
+* Per draw data of the static mesh batch, matches DrawData in phong_batched/shader.vert (std430)
+*/
+struct BatchDrawData
+{
+	glm::mat4 model = glm::mat4(1.0f);
+	glm::mat4 normalMatrix = glm::mat4(1.0f);
+	glm::vec4 ka = glm::vec4(0.0f);
+	glm::vec4 kd = glm::vec4(0.0f);
+	glm::vec4 ks = glm::vec4(0.0f);//w = shininess
+};
+
+/*
+* Collects the draws of a pass and orders them by a 64 bit key so that draws sharing
+* GPU state end up next to each other. Key layout from most to least significant bits:
+* shading mode (4) | texture set (20) | VAO (16) | quantized view depth (24)
+*/
+class RenderQueue
+{
+public:
+	void Clear()
+	{
+		items.clear();
+		textureSets.clear();
+	}
+
+	/*
+	* Computes the sort key of the item and pushes it to the queue
+	*/
+	void Push(DrawItem item, float nearPlane, float farPlane)
+	{
+		item.sortKey =
+			((uint64_t)((int)item.shadingMode & 0xF) << 60) |
+			((uint64_t)(GetTextureSetID(item) & 0xFFFFF) << 40) |
+			((uint64_t)(item.vaoIndex & 0xFFFF) << 24) |
+			(uint64_t)QuantizeDepth(item.viewDepth, nearPlane, farPlane);
+		items.push_back(item);
+	}
+
+	void Sort()
+	{
+		std::sort(items.begin(), items.end(),
+			[](const DrawItem& a, const DrawItem& b) { return a.sortKey < b.sortKey; });
+	}
+
+	/*
+	* The items nearest first regardless of their state, for passes that only write depth
+	*/
+	const std::vector<const DrawItem*>& FrontToBack()
+	{
+		frontToBack.clear();
+		for (const DrawItem& item : items)
+			frontToBack.push_back(&item);
+		std::sort(frontToBack.begin(), frontToBack.end(),
+			[](const DrawItem* a, const DrawItem* b) { return a->viewDepth < b->viewDepth; });
+		return frontToBack;
+	}
+
+	std::vector<DrawItem>::iterator begin() { return items.begin(); }
+	std::vector<DrawItem>::iterator end() { return items.end(); }
+	size_t Size() { return items.size(); }
+
+private:
+	std::vector<DrawItem> items;
+	std::vector<const DrawItem*> frontToBack;
+	std::map<std::array<int, 7>, unsigned int> textureSets;
+
+	/*
+	* Returns a small id shared by every item that binds exactly the same textures
+	*/
+	unsigned int GetTextureSetID(const DrawItem& item)
+	{
+		std::array<int, 7> signature = {
+			item.textureIndices[0], item.textureIndices[1], item.textureIndices[2],
+			item.textureIndices[3], item.textureIndices[4], item.envMapIndex,
+			item.mirrorReflection ? 1 : 0 };
+		auto it = textureSets.find(signature);
+		if (it != textureSets.end())
+			return it->second;
+		unsigned int id = textureSets.size();
+		textureSets[signature] = id;
+		return id;
+	}
+
+	/*
+	* Logarithmic depth quantization so that the huge far planes used by the editor
+	* camera still leave enough precision for front to back ordering near the viewer
+	*/
+	static uint32_t QuantizeDepth(float depth, float nearPlane, float farPlane)
+	{
+		nearPlane = glm::max(nearPlane, 1e-4f);
+		farPlane = glm::max(farPlane, nearPlane * 2.0f);
+		const float t = glm::clamp(glm::log(glm::max(depth, nearPlane) / nearPlane) /
+			glm::log(farPlane / nearPlane), 0.0f, 1.0f);
+		return (uint32_t)(t * (float)0xFFFFFF);
+	}
+};
+
+/*
+* Remembers the last state the queue submitted during a pass so redundant
+* binds and uniform uploads can be skipped. Counts what was issued and what was skipped.
+*/
+struct RenderStateCache
+{
+	int vaoIndex = -1;
+	GLuint boundTextures[5] = { 0,0,0,0,0 };
+	int hasTexture[5] = { -1,-1,-1,-1,-1 };
+	int envMapIndex = -2;
+	int mirrorReflection = -1;
+	int shadingMode = -1;
+	bool materialSet = false;
+	glm::vec3 ka, kd, ks;
+	float shininess = 0.0f;
+
+	unsigned int stateChanges = 0;
+	unsigned int skippedChanges = 0;
+
+	/*
+	* Updates the cached value and returns true if the state really has to change
+	*/
+	template <typename V>
+	bool Changed(V& cached, const V& value)
+	{
+		if (cached == value)
+		{
+			skippedChanges++;
+			return false;
+		}
+		cached = value;
+		stateChanges++;
+		return true;
+	}
+
+	/*
+	* Forgets the uniforms after the pass switched programs, bound GL objects stay valid
+	*/
+	void ForgetUniforms()
+	{
+		for (int i = 0; i < 5; i++)
+			hasTexture[i] = -1;
+		envMapIndex = -2;
+		mirrorReflection = -1;
+		shadingMode = -1;
+		materialSet = false;
+	}
+
+	bool MaterialChanged(const CPhongMaterial* material)
+	{
+		const glm::vec3 a = material ? material->ambient : glm::vec3(0.0f);
+		const glm::vec3 d = material ? material->diffuse : glm::vec3(0.0f);
+		const glm::vec3 s = material ? material->specular : glm::vec3(0.0f);
+		const float sh = material ? material->shininess : 0.0f;
+		if (materialSet && a == ka && d == kd && s == ks && sh == shininess)
+		{
+			skippedChanges++;
+			return false;
+		}
+		materialSet = true;
+		ka = a; kd = d; ks = s; shininess = sh;
+		stateChanges++;
+		return true;
+	}
+};
@@ -11,7 +11,14 @@
 #include <imgui.h>
 #include <ImguiHelpers.h>
 #include <ApplicationState.h>
+#include <RenderQueue.h>
+#include <Culling.h>
+#include <OffscreenScheduler.h>
+#include <ShadowAtlas.h>
+#include <LightClusters.h>
 #include <glm/gtc/type_ptr.hpp>
+#include <chrono>
+#include <array>
 
 
 template <class T>
@@ -35,16 +42,29 @@ public:
 		//glClearColor(clearColor.x, clearColor.y, clearColor.z, clearColor.w);
 		program = std::make_unique<OpenGLProgram>();
 
-		glEnable(GL_DEBUG_OUTPUT);
+		gldebug::Initialize();
+		//the state cache starts from the default framebuffer covering the window
+		int width, height;
+		glfwGetFramebufferSize(GLFWHandler::GetInstance().GetWindowPointer(), &width, &height);
+		GLState::GetInstance().BindFramebuffer(0);
+		GLState::GetInstance().Viewport(0, 0, width, height);
 		static_cast<T*>(this)->Start();
 	}
 	
 	//Renders the Scene and clears the Frame
 	void Render()
 	{
-		if (frameCounter % ApplicationState::GetInstance().renderEveryNthFrame == 0)
+		ApplicationState& state = ApplicationState::GetInstance();
+		if (frameCounter % state.renderEveryNthFrame == 0)
 		{
 			GLFWHandler::GetInstance().SwapBuffers();
+
+			const bool validate = state.glValidateEveryNthFrame > 0 &&
+				frameCounter % (state.glValidateEveryNthFrame * state.renderEveryNthFrame) == 0;
+			if (validate)
+				gldebug::BeginValidationFrame();
+			auto start = std::chrono::high_resolution_clock::now();
+			GLState::GetInstance().ResetCounters();
 		
 			//Scene changes
 			static_cast<T*>(this)->FirstPass();
@@ -53,6 +73,14 @@ public:
 			program->Clear();
 			//Rendering
 			static_cast<T*>(this)->MainPass();
+
+			//time spent issuing the frame, excluding the swap that waits for vsync
+			state.renderStats.cpuTime = std::chrono::duration<float, std::milli>(
+				std::chrono::high_resolution_clock::now() - start).count();
+			state.renderStats.glStateCalls = GLState::GetInstance().GetIssuedCalls();
+			state.renderStats.skippedGLStateCalls = GLState::GetInstance().GetSkippedCalls();
+			if (validate)
+				gldebug::EndValidationFrame(frameCounter);
 		}
 		frameCounter++;
 	}
@@ -80,10 +108,42 @@ protected:
 		int v[5] = { -1,-1,-1,-1,-1 };
 	};
 	std::unordered_map<entt::entity, unsigned int> entity2VAOIndex;
+	std::unordered_map<entt::entity, StreamingVertexBuffer> entity2StreamingBuffer;//soft body positions and normals
 	std::unordered_map<entt::entity,vec5> entity2TextureIndices;
 	std::unordered_map<entt::entity, unsigned int> entity2EnvMapIndex;
-	std::unordered_map<entt::entity, unsigned int> entity2ShadowMapIndex;
-	std::unordered_map<entt::entity, unsigned int> entity2ShadowCubeIndex;
+
+	//--shadow atlas--//
+	struct ShadowView
+	{
+		AtlasRect rect;
+		glm::mat4 matrix = glm::mat4(0.0f);//light view projection the tile was rendered with, zero until then
+	};
+	struct LightShadow
+	{
+		std::vector<ShadowView> views;//cube faces, cascades or the single spot light view
+		int tileSize = 0;
+		long int seenFrame = 0;
+	};
+	std::unique_ptr<ShadowAtlasTexture> shadowAtlas;
+	AtlasPacker atlasPacker;
+	std::unordered_map<entt::entity, LightShadow> entity2Shadow;
+
+	void ReleaseShadowTiles(LightShadow& shadow)
+	{
+		for (const ShadowView& view : shadow.views)
+			atlasPacker.Free(view.rect);
+		shadow.views.clear();
+		shadow.tileSize = 0;
+	}
+
+	void ReleaseShadow(entt::entity e)
+	{
+		auto shadow = entity2Shadow.find(e);
+		if (shadow == entity2Shadow.end())
+			return;
+		ReleaseShadowTiles(shadow->second);
+		entity2Shadow.erase(shadow);
+	}
 
 	/*
 	* Parses arguments called when application starts
@@ -158,6 +218,11 @@ protected:
 			program->vaos[entity2VAOIndex[e]].Delete();
 			entity2VAOIndex.erase(e);
 		}
+		if (entity2StreamingBuffer.find(e) != entity2StreamingBuffer.end())
+		{
+			entity2StreamingBuffer[e].Delete();
+			entity2StreamingBuffer.erase(e);
+		}
 		if (toBeRemoved)
 			return;
 		auto* mesh = scene->registry.try_get<CTriMesh>(e);
@@ -185,27 +250,36 @@ protected:
 		{
 			program->vaos.push_back(VertexArrayObject());
 			entity2VAOIndex[e] = program->vaos.size() - 1;
-			VertexBufferObject vertexVBO(
-				mesh->GetVertexDataPtr(),
-				mesh->GetNumVertices(),
-				GL_FLOAT,
-				"pos",
-				3,
-				program->GetID(),
-				scene->registry.any_of<CSoftBody>(e) ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
-			program->vaos.back().AddVBO(vertexVBO);
-
-			if (mesh->GetNumNormals() > 0)
+			if (scene->registry.any_of<CSoftBody>(e) && mesh->GetNumNormals() == mesh->GetNumVertices())
+			{
+				//deformed every frame, streamed through persistently mapped storage
+				entity2StreamingBuffer[e].Create({ "pos", "norm" },
+					{ mesh->GetVertexDataPtr(), mesh->GetNormalDataPtr() },
+					mesh->GetNumVertices(),
+					program->GetID());
+			}
+			else
 			{
-				VertexBufferObject normalsVBO(
-					mesh->GetNormalDataPtr(),
-					mesh->GetNumNormals(),
+				VertexBufferObject vertexVBO(
+					mesh->GetVertexDataPtr(),
+					mesh->GetNumVertices(),
 					GL_FLOAT,
-					"norm",
+					"pos",
 					3,
-					program->GetID(),
-					scene->registry.any_of<CSoftBody>(e) ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
-				program->vaos.back().AddVBO(normalsVBO);
+					program->GetID());
+				program->vaos.back().AddVBO(vertexVBO);
+
+				if (mesh->GetNumNormals() > 0)
+				{
+					VertexBufferObject normalsVBO(
+						mesh->GetNormalDataPtr(),
+						mesh->GetNumNormals(),
+						GL_FLOAT,
+						"norm",
+						3,
+						program->GetID());
+					program->vaos.back().AddVBO(normalsVBO);
+				}
 			}
 			if (mesh->GetNumTextureVertices() > 0 && mesh->GetTextureDataPtr() != nullptr)
 			{
@@ -266,6 +340,9 @@ protected:
 			program->vaos.back().AddVBO(vertexVBO);
 			program->vaos.back().SetDrawMode(GL_TRIANGLES);
 		}
+		if (entity2VAOIndex.find(e) != entity2VAOIndex.end())
+			gldebug::Label(GL_VERTEX_ARRAY, program->vaos[entity2VAOIndex[e]].GetID(),
+				"entity " + std::to_string((uint32_t)e));
 	};
 	/*
 	* Handles texture updates
@@ -376,37 +453,9 @@ protected:
 		auto* light = scene->registry.try_get<CLight>(e);
 		if (light)
 		{
-			bool point = light->GetLightType() == LightType::POINT;
-			if ( point &&
-				entity2ShadowCubeIndex.find(e) != entity2ShadowCubeIndex.end())
-			{
-				program->shadowCubeMaps[entity2ShadowCubeIndex[e]].Delete();
-				entity2ShadowCubeIndex.erase(e);
-			}
-			if (entity2ShadowMapIndex.find(e) != entity2ShadowMapIndex.end())
-			{
-				program->shadowTextures[entity2ShadowMapIndex[e]].Delete();
-				entity2ShadowMapIndex.erase(e);
-			}
-
-			if (toBeRemoved)
-				return;
-			if (point)
-			{
-				ShadowCubeTexture sMap({ 800,800 }, GL_TEXTURE10 + light->slot);
-				program->shadowCubeMaps.push_back(sMap);
-				entity2ShadowCubeIndex[e] = program->shadowCubeMaps.size() - 1;
-				//light->glID = sMap.GetGLID();
-				printf("id %d\n", light->glID);
-			}
-			else
-			{
-				auto texUnit = (light->GetLightType() == LightType::DIRECTIONAL ? GL_TEXTURE15 : GL_TEXTURE20) + light->slot;
-				ShadowTexture sMap({ 800,800 }, texUnit);
-				program->shadowTextures.push_back(sMap);
-				entity2ShadowMapIndex[e] = program->shadowTextures.size() - 1;
-				light->glID = sMap.GetGLID();
-			}
+			//tiles in the shadow atlas are handed out again when the shadow is rendered
+			ReleaseShadow(e);
+			light->glID = shadowAtlas ? shadowAtlas->GetGLID() : 0;
 		}
 	}
 	/*
@@ -414,30 +463,16 @@ protected:
 	*/
 	void OnSoftbodyChange(entt::entity e)
 	{
-		//get the softbody
 		auto& softbody = scene->registry.get<CSoftBody>(e);
 		auto* mesh = scene->registry.try_get<CTriMesh>(e);
-		int nthframe = ApplicationState::GetInstance().renderEveryNthFrame;
-		if (mesh != nullptr)
-		{
-			int i = 0;
-			for (const auto [nodeIdx, meshIdx] : softbody.nodes2SurfIds)
-			{
-				if(i++%(frameCounter% 2 + 1) == 0)
-					mesh->GetVertex(meshIdx) = glm::make_vec3(softbody.nodePositions.segment<3>(nodeIdx *3).data());
-			}
-			//mesh->ComputeNormals();
+		auto buffer = entity2StreamingBuffer.find(e);
+		if (mesh == nullptr || buffer == entity2StreamingBuffer.end() ||
+			softbody.surfaceNodeIds.size() != mesh->GetNumVertices())
+			return;
 
-			if (i++ % (frameCounter % 2 + 1) == 0)
-			{
-				//now update the buffer in program vaos
-				auto vao = program->vaos[entity2VAOIndex[e]];
-				vao.GetVBO(0).SetData(mesh->GetVertexDataPtr(), 
-					mesh->GetNumVertices(), GL_FLOAT, GL_DYNAMIC_DRAW);//0th buffer is always vPos buffer
-				//vao.GetVBO(1).SetData(mesh->GetNormalDataPtr(),
-				//	mesh->GetNumNormals(), GL_FLOAT);//1st buffer is always vNormal buffer
-			}
-		}
+		mesh->UpdateFromNodes(softbody.nodePositions, softbody.surfaceNodeIds);
+		buffer->second.Upload(program->vaos[entity2VAOIndex[e]].GetID(),
+			{ mesh->GetVertexDataPtr(), mesh->GetNormalDataPtr() });
 	}
 };
 
@@ -1253,7 +1288,43 @@ public:
 			"../assets/shaders/tessellation/subdivide.tesc",
 			"../assets/shaders/tessellation/subdivide.tese", 3));
 			//throw std::runtime_error("Failed to create wireframe program");
+		//same pipeline with fractional spacing for the adaptive levels, the fixed levels keep equal spacing
+		adaptiveWireframeProgram = std::make_unique<OpenGLProgram>();
+		adaptiveWireframeProgram->CreatePipelineFromFiles("../assets/shaders/wireframe/wireframe.vert",
+			"../assets/shaders/wireframe/wireframe.frag",
+			"../assets/shaders/wireframe/wireframe.geom",
+			"../assets/shaders/tessellation/subdivide.tesc",
+			"../assets/shaders/tessellation/subdivide_adaptive.tese", 3);
 		
+		//programs drawing the static mesh batch with per draw data fetched by gl_DrawID
+		batchedProgram = std::make_unique<OpenGLProgram>();
+		batchedProgram->CreatePipelineFromFiles("../assets/shaders/phong_batched/shader.vert",
+			"../assets/shaders/phong_textured/shader.frag");
+		shadowBatchedProgram = std::make_unique<OpenGLProgram>();
+		shadowBatchedProgram->CreatePipelineFromFiles("../assets/shaders/shadow/shadow_batched.vert",
+			"../assets/shaders/shadow/shadow.frag");
+
+		//shading programs with the wireframe overlay geometry stage
+		wireframeOverlayProgram = std::make_unique<OpenGLProgram>();
+		wireframeOverlayProgram->CreatePipelineFromFiles("../assets/shaders/phong_textured/shader.vert",
+			"../assets/shaders/phong_textured/shader.frag", "../assets/shaders/phong_textured/wireframe_overlay.geom");
+		wireframeOverlayBatchedProgram = std::make_unique<OpenGLProgram>();
+		wireframeOverlayBatchedProgram->CreatePipelineFromFiles("../assets/shaders/phong_batched/shader.vert",
+			"../assets/shaders/phong_textured/shader.frag", "../assets/shaders/phong_textured/wireframe_overlay.geom");
+
+		//programs rendering all faces of a point light shadow at once
+		shadowCubeProgram = std::make_unique<OpenGLProgram>();
+		shadowCubeProgram->CreatePipelineFromFiles("../assets/shaders/shadow/shadow_cube.vert",
+			"../assets/shaders/shadow/shadow.frag", "../assets/shaders/shadow/shadow_cube.geom");
+		shadowCubeBatchedProgram = std::make_unique<OpenGLProgram>();
+		shadowCubeBatchedProgram->CreatePipelineFromFiles("../assets/shaders/shadow/shadow_cube_batched.vert",
+			"../assets/shaders/shadow/shadow.frag", "../assets/shaders/shadow/shadow_cube.geom");
+		meshBatch.Initialize(1 << 16, 1 << 18);
+
+		//every shadow map lives in one atlas, the lights get power of two tiles of it
+		shadowAtlas = std::make_unique<ShadowAtlasTexture>(4096);
+		atlasPacker.Reset(shadowAtlas->GetSize(), 128);
+
 		//load shaders to the main program 
 		if (!program->CreatePipelineFromFiles("../assets/shaders/phong_textured/shader.vert",
 			"../assets/shaders/phong_textured/shader.frag"/*, 
@@ -1305,137 +1376,322 @@ public:
 	};
 	void FirstPass()
 	{	
+		frameStats = RenderStats();
+		scene->UpdateBVH();
+		offscreenScheduler.BeginFrame(scene->GetMovedBounds());
 		//=======StackPush=======
-		glm::vec4 clearColor = program->GetClearColor();
-		Camera origCam = scene->camera;
-		//render shadow textures
+		const glm::vec4 clearColor = program->GetClearColor();
+		const Camera origCam = scene->camera;
+		const glm::mat4 viewProjection = scene->camera.GetProjectionMatrix() * scene->camera.GetViewMatrix();
+		const glm::vec3 eye = scene->camera.GetLookAtEye();
+		//assign the atlas tiles, the more important lights first so they get the larger ones
+		std::vector<std::pair<float, entt::entity>> shadowCasters;
 		scene->registry.view<CLight>()
 			.each([&](const auto& entity, auto& light)
 			{
-				if (!light.scheduledTextureUpdate && light.IsCastingShadows())
-				{
-					if(light.GetLightType() == LightType::POINT &&
-						(entity2ShadowCubeIndex.find(entity) != entity2ShadowCubeIndex.end()))
-					{
-						int i = frameCounter % 6;
-						auto tmpCamera = Camera(light.position,
-							angles[i], 10.0, -90);
-						tmpCamera.SetFarPlane(100.f);
-						program->shadowCubeMaps[entity2ShadowCubeIndex[entity]]
-							.RenderSide(i, std::bind(&MultiTargetRenderer::RenderShadows,
-								this, light.CalculateShadowMatrix(i)
-								/*tmpCamera.GetProjectionMatrix() * tmpCamera.GetViewMatrix()*/), i == 5);
-					}
-					else if ( (light.GetLightType() == LightType::DIRECTIONAL ||
-						light.GetLightType() == LightType::SPOT) && 
-						(entity2ShadowMapIndex.find(entity) != entity2ShadowMapIndex.end()) )
+				if (light.scheduledTextureUpdate || !light.IsCastingShadows())
+					return;
+				//directional lights cover the whole scene, the others matter less the further they are
+				const float importance = light.GetLightType() == LightType::DIRECTIONAL ? 1.0f :
+					1.0f / (1.0f + 0.1f * glm::length(light.position - eye));
+				shadowCasters.push_back({ importance, entity });
+			});
+		std::sort(shadowCasters.begin(), shadowCasters.end(),
+			[](const auto& a, const auto& b) { return a.first > b.first; });
+
+		//submit shadow views
+		for (const auto& [weight, entity] : shadowCasters)
+		{
+			CLight& light = scene->registry.get<CLight>(entity);
+			if (!AssignShadowTiles(entity, light, weight))
+				continue;
+			LightShadow& shadow = entity2Shadow[entity];
+			const uint32_t id = (uint32_t)entt::to_integral(entity);
+			auto submitView = [&](int v, OffscreenScheduler::TargetKind kind, float viewWeight, const glm::mat4& shadowMatrix)
+			{
+				const uint64_t key = OffscreenScheduler::MakeKey(id, kind, v);
+				ShadowView* view = &shadow.views[v];
+				//a new tile holds nothing yet
+				if (view->matrix == glm::mat4(0.0f))
+					offscreenScheduler.Forget(key);
+				offscreenScheduler.Submit(key, viewWeight, shadowMatrix, 1, 240, [this, view, shadowMatrix]()
 					{
-						program->shadowTextures[entity2ShadowMapIndex[entity]]
-						.Render(std::bind(&MultiTargetRenderer::RenderShadows,
-							this, light.CalculateShadowMatrix()));
-					}
+						shadowAtlas->Render(view->rect.ToViewport(),
+							std::bind(&MultiTargetRenderer::RenderShadows, this, shadowMatrix));
+						view->matrix = shadowMatrix;
+					});
+			};
+
+			if (light.GetLightType() == LightType::POINT)
+			{
+				std::array<glm::mat4, 6> faceMatrices;
+				for (int i = 0; i < 6; i++)
+					faceMatrices[i] = light.CalculateShadowMatrix(i);
+				if (ApplicationState::GetInstance().layeredPointShadows)
+				{
+					const uint64_t key = OffscreenScheduler::MakeKey(id, OffscreenScheduler::TargetKind::ShadowCube);
+					if (shadow.views[0].matrix == glm::mat4(0.0f))
+						offscreenScheduler.Forget(key);
+					LightShadow* target = &shadow;
+					offscreenScheduler.Submit(key, weight, faceMatrices.data(), 6, 1, 240, [this, target, faceMatrices]()
+						{
+							std::array<glm::ivec4, 6> rects;
+							for (int i = 0; i < 6; i++)
+								rects[i] = target->views[i].rect.ToViewport();
+							shadowAtlas->RenderViews(rects.data(), 6,
+								std::bind(&MultiTargetRenderer::RenderShadowCube, this, faceMatrices));
+							for (int i = 0; i < 6; i++)
+								target->views[i].matrix = faceMatrices[i];
+						});
 				}
-				
-			});
+				else for (int i = 0; i < 6; i++)
+					submitView(i, OffscreenScheduler::TargetKind::ShadowCubeFace, weight, faceMatrices[i]);
+			}
+			else if (light.GetLightType() == LightType::DIRECTIONAL)
+			{
+				//cascades follow the main camera, each one is culled and scheduled on its own
+				Camera camera = origCam;
+				const auto matrices = light.CalculateCascadeMatrices(camera,
+					ApplicationState::GetInstance().shadowDistance, shadow.tileSize);
+				for (int c = 0; c < CLight::cascadeCount; c++)
+					submitView(c, OffscreenScheduler::TargetKind::ShadowCascade, weight / (float)(c + 1), matrices[c]);
+			}
+			else
+				submitView(0, OffscreenScheduler::TargetKind::ShadowMap, weight, light.CalculateShadowMatrix());
+		}
 
-		//render renderedTextures
+		//lights that stopped casting shadows or were removed give their tiles back
+		for (auto it = entity2Shadow.begin(); it != entity2Shadow.end();)
+		{
+			if (it->second.seenFrame != frameCounter)
+			{
+				ReleaseShadowTiles(it->second);
+				it = entity2Shadow.erase(it);
+			}
+			else
+				++it;
+		}
+
+		//submit renderedTextures
 		scene->registry.view<CImageMaps>()
 			.each([&](const auto& entity, auto& maps)
 			{
 				auto* mesh = scene->registry.try_get<CTriMesh>(entity);
 				auto* transform = scene->registry.try_get<CTransform>(entity);
-				bool meshVisibility = true;
-				//Set the object's visibility to false
-				if (mesh)
+				if (maps.scheduledTextureUpdate || !mesh || !transform || !mesh->visible)
+					return;
+				const uint32_t id = (uint32_t)entt::to_integral(entity);
+				auto* material = scene->registry.try_get<CPhongMaterial>(entity);
+				const glm::vec4 background = material ? glm::vec4(material->diffuse, 1) : clearColor;
+				const float weight = ScreenCoverage(scene->GetWorldBounds(entity), viewProjection);
+
+				//the pass hides the mesh it is rendered for and restores the state afterwards
+				auto offscreenPass = [this, mesh, background, clearColor, origCam](const Camera& camera, std::function<void()> render)
 				{
-					meshVisibility = mesh->visible;
 					mesh->visible = false;
-				}
-
+					program->SetClearColor(background);
+					scene->camera = camera;
+					renderingOffscreen = true;
+					render();
+					renderingOffscreen = false;
+					scene->camera = origCam;
+					program->SetClearColor(clearColor);
+					mesh->visible = true;
+				};
 
 				//iterate over each imagemap of maps
-				if (!maps.scheduledTextureUpdate && meshVisibility)
+				for (auto it = maps.mapsBegin(); it != maps.mapsEnd(); ++it)
 				{
-					for (auto it = maps.mapsBegin(); it != maps.mapsEnd(); ++it)
+					if (!it->second.IsRenderedImage())
+						continue;
+					if(it->second.GetBindingSlot() == ImageMap::BindingSlot::ENV_MAP)
 					{
-						if (it->second.IsRenderedImage())
+						if (entity2EnvMapIndex.find(entity) == entity2EnvMapIndex.end() ||
+							entity2EnvMapIndex[entity] >= program->cubeMaps.size())
+							continue;
+						CubeMappedTexture* cube = &program->cubeMaps[entity2EnvMapIndex[entity]];
+						for (int i = 0; i < 6; i++)
 						{
-							auto* material = scene->registry.try_get<CPhongMaterial>(entity);
-							if(material)
-								program->SetClearColor(glm::vec4(material->diffuse,1));
-							if(it->second.GetBindingSlot() == ImageMap::BindingSlot::ENV_MAP)
-							{
-								int i = frameCounter % 6;
-								auto cntr = glm::vec3(glm::vec4(mesh->GetBoundingBoxCenter(), 1.0f) * transform->GetModelMatrix());
-								scene->camera = Camera(transform->GetPosition(),
-									angles[i], 1.0f * transform->GetScale()[i/2], -90);
-								if (entity2EnvMapIndex.find(entity) != entity2EnvMapIndex.end() &&
-									entity2EnvMapIndex[entity] < program->cubeMaps.size())
-									program->cubeMaps[entity2EnvMapIndex[entity]].
-										RenderSide(i,std::bind(&MultiTargetRenderer::MainPass, this),i==5);
-							}
-							else if(program->renderedTextures.size() > it->second.GetProgramRenderedTexIndex())
-							{
-								if (it->second.GetRenderImageMode() == ImageMap::RenderImageMode::REFLECTION)
+							Camera camera(transform->GetPosition(),
+								angles[i], 1.0f * transform->GetScale()[i/2], -90);
+							offscreenScheduler.Submit(OffscreenScheduler::MakeKey(id, OffscreenScheduler::TargetKind::EnvMapFace, i),
+								weight, camera.GetProjectionMatrix() * camera.GetViewMatrix(), 2, 120,
+								[this, offscreenPass, camera, cube, i]()
 								{
-									scene->camera = Camera::Reflect(glm::vec4(mesh->GetBoundingBoxCenter(), 1.0f) * 
-										transform->GetModelMatrix(), 
-										glm::vec3(0,1,0) * glm::transpose(glm::inverse(glm::mat3(transform->GetModelMatrix()))),
-										scene->camera);
-									program->renderedTextures[it->second.GetProgramRenderedTexIndex()].
-										Render(std::bind(&MultiTargetRenderer::MainPass, this));
-								}
-							}
+									offscreenPass(camera, [&]() { cube->RenderSide(i, std::bind(&MultiTargetRenderer::MainPass, this)); });
+								});
 						}
 					}
+					else if(program->renderedTextures.size() > it->second.GetProgramRenderedTexIndex() &&
+						it->second.GetRenderImageMode() == ImageMap::RenderImageMode::REFLECTION)
+					{
+						Camera camera = Camera::Reflect(glm::vec4(mesh->GetBoundingBoxCenter(), 1.0f) * 
+							transform->GetModelMatrix(), 
+							glm::vec3(0,1,0) * glm::transpose(glm::inverse(glm::mat3(transform->GetModelMatrix()))),
+							scene->camera);
+						RenderedTexture2D* texture = &program->renderedTextures[it->second.GetProgramRenderedTexIndex()];
+						offscreenScheduler.Submit(OffscreenScheduler::MakeKey(id, OffscreenScheduler::TargetKind::RenderedTexture,
+							(int)it->second.GetProgramRenderedTexIndex()),
+							weight, camera.GetProjectionMatrix() * camera.GetViewMatrix(), 1, 120,
+							[this, offscreenPass, camera, texture]()
+							{
+								offscreenPass(camera, [&]() { texture->Render(std::bind(&MultiTargetRenderer::MainPass, this)); });
+							});
+					}
 				}
-
-				if(mesh)
-					mesh->visible = meshVisibility;
 			});
 
+		offscreenScheduler.Run(ApplicationState::GetInstance().offscreenBudgetMs);
+		frameStats.shadowAtlasUsage = (float)atlasPacker.GetUsedTexels() /
+			glm::max(1.0f, (float)atlasPacker.GetAtlasSize() * (float)atlasPacker.GetAtlasSize());
+		frameStats.offscreenPasses = offscreenScheduler.GetRenderedPasses();
+		frameStats.deferredOffscreenPasses = offscreenScheduler.GetDeferredPasses();
+		frameStats.offscreenTime = offscreenScheduler.GetTime();
+
 		//=======StackPop=======
 		program->SetClearColor(clearColor);
 		scene->camera = origCam;
 	}
+
+	/*
+	* Gives the light one atlas tile per shadow view, sized by its importance. A light grows as soon as a
+	* larger tile is wanted and free, but only shrinks two sizes down so lights near a threshold do not
+	* keep moving around the atlas. When the atlas is full lights get smaller tiles, the ones nothing
+	* fits for go without shadows. Returns false in that case
+	*/
+	bool AssignShadowTiles(entt::entity entity, CLight& light, float importance)
+	{
+		const bool point = light.GetLightType() == LightType::POINT;
+		const int viewCount = point ? 6 : light.GetLightType() == LightType::DIRECTIONAL ? CLight::cascadeCount : 1;
+		const int maxSize = point ? 512 : 1024;
+		int size = maxSize;
+		for (float threshold = 0.5f; importance < threshold && size > atlasPacker.GetMinTileSize(); threshold *= 0.5f)
+			size /= 2;
+
+		LightShadow& shadow = entity2Shadow[entity];
+		shadow.seenFrame = frameCounter;
+		const bool shrink = shadow.tileSize > size;
+		if (!shadow.views.empty() && (shadow.tileSize == size || (shrink && shadow.tileSize < size * 4)))
+			return true;
+		if (shrink)
+			ReleaseShadowTiles(shadow);
+
+		//the wanted size first, then smaller ones while they still beat the current tiles
+		std::vector<ShadowView> views;
+		for (int tileSize = size; tileSize >= atlasPacker.GetMinTileSize() && tileSize > shadow.tileSize; tileSize /= 2)
+		{
+			views.clear();
+			for (int v = 0; v < viewCount; v++)
+			{
+				const AtlasRect rect = atlasPacker.Allocate(tileSize);
+				if (!rect.IsValid())
+					break;
+				views.push_back({ rect });
+			}
+			if ((int)views.size() == viewCount)
+			{
+				ReleaseShadowTiles(shadow);
+				shadow.views = views;
+				shadow.tileSize = tileSize;
+				return true;
+			}
+			for (const ShadowView& view : views)
+				atlasPacker.Free(view.rect);
+		}
+		return !shadow.views.empty();
+	}
+
+	/*
+	* Fraction of the screen covered by the projection of the box, with a floor so hidden targets
+	* still get refreshed once in a while
+	*/
+	static float ScreenCoverage(const AABB& box, const glm::mat4& viewProjection)
+	{
+		if (!box.IsValid())
+			return 1.0f;
+		glm::vec2 ndcMin(FLT_MAX), ndcMax(-FLT_MAX);
+		for (int c = 0; c < 8; c++)
+		{
+			const glm::vec4 corner = viewProjection * glm::vec4(
+				c & 1 ? box.max.x : box.min.x, c & 2 ? box.max.y : box.min.y, c & 4 ? box.max.z : box.min.z, 1.0f);
+			//the camera is inside or right next to the box
+			if (corner.w <= 1e-6f)
+				return 1.0f;
+			const glm::vec2 ndc = glm::vec2(corner) / corner.w;
+			ndcMin = glm::min(ndcMin, ndc);
+			ndcMax = glm::max(ndcMax, ndc);
+		}
+		ndcMin = glm::clamp(ndcMin, glm::vec2(-1.0f), glm::vec2(1.0f));
+		ndcMax = glm::clamp(ndcMax, glm::vec2(-1.0f), glm::vec2(1.0f));
+		const glm::vec2 size = glm::max(ndcMax - ndcMin, glm::vec2(0.0f));
+		return 0.05f + size.x * size.y * 0.25f;
+	}
 //=======================================================================================================================
+	/*
+	* Wireframe of the meshes with a displacement map. The main pass does not displace, so their
+	* tessellated surface is drawn as lines on top of it. Everything else gets the overlay of the main pass
+	*/
 	void RenderWireframe()
 	{
-		wireframeProgram->Use();
-		scene->registry.view<CTriMesh>()
-		.each([&](const auto& entity, auto& mesh)
+		const ApplicationState& state = ApplicationState::GetInstance();
+		OpenGLProgram* tessellation = state.adaptiveTessellation ? adaptiveWireframeProgram.get() : wireframeProgram.get();
+		tessellation->Use();
+		CollectVisible(Frustum(scene->camera.GetProjectionMatrix() * scene->camera.GetViewMatrix()));
+
+		//the levels follow the screen size of the patch edges
+		glm::ivec4 viewport = GLState::GetInstance().GetViewport();
+		if (viewport.z <= 0 || viewport.w <= 0)
+			GL_CALL(glGetIntegerv(GL_VIEWPORT, &viewport[0]));
+		tessellation->SetUniform("projection_scale", scene->camera.GetProjectionMatrix()[1][1] * 0.5f * viewport.w);
+		tessellation->SetUniform("adaptive_tessellation", state.adaptiveTessellation ? 1 : 0);
+		tessellation->SetUniform("tessellation_edge_pixels", glm::max(state.tessellationEdgePixels, 1.0f));
+		tessellation->SetUniform("cull_patches", state.cullTessellationPatches ? 1 : 0);
+
+		//only the pass on screen is measured, both counters are read back a few frames late
+		const bool measure = !renderingOffscreen;
+		const bool measureEdges = measure && tessellationStats.Begin(7, 0.0f);
+		tessellation->SetUniform("collect_stats", measureEdges ? 1 : 0);
+		const bool countTriangles = measure && tessellationQuery.Begin();
+		ForEachVisibleMesh([&](entt::entity entity, CTriMesh& mesh)
 		{
-			if (entity2VAOIndex.find(entity) != entity2VAOIndex.end())
-			program->vaos[entity2VAOIndex[entity]].visible = mesh.visible;
+			auto imaps = scene->registry.try_get<CImageMaps>(entity);
+			if (!imaps || !mesh.visible ||
+				entity2VAOIndex.find(entity) == entity2VAOIndex.end() ||
+				entity2TextureIndices.find(entity) == entity2TextureIndices.end() ||
+				mesh.GetShadingMode() != ShadingMode::PHONG ||
+				scene->registry.any_of<CSkyBox>(entity))
+				return;
+			const int texIndex = entity2TextureIndices[entity].v[4];
+			if (texIndex < 0)
+				return;
 			CTransform* transform = scene->registry.try_get<CTransform>(entity);
 			
 			const glm::mat4 mvp = scene->camera.GetProjectionMatrix() * 
 				scene->camera.GetViewMatrix() * 
 				(transform ? transform->GetModelMatrix() : glm::mat4(1.0f));
-			wireframeProgram->SetUniform("to_screen_space", mvp);
+			tessellation->SetUniform("to_screen_space", mvp);
+			tessellation->SetUniform("to_view_space", scene->camera.GetViewMatrix() *
+				(transform ? transform->GetModelMatrix() : glm::mat4(1.0f)));
 			
-			wireframeProgram->SetUniform("tessellation_level", mesh.tessellationLevel);
-			wireframeProgram->SetUniform("displacement_multiplier", 0.0f);
-			auto imaps = scene->registry.try_get<CImageMaps>(entity);
-			if (imaps)
-			{
-				int texIndex = entity2TextureIndices[entity].v[4];
-				
-				//bind texture
-				if (texIndex >= 0)
-				{
-					wireframeProgram->SetUniform("displacement_multiplier", 
-						imaps->GetImageMap(ImageMap::BindingSlot::DISPLACEMENT).dispMultiplier);
-					wireframeProgram->SetUniform("displacement_map", 4);
-					program->textures[texIndex].Bind();
-				}
-			}
+			tessellation->SetUniform("tessellation_level", mesh.tessellationLevel);
+			tessellation->SetUniform("displacement_multiplier", 
+				imaps->GetImageMap(ImageMap::BindingSlot::DISPLACEMENT).dispMultiplier);
+			tessellation->SetUniform("displacement_map", 4);
+			program->textures[texIndex].Bind();
 
-			if (entity2VAOIndex.find(entity) != entity2VAOIndex.end() && 
-				mesh.GetShadingMode() == ShadingMode::PHONG && 
-				!scene->registry.any_of<CSkyBox>(entity))
-				program->vaos[entity2VAOIndex[entity]].Draw(GL_PATCHES);
+			program->vaos[entity2VAOIndex[entity]].Draw(GL_PATCHES);
 		});
+
+		//the geometry shader emits the three edges of every generated triangle as lines
+		if (countTriangles)
+			tessellationQuery.End();
+		if (measureEdges)
+			tessellationStats.End();
+		if (measure)
+		{
+			frameStats.tessellatedTriangles = tessellationQuery.GetLatest() / 3;
+			frameStats.tessellationMaxEdge = tessellationStats.GetLatest();
+		}
 	}
 //=======================================================================================================================
 	//Gets called from FirstPass
@@ -1443,252 +1699,562 @@ public:
 	{
 		//bind shadow program
 		shadowProgram->Use();
+		frameStats.shadowCulledObjects += CollectVisible(Frustum(shadowMatrix));
+		GatherInstances();
 
 		//only render meshes
-		scene->registry.view<CTriMesh>()
-		.each([&](const auto& entity, auto& mesh)
+		ClearBatchDraws();
+		ForEachVisibleMesh([&](entt::entity entity, CTriMesh& mesh)
 		{
 			if (entity2VAOIndex.find(entity) != entity2VAOIndex.end())
 				program->vaos[entity2VAOIndex[entity]].visible = mesh.visible;
 			CTransform* transform = scene->registry.try_get<CTransform>(entity);
+			const glm::mat4 model = transform ? transform->GetModelMatrix() : glm::mat4(1.0f);
+			if (mesh.visible && AppendBatchDraw(entity, mesh, model, nullptr))
+				return;
 
-			const glm::mat4 mlp = shadowMatrix *(transform ?
-				transform->GetModelMatrix() : glm::mat4(1.0f));
+			const glm::mat4 mlp = shadowMatrix * model;
 			shadowProgram->SetUniform("to_screen_space", mlp);
 
 			if (entity2VAOIndex.find(entity) != entity2VAOIndex.end() && mesh.GetShadingMode() == ShadingMode::PHONG)
 				program->vaos[entity2VAOIndex[entity]].Draw();
 		});
+
+		if (!batchCommands.empty() || !instanceGroups.empty())
+		{
+			shadowBatchedProgram->Use();
+			shadowBatchedProgram->SetUniform("to_light_space", shadowMatrix);
+			if (!batchCommands.empty())
+			{
+				shadowBatchedProgram->SetUniform("instance_offset", -1);
+				meshBatch.Draw(batchCommands, batchDrawData.data(), batchDrawData.size() * sizeof(BatchDrawData));
+			}
+			DrawInstanceGroups(shadowBatchedProgram.get(), false);
+		}
+	}
+
+	/*
+	* Renders the six faces of a point light shadow in one pass, the geometry shader writes each triangle
+	* to the atlas tiles of the faces it can cast on. Casters are culled against every face on the CPU and
+	* carry the mask of their faces, so the geometry shader only runs the invocations they need
+	*/
+	void RenderShadowCube(const std::array<glm::mat4, 6>& faceMatrices)
+	{
+		frameStats.shadowCulledObjects += CollectVisibleCube(faceMatrices);
+		GatherInstances(&casterFaces);
+
+		shadowCubeProgram->Use();
+		SetFaceMatrices(shadowCubeProgram.get(), faceMatrices);
+		ClearBatchDraws();
+		ForEachVisibleMesh([&](entt::entity entity, CTriMesh& mesh)
+		{
+			if (entity2VAOIndex.find(entity) != entity2VAOIndex.end())
+				program->vaos[entity2VAOIndex[entity]].visible = mesh.visible;
+			CTransform* transform = scene->registry.try_get<CTransform>(entity);
+			const glm::mat4 model = transform ? transform->GetModelMatrix() : glm::mat4(1.0f);
+			if (mesh.visible && AppendBatchDraw(entity, mesh, model, nullptr))
+			{
+				batchDrawData.back().ka.w = (float)casterFaces[entity];
+				return;
+			}
+
+			shadowCubeProgram->SetUniform("to_world_space", model);
+			shadowCubeProgram->SetUniform("face_mask", casterFaces[entity]);
+			if (entity2VAOIndex.find(entity) != entity2VAOIndex.end() && mesh.GetShadingMode() == ShadingMode::PHONG)
+				program->vaos[entity2VAOIndex[entity]].Draw();
+		});
+
+		if (!batchCommands.empty() || !instanceGroups.empty())
+		{
+			shadowCubeBatchedProgram->Use();
+			SetFaceMatrices(shadowCubeBatchedProgram.get(), faceMatrices);
+			if (!batchCommands.empty())
+			{
+				shadowCubeBatchedProgram->SetUniform("instance_offset", -1);
+				meshBatch.Draw(batchCommands, batchDrawData.data(), batchDrawData.size() * sizeof(BatchDrawData));
+			}
+			DrawInstanceGroups(shadowCubeBatchedProgram.get(), false);
+		}
+	}
+
+	static void SetFaceMatrices(OpenGLProgram* target, const std::array<glm::mat4, 6>& faceMatrices)
+	{
+		for (int i = 0; i < 6; i++)
+		{
+			const std::string uniformName = std::string("face_matrices[") + std::to_string(i) + std::string("]");
+			target->SetUniform(uniformName.c_str(), faceMatrices[i]);
+		}
+	}
+
+	/*
+	* Geometry changes also keep the static mesh batch in sync
+	*/
+	void OnGeometryChange(entt::entity e, bool toBeRemoved)
+	{
+		Renderer::OnGeometryChange(e, toBeRemoved);
+		scene->InvalidateBounds(e);
+
+		if (entity2BatchSlot.find(e) != entity2BatchSlot.end())
+		{
+			meshBatch.Remove(entity2BatchSlot[e]);
+			entity2BatchSlot.erase(e);
+		}
+		if (toBeRemoved || !meshBatch.IsInitialized())
+			return;
+
+		auto* mesh = scene->registry.try_get<CTriMesh>(e);
+		if (!mesh || mesh->GetNumFaces() == 0 ||
+			scene->registry.any_of<CSoftBody, CPhysicsBounds, CSkyBox, CLight>(e) ||
+			(mesh->GetNumNormals() != 0 && mesh->GetNumNormals() != mesh->GetNumVertices()) ||
+			(mesh->GetNumTextureVertices() != 0 && mesh->GetNumTextureVertices() != mesh->GetNumVertices()))
+			return;
+
+		entity2BatchSlot[e] = meshBatch.Add(
+			(const float*)mesh->GetVertexDataPtr(),
+			mesh->GetNumNormals() > 0 ? (const float*)mesh->GetNormalDataPtr() : nullptr,
+			mesh->GetNumTextureVertices() > 0 ? (const float*)mesh->GetTextureDataPtr() : nullptr,
+			mesh->GetNumVertices(),
+			(const unsigned int*)mesh->GetFaceDataPtr(),
+			mesh->GetNumFaces() * 3);
+	}
+
+	/*
+	* Soft body updates move the mesh vertices so their cached bounds are recomputed
+	*/
+	void OnSoftbodyChange(entt::entity e)
+	{
+		Renderer::OnSoftbodyChange(e);
+		scene->InvalidateBounds(e);
 	}
 	
 //=======================================================================================================================
-	void MainPass()
-	{	
-		//bind GLSL program
-		program->Use();
-		
-		//Set up lights
-		int p = 0;
-		int d = 0;
-		int s = 0;
-		scene->registry.view<CLight>()
-			.each([&](const auto& entity, auto& light)
+	/*
+	* Uploads the lights and their shadow views to the buffers read by the phong_textured layout and bins
+	* the point and spot lights into the clusters of the current camera. Directional lights come first
+	* in the light buffer, they reach every fragment and are not binned
+	*/
+	void UpdateLights()
+	{
+		lightData.clear();
+		shadowViewData.clear();
+		lightVolumes.clear();
+		const float atlasSize = (float)atlasPacker.GetAtlasSize();
+		const float threshold = ApplicationState::GetInstance().lightCutoff;
+		//maps the light clip space to [0,1] before the tile offset is applied in the shader
+		const glm::mat4 scaleBias = glm::mat4(
+			0.5, 0.0, 0.0, 0.0,
+			0.0, 0.5, 0.0, 0.0,
+			0.0, 0.0, 0.5, 0.0,
+			0.5, 0.5, 0.5, 1.0
+		);
+		auto addLight = [&](entt::entity entity, CLight& light)
 		{
-			if (light.GetLightType() == LightType::POINT)
+			LightData data;
+			const LightType type = light.GetLightType();
+			const bool directional = type == LightType::DIRECTIONAL;
+			const float range = directional ? 0.0f : light.CalculateRange(threshold);
+			data.position = glm::vec4(directional ? glm::vec3(0.0f) : light.position, range);
+			data.direction = glm::vec4(type == LightType::POINT ? glm::vec3(0.0f) : light.direction, light.cutoff);
+			data.color = glm::vec4(light.color, light.intensity);
+			data.shadow.z = type == LightType::POINT ? 0 : directional ? 1 : 2;
+
+			auto shadow = entity2Shadow.find(entity);
+			if (!light.scheduledTextureUpdate && light.IsCastingShadows() && shadow != entity2Shadow.end() &&
+				!shadow->second.views.empty())
 			{
-				std::string varName("p_lights[" + std::to_string(p) + "].position");
-				program->SetUniform(varName.c_str(), glm::vec3(/*scene->camera.GetViewMatrix() **/ glm::vec4(light.position, 1)));
-				varName = std::string("p_lights[" + std::to_string(p) + "].intensity");
-				program->SetUniform(varName.c_str(), light.intensity);
-				varName = std::string("p_lights[" + std::to_string(p) + "].color");
-				program->SetUniform(varName.c_str(), light.color);
-				varName = std::string("p_lights[" + std::to_string(p) + "].casting_shadows");
-				if (light.show)//Display light
-				{
-					program->SetUniform("shading_mode", 1);
-					program->SetUniform("to_screen_space",
-						scene->camera.GetProjectionMatrix() *
-						scene->camera.GetViewMatrix() * glm::translate(glm::mat4(1), light.position));
-					if (entity2VAOIndex.find(entity) != entity2VAOIndex.end())
-						program->vaos[entity2VAOIndex[entity]].Draw();
-				}
-				if (!light.scheduledTextureUpdate && light.IsCastingShadows() &&
-					entity2ShadowCubeIndex.find(entity) != entity2ShadowCubeIndex.end())
+				data.shadow.x = (int)shadowViewData.size();
+				data.shadow.y = (int)shadow->second.views.size();
+				//the matrices the tiles were rendered with, they can lag behind the light
+				for (const ShadowView& view : shadow->second.views)
 				{
-					program->SetUniform(varName.c_str(), 1);
-					program->shadowCubeMaps[entity2ShadowCubeIndex[entity]].Bind();
-					varName = std::string("p_shadow_maps[" + std::to_string(p) + "]");
-					program->SetUniform(varName.c_str(), 10 + light.slot);
+					ShadowViewData viewData;
+					if (view.matrix != glm::mat4(0.0f))
+						viewData.toShadowSpace = scaleBias * view.matrix;
+					viewData.rect = glm::vec4(view.rect.x, view.rect.y, view.rect.size, view.rect.size) / atlasSize;
+					shadowViewData.push_back(viewData);
 				}
-				else
-					program->SetUniform(varName.c_str(), 0);
-				p++;
 			}
-			else if (light.GetLightType() == LightType::DIRECTIONAL)
+			lightData.push_back(data);
+			if (!directional)
+				lightVolumes.push_back(BoundingVolume(light, range));
+		};
+		scene->registry.view<CLight>()
+			.each([&](const auto& entity, auto& light)
 			{
-				std::string varName("d_lights[" + std::to_string(d) + "].direction");
-				program->SetUniform(varName.c_str(), glm::vec3(scene->camera.GetViewMatrix() * glm::vec4(light.direction, 0)));
-				varName = std::string("d_lights[" + std::to_string(d) + "].intensity");
-				program->SetUniform(varName.c_str(), light.intensity);
-				varName = std::string("d_lights[" + std::to_string(d) + "].color");
-				program->SetUniform(varName.c_str(), light.color);
-				varName = std::string("d_lights[" + std::to_string(d) + "].casting_shadows");
-				if (!light.scheduledTextureUpdate && light.IsCastingShadows() &&
-					entity2ShadowMapIndex.find(entity) != entity2ShadowMapIndex.end())
-				{
-					program->SetUniform(varName.c_str(), 1);
-
-					varName = std::string("d_lights[" + std::to_string(d) + "].to_light_view_space");
-					const glm::mat4 shadowMatrix = glm::mat4(
-						0.5, 0.0, 0.0, 0.0,
-						0.0, 0.5, 0.0, 0.0,
-						0.0, 0.0, 0.5, 0.0,
-						0.5, 0.5, 0.47, 1.0
-					) * light.CalculateShadowMatrix();
-					program->SetUniform(varName.c_str(), shadowMatrix);
-
-					program->shadowTextures[entity2ShadowMapIndex[entity]].Bind();
-					varName = std::string("d_shadow_maps[" + std::to_string(d) + "]");
-					program->SetUniform(varName.c_str(), 15 + light.slot);//todo
-				}
-				else
-				{
-					program->SetUniform(varName.c_str(), 0);
-				}
-				d++;
-			}
-			else if (light.GetLightType() == LightType::SPOT)
+				if (light.GetLightType() == LightType::DIRECTIONAL)
+					addLight(entity, light);
+			});
+		directionalLightCount = (int)lightData.size();
+		scene->registry.view<CLight>()
+			.each([&](const auto& entity, auto& light)
 			{
-				std::string varName("s_lights[" + std::to_string(s) + "].position");
-				program->SetUniform(varName.c_str(), glm::vec3(scene->camera.GetViewMatrix() * glm::vec4(light.position, 1)));
-				varName = std::string("s_lights[" + std::to_string(s) + "].direction");
-				program->SetUniform(varName.c_str(), glm::vec3(scene->camera.GetViewMatrix() * glm::vec4(light.direction, 0)));
-				varName = std::string("s_lights[" + std::to_string(s) + "].intensity");
-				program->SetUniform(varName.c_str(), light.intensity);
-				varName = std::string("s_lights[" + std::to_string(s) + "].color");
-				program->SetUniform(varName.c_str(), light.color);
-				varName = std::string("s_lights[" + std::to_string(s) + "].cutoff");
-				program->SetUniform(varName.c_str(), light.cutoff);
-				varName = std::string("s_lights[" + std::to_string(s) + "].casting_shadows");
-
-				if (light.show)//Display light
-				{
-					program->SetUniform("shading_mode", 1);
-					program->SetUniform("to_screen_space",
-						scene->camera.GetProjectionMatrix() *
-						scene->camera.GetViewMatrix() * glm::translate(glm::mat4(1), light.position));
-					if (entity2VAOIndex.find(entity) != entity2VAOIndex.end())
-						program->vaos[entity2VAOIndex[entity]].Draw();
-				}
+				if (light.GetLightType() != LightType::DIRECTIONAL)
+					addLight(entity, light);
+			});
 
-				if (!light.scheduledTextureUpdate && light.IsCastingShadows() &&
-					entity2ShadowMapIndex.find(entity) != entity2ShadowMapIndex.end())
-				{
-					program->SetUniform(varName.c_str(), 1);
-
-					varName = std::string("s_lights[" + std::to_string(s) + "].to_light_view_space");
-					const glm::mat4 shadowMatrix = glm::mat4(
-						0.5, 0.0, 0.0, 0.0,
-						0.0, 0.5, 0.0, 0.0,
-						0.0, 0.0, 0.5, 0.0,
-						0.5, 0.5, 0.4998, 1.0
-					) * light.CalculateShadowMatrix();
-					program->SetUniform(varName.c_str(), shadowMatrix);
-
-					program->shadowTextures[entity2ShadowMapIndex[entity]].Bind();
-					varName = std::string("s_shadow_maps[" + std::to_string(s) + "]");
-					program->SetUniform(varName.c_str(), 20 + light.slot);
-				}
-				else
-				{
-					program->SetUniform(varName.c_str(), 0);
-				}
-				s++;
+		//the sliced depth range stops well before the far plane, further fragments share the last slice
+		Camera& camera = scene->camera;
+		lightClusters.Build(lightVolumes, camera.GetViewMatrix(), camera.GetProjectionMatrix(),
+			glm::max(camera.GetNearPlane(), 0.1f), glm::min(camera.GetFarPlane(), 1000.0f));
+		frameStats.clusterLightIndices = (unsigned int)lightClusters.GetLightIndices().size();
+		frameStats.maxLightsPerCluster = lightClusters.GetMaxLightsPerCluster();
+		frameStats.lightBinningTime = lightClusters.GetBuildTime();
+
+		//empty buffers can not be bound
+		lightCount = (int)lightData.size();
+		if (lightData.empty())
+			lightData.push_back(LightData());
+		if (shadowViewData.empty())
+			shadowViewData.push_back(ShadowViewData());
+		lightBuffer.SetData(lightData.data(), lightData.size() * sizeof(LightData));
+		shadowViewBuffer.SetData(shadowViewData.data(), shadowViewData.size() * sizeof(ShadowViewData));
+		clusterBuffer.SetData(lightClusters.GetClusters().data(), lightClusters.GetClusters().size() * sizeof(glm::uvec2));
+		const std::vector<uint32_t>& indices = lightClusters.GetLightIndices();
+		const uint32_t noIndex = 0;
+		clusterIndexBuffer.SetData(indices.empty() ? &noIndex : indices.data(),
+			std::max<size_t>(indices.size(), 1) * sizeof(uint32_t));
+	}
+
+	/*
+	* Sphere around the volume the light reaches, spot lights are bounded by the sphere around their cone
+	*/
+	static LightVolume BoundingVolume(CLight& light, float range)
+	{
+		if (light.GetLightType() != LightType::SPOT)
+			return { light.position, range };
+		const glm::vec3 direction = glm::normalize(light.direction);
+		const float cosAngle = glm::clamp(light.cutoff, 0.0f, 1.0f);
+		const float sinAngle = glm::sqrt(1.0f - cosAngle * cosAngle);
+		//wide cones are bounded by the sphere around their cap, narrow ones by the one through apex and rim
+		if (cosAngle < 0.70710678f)
+			return { light.position + direction * cosAngle * range, sinAngle * range };
+		const float radius = range / (2.0f * cosAngle);
+		return { light.position + direction * radius, radius };
+	}
+
+	/*
+	* Binds the buffers of the last UpdateLights and the shadow atlas to the program.
+	* Light gizmos are drawn with the main program when drawLightGizmos is set
+	*/
+	void SetLightUniforms(OpenGLProgram* target, bool drawLightGizmos)
+	{
+		lightBuffer.BindBase(3);
+		shadowViewBuffer.BindBase(4);
+		clusterBuffer.BindBase(5);
+		clusterIndexBuffer.BindBase(6);
+		target->SetUniform("light_count", lightCount);
+		target->SetUniform("directional_light_count", directionalLightCount);
+
+		//the tiles of the clusters follow the viewport the pass renders to
+		glm::ivec4 viewport = GLState::GetInstance().GetViewport();
+		if (viewport.z <= 0 || viewport.w <= 0)
+			GL_CALL(glGetIntegerv(GL_VIEWPORT, &viewport[0]));
+		target->SetUniform("clustered_lighting", ApplicationState::GetInstance().clusteredLighting ? 1 : 0);
+		target->SetUniform("cluster_viewport", glm::vec4(viewport));
+		target->SetUniform("cluster_near", lightClusters.GetNear());
+		target->SetUniform("cluster_slice_scale", lightClusters.GetSliceScale());
+
+		if (shadowAtlas)
+		{
+			shadowAtlas->Bind();
+			target->SetUniform("shadow_atlas", shadowAtlas->GetTextureUnit());
+		}
+
+		if (!drawLightGizmos)
+			return;
+		scene->registry.view<CLight>()
+			.each([&](const auto& entity, auto& light)
+			{
+				if (light.GetLightType() == LightType::DIRECTIONAL || !light.show)
+					return;
+				program->SetUniform("shading_mode", 1);
+				program->SetUniform("to_screen_space",
+					scene->camera.GetProjectionMatrix() *
+					scene->camera.GetViewMatrix() * glm::translate(glm::mat4(1), light.position));
+				if (entity2VAOIndex.find(entity) != entity2VAOIndex.end())
+					program->vaos[entity2VAOIndex[entity]].Draw();
+			});
+	}
+
+	/*
+	* Depth only pass over the draws of the main pass, nearest first, with the minimal shadow programs.
+	* The main pass then shades with an equal depth test, so each pixel runs the fragment shader once.
+	* All vertex shaders involved declare gl_Position invariant and build it with the same expression
+	*/
+	void RenderDepthPrePass(const glm::mat4& view, const glm::mat4& projection)
+	{
+		GL_CALL(glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE));
+		shadowProgram->Use();
+		unsigned int vaoIndex = ~0u;
+		for (const DrawItem* item : renderQueue.FrontToBack())
+		{
+			shadowProgram->SetUniform("to_screen_space", projection * (view * item->model));
+			VertexArrayObject& vao = program->vaos[item->vaoIndex];
+			vao.Draw(vao.GetDrawMode(), item->vaoIndex != vaoIndex);
+			vaoIndex = item->vaoIndex;
+		}
+
+		if (!batchCommands.empty() || !instanceGroups.empty())
+		{
+			shadowBatchedProgram->Use();
+			shadowBatchedProgram->SetUniform("to_light_space", projection * view);
+			if (!batchCommands.empty())
+			{
+				shadowBatchedProgram->SetUniform("instance_offset", -1);
+				meshBatch.Draw(batchCommands, batchDrawData.data(), batchDrawData.size() * sizeof(BatchDrawData));
 			}
-		});
-		program->SetUniform("p_light_count", p);
-		program->SetUniform("d_light_count", d);
-		program->SetUniform("s_light_count", s);
+			DrawInstanceGroups(shadowBatchedProgram.get(), false);
+		}
+		GL_CALL(glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE));
+	}
 
-		//Render meshes
-		scene->registry.view<CTriMesh>()
-		.each([&](const auto& entity, auto& mesh)
+	void MainPass()
+	{	
+		//bind GLSL program
+		program->Use();
+		
+		const glm::mat4 view = scene->camera.GetViewMatrix();
+		const glm::mat4 projection = scene->camera.GetProjectionMatrix();
+
+		//Set up lights
+		UpdateLights();
+		SetLightUniforms(program.get(), true);
+		program->SetUniform("view_matrix", view);
+
+		//The wireframe overlay shades the triangles through a variant of the programs whose geometry
+		//stage adds the edge distances, so the lines cost a few instructions per fragment
+		const bool wireframeOverlay = ApplicationState::GetInstance().renderingWireframe;
+		glm::ivec4 overlayViewport = GLState::GetInstance().GetViewport();
+		if (wireframeOverlay && (overlayViewport.z <= 0 || overlayViewport.w <= 0))
+			GL_CALL(glGetIntegerv(GL_VIEWPORT, &overlayViewport[0]));
+		if (wireframeOverlay)
 		{
-			if (entity2VAOIndex.find(entity) != entity2VAOIndex.end())
+			wireframeOverlayProgram->Use();
+			SetLightUniforms(wireframeOverlayProgram.get(), false);
+			wireframeOverlayProgram->SetUniform("viewport_size", glm::vec2(overlayViewport.z, overlayViewport.w));
+			wireframeOverlayProgram->SetUniform("view_matrix", view);
+			wireframeOverlayProgram->SetUniform("camera_pos", scene->camera.GetLookAtEye());
+			program->Use();
+		}
+
+		//Collect the draws inside the view frustum into the render queue or the static mesh batch
+		frameStats.culledObjects += CollectVisible(Frustum(projection * view));
+		frameStats.visibleObjects += GatherInstances();
+		renderQueue.Clear();
+		ClearBatchDraws();
+		ForEachVisibleMesh([&](entt::entity entity, CTriMesh& mesh)
+		{
+			if (entity2VAOIndex.find(entity) == entity2VAOIndex.end())
+				return;
 			program->vaos[entity2VAOIndex[entity]].visible = mesh.visible;
-			CPhongMaterial* material = scene->registry.try_get<CPhongMaterial>(entity);
+			if (!mesh.visible)
+				return;
+			frameStats.visibleObjects++;
 			CTransform* transform = scene->registry.try_get<CTransform>(entity);
+			CPhongMaterial* material = scene->registry.try_get<CPhongMaterial>(entity);
+			const glm::mat4 model = transform ? transform->GetModelMatrix() : glm::mat4(1.0f);
+			if (AppendBatchDraw(entity, mesh, model, material))
+				return;
 
-			const glm::mat4 m = transform ? transform->GetModelMatrix() : glm::mat4(1.0f);
-			const glm::mat4 mv = scene->camera.GetViewMatrix() * (transform ?
-				transform->GetModelMatrix() : glm::mat4(1.0f));
-			const glm::mat4 mvp = scene->camera.GetProjectionMatrix() * mv;
-
-			program->SetUniform("material.ka", material ? material->ambient : glm::vec3(0.0f));
-			program->SetUniform("material.kd", material ? material->diffuse : glm::vec3(0.0f));
-			program->SetUniform("material.ks", material ? material->specular : glm::vec3(0.0f));
-			program->SetUniform("material.shininess", material ? material->shininess : 0.0f);
-
-			program->SetUniform("to_screen_space", mvp);
-			program->SetUniform("to_view_space", mv);
-			program->SetUniform("to_world_space", m);
-			program->SetUniform("normals_to_world_space", glm::transpose(glm::inverse(glm::mat3(m))));
-			program->SetUniform("normals_to_view_space",
-				glm::transpose(glm::inverse(glm::mat3(mv))));
-			program->SetUniform("camera_pos", scene->camera.GetLookAtEye());
-			//program->SetUniform("displacement_multiplier", 0.0f);
-			//program->SetUniform("tessellation_level", 1);
+			DrawItem item;
+			item.entity = entity;
+			item.vaoIndex = entity2VAOIndex[entity];
+			item.shadingMode = mesh.GetShadingMode();
+			item.material = material;
+			item.model = model;
+			item.viewDepth = -(view * item.model * glm::vec4(mesh.GetBoundingBoxCenter(), 1.0f)).z;
 
 			CImageMaps* imgMaps = scene->registry.try_get<CImageMaps>(entity);
 			if (imgMaps && !imgMaps->scheduledTextureUpdate)
 			{
-				//iterate over all imagemaps
 				for (auto it = imgMaps->mapsBegin(); it != imgMaps->mapsEnd(); ++it)
 				{
 					if (it->second.GetBindingSlot() == ImageMap::BindingSlot::ENV_MAP)
 					{
-						int texIndex = entity2EnvMapIndex[entity];
-						//bind texture
-						if (texIndex < program->cubeMaps.size())
-						{
-							program->cubeMaps[texIndex].Bind();
-							program->SetUniform("has_env_map", 1);
-							program->SetUniform("env_map", (int)it->second.GetBindingSlot());
-						}
+						if (entity2EnvMapIndex.find(entity) != entity2EnvMapIndex.end() &&
+							entity2EnvMapIndex[entity] < program->cubeMaps.size())
+							item.envMapIndex = entity2EnvMapIndex[entity];
 					}
-					else
+					else if (entity2TextureIndices.find(entity) != entity2TextureIndices.end())
 					{
 						int texIndex = entity2TextureIndices[entity].v[(int)it->first];
-						//bind texture
 						if (texIndex >= 0)
 						{
-							if (it->second.IsRenderedImage())
-								program->SetUniform("mirror_reflection", 1);
-							else
-								program->SetUniform("mirror_reflection", 0);
-							program->textures[texIndex].Bind();
-							//set uniform
-							const std::string uniformName = std::string("has_texture[") + std::to_string(((int)it->first)) + std::string("]");
-							program->SetUniform(uniformName.c_str(), 1);
-							const std::string uniformName2 = std::string("tex_list[") + std::to_string(((int)it->first)) + std::string("]");
-							program->SetUniform(uniformName2.c_str(), ((int)it->first));
-							if (it->first == ImageMap::BindingSlot::DISPLACEMENT)
-							{
-							/*	program->SetUniform("tessellation_level", mesh.tessellationLevel);
-								program->SetUniform("displacement_multiplier",
-									imgMaps->GetImageMap(ImageMap::BindingSlot::DISPLACEMENT).dispMultiplier);
-								program->SetUniform("displacement_map", 4);*/
-								//program->textures[texIndex].Bind();
-							}
+							item.textureIndices[(int)it->first] = texIndex;
+							item.mirrorReflection |= it->second.IsRenderedImage();
 						}
 					}
 				}
 			}
-			program->SetUniform("shading_mode", ((int)mesh.GetShadingMode()));
-			if (entity2VAOIndex.find(entity) != entity2VAOIndex.end())
-				program->vaos[entity2VAOIndex[entity]].Draw(/*GL_PATCHES*/);
-			//Reset uniforms
+			renderQueue.Push(item, scene->camera.GetNearPlane(), scene->camera.GetFarPlane());
+		});
+		renderQueue.Sort();
+		SortBatchDrawsFrontToBack(view);
+
+		//With the depth laid down first only the visible surface of each pixel passes the equal test
+		const bool depthPrePass = ApplicationState::GetInstance().depthPrePass;
+		if (depthPrePass)
+		{
+			RenderDepthPrePass(view, projection);
+			program->Use();
+			GLState::GetInstance().DepthFunc(GL_EQUAL);
+			GLState::GetInstance().DepthMask(GL_FALSE);
+		}
+		//overdraw is only measured for the pass on screen
+		const bool countSamples = !renderingOffscreen && shadedSamplesQuery.Begin();
+
+		//Submit the sorted draws skipping state that is already set
+		RenderStateCache cache;
+		bool usedTextureUnit[5] = { false,false,false,false,false };
+		int usedEnvMap = -1;
+		program->SetUniform("camera_pos", scene->camera.GetLookAtEye());
+		OpenGLProgram* shading = program.get();
+		//clears the sampling uniforms the queue set on a program
+		auto resetSamplingUniforms = [&](OpenGLProgram* target)
+		{
 			for (int i = 0; i < 5; i++)
 			{
-				const std::string uniformName = std::string("has_texture[") + std::to_string(i) + std::string("]");
-				program->SetUniform(uniformName.c_str(), 0);
+				if (cache.hasTexture[i] == 1)
+				{
+					const std::string uniformName = std::string("has_texture[") + std::to_string(i) + std::string("]");
+					target->SetUniform(uniformName.c_str(), 0);
+				}
 			}
-			for (auto tex : program->textures)
+			if (cache.envMapIndex >= 0)
+				target->SetUniform("has_env_map", 0);
+			target->SetUniform("mirror_reflection", 0);
+		};
+		for (auto& item : renderQueue)
+		{
+			//lines and points can't go through the overlay's triangle geometry stage
+			OpenGLProgram* target = wireframeOverlay &&
+				program->vaos[item.vaoIndex].GetDrawMode() == GL_TRIANGLES ? wireframeOverlayProgram.get() : program.get();
+			if (target != shading)
 			{
-				tex.Unbind();
+				resetSamplingUniforms(shading);
+				cache.ForgetUniforms();
+				shading = target;
+				shading->Use();
 			}
-			program->SetUniform("has_env_map", 0);
-			for (auto tex : program->cubeMaps)
+
+			if (cache.MaterialChanged(item.material))
 			{
-				tex.Unbind();
+				shading->SetUniform("material.ka", cache.ka);
+				shading->SetUniform("material.kd", cache.kd);
+				shading->SetUniform("material.ks", cache.ks);
+				shading->SetUniform("material.shininess", cache.shininess);
 			}
-				
-		});
+
+			const glm::mat4 mv = view * item.model;
+			shading->SetUniform("to_screen_space", projection * mv);
+			shading->SetUniform("to_view_space", mv);
+			shading->SetUniform("to_world_space", item.model);
+			shading->SetUniform("normals_to_world_space", glm::transpose(glm::inverse(glm::mat3(item.model))));
+			shading->SetUniform("normals_to_view_space", glm::transpose(glm::inverse(glm::mat3(mv))));
+
+			for (int i = 0; i < 5; i++)
+			{
+				const int hasTexture = item.textureIndices[i] >= 0 ? 1 : 0;
+				if (hasTexture)
+				{
+					Texture2D& texture = program->textures[item.textureIndices[i]];
+					if (cache.Changed(cache.boundTextures[i], texture.GetGLID()))
+						texture.Bind();
+					usedTextureUnit[i] = true;
+				}
+				if (cache.Changed(cache.hasTexture[i], hasTexture))
+				{
+					const std::string uniformName = std::string("has_texture[") + std::to_string(i) + std::string("]");
+					shading->SetUniform(uniformName.c_str(), hasTexture);
+					if (hasTexture)
+					{
+						const std::string uniformName2 = std::string("tex_list[") + std::to_string(i) + std::string("]");
+						shading->SetUniform(uniformName2.c_str(), i);
+					}
+				}
+			}
+			if (cache.Changed(cache.mirrorReflection, item.mirrorReflection ? 1 : 0))
+				shading->SetUniform("mirror_reflection", cache.mirrorReflection);
+			if (cache.Changed(cache.envMapIndex, item.envMapIndex))
+			{
+				if (item.envMapIndex >= 0)
+				{
+					program->cubeMaps[item.envMapIndex].Bind();
+					shading->SetUniform("has_env_map", 1);
+					shading->SetUniform("env_map", (int)ImageMap::BindingSlot::ENV_MAP);
+					usedEnvMap = item.envMapIndex;
+				}
+				else
+					shading->SetUniform("has_env_map", 0);
+			}
+			if (cache.Changed(cache.shadingMode, (int)item.shadingMode))
+				shading->SetUniform("shading_mode", cache.shadingMode);
+
+			const bool bindVAO = cache.Changed(cache.vaoIndex, (int)item.vaoIndex);
+			program->vaos[item.vaoIndex].Draw(program->vaos[item.vaoIndex].GetDrawMode(), bindVAO);
+			frameStats.draws++;
+		}
+		resetSamplingUniforms(shading);
+		if (shading != program.get())
+			program->Use();
+
+		//Issue every batched static mesh with a single multi draw and every
+		//group of instances with a single instanced draw
+		if (!batchCommands.empty() || !instanceGroups.empty())
+		{
+			OpenGLProgram* batched = wireframeOverlay ? wireframeOverlayBatchedProgram.get() : batchedProgram.get();
+			batched->Use();
+			SetLightUniforms(batched, false);
+			batched->SetUniform("view_matrix", view);
+			batched->SetUniform("view_projection_matrix", projection * view);
+			batched->SetUniform("camera_pos", scene->camera.GetLookAtEye());
+			batched->SetUniform("shading_mode", 0);
+			if (wireframeOverlay)
+				batched->SetUniform("viewport_size", glm::vec2(overlayViewport.z, overlayViewport.w));
+			if (!batchCommands.empty())
+			{
+				batched->SetUniform("instance_offset", -1);
+				meshBatch.Draw(batchCommands, batchDrawData.data(), batchDrawData.size() * sizeof(BatchDrawData));
+				frameStats.draws++;
+				frameStats.batchedMeshes += batchCommands.size();
+			}
+			DrawInstanceGroups(batched, true);
+			program->Use();
+		}
+
+		if (countSamples)
+			shadedSamplesQuery.End();
+		if (depthPrePass)
+		{
+			GLState::GetInstance().DepthFunc(GL_LESS);
+			GLState::GetInstance().DepthMask(GL_TRUE);
+		}
+		if (!renderingOffscreen)
+		{
+			glm::ivec4 viewport = GLState::GetInstance().GetViewport();
+			if (viewport.z <= 0 || viewport.w <= 0)
+				GL_CALL(glGetIntegerv(GL_VIEWPORT, &viewport[0]));
+			frameStats.shadedSamples = shadedSamplesQuery.GetLatest();
+			frameStats.shadedSamplesPerPixel = (float)((double)frameStats.shadedSamples / glm::max(viewport.z * viewport.w, 1));
+		}
+
+		//Reset the sampling state once per pass instead of once per draw so rendered
+		//textures are never left bound while they are being rendered into
+		for (int i = 0; i < 5; i++)
+		{
+			if (usedTextureUnit[i])
+				GLState::GetInstance().BindTexture(GL_TEXTURE0 + i, GL_TEXTURE_2D, 0);
+		}
+		if (usedEnvMap >= 0)
+			program->cubeMaps[usedEnvMap].Unbind();
+		frameStats.stateChanges += cache.stateChanges;
+		frameStats.skippedStateChanges += cache.skippedChanges;
+
 		/*program->SetUniform("displacement_multiplier", 0.0f);
 		program->SetUniform("tessellation_level", 1);*/
 		
 		//Render skybox
-		GL_CALL(glDepthMask(GL_FALSE));//TODO
+		GLState::GetInstance().DepthMask(GL_FALSE);//TODO
 		scene->registry.view<CSkyBox>()
 			.each([&](const auto& entity, auto& env)
 				{
@@ -1707,10 +2273,12 @@ public:
 						program->cubeMaps[cubemapIndex].Unbind();
 					}
 				});
-		GL_CALL(glDepthMask(GL_TRUE));//TODO
+		GLState::GetInstance().DepthMask(GL_TRUE);//TODO
 		
-		if (ApplicationState::GetInstance().renderingWireframe)
+		if (wireframeOverlay)
 			RenderWireframe();
+
+		ApplicationState::GetInstance().renderStats = frameStats;
 	}
 
 	void End()
@@ -1733,10 +2301,39 @@ public:
 			program->AttachFragmentShader();
 			shadowProgram->AttachVertexShader();
 			shadowProgram->AttachFragmentShader();
+			if (batchedProgram->CompileShaders() && shadowBatchedProgram->CompileShaders())
+			{
+				batchedProgram->AttachVertexShader();
+				batchedProgram->AttachFragmentShader();
+				shadowBatchedProgram->AttachVertexShader();
+				shadowBatchedProgram->AttachFragmentShader();
+			}
+			if (shadowCubeProgram->CompileShaders() && shadowCubeBatchedProgram->CompileShaders())
+			{
+				shadowCubeProgram->AttachVertexShader();
+				shadowCubeProgram->AttachGeometryShader();
+				shadowCubeProgram->AttachFragmentShader();
+				shadowCubeBatchedProgram->AttachVertexShader();
+				shadowCubeBatchedProgram->AttachGeometryShader();
+				shadowCubeBatchedProgram->AttachFragmentShader();
+			}
 			wireframeProgram->AttachVertexShader();
 			wireframeProgram->AttachGeometryShader();
 			wireframeProgram->AttachTessellationShaders();
 			wireframeProgram->AttachFragmentShader();
+			adaptiveWireframeProgram->AttachVertexShader();
+			adaptiveWireframeProgram->AttachGeometryShader();
+			adaptiveWireframeProgram->AttachTessellationShaders();
+			adaptiveWireframeProgram->AttachFragmentShader();
+			if (wireframeOverlayProgram->CompileShaders() && wireframeOverlayBatchedProgram->CompileShaders())
+			{
+				wireframeOverlayProgram->AttachVertexShader();
+				wireframeOverlayProgram->AttachGeometryShader();
+				wireframeOverlayProgram->AttachFragmentShader();
+				wireframeOverlayBatchedProgram->AttachVertexShader();
+				wireframeOverlayBatchedProgram->AttachGeometryShader();
+				wireframeOverlayBatchedProgram->AttachFragmentShader();
+			}
 		}
 		else
 		{
@@ -1755,12 +2352,34 @@ public:
 		
 		shadowProgram->SetVertexShaderSourceFromFile("../assets/shaders/shadow/shadow.vert");
 		shadowProgram->SetFragmentShaderSourceFromFile("../assets/shaders/shadow/shadow.frag");
+
+		batchedProgram->SetVertexShaderSourceFromFile("../assets/shaders/phong_batched/shader.vert");
+		batchedProgram->SetFragmentShaderSourceFromFile("../assets/shaders/phong_textured/shader.frag");
+		shadowBatchedProgram->SetVertexShaderSourceFromFile("../assets/shaders/shadow/shadow_batched.vert");
+		shadowBatchedProgram->SetFragmentShaderSourceFromFile("../assets/shaders/shadow/shadow.frag");
+		shadowCubeProgram->SetVertexShaderSourceFromFile("../assets/shaders/shadow/shadow_cube.vert");
+		shadowCubeProgram->SetGeometryShaderSourceFromFile("../assets/shaders/shadow/shadow_cube.geom");
+		shadowCubeProgram->SetFragmentShaderSourceFromFile("../assets/shaders/shadow/shadow.frag");
+		shadowCubeBatchedProgram->SetVertexShaderSourceFromFile("../assets/shaders/shadow/shadow_cube_batched.vert");
+		shadowCubeBatchedProgram->SetGeometryShaderSourceFromFile("../assets/shaders/shadow/shadow_cube.geom");
+		shadowCubeBatchedProgram->SetFragmentShaderSourceFromFile("../assets/shaders/shadow/shadow.frag");
 		
 		wireframeProgram->SetVertexShaderSourceFromFile("../assets/shaders/wireframe/wireframe.vert");
 		wireframeProgram->SetGeometryShaderSourceFromFile("../assets/shaders/wireframe/wireframe.geom");
 		wireframeProgram->SetFragmentShaderSourceFromFile("../assets/shaders/wireframe/wireframe.frag");
 		wireframeProgram->SetTessellationShaderSourcesFromFiles("../assets/shaders/tessellation/subdivide.tesc",
 			"../assets/shaders/tessellation/subdivide.tese");
+		adaptiveWireframeProgram->SetVertexShaderSourceFromFile("../assets/shaders/wireframe/wireframe.vert");
+		adaptiveWireframeProgram->SetGeometryShaderSourceFromFile("../assets/shaders/wireframe/wireframe.geom");
+		adaptiveWireframeProgram->SetFragmentShaderSourceFromFile("../assets/shaders/wireframe/wireframe.frag");
+		adaptiveWireframeProgram->SetTessellationShaderSourcesFromFiles("../assets/shaders/tessellation/subdivide.tesc",
+			"../assets/shaders/tessellation/subdivide_adaptive.tese");
+		wireframeOverlayProgram->SetVertexShaderSourceFromFile("../assets/shaders/phong_textured/shader.vert");
+		wireframeOverlayProgram->SetGeometryShaderSourceFromFile("../assets/shaders/phong_textured/wireframe_overlay.geom");
+		wireframeOverlayProgram->SetFragmentShaderSourceFromFile("../assets/shaders/phong_textured/shader.frag");
+		wireframeOverlayBatchedProgram->SetVertexShaderSourceFromFile("../assets/shaders/phong_batched/shader.vert");
+		wireframeOverlayBatchedProgram->SetGeometryShaderSourceFromFile("../assets/shaders/phong_textured/wireframe_overlay.geom");
+		wireframeOverlayBatchedProgram->SetFragmentShaderSourceFromFile("../assets/shaders/phong_textured/shader.frag");
 		
 		RecompileShaders();
 	}
@@ -1927,6 +2546,301 @@ public:
 private:
 	std::unique_ptr<OpenGLProgram> shadowProgram;
 	std::unique_ptr<OpenGLProgram> wireframeProgram;
+	std::unique_ptr<OpenGLProgram> adaptiveWireframeProgram;
+	std::unique_ptr<OpenGLProgram> wireframeOverlayProgram;
+	std::unique_ptr<OpenGLProgram> wireframeOverlayBatchedProgram;
+	DelayedQuery tessellationQuery = DelayedQuery(GL_PRIMITIVES_GENERATED);
+	DelayedReadback<float> tessellationStats;//longest generated edge, written by subdivide.tesc
+
+	RenderQueue renderQueue;
+	RenderStats frameStats;
+	OffscreenScheduler offscreenScheduler;
+
+	//--static mesh batching--//
+	std::unique_ptr<OpenGLProgram> batchedProgram;
+	std::unique_ptr<OpenGLProgram> shadowBatchedProgram;
+	std::unique_ptr<OpenGLProgram> shadowCubeProgram;
+	std::unique_ptr<OpenGLProgram> shadowCubeBatchedProgram;
+	MeshBatch meshBatch;
+	std::unordered_map<entt::entity, int> entity2BatchSlot;
+	std::vector<DrawElementsIndirectCommand> batchCommands;
+	std::vector<BatchDrawData> batchDrawData;
+
+	//--instancing--//
+	struct InstanceGroup
+	{
+		entt::entity source;
+		unsigned int vaoIndex;
+		unsigned int offset;
+		unsigned int count;
+	};
+	std::unordered_map<entt::entity, std::vector<BatchDrawData>> instanceLists;
+	std::vector<InstanceGroup> instanceGroups;
+	std::vector<BatchDrawData> instanceData;
+	ShaderStorageBuffer instanceBuffer;
+
+	//--lights--//
+	std::vector<LightData> lightData;
+	std::vector<ShadowViewData> shadowViewData;
+	std::vector<LightVolume> lightVolumes;
+	int lightCount = 0;
+	int directionalLightCount = 0;
+	ShaderStorageBuffer lightBuffer;
+	ShaderStorageBuffer shadowViewBuffer;
+
+	//--clustered lighting--//
+	LightClusters lightClusters;
+	ShaderStorageBuffer clusterBuffer;
+	ShaderStorageBuffer clusterIndexBuffer;
+
+	//--depth pre-pass--//
+	DelayedQuery shadedSamplesQuery = DelayedQuery(GL_SAMPLES_PASSED);
+	bool renderingOffscreen = false;//MainPass is drawing the view of a rendered texture or env map
+
+	//--frustum culling--//
+	std::vector<entt::entity> visibleMeshes;
+	std::vector<entt::entity> visibleInstances;
+	std::unordered_map<entt::entity, int> casterFaces;//cube faces each caster of the last CollectVisibleCube reaches
+
+	/*
+	* Collects the meshes and instances inside the frustum with a query on the scene BVH. Meshes without
+	* bounds are always collected. Returns the number of entities that were culled
+	*/
+	unsigned int CollectVisible(const Frustum& frustum)
+	{
+		visibleMeshes.clear();
+		visibleInstances.clear();
+		if (ApplicationState::GetInstance().frustumCulling)
+		{
+			scene->bvh.Query(frustum, [&](entt::entity entity)
+				{
+					if (scene->registry.all_of<CInstanced>(entity))
+						visibleInstances.push_back(entity);
+					else
+						visibleMeshes.push_back(entity);
+				});
+			const auto& unbounded = scene->GetUnboundedEntities();
+			visibleMeshes.insert(visibleMeshes.end(), unbounded.begin(), unbounded.end());
+		}
+		else
+		{
+			for (auto entity : scene->registry.view<CTriMesh>())
+				visibleMeshes.push_back(entity);
+			for (auto entity : scene->registry.view<CInstanced>())
+				visibleInstances.push_back(entity);
+		}
+		const size_t total = scene->registry.view<CTriMesh>().size() + scene->registry.view<CInstanced>().size();
+		const size_t collected = visibleMeshes.size() + visibleInstances.size();
+		return total > collected ? (unsigned int)(total - collected) : 0;
+	}
+
+	/*
+	* CollectVisible for the six faces of a shadow cube map, also fills casterFaces with the bit mask
+	* of the faces each entity is seen by. Returns the number of entities outside every face
+	*/
+	unsigned int CollectVisibleCube(const std::array<glm::mat4, 6>& faceMatrices)
+	{
+		casterFaces.clear();
+		if (ApplicationState::GetInstance().frustumCulling)
+		{
+			for (int i = 0; i < 6; i++)
+				scene->bvh.Query(Frustum(faceMatrices[i]), [&](entt::entity entity) { casterFaces[entity] |= 1 << i; });
+			for (auto entity : scene->GetUnboundedEntities())
+				casterFaces[entity] = 63;
+		}
+		else
+		{
+			for (auto entity : scene->registry.view<CTriMesh>())
+				casterFaces[entity] = 63;
+			for (auto entity : scene->registry.view<CInstanced>())
+				casterFaces[entity] = 63;
+		}
+
+		visibleMeshes.clear();
+		visibleInstances.clear();
+		for (const auto& [entity, faces] : casterFaces)
+		{
+			if (scene->registry.all_of<CInstanced>(entity))
+				visibleInstances.push_back(entity);
+			else
+				visibleMeshes.push_back(entity);
+		}
+		const size_t total = scene->registry.view<CTriMesh>().size() + scene->registry.view<CInstanced>().size();
+		const size_t collected = visibleMeshes.size() + visibleInstances.size();
+		return total > collected ? (unsigned int)(total - collected) : 0;
+	}
+
+	/*
+	* Calls callback(entity, mesh) for every mesh collected by the last CollectVisible
+	*/
+	template <typename F>
+	void ForEachVisibleMesh(F callback)
+	{
+		for (auto entity : visibleMeshes)
+		{
+			auto* mesh = scene->registry.try_get<CTriMesh>(entity);
+			if (mesh)
+				callback(entity, *mesh);
+		}
+	}
+
+	/*
+	* Groups the instances collected by the last CollectVisible by their source mesh and uploads
+	* their per instance data into one shader storage buffer. Returns the number of instances.
+	* The cube face masks of the instances go into ka.w when given
+	*/
+	unsigned int GatherInstances(const std::unordered_map<entt::entity, int>* faceMasks = nullptr)
+	{
+		for (auto& [source, list] : instanceLists)
+			list.clear();
+		instanceGroups.clear();
+		instanceData.clear();
+
+		for (auto entity : visibleInstances)
+		{
+			auto* instanced = scene->registry.try_get<CInstanced>(entity);
+			auto* transform = scene->registry.try_get<CTransform>(entity);
+			if (!instanced || !transform || !instanced->visible || !scene->registry.valid(instanced->source) ||
+				entity2VAOIndex.find(instanced->source) == entity2VAOIndex.end())
+				continue;
+			const glm::mat4 model = transform->GetModelMatrix();
+			CPhongMaterial* material = scene->registry.try_get<CPhongMaterial>(entity);
+			if (!material)
+				material = scene->registry.try_get<CPhongMaterial>(instanced->source);
+
+			BatchDrawData data;
+			data.model = model;
+			data.normalMatrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(model))));
+			if (material)
+			{
+				data.ka = glm::vec4(material->ambient, 0.0f);
+				data.kd = glm::vec4(material->diffuse, 0.0f);
+				data.ks = glm::vec4(material->specular, material->shininess);
+			}
+			if (faceMasks)
+				data.ka.w = (float)faceMasks->at(entity);
+			instanceLists[instanced->source].push_back(data);
+		}
+
+		for (auto& [source, list] : instanceLists)
+		{
+			if (list.empty() || entity2VAOIndex.find(source) == entity2VAOIndex.end())
+				continue;
+			instanceGroups.push_back({ source, entity2VAOIndex[source],
+				(unsigned int)instanceData.size(), (unsigned int)list.size() });
+			instanceData.insert(instanceData.end(), list.begin(), list.end());
+		}
+		if (!instanceData.empty())
+			instanceBuffer.SetData(instanceData.data(), instanceData.size() * sizeof(BatchDrawData));
+		return instanceData.size();
+	}
+
+	/*
+	* Issues one instanced draw per source mesh with the given program. Textures of the source
+	* mesh are bound when bindTextures is set
+	*/
+	void DrawInstanceGroups(OpenGLProgram* target, bool bindTextures)
+	{
+		if (instanceGroups.empty())
+			return;
+		instanceBuffer.BindBase(0);
+		for (auto& group : instanceGroups)
+		{
+			const bool textured = bindTextures &&
+				entity2TextureIndices.find(group.source) != entity2TextureIndices.end();
+			if (textured)
+			{
+				for (int i = 0; i < 5; i++)
+				{
+					const int texIndex = entity2TextureIndices[group.source].v[i];
+					if (texIndex < 0)
+						continue;
+					program->textures[texIndex].Bind();
+					const std::string uniformName = std::string("has_texture[") + std::to_string(i) + std::string("]");
+					target->SetUniform(uniformName.c_str(), 1);
+					const std::string uniformName2 = std::string("tex_list[") + std::to_string(i) + std::string("]");
+					target->SetUniform(uniformName2.c_str(), i);
+				}
+			}
+
+			target->SetUniform("instance_offset", (int)group.offset);
+			program->vaos[group.vaoIndex].DrawInstanced(group.count);
+			if (bindTextures)
+			{
+				frameStats.draws++;
+				frameStats.instances += group.count;
+			}
+
+			if (textured)
+			{
+				for (int i = 0; i < 5; i++)
+				{
+					const int texIndex = entity2TextureIndices[group.source].v[i];
+					if (texIndex < 0)
+						continue;
+					const std::string uniformName = std::string("has_texture[") + std::to_string(i) + std::string("]");
+					target->SetUniform(uniformName.c_str(), 0);
+					program->textures[texIndex].Unbind();
+				}
+			}
+		}
+		target->SetUniform("instance_offset", -1);
+	}
+
+	void ClearBatchDraws()
+	{
+		batchCommands.clear();
+		batchDrawData.clear();
+	}
+
+	/*
+	* Orders the multi draw lists nearest first by the origin of each draw, commands and data together
+	*/
+	void SortBatchDrawsFrontToBack(const glm::mat4& view)
+	{
+		const size_t count = batchCommands.size();
+		if (count < 2)
+			return;
+		std::vector<std::pair<float, unsigned int>> order(count);
+		for (size_t i = 0; i < count; i++)
+			order[i] = { -(view * batchDrawData[i].model[3]).z, (unsigned int)i };
+		std::sort(order.begin(), order.end());
+		std::vector<DrawElementsIndirectCommand> commands(count);
+		std::vector<BatchDrawData> data(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			commands[i] = batchCommands[order[i].second];
+			data[i] = batchDrawData[order[i].second];
+		}
+		batchCommands.swap(commands);
+		batchDrawData.swap(data);
+	}
+
+	/*
+	* Appends the entity to the multi draw lists if it lives in the static mesh batch and
+	* can be drawn without per mesh textures. Returns false if it has to be drawn on its own
+	*/
+	bool AppendBatchDraw(entt::entity entity, CTriMesh& mesh, const glm::mat4& model, CPhongMaterial* material)
+	{
+		if (!ApplicationState::GetInstance().batchStaticMeshes ||
+			entity2BatchSlot.find(entity) == entity2BatchSlot.end() ||
+			mesh.GetShadingMode() != ShadingMode::PHONG ||
+			scene->registry.any_of<CImageMaps, CSoftBody>(entity))
+			return false;
+
+		batchCommands.push_back(meshBatch.GetCommand(entity2BatchSlot[entity]));
+		BatchDrawData data;
+		data.model = model;
+		data.normalMatrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(model))));
+		if (material)
+		{
+			data.ka = glm::vec4(material->ambient, 0.0f);
+			data.kd = glm::vec4(material->diffuse, 0.0f);
+			data.ks = glm::vec4(material->specular, material->shininess);
+		}
+		batchDrawData.push_back(data);
+		return true;
+	}
 	
 	//--orbit controls--//
 	bool m1Down = false;
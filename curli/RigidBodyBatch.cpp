@@ -0,0 +1,201 @@
+#include <RigidBodyBatch.h>
+#include <ParallelFor.h>
+#include <xmmintrin.h>
+#include <algorithm>
+
+namespace
+{
+	inline __m128 dot3(__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz)
+	{
+		return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz));
+	}
+
+	//3x3 matrix per lane, m[row][column]
+	struct Mat3x4
+	{
+		__m128 m[3][3];
+	};
+
+	inline Mat3x4 rotationOf(__m128 w, __m128 x, __m128 y, __m128 z)
+	{
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 two = _mm_set1_ps(2.0f);
+		const __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+		const __m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+		const __m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+		Mat3x4 r;
+		r.m[0][0] = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz)));
+		r.m[0][1] = _mm_mul_ps(two, _mm_sub_ps(xy, wz));
+		r.m[0][2] = _mm_mul_ps(two, _mm_add_ps(xz, wy));
+		r.m[1][0] = _mm_mul_ps(two, _mm_add_ps(xy, wz));
+		r.m[1][1] = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz)));
+		r.m[1][2] = _mm_mul_ps(two, _mm_sub_ps(yz, wx));
+		r.m[2][0] = _mm_mul_ps(two, _mm_sub_ps(xz, wy));
+		r.m[2][1] = _mm_mul_ps(two, _mm_add_ps(yz, wx));
+		r.m[2][2] = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy)));
+		return r;
+	}
+
+	//w = R * I_rest^{-1} * R^T * L
+	inline void angularVelocity(const Mat3x4& r, const Mat3x4& invInertia, const __m128 l[3], __m128 w[3])
+	{
+		__m128 local[3], scaled[3];
+		for (int i = 0; i < 3; i++)
+			local[i] = dot3(r.m[0][i], r.m[1][i], r.m[2][i], l[0], l[1], l[2]);
+		for (int i = 0; i < 3; i++)
+			scaled[i] = dot3(invInertia.m[i][0], invInertia.m[i][1], invInertia.m[i][2], local[0], local[1], local[2]);
+		for (int i = 0; i < 3; i++)
+			w[i] = dot3(r.m[i][0], r.m[i][1], r.m[i][2], scaled[0], scaled[1], scaled[2]);
+	}
+}
+
+void RigidBodyBatch::Clear()
+{
+	entities.clear();
+	bodies.clear();
+	for (auto* array : { &px, &py, &pz, &lx, &ly, &lz, &ax, &ay, &az, &qw, &qx, &qy, &qz, &mass, &invMass, &drag, &gravity })
+		array->clear();
+	for (auto& array : invInertia)
+		array.clear();
+	moved.clear();
+}
+
+void RigidBodyBatch::Add(entt::entity entity, CRigidBody& rigidBody)
+{
+	entities.push_back(entity);
+	bodies.push_back(&rigidBody);
+	px.push_back(rigidBody.position.x); py.push_back(rigidBody.position.y); pz.push_back(rigidBody.position.z);
+	lx.push_back(rigidBody.linearMomentum.x); ly.push_back(rigidBody.linearMomentum.y); lz.push_back(rigidBody.linearMomentum.z);
+	ax.push_back(rigidBody.angularMomentum.x); ay.push_back(rigidBody.angularMomentum.y); az.push_back(rigidBody.angularMomentum.z);
+	const glm::quat q = rigidBody.GetOrientation();
+	qw.push_back(q.w); qx.push_back(q.x); qy.push_back(q.y); qz.push_back(q.z);
+	mass.push_back(rigidBody.mass);
+	invMass.push_back(rigidBody.mass > 0.0f ? 1.0f / rigidBody.mass : 0.0f);
+	drag.push_back(rigidBody.drag);
+	gravity.push_back(rigidBody.gravity);
+	const glm::mat3 inertia = rigidBody.GetInverseInertiaTensorAtRest();
+	for (int column = 0; column < 3; column++)
+		for (int row = 0; row < 3; row++)
+			invInertia[column * 3 + row].push_back(inertia[column][row]);
+}
+
+void RigidBodyBatch::Integrate(float dt)
+{
+	const int count = (int)entities.size();
+	if (count == 0)
+		return;
+	//pad to a multiple of four with bodies at rest so the kernel needs no remainder loop
+	const int padded = (count + 3) & ~3;
+	for (auto* array : { &px, &py, &pz, &lx, &ly, &lz, &ax, &ay, &az, &qx, &qy, &qz, &mass, &invMass, &drag, &gravity })
+		array->resize(padded, 0.0f);
+	qw.resize(padded, 1.0f);
+	for (auto& array : invInertia)
+		array.resize(padded, 0.0f);
+	moved.assign(padded, 0);
+
+	forEachBlock(padded, chunkSize, [&](int begin, int end) { IntegrateRange(begin, end, dt); });
+}
+
+void RigidBodyBatch::IntegrateRange(int begin, int end, float dt)
+{
+	const __m128 vdt = _mm_set1_ps(dt);
+	const __m128 halfDt = _mm_set1_ps(0.5f * dt);
+	const __m128 linearDrag = _mm_set1_ps(-0.5f * dt);
+	const __m128 angularDrag = _mm_set1_ps(-0.5f * dt * 100.f);
+
+	for (int i = begin; i < end; i += 4)
+	{
+		const __m128 im = _mm_loadu_ps(&invMass[i]);
+		const __m128 dragCoefficient = _mm_loadu_ps(&drag[i]);
+
+		//linear: drag, gravity, then move with the new velocity
+		__m128 l[3] = { _mm_loadu_ps(&lx[i]), _mm_loadu_ps(&ly[i]), _mm_loadu_ps(&lz[i]) };
+		__m128 v[3] = { _mm_mul_ps(l[0], im), _mm_mul_ps(l[1], im), _mm_mul_ps(l[2], im) };
+		__m128 k = _mm_mul_ps(_mm_mul_ps(linearDrag, dragCoefficient), _mm_sqrt_ps(dot3(v[0], v[1], v[2], v[0], v[1], v[2])));
+		for (int j = 0; j < 3; j++)
+			l[j] = _mm_add_ps(l[j], _mm_mul_ps(k, v[j]));
+		l[1] = _mm_sub_ps(l[1], _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(&gravity[i]), _mm_loadu_ps(&mass[i])), vdt));
+		const __m128 p0[3] = { _mm_loadu_ps(&px[i]), _mm_loadu_ps(&py[i]), _mm_loadu_ps(&pz[i]) };
+		__m128 p[3];
+		for (int j = 0; j < 3; j++)
+			p[j] = _mm_add_ps(p0[j], _mm_mul_ps(_mm_mul_ps(l[j], im), vdt));
+
+		//angular: drag, then rotate the quaternion with the new angular velocity
+		Mat3x4 inertia;
+		for (int column = 0; column < 3; column++)
+			for (int row = 0; row < 3; row++)
+				inertia.m[row][column] = _mm_loadu_ps(&invInertia[column * 3 + row][i]);
+		const __m128 q0[4] = { _mm_loadu_ps(&qw[i]), _mm_loadu_ps(&qx[i]), _mm_loadu_ps(&qy[i]), _mm_loadu_ps(&qz[i]) };
+		const Mat3x4 r = rotationOf(q0[0], q0[1], q0[2], q0[3]);
+		__m128 a[3] = { _mm_loadu_ps(&ax[i]), _mm_loadu_ps(&ay[i]), _mm_loadu_ps(&az[i]) };
+		__m128 w[3];
+		angularVelocity(r, inertia, a, w);
+		k = _mm_mul_ps(_mm_mul_ps(angularDrag, dragCoefficient), _mm_sqrt_ps(dot3(w[0], w[1], w[2], w[0], w[1], w[2])));
+		for (int j = 0; j < 3; j++)
+			a[j] = _mm_add_ps(a[j], _mm_mul_ps(k, w[j]));
+		angularVelocity(r, inertia, a, w);
+
+		__m128 q[4] = { q0[0], q0[1], q0[2], q0[3] };
+		for (int step = 0; step < 2; step++)//applied twice like CRigidBody::TakeFwEulerStep
+		{
+			//q += dt / 2 * (0, w) * q
+			const __m128 dw = _mm_sub_ps(_mm_setzero_ps(), dot3(w[0], w[1], w[2], q[1], q[2], q[3]));
+			const __m128 dx = _mm_add_ps(_mm_mul_ps(q[0], w[0]), _mm_sub_ps(_mm_mul_ps(w[1], q[3]), _mm_mul_ps(w[2], q[2])));
+			const __m128 dy = _mm_add_ps(_mm_mul_ps(q[0], w[1]), _mm_sub_ps(_mm_mul_ps(w[2], q[1]), _mm_mul_ps(w[0], q[3])));
+			const __m128 dz = _mm_add_ps(_mm_mul_ps(q[0], w[2]), _mm_sub_ps(_mm_mul_ps(w[0], q[2]), _mm_mul_ps(w[1], q[1])));
+			q[0] = _mm_add_ps(q[0], _mm_mul_ps(halfDt, dw));
+			q[1] = _mm_add_ps(q[1], _mm_mul_ps(halfDt, dx));
+			q[2] = _mm_add_ps(q[2], _mm_mul_ps(halfDt, dy));
+			q[3] = _mm_add_ps(q[3], _mm_mul_ps(halfDt, dz));
+		}
+		const __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(q[0], q[0]), dot3(q[1], q[2], q[3], q[1], q[2], q[3])));
+		for (int j = 0; j < 4; j++)
+			q[j] = _mm_div_ps(q[j], length);
+
+		__m128 changed = _mm_setzero_ps();
+		for (int j = 0; j < 3; j++)
+			changed = _mm_or_ps(changed, _mm_cmpneq_ps(p[j], p0[j]));
+		for (int j = 0; j < 4; j++)
+			changed = _mm_or_ps(changed, _mm_cmpneq_ps(q[j], q0[j]));
+		const int mask = _mm_movemask_ps(changed);
+		for (int j = 0; j < 4; j++)
+			moved[i + j] = (mask >> j) & 1;
+
+		_mm_storeu_ps(&px[i], p[0]); _mm_storeu_ps(&py[i], p[1]); _mm_storeu_ps(&pz[i], p[2]);
+		_mm_storeu_ps(&lx[i], l[0]); _mm_storeu_ps(&ly[i], l[1]); _mm_storeu_ps(&lz[i], l[2]);
+		_mm_storeu_ps(&ax[i], a[0]); _mm_storeu_ps(&ay[i], a[1]); _mm_storeu_ps(&az[i], a[2]);
+		_mm_storeu_ps(&qw[i], q[0]); _mm_storeu_ps(&qx[i], q[1]); _mm_storeu_ps(&qy[i], q[2]); _mm_storeu_ps(&qz[i], q[3]);
+	}
+}
+
+unsigned int RigidBodyBatch::Scatter(entt::registry& registry)
+{
+	const int count = (int)entities.size();
+	//the bodies are distinct, so their state is copied back in parallel
+	forEachBlock(count, chunkSize, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				CRigidBody& rigidBody = *bodies[i];
+				rigidBody.linearMomentum = glm::vec3(lx[i], ly[i], lz[i]);
+				rigidBody.angularMomentum = glm::vec3(ax[i], ay[i], az[i]);
+				if (!moved[i])
+					continue;
+				rigidBody.position = glm::vec3(px[i], py[i], pz[i]);
+				rigidBody.SetOrientation(glm::quat(qw[i], qx[i], qy[i], qz[i]));
+			}
+		});
+	//transforms are applied on one thread, CalculateModelMatrix also writes the transforms of the children
+	//which two bodies may share
+	for (int i = 0; i < count; i++)
+	{
+		if (!moved[i])
+			continue;
+		auto* transform = registry.try_get<CTransform>(entities[i]);
+		if (!transform || !bodies[i]->SynchronizeTransform(*transform))
+			continue;
+		if (auto* collider = registry.try_get<CBoxCollider>(entities[i]))
+			collider->SetTransform(*transform);
+	}
+	return (unsigned int)std::count(moved.begin(), moved.begin() + count, 1);
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <Scene.h>
+#include <vector>
+
+/*
+* Rigid body state gathered into structure of arrays so the forward Euler step of CRigidBody runs
+* on four bodies per SSE instruction, in parallel chunks. Only the bodies whose pose changed get
+* their transform and collider updated when the state is scattered back
+*/
+class RigidBodyBatch
+{
+public:
+	void Clear();
+
+	/*
+	* Appends the state of the body, call Integrate once every body of the step is added
+	*/
+	void Add(entt::entity entity, CRigidBody& rigidBody);
+
+	/*
+	* Same as CRigidBody::TakeFwEulerStep for every body in the batch
+	*/
+	void Integrate(float dt);
+
+	/*
+	* Writes the state back to the rigid bodies and synchronizes the transforms and colliders of the
+	* bodies that moved. Returns the number of moved bodies
+	*/
+	unsigned int Scatter(entt::registry& registry);
+
+	size_t GetSize() const { return entities.size(); }
+
+private:
+	std::vector<entt::entity> entities;
+	std::vector<CRigidBody*> bodies;
+	std::vector<float> px, py, pz;//position
+	std::vector<float> lx, ly, lz;//linear momentum
+	std::vector<float> ax, ay, az;//angular momentum
+	std::vector<float> qw, qx, qy, qz;//orientation
+	std::vector<float> mass, invMass, drag, gravity;
+	std::vector<float> invInertia[9];//inverse inertia tensor at rest, column major
+	std::vector<unsigned char> moved;
+
+	static constexpr int chunkSize = 1024;//bodies per parallel task, multiple of 4
+
+	void IntegrateRange(int begin, int end, float dt);
+};
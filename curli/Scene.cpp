@@ -2,7 +2,9 @@
 #include <GLFWHandler.h>
 #include <Eigen/Eigenvalues>
 #include <thread>
+#include <mutex>
 #include <filesystem>
+#include <numeric>
 
 //===============Sinks for entity management===============
 void scheduleSynchForAddedGeom(entt::registry& registry, entt::entity e)
@@ -158,6 +160,7 @@ void CTransform::Update()
 
 void CTriMesh::InitializeFrom(cy::TriMesh& mesh)
 {
+	bvhDirty = true;
 	shading = ShadingMode::PHONG;
 	unsigned int minAttribCount = glm::min(mesh.NV(), glm::min(mesh.NVN(), mesh.NVT()));
 	bool hasTextureCoords = true;
@@ -386,8 +389,10 @@ struct PairHash {
 namespace fs = std::filesystem;
 
 void CTriMesh::InitializeFrom(const std::string& nodePath, const std::string elePath,
-	std::vector<Spring>& springs, Eigen::VectorXf& nodes, std::unordered_map<int, int>& volIdx2SurfIdx)
-{	
+	std::vector<Spring>& springs, Eigen::VectorXf& nodes, std::unordered_map<int, int>& volIdx2SurfIdx,
+	std::vector<glm::ivec4>* tets)
+{
+	bvhDirty = true;
 	printf("==========Reading ele & node files==========\n");
 	// Make sure files exist and good
 	assert(fs::exists(nodePath) && fs::path(nodePath).extension() == ".node" && "Invalid extension for tetgen files");
@@ -437,6 +442,8 @@ void CTriMesh::InitializeFrom(const std::string& nodePath, const std::string ele
 		glm::ivec4 tet;
 		eleFile >> tet.x >> tet.y >> tet.z >> tet.w;
 		tet -= glm::ivec4(firstNodeIdx);
+		if (tets)
+			tets->push_back(tet);
 
 		// Add edges to surface face set
 		for (glm::ivec4 tetFace : std::array<glm::ivec4, 4>{ { {0, 1, 3, 2}, { 1,2,3,0 }, { 0,3,2,1 }, { 0,1,2,3 }}}) {
@@ -483,19 +490,21 @@ void CTriMesh::InitializeFrom(const std::string& nodePath, const std::string ele
 	this->vertexNormals.resize(this->vertices.size(), glm::vec3(0.0f));
 	for (const auto [face, count] : surfFaceIdx) {
 		if (count != 1) continue;
-		const glm::ivec3 f(volIdx2SurfIdx[face[0]], volIdx2SurfIdx[face[1]], volIdx2SurfIdx[face[2]]);
-		this->faces.push_back(f);
+		glm::ivec3 f(volIdx2SurfIdx[face[0]], volIdx2SurfIdx[face[1]], volIdx2SurfIdx[face[2]]);
 
-		// Compute normal for face
+		// Compute normal for face, wind it counter clockwise around the outward normal
+		// so the normals can be recomputed from the winding when the surface deforms
 		const glm::vec3 e1 = this->vertices[f[1]] - this->vertices[f[0]];
 		const glm::vec3 e2 = this->vertices[f[2]] - this->vertices[f[0]];
-		glm::vec3 normal = glm::normalize(glm::cross(e2, e1));
+		glm::vec3 normal = glm::normalize(glm::cross(e1, e2));
 		const glm::vec3 inwardVec = glm::make_vec3(nodes.segment<3>(face2InVertIdx.at(face) * 3).data()) -
 			this->vertices[f[0]];
 		if (glm::dot(normal, inwardVec) >= 0) {
 			normal *= -1.0f;
+			std::swap(f[1], f[2]);
 		}
 		assert(!glm::any(glm::isnan(normal)));
+		this->faces.push_back(f);
 
 		for (int i = 0; i < 3; i++) {
 			this->vertexNormals[f[i]] += normal;
@@ -518,30 +527,86 @@ void CTriMesh::InitializeFrom(const std::string& nodePath, const std::string ele
 		springs.size(), nodes.size() / 3);
 }
 
+void CTriMesh::UpdateFromNodes(const Eigen::VectorXf& nodes, const std::vector<int>& vertex2Node)
+{
+	bvhDirty = true;
+	const int vertexCount = (int)vertices.size();
+	const int faceCount = (int)faces.size();
+	if (vertexNormals.size() != vertices.size())
+		vertexNormals.resize(vertices.size());
+
+	//faces around each vertex, so the normals are gathered per vertex without atomics
+	if (vertexFaceStart.size() != vertices.size() + 1 || vertexFaces.size() != faces.size() * 3)
+	{
+		vertexFaceStart.assign(vertexCount + 1, 0);
+		for (const glm::uvec3& face : faces)
+			for (int k = 0; k < 3; k++)
+				vertexFaceStart[face[k] + 1]++;
+		std::partial_sum(vertexFaceStart.begin(), vertexFaceStart.end(), vertexFaceStart.begin());
+		vertexFaces.resize(faces.size() * 3);
+		std::vector<int> cursor(vertexFaceStart.begin(), vertexFaceStart.end() - 1);
+		for (int i = 0; i < faceCount; i++)
+			for (int k = 0; k < 3; k++)
+				vertexFaces[cursor[faces[i][k]]++] = i;
+		faceNormals.resize(faces.size());
+	}
+
+	std::vector<int> indices(glm::max(vertexCount, faceCount));
+	std::iota(indices.begin(), indices.end(), 0);
+	std::for_each(std::execution::par_unseq, indices.begin(), indices.begin() + vertexCount, [&](int i)
+		{
+			vertices[i] = glm::make_vec3(nodes.data() + vertex2Node[i] * 3);
+		});
+	//area weighted, the faces are wound counter clockwise around the outward normal
+	std::for_each(std::execution::par_unseq, indices.begin(), indices.begin() + faceCount, [&](int i)
+		{
+			const glm::uvec3& face = faces[i];
+			faceNormals[i] = glm::cross(vertices[face.y] - vertices[face.x], vertices[face.z] - vertices[face.x]);
+		});
+	std::for_each(std::execution::par_unseq, indices.begin(), indices.begin() + vertexCount, [&](int i)
+		{
+			glm::vec3 normal(0.0f);
+			for (int j = vertexFaceStart[i]; j < vertexFaceStart[i + 1]; j++)
+				normal += faceNormals[vertexFaces[j]];
+			const float length = glm::length(normal);
+			if (length > 1e-12f)
+				vertexNormals[i] = normal / length;
+		});
+}
+
 void CTriMesh::Update()
 {
 }
 
-glm::vec3 CTriMesh::ApproximateTheClosestPointTo(glm::vec3 point, int stride)
+glm::vec3 CTriMesh::ClosestPointTo(glm::vec3 point) const
+{
+	glm::vec3 closest = point;
+	GetBVH().ClosestPoint(point, closest);
+	return closest;
+}
+
+bool CTriMesh::Raycast(glm::vec3 origin, glm::vec3 direction, float& t) const
 {
-	float minDist = std::numeric_limits<float>::max();
-	glm::vec3 closestPoint = glm::vec3(0.0f);
-	for (int i = 0; i < this->vertices.size(); i += stride)
+	return GetBVH().Raycast(origin, direction, t) >= 0;
+}
+
+const MeshBVH& CTriMesh::GetBVH() const
+{
+	//physics and picking may query the same mesh from different threads
+	static std::mutex buildMutex;
+	//the acquire pairs with the release below, a reader that sees the flag cleared sees the whole BVH
+	if (bvhDirty.load(std::memory_order_acquire))
 	{
-		glm::vec3 v = this->vertices[i];
-		if (glm::any(glm::isnan(v)))
-			continue;
-		if(glm::distance(point, v) < minDist)
+		std::lock_guard<std::mutex> lock(buildMutex);
+		if (bvhDirty.load(std::memory_order_relaxed))
 		{
-			minDist = glm::distance(point, v);
-			closestPoint = v;
+			bvh.Build(vertices, faces);
+			bvhDirty.store(false, std::memory_order_release);
 		}
 	}
-	return closestPoint;
+	return bvh;
 }
 
-bool CLight::slotUsed[15];
-
 void CLight::Update()
 {
 }
@@ -575,6 +640,7 @@ void CRigidBody::initializeInertiaTensor(const CTriMesh* mesh, CTransform* trans
 		inertiaAtRest[1][2] = inertiaAtRest[1][2] - v.y * v.z;
 	}
 	inertiaAtRest = inertiaAtRest * mass;
+	invInertiaAtRest = glm::inverse(inertiaAtRest);
 	/*Eigen::EigenSolver<Eigen::Matrix3f> solver(mat, false);
 	auto& eigenValues = solver.eigenvalues();
 
@@ -653,53 +719,348 @@ void CSoftBody::ApplyImpulse(Eigen::Vector3f imp, int nodeIdx)
 }
 
 void CSoftBody::UpdateNodeForces()
+{
+	ComputeForces(nodePositions, nodeVelocities, nodeTotalForces);
+}
+
+void CSoftBody::ComputeForces(const Eigen::VectorXf& positions, const Eigen::VectorXf& velocities, Eigen::VectorXf& forces)
 {
 	// Calculate internal forces
-	nodeTotalForces.setZero(nodePositions.size());
-	std::for_each(std::execution::par_unseq, springs.begin(), springs.end(), [this](const Spring& spring)
+	//sequential, springs share nodes and the integrators need the same sums on every evaluation
+	forces.setZero(positions.size());
+	for (const Spring& spring : springs)
 	{
-		const Eigen::Vector3f& node0 = nodePositions.segment<3>(spring.nodes[0] * 3);
-		const Eigen::Vector3f& node1 = nodePositions.segment<3>(spring.nodes[1] * 3);
-		const Eigen::Vector3f& vel0 = nodeVelocities.segment<3>(spring.nodes[0] * 3);
-		const Eigen::Vector3f& vel1 = nodeVelocities.segment<3>(spring.nodes[1] * 3);
+		const Eigen::Vector3f& node0 = positions.segment<3>(spring.nodes[0] * 3);
+		const Eigen::Vector3f& node1 = positions.segment<3>(spring.nodes[1] * 3);
+		const Eigen::Vector3f& vel0 = velocities.segment<3>(spring.nodes[0] * 3);
+		const Eigen::Vector3f& vel1 = velocities.segment<3>(spring.nodes[1] * 3);
 		auto force = spring.CalculateForce(node0, node1, vel0, vel1);
-		nodeTotalForces.segment<3>(spring.nodes[0] * 3) += force;
-		nodeTotalForces.segment<3>(spring.nodes[1] * 3) -= force;
-	});
+		forces.segment<3>(spring.nodes[0] * 3) += force;
+		forces.segment<3>(spring.nodes[1] * 3) -= force;
+	}
 
 	// Add gravitational force
 	const Eigen::Vector3f gravityVec(0, 0, -gravity * 1.f);
-	for (int i = 0; i < nodePositions.size(); i += 3)
+	for (int i = 0; i < positions.size(); i += 3)
 	{
-		nodeTotalForces.segment<3>(i) += gravityVec;
+		forces.segment<3>(i) += gravityVec;
 	}
 
 	// Add external forces
-	nodeTotalForces = nodeTotalForces + nodeExtForces;
+	forces += nodeExtForces;
+}
 
+void CSoftBody::FinishStep()
+{
+	if (!nodeVelocities.isZero(0.001f))
+		dirty = true;
+	nodeExtForces.setZero(nodePositions.size());
 }
 
-void CSoftBody::TakeFwEulerStep(float dt)
+void CSoftBody::TakeSymplecticEulerStep(float dt)
 {
 	UpdateNodeForces();
 	nodeVelocities += dt * nodeTotalForces / massPerNode;
 	nodePositions += dt * nodeVelocities;
+	FinishStep();
+}
 
-	if (nodeVelocities.any() > 0.001f)
+void CSoftBody::TakeVelocityVerletStep(float dt)
+{
+	//kick, drift, kick. The damping forces use the half step velocities
+	UpdateNodeForces();
+	nodeVelocities += (0.5f * dt / massPerNode) * nodeTotalForces;
+	nodePositions += dt * nodeVelocities;
+	UpdateNodeForces();
+	nodeVelocities += (0.5f * dt / massPerNode) * nodeTotalForces;
+	FinishStep();
+}
+
+void CSoftBody::TakeRK4Step(float dt)
+{
+	const Eigen::VectorXf x0 = nodePositions;
+	const Eigen::VectorXf v0 = nodeVelocities;
+	const float invMass = 1.0f / massPerNode;
+	Eigen::VectorXf a1, a2, a3, a4;
+
+	ComputeForces(x0, v0, a1);
+	a1 *= invMass;
+	const Eigen::VectorXf v2 = v0 + (0.5f * dt) * a1;
+	ComputeForces(x0 + (0.5f * dt) * v0, v2, a2);
+	a2 *= invMass;
+	const Eigen::VectorXf v3 = v0 + (0.5f * dt) * a2;
+	ComputeForces(x0 + (0.5f * dt) * v2, v3, a3);
+	a3 *= invMass;
+	const Eigen::VectorXf v4 = v0 + dt * a3;
+	ComputeForces(x0 + dt * v3, v4, a4);
+	a4 *= invMass;
+
+	nodePositions = x0 + (dt / 6.0f) * (v0 + 2.0f * v2 + 2.0f * v3 + v4);
+	nodeVelocities = v0 + (dt / 6.0f) * (a1 + 2.0f * a2 + 2.0f * a3 + a4);
+	FinishStep();
+}
+
+namespace
+{
+	/*
+	* Greedy coloring of the constraints so the ones of a color share no nodes. Up to 63 colors are used,
+	* constraints that find no free color go to the serial list
+	*/
+	template <typename NodesOf>
+	void colorConstraints(int constraintCount, int nodeCount, int nodesPerConstraint, NodesOf nodesOf,
+		std::vector<std::vector<int>>& batches, std::vector<int>& serial)
 	{
-		dirty = true;
+		constexpr int maxColors = 63;
+		std::vector<uint64_t> nodeColors(nodeCount, 0);
+		batches.clear();
+		serial.clear();
+		for (int i = 0; i < constraintCount; i++)
+		{
+			uint64_t used = 0;
+			for (int j = 0; j < nodesPerConstraint; j++)
+				used |= nodeColors[nodesOf(i, j)];
+			int color = 0;
+			while (color < maxColors && (used & (1ull << color)))
+				color++;
+			if (color == maxColors)
+			{
+				serial.push_back(i);
+				continue;
+			}
+			for (int j = 0; j < nodesPerConstraint; j++)
+				nodeColors[nodesOf(i, j)] |= 1ull << color;
+			if (color >= (int)batches.size())
+				batches.resize(color + 1);
+			batches[color].push_back(i);
+		}
+	}
+
+	float tetVolume(const Eigen::VectorXf& positions, glm::ivec4 tet)
+	{
+		const Eigen::Vector3f p0 = positions.segment<3>(tet[0] * 3);
+		return (positions.segment<3>(tet[1] * 3) - p0).cross(positions.segment<3>(tet[2] * 3) - p0)
+			.dot(positions.segment<3>(tet[3] * 3) - p0) / 6.0f;
 	}
-	nodeExtForces.setZero(nodePositions.size());
 }
 
+void CSoftBody::SetTetrahedra(const std::vector<glm::ivec4>& tets)
+{
+	tetrahedra = tets;
+	tetRestVolumes.resize(tetrahedra.size());
+	for (size_t i = 0; i < tetrahedra.size(); i++)
+		tetRestVolumes[i] = tetVolume(nodePositions, tetrahedra[i]);
+}
 
-void CSoftBody::TakeBwEulerStep(float dt)
+void CSoftBody::SetSurface(const CTriMesh& mesh)
+{
+	std::vector<glm::ivec3> triangles(mesh.GetNumFaces());
+	for (unsigned int i = 0; i < mesh.GetNumFaces(); i++)
+	{
+		const glm::uvec3 face = mesh.GetFace(i);
+		triangles[i] = glm::ivec3(surfaceNodeIds[face.x], surfaceNodeIds[face.y], surfaceNodeIds[face.z]);
+	}
+	SetSurface(triangles);
+}
+
+void CSoftBody::SetSurface(const std::vector<glm::ivec3>& triangles)
+{
+	surfaceTriangles = triangles;
+	restPositions = nodePositions;
+	std::vector<bool> onSurface(nodePositions.size() / 3, false);
+	float edgeLengthSum = 0.0f;
+	for (const glm::ivec3& triangle : surfaceTriangles)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			onSurface[triangle[i]] = true;
+			edgeLengthSum += (nodePositions.segment<3>(triangle[i] * 3) - nodePositions.segment<3>(triangle[(i + 1) % 3] * 3)).norm();
+		}
+	}
+	surfaceNodes.clear();
+	for (int i = 0; i < (int)onSurface.size(); i++)
+		if (onSurface[i])
+			surfaceNodes.push_back(i);
+	surfaceEdgeLength = surfaceTriangles.empty() ? 0.0f : edgeLengthSum / (3.0f * surfaceTriangles.size());
+	collisionThickness = 0.25f * surfaceEdgeLength;
+}
+
+void CSoftBody::UpdateConstraintBatches()
+{
+	const int nodeCount = (int)nodePositions.size() / 3;
+	if (springBatches.constraintCount != springs.size())
+	{
+		colorConstraints((int)springs.size(), nodeCount, 2,
+			[this](int i, int j) { return springs[i].nodes[j]; }, springBatches.batches, springBatches.serial);
+		springBatches.constraintCount = springs.size();
+	}
+	if (tetBatches.constraintCount != tetrahedra.size())
+	{
+		colorConstraints((int)tetrahedra.size(), nodeCount, 4,
+			[this](int i, int j) { return tetrahedra[i][j]; }, tetBatches.batches, tetBatches.serial);
+		tetBatches.constraintCount = tetrahedra.size();
+	}
+}
+
+void CSoftBody::SolveSpring(int index, float alpha)
+{
+	//every node has the same mass so the inverse masses cancel out of the correction
+	const Spring& spring = springs[index];
+	Eigen::Ref<Eigen::Vector3f> p0 = nodePositions.segment<3>(spring.nodes[0] * 3);
+	Eigen::Ref<Eigen::Vector3f> p1 = nodePositions.segment<3>(spring.nodes[1] * 3);
+	Eigen::Vector3f n = p1 - p0;
+	const float length = n.norm();
+	if (length < 1e-7f)
+		return;
+	n /= length;
+	const float w = 1.0f / massPerNode;
+	const float compliance = alpha / spring.k;
+	const float deltaLambda = (-(length - spring.restLength) - compliance * springLambdas[index]) / (2.0f * w + compliance);
+	springLambdas[index] += deltaLambda;
+	p0 -= (w * deltaLambda) * n;
+	p1 += (w * deltaLambda) * n;
+}
+
+void CSoftBody::SolveTetrahedron(int index, float alpha)
+{
+	//gradient of the volume with respect to each node is the normal of the opposite face
+	static const int opposite[4][3] = { {1, 3, 2}, {0, 2, 3}, {0, 3, 1}, {0, 1, 2} };
+	const glm::ivec4 tet = tetrahedra[index];
+	Eigen::Vector3f gradients[4];
+	float gradientSum = 0.0f;
+	for (int i = 0; i < 4; i++)
+	{
+		const Eigen::Vector3f p0 = nodePositions.segment<3>(tet[opposite[i][0]] * 3);
+		gradients[i] = (nodePositions.segment<3>(tet[opposite[i][1]] * 3) - p0)
+			.cross(nodePositions.segment<3>(tet[opposite[i][2]] * 3) - p0) / 6.0f;
+		gradientSum += gradients[i].squaredNorm();
+	}
+	const float w = 1.0f / massPerNode;
+	const float compliance = alpha * volumeCompliance;
+	const float denominator = w * gradientSum + compliance;
+	if (denominator < 1e-12f)
+		return;
+	const float c = tetVolume(nodePositions, tet) - tetRestVolumes[index];
+	const float deltaLambda = (-c - compliance * tetLambdas[index]) / denominator;
+	tetLambdas[index] += deltaLambda;
+	for (int i = 0; i < 4; i++)
+		nodePositions.segment<3>(tet[i] * 3) += (w * deltaLambda) * gradients[i];
+}
+
+void CSoftBody::TakeXPBDStep(float dt)
+{
+	UpdateConstraintBatches();
+	//predict with the gravity and external forces
+	Eigen::VectorXf accelerations = nodeExtForces / massPerNode;
+	for (int i = 2; i < accelerations.size(); i += 3)
+		accelerations[i] -= gravity / massPerNode;
+	nodeVelocities += dt * accelerations;
+	nodeVelocities /= 1.0f + drag * dt;
+	const Eigen::VectorXf previousPositions = nodePositions;
+	nodePositions += dt * nodeVelocities;
+
+	//Gauss-Seidel over the batches, the constraints within a batch touch different nodes
+	const float alpha = 1.0f / (dt * dt);
+	springLambdas.assign(springs.size(), 0.0f);
+	tetLambdas.assign(tetrahedra.size(), 0.0f);
+	for (int iteration = 0; iteration < xpbdIterations; iteration++)
+	{
+		for (const auto& batch : springBatches.batches)
+			std::for_each(std::execution::par, batch.begin(), batch.end(), [&](int i) { SolveSpring(i, alpha); });
+		for (int i : springBatches.serial)
+			SolveSpring(i, alpha);
+		for (const auto& batch : tetBatches.batches)
+			std::for_each(std::execution::par, batch.begin(), batch.end(), [&](int i) { SolveTetrahedron(i, alpha); });
+		for (int i : tetBatches.serial)
+			SolveTetrahedron(i, alpha);
+	}
+
+	nodeVelocities = (nodePositions - previousPositions) / dt;
+	FinishStep();
+}
+
+float CSoftBody::EstimateTimeStep(float stabilityLimit, float courant) const
+{
+	if (springs.empty())
+		return FLT_MAX;
+	std::vector<float> nodeStiffness(nodePositions.size() / 3, 0.0f);
+	float shortestSpring = FLT_MAX;
+	for (const Spring& spring : springs)
+	{
+		nodeStiffness[spring.nodes[0]] += spring.k;
+		nodeStiffness[spring.nodes[1]] += spring.k;
+		shortestSpring = glm::min(shortestSpring, spring.restLength);
+	}
+
+	float dt = FLT_MAX;
+	if (stabilityLimit > 0.0f)
+	{
+		//Gershgorin bound of the largest eigenvalue of M^-1 K, the highest frequency squared
+		const float maxStiffness = *std::max_element(nodeStiffness.begin(), nodeStiffness.end());
+		const float omega = glm::sqrt(2.0f * maxStiffness / massPerNode);
+		if (omega > 0.0f)
+			dt = stabilityLimit / omega;
+	}
+
+	float maxSpeedSquared = 0.0f;
+	for (int i = 0; i < nodeVelocities.size() / 3; i++)
+		maxSpeedSquared = glm::max(maxSpeedSquared, nodeVelocities.segment<3>(i * 3).squaredNorm());
+	if (maxSpeedSquared > 0.0f && shortestSpring > 0.0f)
+		dt = glm::min(dt, courant * shortestSpring / glm::sqrt(maxSpeedSquared));
+	return dt;
+}
+
+float CSoftBody::GetEnergy() const
+{
+	float energy = 0.5f * massPerNode * nodeVelocities.squaredNorm();
+	for (const Spring& spring : springs)
+	{
+		const float stretch = (nodePositions.segment<3>(spring.nodes[1] * 3) -
+			nodePositions.segment<3>(spring.nodes[0] * 3)).norm() - spring.restLength;
+		energy += 0.5f * spring.k * stretch * stretch;
+	}
+	//gravity pulls every node along -z with the same force
+	for (int i = 2; i < nodePositions.size(); i += 3)
+		energy += gravity * nodePositions(i);
+	return energy;
+}
+
+void CSoftBody::TakeFwEulerStep(float dt)
+{
+	//explicit, the positions move with the velocities from the start of the step
+	UpdateNodeForces();
+	nodePositions += dt * nodeVelocities;
+	nodeVelocities += dt * nodeTotalForces / massPerNode;
+	FinishStep();
+}
+
+
+void CSoftBody::BuildBwEulerSystem(float dt, Eigen::SparseMatrix<float>& lhs, Eigen::VectorXf& rhs)
 {
 	UpdateNodeForces();
-	
 	UpdateStiffnessMatrix(dt);
+	lhs = massMatrix - dt * dt * stiffnessMatrix;
+	rhs = massMatrix * nodeVelocities + dt * nodeTotalForces;
+}
+
+void CSoftBody::FinishBwEulerStep(const Eigen::VectorXf& velocities, float dt)
+{
+	nodeVelocities = velocities;
+	//check if nodeVelocities are all zero
+	if (nodeVelocities.any() > 0.001f)
+	{
+		dirty = true;
+	}
+	
+	nodePositions += nodeVelocities * dt;
+	nodeExtForces.setZero();
+}
+
+void CSoftBody::TakeBwEulerStep(float dt)
+{
 	// Solve for v_{t+1} where (M - dt*dt *K) * vv_{t+1} = M * v_{t} + dt * f_{t}
-	Eigen::SparseMatrix<float> MminusdtsK = massMatrix - dt * dt * stiffnessMatrix;
+	Eigen::SparseMatrix<float> MminusdtsK;
+	Eigen::VectorXf rhs;
+	BuildBwEulerSystem(dt, MminusdtsK, rhs);
 	Eigen::LeastSquaresConjugateGradient<Eigen::SparseMatrix<float>> solver;
 	solver.setMaxIterations(50);
 	solver.compute(MminusdtsK);
@@ -710,7 +1071,7 @@ void CSoftBody::TakeBwEulerStep(float dt)
 		return;
 	}
 	
-	nodeVelocities = solver.solve(massMatrix * nodeVelocities + dt * nodeTotalForces);
+	const Eigen::VectorXf velocities = solver.solve(rhs);
 	
 	if (solver.info() != Eigen::Success)
 	{
@@ -718,14 +1079,57 @@ void CSoftBody::TakeBwEulerStep(float dt)
 		//return;
 	}
 
-	//check if nodeVelocities are all zero
-	if (nodeVelocities.any() > 0.001f)
+	FinishBwEulerStep(velocities, dt);
+}
+
+void CSoftBody::TakeBwEulerStep(const std::vector<CSoftBody*>& bodies, float dt)
+{
+	//the systems of the bodies are independent, build them in parallel
+	std::vector<Eigen::SparseMatrix<float>> lhs(bodies.size());
+	std::vector<Eigen::VectorXf> rhs(bodies.size());
+	std::vector<int> offsets(bodies.size() + 1, 0);
+	for (size_t i = 0; i < bodies.size(); i++)
+		offsets[i + 1] = offsets[i] + (int)bodies[i]->nodePositions.size();
+	std::vector<size_t> indices(bodies.size());
+	std::iota(indices.begin(), indices.end(), 0);
+	std::for_each(std::execution::par, indices.begin(), indices.end(), [&](size_t i)
+		{
+			bodies[i]->BuildBwEulerSystem(dt, lhs[i], rhs[i]);
+		});
+	if (offsets.back() == 0)
+		return;
+
+	//place them on the diagonal of one system
+	std::vector<Eigen::Triplet<float>> triplets;
+	size_t nonZeros = 0;
+	for (const auto& matrix : lhs)
+		nonZeros += matrix.nonZeros();
+	triplets.reserve(nonZeros);
+	Eigen::VectorXf b(offsets.back());
+	for (size_t i = 0; i < bodies.size(); i++)
 	{
-		dirty = true;
+		for (int k = 0; k < lhs[i].outerSize(); k++)
+			for (Eigen::SparseMatrix<float>::InnerIterator it(lhs[i], k); it; ++it)
+				triplets.emplace_back(offsets[i] + (int)it.row(), offsets[i] + (int)it.col(), it.value());
+		b.segment(offsets[i], rhs[i].size()) = rhs[i];
 	}
-	
-	nodePositions += nodeVelocities * dt;
-	nodeExtForces.setZero();
+	Eigen::SparseMatrix<float> system(offsets.back(), offsets.back());
+	system.setFromTriplets(triplets.begin(), triplets.end());
+
+	Eigen::LeastSquaresConjugateGradient<Eigen::SparseMatrix<float>> solver;
+	solver.setMaxIterations(50);
+	solver.compute(system);
+	if (solver.info() != Eigen::Success)
+	{
+		std::cerr << "Failed to decompose matrix." << std::endl;
+		return;
+	}
+	const Eigen::VectorXf velocities = solver.solve(b);
+	if (solver.info() != Eigen::Success)
+		std::cerr << "Failed to solve" << std::endl;
+
+	for (size_t i = 0; i < bodies.size(); i++)
+		bodies[i]->FinishBwEulerStep(velocities.segment(offsets[i], rhs[i].size()), dt);
 }
 
 void CRigidBody::TakeFwEulerStep(float dt)
@@ -750,6 +1154,96 @@ void CRigidBody::TakeFwEulerStep(float dt)
 	orientationMatrix = glm::toMat3(orientationQuat);
 }
 
+bool CRigidBody::SynchronizeTransform(CTransform& transform)
+{
+	if (position == syncedPosition && orientationQuat == syncedOrientation && transform.GetPosition() == position)
+		return false;
+	transform.SetPosition(position);
+	transform.SetEulerRotation(orientationMatrix);
+	syncedPosition = position;
+	syncedOrientation = orientationQuat;
+	return true;
+}
+
+glm::vec3 CRigidBody::LinearForce(glm::vec3 velocity)
+{
+	return -0.5f * drag * glm::length(velocity) * velocity + glm::vec3(0, -1, 0) * gravity * mass;
+}
+
+glm::vec3 CRigidBody::Torque(glm::vec3 angularVelocity)
+{
+	return -0.5f * drag * glm::length(angularVelocity) * angularVelocity * 100.f;
+}
+
+void CRigidBody::Rotate(glm::vec3 angularVelocity, float dt)
+{
+	orientationQuat += (0.5f * dt) * glm::quat(0.0f, angularVelocity) * orientationQuat;
+	orientationQuat = glm::normalize(orientationQuat);
+	orientationMatrix = glm::toMat3(orientationQuat);
+}
+
+void CRigidBody::TakeSymplecticEulerStep(float dt)
+{
+	//update the momenta first, then move with the new velocities
+	linearMomentum += LinearForce(GetVelocity()) * dt;
+	angularMomentum += Torque(GetAngularVelocity()) * dt;
+	position += GetVelocity() * dt;
+	Rotate(GetAngularVelocity(), dt);
+}
+
+void CRigidBody::TakeVelocityVerletStep(float dt)
+{
+	//kick, drift, kick
+	linearMomentum += LinearForce(GetVelocity()) * (0.5f * dt);
+	angularMomentum += Torque(GetAngularVelocity()) * (0.5f * dt);
+	position += GetVelocity() * dt;
+	Rotate(GetAngularVelocity(), dt);
+	linearMomentum += LinearForce(GetVelocity()) * (0.5f * dt);
+	angularMomentum += Torque(GetAngularVelocity()) * (0.5f * dt);
+}
+
+void CRigidBody::TakeRK4Step(float dt)
+{
+	//derivatives of the position, linear momentum, orientation and angular momentum
+	struct Derivative
+	{
+		glm::vec3 position;
+		glm::vec3 linearMomentum;
+		glm::quat orientation;
+		glm::vec3 angularMomentum;
+	};
+	auto evaluate = [this](glm::vec3 l, glm::quat q, glm::vec3 a)
+	{
+		const glm::mat3 r = glm::toMat3(glm::normalize(q));
+		const glm::vec3 v = l / mass;
+		const glm::vec3 w = r * invInertiaAtRest * (glm::transpose(r) * a);
+		return Derivative{ v, LinearForce(v), 0.5f * glm::quat(0.0f, w) * q, Torque(w) };
+	};
+
+	const glm::vec3 l0 = linearMomentum;
+	const glm::quat q0 = orientationQuat;
+	const glm::vec3 a0 = angularMomentum;
+	const float h = 0.5f * dt;
+	const Derivative k1 = evaluate(l0, q0, a0);
+	const Derivative k2 = evaluate(l0 + k1.linearMomentum * h, q0 + k1.orientation * h, a0 + k1.angularMomentum * h);
+	const Derivative k3 = evaluate(l0 + k2.linearMomentum * h, q0 + k2.orientation * h, a0 + k2.angularMomentum * h);
+	const Derivative k4 = evaluate(l0 + k3.linearMomentum * dt, q0 + k3.orientation * dt, a0 + k3.angularMomentum * dt);
+
+	const float w = dt / 6.0f;
+	position += (k1.position + 2.0f * k2.position + 2.0f * k3.position + k4.position) * w;
+	linearMomentum += (k1.linearMomentum + 2.0f * k2.linearMomentum + 2.0f * k3.linearMomentum + k4.linearMomentum) * w;
+	angularMomentum += (k1.angularMomentum + 2.0f * k2.angularMomentum + 2.0f * k3.angularMomentum + k4.angularMomentum) * w;
+	orientationQuat = glm::normalize(q0 + (k1.orientation + 2.0f * k2.orientation + 2.0f * k3.orientation + k4.orientation) * w);
+	orientationMatrix = glm::toMat3(orientationQuat);
+}
+
+float CRigidBody::GetEnergy()
+{
+	return 0.5f * glm::dot(linearMomentum, GetVelocity()) +
+		0.5f * glm::dot(angularMomentum, GetAngularVelocity()) +
+		mass * gravity * position.y;
+}
+
 void CRigidBody::SetMassMatrix()
 {
 	invMassMatrix = glm::inverse(glm::mat3(1.0f) * mass);
@@ -772,6 +1266,18 @@ void CPhysicsBounds::Update()
 {
 }
 
+void CPlaneCollider::Update()
+{
+}
+
+void CSphereCollider::Update()
+{
+}
+
+void CMeshCollider::Update()
+{
+}
+
 void CSkyBox::Update()
 {
 }
@@ -830,6 +1336,10 @@ void CPhongMaterial::Update()
 {
 }
 
+void CInstanced::Update()
+{
+}
+
 void CImageMaps::Update()
 {
 }
@@ -877,6 +1387,166 @@ void Scene::Update()
 		});
 }
 
+//===============Bounding volume hierarchy===============
+//displacement maps push the surface along the local z axis by up to the multiplier
+static float displacementOf(entt::registry& registry, entt::entity e)
+{
+	auto* imaps = registry.try_get<CImageMaps>(e);
+	if (imaps)
+		for (auto it = imaps->mapsBegin(); it != imaps->mapsEnd(); ++it)
+			if (it->first == ImageMap::BindingSlot::DISPLACEMENT)
+				return glm::abs(it->second.dispMultiplier);
+	return 0.0f;
+}
+
+void Scene::UpdateBVH()
+{
+	bvhFrame++;
+	unboundedEntities.clear();
+	movedBounds.clear();
+
+	auto refresh = [&](entt::entity entity, CTriMesh& mesh, CTransform* transform)
+	{
+		EntityBounds& bounds = entityBounds[entity];
+		bounds.frame = bvhFrame;
+		const bool localDirty = bounds.dirty;
+		if (localDirty)
+		{
+			//soft bodies move their nodes every step, bound the nodes instead of the stale mesh
+			bounds.local = AABB();
+			auto* softbody = registry.try_get<CSoftBody>(entity);
+			if (softbody)
+			{
+				const Eigen::VectorXf& nodes = softbody->nodePositions;
+				for (int i = 0; i + 2 < nodes.size(); i += 3)
+					bounds.local.Expand(glm::vec3(nodes[i], nodes[i + 1], nodes[i + 2]));
+			}
+			else if (mesh.GetNumVertices() > 0)
+				bounds.local = AABB(mesh.GetBoundingBoxMin(), mesh.GetBoundingBoxMax());
+			bounds.dirty = false;
+		}
+
+		const unsigned int revision = transform ? transform->GetRevision() : 0;
+		const float displacement = displacementOf(registry, entity);
+		if (!localDirty && revision == bounds.transformRevision && displacement == bounds.displacement)
+		{
+			if (bounds.proxy < 0)
+				unboundedEntities.push_back(entity);
+			return;
+		}
+		bounds.transformRevision = revision;
+		bounds.displacement = displacement;
+		if (bounds.world.IsValid())
+			movedBounds.push_back(bounds.world);
+
+		AABB local = bounds.local;
+		if (local.IsValid())
+		{
+			local.min.z -= displacement;
+			local.max.z += displacement;
+		}
+		bounds.world = transform ? local.Transform(transform->GetModelMatrix()) : local;
+		if (bounds.world.IsValid())
+			movedBounds.push_back(bounds.world);
+
+		if (!bounds.world.IsValid())
+		{
+			if (bounds.proxy >= 0)
+				bvh.Remove(bounds.proxy);
+			bounds.proxy = -1;
+			unboundedEntities.push_back(entity);
+		}
+		else if (bounds.proxy < 0)
+			bounds.proxy = bvh.Insert(bounds.world, entity);
+		else
+			bvh.Update(bounds.proxy, bounds.world);
+	};
+
+	registry.view<CTriMesh>().each([&](const entt::entity& entity, CTriMesh& mesh)
+		{
+			if (registry.any_of<CSkyBox, CPhysicsBounds>(entity))
+			{
+				unboundedEntities.push_back(entity);
+				return;
+			}
+			refresh(entity, mesh, registry.try_get<CTransform>(entity));
+		});
+	registry.view<CInstanced, CTransform>().each([&](const entt::entity& entity, CInstanced& instanced, CTransform& transform)
+		{
+			auto* mesh = registry.valid(instanced.source) ? registry.try_get<CTriMesh>(instanced.source) : nullptr;
+			if (mesh)
+				refresh(entity, *mesh, &transform);
+		});
+
+	//remove the entities that were destroyed or lost their mesh since the last update
+	for (auto it = entityBounds.begin(); it != entityBounds.end();)
+	{
+		if (it->second.frame == bvhFrame)
+		{
+			++it;
+			continue;
+		}
+		if (it->second.proxy >= 0)
+			bvh.Remove(it->second.proxy);
+		if (it->second.world.IsValid())
+			movedBounds.push_back(it->second.world);
+		it = entityBounds.erase(it);
+	}
+
+	if (++framesSinceRebuild >= bvhRebuildInterval)
+	{
+		framesSinceRebuild = 0;
+		if (bvh.GetCost() > bvhRebuildThreshold * bvh.GetRebuildCost())
+			bvh.Rebuild();
+	}
+}
+
+void Scene::InvalidateBounds(entt::entity e)
+{
+	auto it = entityBounds.find(e);
+	if (it != entityBounds.end())
+		it->second.dirty = true;
+}
+
+AABB Scene::GetWorldBounds(entt::entity e)
+{
+	auto it = entityBounds.find(e);
+	return it != entityBounds.end() ? it->second.world : AABB();
+}
+
+entt::entity Scene::Raycast(glm::vec3 origin, glm::vec3 direction, float& distance)
+{
+	entt::entity closest = entt::null;
+	distance = FLT_MAX;
+	bvh.Raycast(origin, direction, FLT_MAX, [&](entt::entity entity, float tEnter) -> float
+		{
+			CTriMesh* mesh = registry.try_get<CTriMesh>(entity);
+			auto* instanced = registry.try_get<CInstanced>(entity);
+			if (instanced)
+				mesh = instanced->visible && registry.valid(instanced->source) ?
+					registry.try_get<CTriMesh>(instanced->source) : nullptr;
+			else if (mesh && !mesh->visible)
+				return -1.0f;
+			if (!mesh)
+				return -1.0f;
+
+			//intersect in model space, the parameter along the ray is the same in both spaces
+			auto* transform = registry.try_get<CTransform>(entity);
+			const glm::mat4 invModel = transform ? glm::inverse(transform->GetModelMatrix()) : glm::mat4(1.0f);
+			float t;
+			if (!mesh->Raycast(glm::vec3(invModel * glm::vec4(origin, 1.0f)),
+				glm::vec3(invModel * glm::vec4(direction, 0.0f)), t))
+				return -1.0f;
+			if (t < distance)
+			{
+				distance = t;
+				closest = entity;
+			}
+			return t;
+		});
+	return closest;
+}
+
 bool Scene::EntityHas(entt::entity e, CType component)
 {
 	switch (component)
@@ -911,6 +1581,18 @@ bool Scene::EntityHas(entt::entity e, CType component)
 	case CType::BoxCollider:
 		return registry.all_of<CBoxCollider>(e);
 		break;
+	case CType::Instanced:
+		return registry.all_of<CInstanced>(e);
+		break;
+	case CType::PlaneCollider:
+		return registry.all_of<CPlaneCollider>(e);
+		break;
+	case CType::SphereCollider:
+		return registry.all_of<CSphereCollider>(e);
+		break;
+	case CType::MeshCollider:
+		return registry.all_of<CMeshCollider>(e);
+		break;
 	case CType::Count:
 		break;
 	default:
@@ -1040,13 +1722,16 @@ entt::entity Scene::CreateModelObject(const std::string& nodePath, const std::st
 	std::vector<Spring> springs;
 	Eigen::VectorXf nodePositions;
 	std::unordered_map<int, int> volIdx2SurfIdx;
-	mesh.InitializeFrom(nodePath, elePath, springs, nodePositions, volIdx2SurfIdx);
+	std::vector<glm::ivec4> tets;
+	mesh.InitializeFrom(nodePath, elePath, springs, nodePositions, volIdx2SurfIdx, &tets);
 	registry.emplace<CTriMesh>(entity, mesh);
 	auto& transform = registry.emplace<CTransform>(entity, position, rotation, scale);
 	transform.SetPivot(mesh.GetBoundingBoxCenter());
 	auto& material = registry.emplace<CPhongMaterial>(entity);
 	
-	registry.emplace<CSoftBody>(entity, springs, nodePositions, volIdx2SurfIdx);
+	auto& softBody = registry.emplace<CSoftBody>(entity, springs, nodePositions, volIdx2SurfIdx);
+	softBody.SetTetrahedra(tets);
+	softBody.SetSurface(mesh);
 	registry.emplace<CBoxCollider>(entity, mesh.GetBoundingBoxMin(), mesh.GetBoundingBoxMax());
 
 	return entity;
@@ -1061,6 +1746,36 @@ entt::entity Scene::CreateModelObject(cy::TriMesh& mesh, glm::vec3 position, glm
 	return entity;
 }
 
+entt::entity Scene::LoadMeshAsset(const std::string& meshPath)
+{
+	auto it = meshAssets.find(meshPath);
+	if (it != meshAssets.end() && registry.valid(it->second))
+		return it->second;
+
+	auto asset = CreateModelObject(meshPath);
+	registry.get<CTriMesh>(asset).visible = false;//only drawn through its instances
+	meshAssets[meshPath] = asset;
+	return asset;
+}
+
+entt::entity Scene::CreateInstancedModelObject(const std::string& meshPath, glm::vec3 position, glm::vec3 rotation,
+	glm::vec3 scale, bool addToSceneObjects)
+{
+	auto asset = LoadMeshAsset(meshPath);
+	auto entity = registry.create();
+	if (addToSceneObjects)
+	{
+		auto name = meshPath.substr(meshPath.find_last_of("/\\") + 1);
+		InsertSceneObject(name.substr(0, name.find_last_of(".")) + "-instance", entity);
+	}
+
+	registry.emplace<CInstanced>(entity, asset);
+	auto& transform = registry.emplace<CTransform>(entity, position, rotation, scale);
+	transform.SetPivot(registry.get<CTriMesh>(asset).GetBoundingBoxCenter());
+	registry.emplace<CPhongMaterial>(entity, registry.get<CPhongMaterial>(asset));
+	return entity;
+}
+
 
 float CPhysicsBounds::MagImpulseCollistionFrom(float e, float m, glm::mat3 I, glm::vec3 v, glm::vec3 n, glm::vec3 r)
 {
@@ -1212,9 +1927,9 @@ std::vector<unsigned char> CSkyBox::GetSideImagesFlat()
 	return flattenedImages;
 }
 
-bool CBoxCollider::CollidingWith(CBoxCollider* other)
+bool CBoxCollider::CollidingWith(const CBoxCollider& other, ContactManifold& manifold) const
 {
-	return false;//TODO
+	return CollideOBBs(obb, other.obb, manifold);
 }
 
 void CSoftBody::Update()
@@ -1,6 +1,7 @@
 #pragma once
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
+#include <GLDebug.h>
 
 #include <cyTriMesh.h>
 #include <CyToGLMHelper.h>
@@ -21,6 +22,10 @@
 #include <glm/gtc/matrix_access.hpp>
 #include <glm/gtx/matrix_operation.hpp>
 
+#include <BVH.h>
+#include <Collision.h>
+#include <MeshBVH.h>
+
 #include <lodepng.h>
 
 #include <fstream>
@@ -28,19 +33,9 @@
 #include <string>
 #include <unordered_map>
 #include <tuple>
+#include <array>
 #include <execution>
-
-//define a macro that takes a function calls it and ctaches opengl errors
-#define GL_CALL(func) \
-do { \
-    func; \
-    GLenum error = glGetError(); \
-    if (error != GL_NO_ERROR) { \
-        const char* errorString = (const char*)glad_glGetString(GL_VERSION); \
-        const char* description = (const char*)glfwGetError(NULL); \
-        printf("OpenGL error %d (%s) at %s:%d - %s\n", error, errorString, __FILE__, __LINE__, description); \
-    } \
-} while (false)
+#include <atomic>
 
 struct Camera
 {
@@ -68,7 +63,7 @@ public:
 		this->CalculateProjectionMatrix();
 	}
 	
-	Camera(Camera& other)
+	Camera(const Camera& other)
 		: center(other.center), eye(other.eye), up(other.up),
 		fov(other.fov), nearPlane(other.nearPlane), farPlane(other.farPlane),
 		aspectRatio(other.aspectRatio), perspective(other.perspective)
@@ -88,7 +83,7 @@ public:
 		return result;
 	}
 	
-	static Camera& Reflect(glm::vec3 point, glm::vec3 normal, Camera& camera)
+	static Camera Reflect(glm::vec3 point, glm::vec3 normal, Camera& camera)
 	{
 		glm::vec3 center = camera.GetCenter();
 		glm::vec3 eye = camera.GetLookAtEye();
@@ -329,6 +324,9 @@ enum class CType{
 	PhysicsBounds,VelocityField2D,
 	ForceField2D, RigidBody,
 	BoxCollider, SoftBody,
+	Instanced,
+	PlaneCollider, SphereCollider,
+	MeshCollider,
 	Count
 };
 struct Component
@@ -442,6 +440,16 @@ public:
 			CalculateModelMatrix();
 		return modelMatrix;
 	}
+	/*
+	* Incremented every time the model matrix is recalculated, lets caches derived from the
+	* model matrix detect that they are stale
+	*/
+	unsigned int GetRevision()
+	{
+		if (modelDirty)
+			CalculateModelMatrix();
+		return revision;
+	}
 	void Reset()
 	{
 		position = glm::vec3(0.f);
@@ -498,6 +506,7 @@ public:
 			modelMatrix *= parent->GetModelMatrix();
 
 		modelDirty = false;
+		revision++;
 		for (auto child : children)
 		{
 			child->CalculateModelMatrix();
@@ -518,6 +527,7 @@ private:
 
 	glm::mat4 modelMatrix = glm::mat4(1.f);
 	bool modelDirty = false;
+	unsigned int revision = 0;
 	
 	CTransform* parent = nullptr;
 	std::vector<CTransform*> children;
@@ -549,6 +559,28 @@ public:
 	//deep copy constructor
 	CTriMesh(const CTriMesh& other)
 	{
+		CopyFrom(other);
+	}
+
+	CTriMesh& operator=(const CTriMesh& other)
+	{
+		if (this != &other)
+		{
+			Component::operator=(other);
+			CopyFrom(other);
+		}
+		return *this;
+	}
+
+	/*
+	* Copies the geometry and settings, the BVH and the caches of UpdateFromNodes are rebuilt on use
+	*/
+	void CopyFrom(const CTriMesh& other)
+	{
+		bvhDirty = true;
+		faceNormals.clear();
+		vertexFaceStart.clear();
+		vertexFaces.clear();
 		this->vertices = other.vertices;
 		this->vertexNormals = other.vertexNormals;
 		this->textureCoords = other.textureCoords;
@@ -571,6 +603,7 @@ public:
 	glm::vec2 GetVTexture(unsigned int index) const { return textureCoords.at(index); }
 	glm::uvec3 GetFace(unsigned int index) const { return faces.at(index); }
 	
+	//writable access, callers that move vertices or change faces call InvalidateBVH
 	glm::vec3& GetVertex(unsigned int index) { return vertices.at(index); }
 	glm::vec3& GetVNormal(unsigned int index) { return vertexNormals.at(index); }
 	glm::vec2& GetVTexture(unsigned int index) { return textureCoords.at(index); }
@@ -588,7 +621,14 @@ public:
 	*/
 	void InitializeFrom(cy::TriMesh& mesh);
 	void InitializeFrom(const std::string& nodePath, const std::string elePath,
-		std::vector<Spring>& springs, Eigen::VectorXf& nodes, std::unordered_map<int, int>& volIdx2SurfIdx);
+		std::vector<Spring>& springs, Eigen::VectorXf& nodes, std::unordered_map<int, int>& volIdx2SurfIdx,
+		std::vector<glm::ivec4>* tets = nullptr);
+
+	/*
+	* Moves every vertex to the node it is mapped to in vertex2Node and recomputes the vertex normals.
+	* Runs in parallel over the vertices and faces, the vertex to face adjacency is cached
+	*/
+	void UpdateFromNodes(const Eigen::VectorXf& nodes, const std::vector<int>& vertex2Node);
 
 	inline void ComputeBoundingBox()
 	{
@@ -663,13 +703,30 @@ public:
 	void Clear()
 	{
 		bBoxInitialized = false;
+		bvhDirty = true;
 		vertices.clear();
 		vertexNormals.clear();
 		textureCoords.clear();
 		faces.clear();
+		faceNormals.clear();
+		vertexFaceStart.clear();
+		vertexFaces.clear();
 	}
 
-	glm::vec3 ApproximateTheClosestPointTo(glm::vec3 point, int stride = 1);
+	/*
+	* Returns the point on the surface of the mesh closest to the model space point
+	*/
+	glm::vec3 ClosestPointTo(glm::vec3 point) const;
+	/*
+	* Intersects the ray with the triangles of the mesh, returns the distance along the direction to the closest hit in t
+	*/
+	bool Raycast(glm::vec3 origin, glm::vec3 direction, float& t) const;
+
+	/*
+	* Triangle BVH of the mesh in model space, built on first use after the geometry changes
+	*/
+	const MeshBVH& GetBVH() const;
+	inline void InvalidateBVH() { bvhDirty = true; }
 
 	
 	bool visible = true;
@@ -683,12 +740,37 @@ private:
 	glm::vec3 bBoxMin = glm::vec3(FLT_MAX);
 	glm::vec3 bBoxMax = glm::vec3(-FLT_MAX);
 	bool bBoxInitialized = false;
+	mutable MeshBVH bvh;//not copied, copies build their own
+	mutable std::atomic<bool> bvhDirty{ true };//read without the build lock, see GetBVH
 	ShadingMode shading = ShadingMode::PHONG; //0 = phong-color, 1 = phong-texture, 2 = editor mode
 
+	//used by UpdateFromNodes, not copied
+	std::vector<glm::vec3> faceNormals;
+	std::vector<int> vertexFaceStart;//vertex count + 1 offsets into vertexFaces
+	std::vector<int> vertexFaces;
+
 	void GenerateFaceFrom(const glm::vec3 v0, const glm::vec3 v1, const glm::vec3 v2,
 		const glm::vec3 vIn, const glm::ivec3 vertIndices);
 };
 
+/*
+* Marks the entity as an instance of the mesh owned by the source entity. Instances share
+* the GPU buffers of the source and are drawn together with one instanced draw call
+*/
+struct CInstanced : Component
+{
+public:
+	static constexpr CType type = CType::Instanced;
+	CInstanced(entt::entity source = entt::null)
+		:source(source)
+	{}
+
+	entt::entity source;
+	bool visible = true;
+
+	void Update();
+};
+
 struct CPhongMaterial : Component
 {
 public:
@@ -862,7 +944,6 @@ enum class LightType
 struct CLight : Component
 {
 public:
-	static bool slotUsed[15];//for glsl shader locations
 	static constexpr CType type = CType::Light;
 	
 	CLight(LightType ltype, glm::vec3 color, float intensity, glm::vec3 position,
@@ -879,20 +960,6 @@ public:
 			//invalid values for safety
 			this->direction = glm::vec3(NAN, NAN, NAN);
 			this->cutoff = -1;
-			for (int i = 0; i < 5; i++)
-			{
-				if (!CLight::slotUsed[i])
-				{
-					CLight::slotUsed[i] = true;
-					this->slot = i;
-					break;
-				}
-			}
-			if (this->slot == -1)
-			{
-				CLight::slotUsed[0] = true;
-				this->slot = 0;
-			}
 		}
 		//Directional light constructor
 		else if (ltype == LightType::DIRECTIONAL)
@@ -903,21 +970,6 @@ public:
 			//invalid values for safety
 			this->position = glm::vec3(NAN, NAN, NAN);
 			this->cutoff = -1;
-			for (int i = 0; i < 5; i++)
-			{
-				if (!CLight::slotUsed[i + 5])
-				{
-					CLight::slotUsed[i + 5] = true;
-					this->slot = i;
-					break;
-				}
-			}
-			if (this->slot == -1)
-			{
-				CLight::slotUsed[5] = true;
-				this->slot = 0;
-			}
-
 		}
 		//Spot light constructor
 		else if (ltype == LightType::SPOT)
@@ -926,34 +978,7 @@ public:
 			this->direction = direction;
 
 			this->cutoff = cutoff;
-
-			for (int i = 0; i < 5; i++)
-			{
-				if (!CLight::slotUsed[i + 10])
-				{
-					CLight::slotUsed[i + 10] = true;
-					this->slot = i;
-					break;
-				}
-			}
-			if (this->slot == -1)
-			{
-				CLight::slotUsed[10] = true;
-				this->slot = 0;
-			}
 		}
-
-	}
-
-	~CLight()
-	{
-		
-		if (lightType == LightType::DIRECTIONAL)
-			this->slot = this->slot + 5;
-		else if (lightType == LightType::SPOT)
-			this->slot = this->slot + 10;
-		
-		CLight::slotUsed[this->slot] = false;
 	}
 
 	glm::mat4 CalculateShadowMatrix(int side = -1)
@@ -963,27 +988,27 @@ public:
 			switch (side)
 			{
 			case 0:
-				return glm::scale(glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 1000.0f), glm::vec3(glm::length(this->position / 1000.f))) *
+				return glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 1000.0f) *
 					glm::lookAt(position, position + glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f));
 				break;
 			case 1:
-				return glm::scale(glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 1000.0f), glm::vec3(glm::length(this->position / 1000.f))) *
+				return glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 1000.0f) *
 					glm::lookAt(position, position + glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f));
 				break;
 			case 2:
-				return glm::scale(glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 1000.0f), glm::vec3(glm::length(this->position / 1000.f))) *
+				return glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 1000.0f) *
 					glm::lookAt(position, position + glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
 				break;
 			case 3:
-				return glm::scale(glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 1000.0f), glm::vec3(glm::length(this->position / 1000.f))) *
+				return glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 1000.0f) *
 					glm::lookAt(position, position + glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f));
 				break;
 			case 4:
-				return glm::scale(glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 1000.0f), glm::vec3(glm::length(this->position / 1000.f))) *
+				return glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 1000.0f) *
 					glm::lookAt(position, position + glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, -1.0f, 0.0f));
 				break;
 			case 5:
-				return glm::scale(glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 1000.0f), glm::vec3(glm::length(this->position / 1000.f))) *
+				return glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 1000.0f) *
 					glm::lookAt(position, position + glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f));
 				break;
 			default:
@@ -1009,6 +1034,79 @@ public:
 			return lightProjection * lightView;
 		}
 	}
+
+	static constexpr int cascadeCount = 4;//shadow cascades of directional lights
+	/*
+	* Shadow matrices of the cascades covering the camera frustum up to shadowDistance. The slices are
+	* spaced between logarithmic and uniform, each cascade is an orthographic box around the bounding
+	* sphere of its slice so its size does not change when the camera turns, and its center is snapped
+	* to whole texels so the shadow edges do not crawl while the camera moves
+	*/
+	std::array<glm::mat4, cascadeCount> CalculateCascadeMatrices(Camera& camera, float shadowDistance,
+		unsigned int resolution, float casterDistance = 100.0f)
+	{
+		const float nearPlane = camera.GetNearPlane();
+		const float farPlane = glm::max(glm::min(camera.GetFarPlane(), shadowDistance), nearPlane * 2.0f);
+		const glm::mat4 cameraToWorld = glm::inverse(camera.GetViewMatrix());
+		const float tanHalfFov = camera.IsPerspective() ? glm::tan(glm::radians(glm::abs(camera.GetFOV())) * 0.5f) : 0.0f;
+
+		const glm::vec3 lightDirection = glm::normalize(direction);
+		const glm::vec3 up = glm::abs(lightDirection.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+		const glm::mat4 lightRotation = glm::lookAt(glm::vec3(0.0f), lightDirection, up);
+
+		std::array<glm::mat4, cascadeCount> matrices;
+		float sliceNear = nearPlane;
+		for (int c = 0; c < cascadeCount; c++)
+		{
+			const float t = (float)(c + 1) / cascadeCount;
+			const float logSplit = nearPlane * glm::pow(farPlane / nearPlane, t);
+			const float uniformSplit = nearPlane + (farPlane - nearPlane) * t;
+			const float sliceFar = glm::mix(uniformSplit, logSplit, 0.75f);
+
+			//corners of the slice in world space
+			glm::vec3 corners[8];
+			for (int i = 0; i < 8; i++)
+			{
+				const float depth = i < 4 ? sliceNear : sliceFar;
+				const float halfHeight = camera.IsPerspective() ? depth * tanHalfFov : 1.0f;
+				const float halfWidth = halfHeight * camera.GetAspectRatio();
+				corners[i] = glm::vec3(cameraToWorld * glm::vec4(
+					(i & 1 ? 1.0f : -1.0f) * halfWidth, (i & 2 ? 1.0f : -1.0f) * halfHeight, -depth, 1.0f));
+			}
+			glm::vec3 center(0.0f);
+			for (const glm::vec3& corner : corners)
+				center += corner / 8.0f;
+			float radius = 0.0f;
+			for (const glm::vec3& corner : corners)
+				radius = glm::max(radius, glm::length(corner - center));
+			radius = glm::ceil(radius * 16.0f) / 16.0f;
+
+			//snap the center in light space to the texel grid
+			const float texelSize = 2.0f * radius / (float)resolution;
+			const glm::vec3 lightCenter = glm::floor(glm::vec3(lightRotation * glm::vec4(center, 1.0f)) / texelSize) * texelSize;
+
+			//the box reaches further towards the light so casters outside the slice still land in it
+			const glm::mat4 lightProjection = glm::ortho(lightCenter.x - radius, lightCenter.x + radius,
+				lightCenter.y - radius, lightCenter.y + radius,
+				-lightCenter.z - radius - casterDistance, -lightCenter.z + radius);
+			matrices[c] = lightProjection * lightRotation;
+			sliceNear = sliceFar;
+		}
+		return matrices;
+	}
+
+	/*
+	* Distance at which the attenuation of phong_textured/shader.frag, 1 / (a d^2 + b d), brings the
+	* intensity below threshold. The shader fades the light out towards it, directional lights have none
+	*/
+	float CalculateRange(float threshold)
+	{
+		const float a = lightType == LightType::SPOT ? 0.0005f : 0.001f;
+		const float b = lightType == LightType::SPOT ? 0.0001f : 0.001f;
+		const float c = intensity / glm::max(threshold, 1e-4f);
+		return (-b + glm::sqrt(b * b + 4.0f * a * c)) / (2.0f * a);
+	}
+
 	LightType GetLightType() { return lightType; }
 	bool IsCastingShadows() { return castingShadow; }
 
@@ -1027,8 +1125,7 @@ public:
 	void Update();
 
 	bool scheduledTextureUpdate = false;
-	GLuint glID;
-	int slot = -1;
+	GLuint glID = 0;
 private:
 	LightType lightType;
 	bool castingShadow = false;
@@ -1116,6 +1213,9 @@ struct CSoftBody : Component
 		this->nodeExtForces = Eigen::VectorXf::Zero(nodes.size());
 		this->nodeTotalForces = Eigen::VectorXf::Zero(nodes.size());
 		this->nodes2SurfIds = nodes2SurfIds;
+		surfaceNodeIds.resize(nodes2SurfIds.size());
+		for (const auto [nodeIdx, surfIdx] : nodes2SurfIds)
+			surfaceNodeIds[surfIdx] = nodeIdx;
 		
 		massPerNode = glm::max(100.f / (float)nodePositions.size(), 0.01f);
 		massMatrix = Eigen::SparseMatrix<float>(nodePositions.size(), nodePositions.size());
@@ -1131,6 +1231,45 @@ struct CSoftBody : Component
 	void Update();
 	void TakeFwEulerStep(float dt);
 	void TakeBwEulerStep(float dt);
+	/*
+	* Backward Euler step of all the bodies with one solve of their block diagonal system
+	*/
+	static void TakeBwEulerStep(const std::vector<CSoftBody*>& bodies, float dt);
+	void TakeSymplecticEulerStep(float dt);
+	void TakeVelocityVerletStep(float dt);
+	void TakeRK4Step(float dt);
+	/*
+	* Extended position based dynamics step. Springs are distance constraints with a compliance of 1 / k,
+	* the tetrahedra volume constraints. Stable for any dt, stiffness converges with the iterations
+	*/
+	void TakeXPBDStep(float dt);
+
+	/*
+	* Adds a volume constraint per tetrahedron, the rest volumes are taken from the current node positions
+	*/
+	void SetTetrahedra(const std::vector<glm::ivec4>& tets);
+
+	/*
+	* Sets the surface triangles, in node indices, used for collisions between soft bodies. The current
+	* node positions become the rest shape whose touching features never collide
+	*/
+	void SetSurface(const std::vector<glm::ivec3>& triangles);
+	/*
+	* Sets the surface from the faces of the mesh built alongside the nodes, mapping its vertices back to
+	* their nodes with surfaceNodeIds
+	*/
+	void SetSurface(const CTriMesh& mesh);
+
+	/*
+	* Kinetic, spring and gravitational potential energy of the nodes
+	*/
+	float GetEnergy() const;
+
+	/*
+	* Largest time step that keeps an explicit step stable, stabilityLimit being its largest stable
+	* omega * dt (0 for implicit steps), and moves no node further than courant times the shortest spring
+	*/
+	float EstimateTimeStep(float stabilityLimit, float courant) const;
 	
 	void UpdateStiffnessMatrix(float dt);
 	void UpdateMassMatrix();
@@ -1140,11 +1279,19 @@ struct CSoftBody : Component
 	void ApplyImpulse(Eigen::Vector3f imp, int nodeIdx);
 
 	std::unordered_map<int, int> nodes2SurfIds;
+	std::vector<int> surfaceNodeIds;//node of each surface mesh vertex
 	Eigen::VectorXf nodePositions;
 	Eigen::VectorXf nodeVelocities;
 	Eigen::VectorXf nodeExtForces;
 	
 	std::vector<Spring> springs;
+	std::vector<glm::ivec4> tetrahedra;
+
+	std::vector<glm::ivec3> surfaceTriangles;
+	std::vector<int> surfaceNodes;
+	Eigen::VectorXf restPositions;
+	float surfaceEdgeLength = 0.0f;//mean
+	float collisionThickness = 0.0f;
 	
 	Eigen::SparseMatrix<float> stiffnessMatrix;
 	Eigen::SparseMatrix<float> massMatrix;
@@ -1152,10 +1299,37 @@ struct CSoftBody : Component
 	float gravity = 0.f;
 	float drag = 0.0f;
 
+	int xpbdIterations = 10;
+	float volumeCompliance = 0.0f;//0 keeps the volume of the tetrahedra rigid
+
 	bool dirty = false;
 private:
 	Eigen::VectorXf nodeTotalForces;
+
+	//constraints split into batches that share no nodes so each batch is solved in parallel,
+	//the ones that did not fit in a batch are solved serially
+	struct ConstraintBatches
+	{
+		std::vector<std::vector<int>> batches;
+		std::vector<int> serial;
+		size_t constraintCount = 0;
+	};
+	ConstraintBatches springBatches;
+	ConstraintBatches tetBatches;
+	std::vector<float> springLambdas;
+	std::vector<float> tetLambdas;
+	std::vector<float> tetRestVolumes;
+	void UpdateConstraintBatches();
+	void SolveSpring(int index, float alpha);
+	void SolveTetrahedron(int index, float alpha);
 	void UpdateNodeForces();
+	//(M - dt^2 K) v' = M v + dt f of the backward Euler step
+	void BuildBwEulerSystem(float dt, Eigen::SparseMatrix<float>& lhs, Eigen::VectorXf& rhs);
+	void FinishBwEulerStep(const Eigen::VectorXf& velocities, float dt);
+	//spring, gravity and external forces at the given state
+	void ComputeForces(const Eigen::VectorXf& positions, const Eigen::VectorXf& velocities, Eigen::VectorXf& forces);
+	//clears the external forces and flags the mesh for an update if the nodes move
+	void FinishStep();
 };
 
 struct CRigidBody : Component
@@ -1186,6 +1360,9 @@ public:
 	void SetMassMatrix();
 	
 	void TakeFwEulerStep(float dt);
+	void TakeSymplecticEulerStep(float dt);
+	void TakeVelocityVerletStep(float dt);
+	void TakeRK4Step(float dt);
 	void ResetToRest()
 	{
 		linearMomentum = glm::vec3(0, 0, 0);
@@ -1202,7 +1379,7 @@ public:
 	inline glm::vec3 GetAngularVelocity()
 	{
 		return orientationMatrix * 
-			glm::inverse(inertiaAtRest) *
+			invInertiaAtRest *
 			(glm::transpose(orientationMatrix) * angularMomentum);
 	}
 	inline glm::mat3 GetOrientationMatrix()
@@ -1214,6 +1391,12 @@ public:
 	{
 		return orientationMatrix * inertiaAtRest * glm::transpose(orientationMatrix);
 	}
+
+	//I^{-1} = R * I_rest^{-1} * R^T
+	inline glm::mat3 GetInverseInertiaTensor()
+	{
+		return orientationMatrix * invInertiaAtRest * glm::transpose(orientationMatrix);
+	}
 	
 	inline void SetRotation(glm::vec3 rotation)
 	{
@@ -1225,6 +1408,38 @@ public:
 	{
 		return inertiaAtRest;
 	}
+
+	inline glm::mat3 GetInverseInertiaTensorAtRest()
+	{
+		return invInertiaAtRest;
+	}
+
+	inline void SetInertiaTensorAtRest(glm::mat3 inertia)
+	{
+		inertiaAtRest = inertia;
+		invInertiaAtRest = glm::inverse(inertia);
+	}
+
+	/*
+	* Kinetic plus gravitational potential energy, used to measure the drift of the integrators
+	*/
+	float GetEnergy();
+
+	inline glm::quat GetOrientation()
+	{
+		return orientationQuat;
+	}
+
+	inline void SetOrientation(glm::quat orientation)
+	{
+		orientationQuat = orientation;
+		orientationMatrix = glm::toMat3(orientationQuat);
+	}
+
+	/*
+	* Writes the pose to the transform if it changed since the last call, returns true if it did
+	*/
+	bool SynchronizeTransform(CTransform& transform);
 	
 	
 
@@ -1234,9 +1449,20 @@ public:
 	float gravity;
 private:
 	glm::mat3 inertiaAtRest;
+	glm::mat3 invInertiaAtRest;//cached, the inertia only changes with the mesh or the mass
 	
 	glm::quat orientationQuat;
 	glm::mat3 orientationMatrix;
+
+	//drag and gravity at the given velocities
+	glm::vec3 LinearForce(glm::vec3 velocity);
+	glm::vec3 Torque(glm::vec3 angularVelocity);
+	//q += dt / 2 * (0, w) * q
+	void Rotate(glm::vec3 angularVelocity, float dt);
+
+	//pose last written to the transform
+	glm::vec3 syncedPosition = glm::vec3(NAN);
+	glm::quat syncedOrientation = glm::quat(NAN, NAN, NAN, NAN);
 	
 	glm::mat3 invMassMatrix;
 };
@@ -1245,66 +1471,79 @@ struct CBoxCollider : Component
 {
 public:
 	static constexpr CType type = CType::BoxCollider;
-	CBoxCollider(glm::vec3 min, glm::vec3 max, float elasticity = 1.0f)
+	CBoxCollider(glm::vec3 min, glm::vec3 max, float elasticity = 1.0f, float friction = 0.4f)
 	{
-		this->min = glm::min(min, max);
-		this->max = glm::max(min, max);
 		this->elasticity = elasticity;
-
-		//Generate vertices
-		vertices[0] = max;
-		vertices[1] = glm::vec3(max.x, max.y, min.z);
-		vertices[2] = glm::vec3(max.x, min.y, min.z);
-		vertices[3] = glm::vec3(max.x, min.y, max.z);
-		vertices[4] = glm::vec3(min.x, min.y, max.z);
-		vertices[5] = min;
-		vertices[6] = glm::vec3(min.x, max.y, min.z);
-		vertices[7] = glm::vec3(min.x, max.y, max.z);
+		this->friction = friction;
+		SetBounds(min, max);
 	}
 	
-	CBoxCollider(std::vector<glm::vec3> geometry, float elasticity = 1.0f)
+	CBoxCollider(std::vector<glm::vec3> geometry, float elasticity = 1.0f, float friction = 0.4f)
+		: CBoxCollider(BoundsOf(geometry, true), BoundsOf(geometry, false), elasticity, friction)
 	{
-		//loop &find min and max over geometry
-		glm::vec3 min = geometry[0];
-		glm::vec3 max = geometry[0];
-		for (int i = 1; i < geometry.size(); i++)
-		{
-			min = glm::min(min, geometry[i]);
-			max = glm::max(max, geometry[i]);
-		}
-		CBoxCollider(min, max, elasticity);
 	}
 	
 	//bool MoveAndCollide(glm::vec3 motion) {};
-	bool CollidingWith(CBoxCollider* Other);
+	/*
+	* Tests the oriented boxes of the colliders, the manifold normal points from this collider to the other
+	*/
+	bool CollidingWith(const CBoxCollider& other, ContactManifold& manifold) const;
 	void Update() {};
 
+	//bounds are in model space, the world box is placed with SetTransform
 	glm::vec3 GetMin() { return min; }
 	glm::vec3 GetMax() { return max; }
 	
-	void SetMin(glm::vec3 min) { this->min = min; }
-	void SetMax(glm::vec3 max) { this->max = max; }
+	void SetMin(glm::vec3 min) { SetBounds(min, max); }
+	void SetMax(glm::vec3 max) { SetBounds(min, max); }
 
 	void SetBounds(glm::vec3 min, glm::vec3 max)
 	{
 		this->min = glm::min(min, max);
 		this->max = glm::max(min, max);
-		
-		vertices[0] = max;
-		vertices[1] = glm::vec3(max.x, max.y, min.z);
-		vertices[2] = glm::vec3(max.x, min.y, min.z);
-		vertices[3] = glm::vec3(max.x, min.y, max.z);
-		vertices[4] = glm::vec3(min.x, min.y, max.z);
-		vertices[5] = min;
-		vertices[6] = glm::vec3(min.x, max.y, min.z);
-		vertices[7] = glm::vec3(min.x, max.y, max.z);
+		SetTransform(model);
+	}
+
+	/*
+	* Places the collider in the world with the model matrix of its entity
+	*/
+	void SetTransform(const glm::mat4& model)
+	{
+		this->model = model;
+		obb = OBB::FromBox(min, max, model);
+		obb.GetCorners(vertices);
+	}
+
+	/*
+	* Places the collider with the transform, skipped if the transform did not change since the last call
+	*/
+	void SetTransform(CTransform& transform)
+	{
+		if (transform.GetRevision() == transformRevision)
+			return;
+		transformRevision = transform.GetRevision();
+		SetTransform(transform.GetModelMatrix());
 	}
 
+	inline const OBB& GetOBB() const { return obb; }
+
 	float elasticity;
-	glm::vec3 vertices[8];
+	float friction;
+	glm::vec3 vertices[8];//world space corners
 private:
 	glm::vec3 min;
 	glm::vec3 max;
+	glm::mat4 model = glm::mat4(1.0f);
+	unsigned int transformRevision = ~0u;
+	OBB obb;
+
+	static glm::vec3 BoundsOf(const std::vector<glm::vec3>& geometry, bool minimum)
+	{
+		glm::vec3 bound = geometry[0];
+		for (int i = 1; i < geometry.size(); i++)
+			bound = minimum ? glm::min(bound, geometry[i]) : glm::max(bound, geometry[i]);
+		return bound;
+	}
 };
 
 //Box to contrain rigid bodies with colliders
@@ -1338,6 +1577,63 @@ private:
 	bool dirty = false;
 };
 
+/*
+* Static half space the soft body nodes are kept out of, the surface is dot(normal, p) = offset
+*/
+struct CPlaneCollider : Component
+{
+	static constexpr CType type = CType::PlaneCollider;
+	CPlaneCollider(glm::vec3 normal = glm::vec3(0.0f, 1.0f, 0.0f), float offset = 0.0f, float restitution = 0.5f)
+	{
+		this->normal = glm::normalize(normal);
+		this->offset = offset;
+		this->restitution = restitution;
+	}
+
+	void Update();
+
+	glm::vec3 normal;
+	float offset;
+	float restitution;
+};
+
+/*
+* Static sphere the soft body nodes are kept out of
+*/
+struct CSphereCollider : Component
+{
+	static constexpr CType type = CType::SphereCollider;
+	CSphereCollider(glm::vec3 center = glm::vec3(0.0f), float radius = 1.0f, float restitution = 0.5f)
+	{
+		this->center = center;
+		this->radius = radius;
+		this->restitution = restitution;
+	}
+
+	void Update();
+
+	glm::vec3 center;
+	float radius;
+	float restitution;
+};
+
+/*
+* Makes the CTriMesh of the entity, placed by its CTransform, a static obstacle for the soft body nodes.
+* Inside is decided by the signed distance to the closest face of the mesh BVH
+*/
+struct CMeshCollider : Component
+{
+	static constexpr CType type = CType::MeshCollider;
+	CMeshCollider(float restitution = 0.5f)
+	{
+		this->restitution = restitution;
+	}
+
+	void Update();
+
+	float restitution;
+};
+
 class Scene
 {
 public:
@@ -1375,6 +1671,17 @@ public:
 	entt::entity CreateModelObject(cy::TriMesh& mesh, glm::vec3 position = glm::vec3(0.f),
 		glm::vec3 rotation = glm::vec3(0.f), glm::vec3 scale = glm::vec3(1.f));
 	/*
+	* Loads an obj file once and returns the hidden entity that owns its mesh. Later calls with the same path
+	* return the same entity
+	*/
+	entt::entity LoadMeshAsset(const std::string& meshPath);
+	/*
+	* Creates an entity with a transform and phong material that instances the mesh asset of the obj file
+	* instead of owning a copy of it. addToSceneObjects can be turned off for very large instance counts
+	*/
+	entt::entity CreateInstancedModelObject(const std::string& meshPath, glm::vec3 position = glm::vec3(0.f),
+		glm::vec3 rotation = glm::vec3(0.f), glm::vec3 scale = glm::vec3(1.f), bool addToSceneObjects = true);
+	/*
 	* Creates a Point light source
 	*/
 	entt::entity CreatePointLight(glm::vec3 pos, float intesity,
@@ -1468,9 +1775,58 @@ public:
 	*/
 	bool EntityHas(entt::entity e, CType component);
 
+	/*
+	* Brings the bounding volume hierarchy up to date. Leaves of entities whose transform or geometry changed
+	* are refit, new meshes and instances are inserted and destroyed ones removed. The tree is rebuilt with
+	* SAH periodically once the refits have degraded it. Not thread safe, call from the render thread
+	*/
+	void UpdateBVH();
+	/*
+	* Marks the cached local bounds of the entity as stale, e.g. after its vertices moved
+	*/
+	void InvalidateBounds(entt::entity e);
+	/*
+	* Returns the world space bounds of the entity as of the last UpdateBVH, empty if it has none
+	*/
+	AABB GetWorldBounds(entt::entity e);
+	/*
+	* Meshes that are not in the BVH because they have no bounds, e.g. skyboxes and physics bounds
+	*/
+	inline const std::vector<entt::entity>& GetUnboundedEntities() { return unboundedEntities; }
+	/*
+	* World bounds before and after the change of the meshes that moved, appeared or disappeared
+	* in the last UpdateBVH
+	*/
+	inline const std::vector<AABB>& GetMovedBounds() { return movedBounds; }
+	/*
+	* Returns the closest visible mesh or instance hit by the ray and the distance to it,
+	* entt::null if nothing is hit. Direction should be normalized
+	*/
+	entt::entity Raycast(glm::vec3 origin, glm::vec3 direction, float& distance);
+
 	Camera camera;
 	entt::registry registry;
+	DynamicAABBTree<entt::entity> bvh;
 	bool explicit_euler = true;
 private:
 	std::unordered_map<std::string, entt::entity> sceneObjects;
+	std::unordered_map<std::string, entt::entity> meshAssets;
+
+	struct EntityBounds
+	{
+		AABB local;
+		AABB world;
+		int proxy = -1;
+		unsigned int transformRevision = 0;
+		unsigned int frame = 0;
+		float displacement = 0.0f;
+		bool dirty = true;
+	};
+	std::unordered_map<entt::entity, EntityBounds> entityBounds;
+	std::vector<entt::entity> unboundedEntities;
+	std::vector<AABB> movedBounds;
+	unsigned int bvhFrame = 0;
+	int framesSinceRebuild = 0;
+	static constexpr int bvhRebuildInterval = 30;
+	static constexpr float bvhRebuildThreshold = 1.5f;
 };
\ No newline at end of file
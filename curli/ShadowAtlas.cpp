@@ -0,0 +1,74 @@
+#include <ShadowAtlas.h>
+
+void AtlasPacker::Reset(int atlasSize, int minTileSize)
+{
+	this->atlasSize = atlasSize;
+	this->minTileSize = glm::max(1, glm::min(minTileSize, atlasSize));
+	usedTexels = 0;
+	freeTiles.assign(LevelOf(this->minTileSize) + 1, {});
+	freeTiles[0].insert({ 0, 0 });
+}
+
+int AtlasPacker::LevelOf(int size) const
+{
+	int level = 0;
+	while (SizeOf(level + 1) >= size && SizeOf(level + 1) >= minTileSize)
+		level++;
+	return level;
+}
+
+AtlasRect AtlasPacker::Allocate(int size)
+{
+	if (atlasSize <= 0 || size > atlasSize)
+		return AtlasRect();
+	const int level = LevelOf(glm::max(size, minTileSize));
+
+	//smallest free tile that is large enough
+	int source = level;
+	while (source >= 0 && freeTiles[source].empty())
+		source--;
+	if (source < 0)
+		return AtlasRect();
+
+	std::pair<int, int> tile = *freeTiles[source].begin();
+	freeTiles[source].erase(freeTiles[source].begin());
+	//split it down, keeping the first quarter and freeing the other three
+	for (int l = source + 1; l <= level; l++)
+	{
+		const int half = SizeOf(l);
+		freeTiles[l].insert({ tile.first + half, tile.second });
+		freeTiles[l].insert({ tile.first, tile.second + half });
+		freeTiles[l].insert({ tile.first + half, tile.second + half });
+	}
+	usedTexels += (size_t)SizeOf(level) * SizeOf(level);
+	return { tile.first, tile.second, SizeOf(level) };
+}
+
+void AtlasPacker::Free(const AtlasRect& rect)
+{
+	if (!rect.IsValid() || freeTiles.empty())
+		return;
+	int level = LevelOf(rect.size);
+	usedTexels -= (size_t)SizeOf(level) * SizeOf(level);
+	std::pair<int, int> tile = { rect.x, rect.y };
+	//merge with the siblings while all of them are free
+	while (level > 0)
+	{
+		const int size = SizeOf(level);
+		const int parentX = tile.first - tile.first % (2 * size);
+		const int parentY = tile.second - tile.second % (2 * size);
+		const std::pair<int, int> siblings[4] = {
+			{ parentX, parentY }, { parentX + size, parentY }, { parentX, parentY + size }, { parentX + size, parentY + size } };
+		bool merge = true;
+		for (const auto& sibling : siblings)
+			if (sibling != tile && freeTiles[level].count(sibling) == 0)
+				merge = false;
+		if (!merge)
+			break;
+		for (const auto& sibling : siblings)
+			freeTiles[level].erase(sibling);
+		tile = { parentX, parentY };
+		level--;
+	}
+	freeTiles[level].insert(tile);
+}
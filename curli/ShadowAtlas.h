@@ -0,0 +1,65 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <set>
+#include <utility>
+#include <vector>
+
+/*
+* Square tile of the shadow atlas in texels
+*/
+struct AtlasRect
+{
+	int x = 0;
+	int y = 0;
+	int size = 0;
+
+	bool IsValid() const { return size > 0; }
+	glm::ivec4 ToViewport() const { return glm::ivec4(x, y, size, size); }
+};
+
+/*
+* Buddy allocator handing out power of two tiles of a square atlas. Every level keeps the free tiles of
+* its size, a request splits the smallest larger free tile and freed tiles merge back with their three
+* siblings, so the atlas does not fragment as lights come, go and change resolution
+*/
+class AtlasPacker
+{
+public:
+	void Reset(int atlasSize, int minTileSize);
+
+	/*
+	* Returns a tile of at least size texels (rounded up to a power of two), invalid if none is free
+	*/
+	AtlasRect Allocate(int size);
+	void Free(const AtlasRect& rect);
+
+	int GetAtlasSize() const { return atlasSize; }
+	int GetMinTileSize() const { return minTileSize; }
+	size_t GetUsedTexels() const { return usedTexels; }
+
+private:
+	int atlasSize = 0;
+	int minTileSize = 0;
+	size_t usedTexels = 0;
+	std::vector<std::set<std::pair<int, int>>> freeTiles;//per level, level 0 is the whole atlas
+
+	int LevelOf(int size) const;
+	int SizeOf(int level) const { return atlasSize >> level; }
+};
+
+/*
+* Shader storage layouts of the lights and their shadow views read by phong_textured/shader.frag
+*/
+struct LightData
+{
+	glm::vec4 position = glm::vec4(0.0f);//w = range
+	glm::vec4 direction = glm::vec4(0.0f);//w = cutoff
+	glm::vec4 color = glm::vec4(0.0f);//w = intensity
+	glm::ivec4 shadow = glm::ivec4(0);//x = first shadow view, y = number of views (0 without shadows), z = type, 0 point 1 directional 2 spot
+};
+
+struct ShadowViewData
+{
+	glm::mat4 toShadowSpace = glm::mat4(0.0f);//light view projection the tile was rendered with
+	glm::vec4 rect = glm::vec4(0.0f);//uv offset and size of the tile
+};
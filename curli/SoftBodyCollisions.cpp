@@ -0,0 +1,247 @@
+#include <SoftBodyCollisions.h>
+#include <algorithm>
+#include <chrono>
+#include <execution>
+#include <numeric>
+
+namespace
+{
+	//closest point on the triangle abc to p and its barycentric coordinates (Ericson, Real-Time Collision Detection 5.1.5)
+	glm::vec3 closestPointOnTriangle(glm::vec3 p, glm::vec3 a, glm::vec3 b, glm::vec3 c, glm::vec3& barycentric)
+	{
+		const glm::vec3 ab = b - a;
+		const glm::vec3 ac = c - a;
+		const glm::vec3 ap = p - a;
+		const float d1 = glm::dot(ab, ap);
+		const float d2 = glm::dot(ac, ap);
+		if (d1 <= 0.0f && d2 <= 0.0f)
+		{
+			barycentric = glm::vec3(1.0f, 0.0f, 0.0f);
+			return a;
+		}
+
+		const glm::vec3 bp = p - b;
+		const float d3 = glm::dot(ab, bp);
+		const float d4 = glm::dot(ac, bp);
+		if (d3 >= 0.0f && d4 <= d3)
+		{
+			barycentric = glm::vec3(0.0f, 1.0f, 0.0f);
+			return b;
+		}
+
+		const float vc = d1 * d4 - d3 * d2;
+		if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+		{
+			const float v = d1 / (d1 - d3);
+			barycentric = glm::vec3(1.0f - v, v, 0.0f);
+			return a + ab * v;
+		}
+
+		const glm::vec3 cp = p - c;
+		const float d5 = glm::dot(ab, cp);
+		const float d6 = glm::dot(ac, cp);
+		if (d6 >= 0.0f && d5 <= d6)
+		{
+			barycentric = glm::vec3(0.0f, 0.0f, 1.0f);
+			return c;
+		}
+
+		const float vb = d5 * d2 - d1 * d6;
+		if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+		{
+			const float w = d2 / (d2 - d6);
+			barycentric = glm::vec3(1.0f - w, 0.0f, w);
+			return a + ac * w;
+		}
+
+		const float va = d3 * d6 - d5 * d4;
+		if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+		{
+			const float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+			barycentric = glm::vec3(0.0f, 1.0f - w, w);
+			return b + (c - b) * w;
+		}
+
+		const float denominator = 1.0f / (va + vb + vc);
+		const float v = vb * denominator;
+		const float w = vc * denominator;
+		barycentric = glm::vec3(1.0f - v - w, v, w);
+		return a + ab * v + ac * w;
+	}
+
+	inline glm::vec3 nodeAt(const Eigen::VectorXf& positions, int node)
+	{
+		return glm::make_vec3(positions.data() + node * 3);
+	}
+
+	inline float millisecondsSince(std::chrono::high_resolution_clock::time_point start)
+	{
+		return std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+}
+
+unsigned int SoftBodyCollisions::Resolve(entt::registry& registry)
+{
+	Gather(registry);
+	buildTime = 0.0f;
+	queryTime = 0.0f;
+	if (triangles.empty())
+		return 0;
+
+	//cells about the size of a triangle keep the number of cells a query visits small
+	float cellSize = 0.0f;
+	maxThickness = 0.0f;
+	for (const CSoftBody* body : bodies)
+	{
+		cellSize = glm::max(cellSize, body->surfaceEdgeLength);
+		maxThickness = glm::max(maxThickness, body->collisionThickness);
+	}
+	auto start = std::chrono::high_resolution_clock::now();
+	hash.Build(points, cellSize);
+	buildTime = millisecondsSince(start);
+
+	start = std::chrono::high_resolution_clock::now();
+	const int triangleCount = (int)triangles.size();
+	std::vector<int> blocks((triangleCount + blockSize - 1) / blockSize);
+	std::iota(blocks.begin(), blocks.end(), 0);
+	blockContacts.resize(blocks.size());
+	std::for_each(std::execution::par, blocks.begin(), blocks.end(), [&](int block)
+		{
+			blockContacts[block].clear();
+			FindContacts(block * blockSize, std::min(triangleCount, (block + 1) * blockSize), blockContacts[block]);
+		});
+	queryTime = millisecondsSince(start);
+
+	//serial so contacts sharing nodes see each others corrections
+	unsigned int contactCount = 0;
+	for (const auto& contacts : blockContacts)
+	{
+		for (const Contact& contact : contacts)
+			ResolveContact(contact);
+		contactCount += (unsigned int)contacts.size();
+	}
+	return contactCount;
+}
+
+void SoftBodyCollisions::Gather(entt::registry& registry)
+{
+	bodies.clear();
+	points.clear();
+	pointOwners.clear();
+	triangles.clear();
+	registry.view<CSoftBody>()
+	.each([&](CSoftBody& sb)
+	{
+		if (sb.surfaceTriangles.empty() || sb.nodeVelocities.size() != sb.nodePositions.size())
+			return;
+		const int body = (int)bodies.size();
+		bodies.push_back(&sb);
+		for (int node : sb.surfaceNodes)
+		{
+			points.push_back(nodeAt(sb.nodePositions, node));
+			pointOwners.push_back({ body, node });
+		}
+		for (const glm::ivec3& triangle : sb.surfaceTriangles)
+			triangles.push_back({ body, triangle });
+	});
+}
+
+void SoftBodyCollisions::FindContacts(int begin, int end, std::vector<Contact>& contacts) const
+{
+	std::vector<int> candidates;
+	for (int t = begin; t < end; t++)
+	{
+		const SurfaceTriangle& triangle = triangles[t];
+		const CSoftBody& body = *bodies[triangle.body];
+		const glm::vec3 a = nodeAt(body.nodePositions, triangle.nodes.x);
+		const glm::vec3 b = nodeAt(body.nodePositions, triangle.nodes.y);
+		const glm::vec3 c = nodeAt(body.nodePositions, triangle.nodes.z);
+		AABB box;
+		box.Expand(a);
+		box.Expand(b);
+		box.Expand(c);
+		box.min -= glm::vec3(maxThickness);
+		box.max += glm::vec3(maxThickness);
+
+		//hash collisions can list a node twice
+		candidates.clear();
+		hash.Query(box, [&](int point) { candidates.push_back(point); });
+		std::sort(candidates.begin(), candidates.end());
+		candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+		for (int point : candidates)
+		{
+			const SurfacePoint& owner = pointOwners[point];
+			const bool sameBody = owner.body == triangle.body;
+			if (sameBody && (owner.node == triangle.nodes.x || owner.node == triangle.nodes.y || owner.node == triangle.nodes.z))
+				continue;
+			const glm::vec3 p = points[point];
+			glm::vec3 barycentric;
+			const glm::vec3 q = closestPointOnTriangle(p, a, b, c, barycentric);
+			const float thickness = glm::max(body.collisionThickness, bodies[owner.body]->collisionThickness);
+			const float distance = glm::length(p - q);
+			if (distance >= thickness)
+				continue;
+
+			//neighbours on the surface are close to the triangle at rest as well and never collide
+			if (sameBody && body.restPositions.size() == body.nodePositions.size())
+			{
+				glm::vec3 restBarycentric;
+				const glm::vec3 restPoint = nodeAt(body.restPositions, owner.node);
+				const glm::vec3 restClosest = closestPointOnTriangle(restPoint, nodeAt(body.restPositions, triangle.nodes.x),
+					nodeAt(body.restPositions, triangle.nodes.y), nodeAt(body.restPositions, triangle.nodes.z), restBarycentric);
+				if (glm::length(restPoint - restClosest) < 2.0f * thickness)
+					continue;
+			}
+
+			glm::vec3 normal;
+			if (distance > 1e-6f)
+				normal = (p - q) / distance;
+			else
+			{
+				normal = glm::cross(b - a, c - a);
+				const float length = glm::length(normal);
+				if (length < 1e-12f)
+					continue;
+				normal /= length;
+			}
+			contacts.push_back({ point, t, barycentric, normal, thickness - distance });
+		}
+	}
+}
+
+void SoftBodyCollisions::ResolveContact(const Contact& contact)
+{
+	const SurfacePoint& owner = pointOwners[contact.point];
+	const SurfaceTriangle& triangle = triangles[contact.triangle];
+	CSoftBody& nodeBody = *bodies[owner.body];
+	CSoftBody& triangleBody = *bodies[triangle.body];
+	const float nodeWeight = 1.0f / nodeBody.massPerNode;
+	const float triangleWeight = 1.0f / triangleBody.massPerNode;
+	const glm::vec3& barycentric = contact.barycentric;
+	const float weight = nodeWeight + triangleWeight * glm::dot(barycentric, barycentric);
+	if (weight <= 0.0f)
+		return;
+	const Eigen::Vector3f n(contact.normal.x, contact.normal.y, contact.normal.z);
+
+	//inelastic impulse on the approaching normal velocity
+	Eigen::Vector3f triangleVelocity = Eigen::Vector3f::Zero();
+	for (int k = 0; k < 3; k++)
+		triangleVelocity += barycentric[k] * triangleBody.nodeVelocities.segment<3>(triangle.nodes[k] * 3);
+	const float vn = (nodeBody.nodeVelocities.segment<3>(owner.node * 3) - triangleVelocity).dot(n);
+	if (vn < 0.0f)
+	{
+		const float impulse = -vn / weight;
+		nodeBody.nodeVelocities.segment<3>(owner.node * 3) += (impulse * nodeWeight) * n;
+		for (int k = 0; k < 3; k++)
+			triangleBody.nodeVelocities.segment<3>(triangle.nodes[k] * 3) -= (impulse * triangleWeight * barycentric[k]) * n;
+	}
+
+	//separate them to the thickness
+	const float correction = contact.depth / weight;
+	nodeBody.nodePositions.segment<3>(owner.node * 3) += (correction * nodeWeight) * n;
+	for (int k = 0; k < 3; k++)
+		triangleBody.nodePositions.segment<3>(triangle.nodes[k] * 3) -= (correction * triangleWeight * barycentric[k]) * n;
+	nodeBody.dirty = true;
+	triangleBody.dirty = true;
+}
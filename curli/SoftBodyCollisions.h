@@ -0,0 +1,60 @@
+#pragma once
+#include <Scene.h>
+#include <SpatialHash.h>
+#include <vector>
+
+/*
+* Collisions of the soft body surfaces with themselves and each other. Surface nodes of every soft body
+* are put in one spatial hash, each surface triangle queries the nodes around it and the ones closer than
+* the collision thickness are pushed out with an inelastic impulse. Detection runs in parallel over the
+* triangles, the contacts are resolved serially
+*/
+class SoftBodyCollisions
+{
+public:
+	/*
+	* Detects and resolves the contacts of every soft body with a surface, returns the number of contacts
+	*/
+	unsigned int Resolve(entt::registry& registry);
+
+	float GetBuildTime() const { return buildTime; }//ms of the last Resolve
+	float GetQueryTime() const { return queryTime; }
+
+private:
+	struct SurfacePoint
+	{
+		int body;
+		int node;
+	};
+
+	struct SurfaceTriangle
+	{
+		int body;
+		glm::ivec3 nodes;
+	};
+
+	struct Contact
+	{
+		int point;//into points
+		int triangle;//into triangles
+		glm::vec3 barycentric;
+		glm::vec3 normal;//towards the node
+		float depth;
+	};
+
+	std::vector<CSoftBody*> bodies;
+	std::vector<glm::vec3> points;
+	std::vector<SurfacePoint> pointOwners;
+	std::vector<SurfaceTriangle> triangles;
+	std::vector<std::vector<Contact>> blockContacts;
+	SpatialHash hash;
+	float maxThickness = 0.0f;
+	float buildTime = 0.0f;
+	float queryTime = 0.0f;
+
+	static constexpr int blockSize = 256;//triangles per parallel task
+
+	void Gather(entt::registry& registry);
+	void FindContacts(int begin, int end, std::vector<Contact>& contacts) const;
+	void ResolveContact(const Contact& contact);
+};
@@ -0,0 +1,43 @@
+#include <SpatialHash.h>
+#include <ParallelFor.h>
+
+void SpatialHash::Build(const std::vector<glm::vec3>& points, float cellSize)
+{
+	const int count = (int)points.size();
+	invCellSize = 1.0f / glm::max(cellSize, 1e-6f);
+	tableSize = (unsigned int)glm::max(1, 2 * count);
+	if (cellCounts.size() != tableSize)
+		cellCounts = std::vector<std::atomic<int>>(tableSize);
+	for (auto& cellCount : cellCounts)
+		cellCount.store(0, std::memory_order_relaxed);
+	pointHashes.resize(count);
+	sortedIndices.resize(count);
+	cellStart.resize(tableSize + 1);
+
+	//count the points per cell
+	forEachBlock(count, blockSize, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				const glm::ivec3 cell = CellOf(points[i]);
+				pointHashes[i] = Hash(cell.x, cell.y, cell.z);
+				cellCounts[pointHashes[i]].fetch_add(1, std::memory_order_relaxed);
+			}
+		});
+
+	//prefix sum, the counters become the write cursors of each cell
+	int offset = 0;
+	for (unsigned int h = 0; h < tableSize; h++)
+	{
+		cellStart[h] = offset;
+		offset += cellCounts[h].load(std::memory_order_relaxed);
+		cellCounts[h].store(cellStart[h], std::memory_order_relaxed);
+	}
+	cellStart[tableSize] = offset;
+
+	forEachBlock(count, blockSize, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+				sortedIndices[cellCounts[pointHashes[i]].fetch_add(1, std::memory_order_relaxed)] = i;
+		});
+}
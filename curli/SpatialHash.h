@@ -0,0 +1,59 @@
+#pragma once
+#include <Culling.h>
+#include <glm/glm.hpp>
+#include <atomic>
+#include <vector>
+
+/*
+* Uniform grid over points with an unbounded extent. Cells are hashed into a table twice the size of
+* the point count and the points are sorted by cell with a parallel counting sort, so the points of a
+* cell are contiguous. Rebuilt from scratch whenever the points move
+*/
+class SpatialHash
+{
+public:
+	void Build(const std::vector<glm::vec3>& points, float cellSize);
+
+	/*
+	* Calls function(index) for the points in the cells overlapping the box. Points of other cells that
+	* share a table entry are included as well, callers test the actual distance
+	*/
+	template <typename F>
+	void Query(const AABB& box, F function) const
+	{
+		if (tableSize == 0)
+			return;
+		const glm::ivec3 lo = CellOf(box.min);
+		const glm::ivec3 hi = CellOf(box.max);
+		for (int z = lo.z; z <= hi.z; z++)
+			for (int y = lo.y; y <= hi.y; y++)
+				for (int x = lo.x; x <= hi.x; x++)
+				{
+					const unsigned int h = Hash(x, y, z);
+					for (int i = cellStart[h]; i < cellStart[h + 1]; i++)
+						function(sortedIndices[i]);
+				}
+	}
+
+	size_t GetSize() const { return sortedIndices.size(); }
+
+private:
+	float invCellSize = 1.0f;
+	unsigned int tableSize = 0;
+	std::vector<int> cellStart;//tableSize + 1 offsets into sortedIndices
+	std::vector<int> sortedIndices;
+	std::vector<unsigned int> pointHashes;
+	std::vector<std::atomic<int>> cellCounts;
+
+	static constexpr int blockSize = 4096;//points per parallel task
+
+	inline glm::ivec3 CellOf(glm::vec3 p) const
+	{
+		return glm::ivec3(glm::floor(p * invCellSize));
+	}
+
+	inline unsigned int Hash(int x, int y, int z) const
+	{
+		return (((unsigned int)x * 92837111u) ^ ((unsigned int)y * 689287499u) ^ ((unsigned int)z * 283923481u)) % tableSize;
+	}
+};